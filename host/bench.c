@@ -0,0 +1,3013 @@
+/**
+
+bench
+throughput and per call cost benchmark of stm32_buffered_uart.c running on top of hal_sim
+
+Wire related numbers (throughput, utilisation, DMA transfers, interrupts) come from the virtual
+time of the simulator and are exactly reproducible. Per call costs are measured on the host CPU
+with CLOCK_MONOTONIC and are only meaningful relative to each other.
+
+usage: buffered_uart_bench [--quick] [--csv]
+
+
+MIT License
+
+Copyright (c) 2022 Jonas Rahlf
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "hal_sim.h"
+#include "stm32_buffered_uart.h"
+#include "stm32_buffered_uart_frame.h"
+#include "stm32_buffered_uart_printf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef BUFFERED_UART_OS_PTHREAD
+#include <pthread.h>
+#endif
+
+#define BENCH_MAX_RING_SIZE 4096
+#define BENCH_COALESCE_TIMEOUT_MS 2
+// interrupt entry, HAL and driver code in front of the DMA start, a few hundred cycles
+#define BENCH_DMA_START_LATENCY_NS 2000
+// the block reception splits the ring size into this many blocks
+#define BENCH_RX_BLOCKS 4
+#define BENCH_STRINGIFY_(x) #x
+#define BENCH_STRINGIFY(x) BENCH_STRINGIFY_(x)
+
+struct CallCost {
+	uint64_t ns;
+	uint64_t calls;
+};
+
+struct Result {
+	uint32_t baud;
+	unsigned int ringSize;
+	unsigned int messageSize;
+	double throughput;			///< payload bytes per second
+	double utilisation;			///< payload throughput relative to the wire capacity
+	uint64_t dmaTransfers;
+	uint64_t interrupts;
+	uint64_t rejected;			///< HAL_BUSY results of BufferedUart_Transmit
+	uint64_t errors;			///< lost or corrupted bytes
+	uint64_t dropped;			///< bytes reported as dropped by the driver
+	uint64_t overruns;
+	uint64_t messages;
+	uint64_t splitMessages;		///< messages which were sent with more than one DMA transfer
+	uint64_t calls;				///< reads of the application (wake ups or polls)
+	double gapNs;				///< average idle time on the line between two DMA transfers
+	uint64_t maxGapNs;
+	uint64_t emptyCalls;		///< reads which returned no data
+	double nsPerCall;
+	double nsPerReceive;
+#ifdef BUFFERED_UART_LATENCY
+	struct BufferedUartLatency latency;
+#endif
+};
+
+static bool s_csv;
+static uint64_t s_timerOverhead;
+static char s_txBuffer[BENCH_MAX_RING_SIZE] __attribute__((aligned(BUFFERED_UART_BUFFER_ALIGNMENT)));
+static char s_rxBuffer[BENCH_MAX_RING_SIZE] __attribute__((aligned(BUFFERED_UART_BUFFER_ALIGNMENT)));
+
+static uint64_t hostNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void calibrateTimer(void)
+{
+	uint64_t best = UINT64_MAX;
+	for (int i = 0; i < 10000; i++) {
+		uint64_t start = hostNs();
+		uint64_t elapsed = hostNs() - start;
+		if (elapsed < best) {
+			best = elapsed;
+		}
+	}
+	s_timerOverhead = best;
+}
+
+static void addCost(struct CallCost *cost, uint64_t start)
+{
+	uint64_t elapsed = hostNs() - start;
+	cost->ns += elapsed > s_timerOverhead ? elapsed - s_timerOverhead : 0;
+	cost->calls++;
+}
+
+static uint64_t min64(uint64_t a, uint64_t b)
+{
+	return a < b ? a : b;
+}
+
+static double costPerCall(const struct CallCost *cost)
+{
+	return cost->calls ? (double)cost->ns / (double)cost->calls : 0.0;
+}
+
+/// bytes of the test pattern are a running counter, so the receiver can detect loss and corruption
+struct PatternChecker {
+	uint8_t expected;
+	uint64_t bytes;
+	uint64_t errors;
+};
+
+static void checkPattern(struct PatternChecker *checker, const uint8_t *data, uint32_t length)
+{
+	for (uint32_t i = 0; i < length; i++) {
+		if (data[i] != checker->expected) {
+			checker->errors++;
+			checker->expected = data[i];
+		}
+		checker->expected++;
+	}
+	checker->bytes += length;
+}
+
+static void fillPattern(uint8_t *counter, uint8_t *data, unsigned int length)
+{
+	uint8_t value = *counter;
+	for (unsigned int i = 0; i < length; i++) {
+		data[i] = value++;
+	}
+	*counter = value;
+}
+
+static void txSink(void *context, const uint8_t *data, uint32_t length)
+{
+	checkPattern(context, data, length);
+}
+
+static double wireCapacity(const struct SimUart *su)
+{
+	return 1e9 / (double)SimUart_ByteTimeNs(su);
+}
+
+/// ends the benchmark if a setup call failed
+static void checkSetup(HAL_StatusTypeDef status, const char *call)
+{
+	if (status != HAL_OK) {
+		fprintf(stderr, "%s failed\n", call);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * fresh simulation with one buffered uart on s_txBuffer and s_rxBuffer. A size of 0 leaves that
+ * direction out, both 0 make a receive only uart for BufferedUart_StartBlockReception
+ */
+static void setupUart(struct SimUart *su, struct BufferedUart *bu, uint32_t baud, unsigned int txSize, unsigned int rxSize)
+{
+	Sim_Reset();
+	SimUart_Init(su, baud);
+	memset(bu, 0, sizeof(*bu));
+	enum BufferedUartMode mode = txSize == 0 ? BUFFERED_UART_RX : rxSize == 0 ? BUFFERED_UART_TX : BUFFERED_UART_TX_RX;
+	checkSetup(BufferedUart_Init(bu, &su->huart, mode, txSize > 0 ? s_txBuffer : NULL, txSize, rxSize > 0 ? s_rxBuffer : NULL, rxSize), "BufferedUart_Init");
+}
+
+enum TransmitMethod {
+	TRANSMIT_COPY,		///< encode into a stack buffer, then BufferedUart_Transmit
+	TRANSMIT_RESERVE	///< encode directly into the ring via BufferedUart_TxReserve/TxCommit
+};
+
+static bool transmitMessage(struct BufferedUart *bu, enum TransmitMethod method, uint8_t *counter, uint8_t *message, unsigned int messageSize, bool *encoded)
+{
+	if (method == TRANSMIT_COPY) {
+		if (!*encoded) {
+			fillPattern(counter, message, messageSize);
+			*encoded = true;
+		}
+		if (BufferedUart_Transmit(bu, message, messageSize) != HAL_OK) {
+			return false;
+		}
+		*encoded = false;
+		return true;
+	}
+
+	struct BufferedUartSpan first;
+	struct BufferedUartSpan second;
+	if (BufferedUart_TxReserve(bu, messageSize, &first, &second) != HAL_OK) {
+		return false;
+	}
+	fillPattern(counter, (uint8_t *)first.data, first.length);
+	fillPattern(counter, (uint8_t *)second.data, second.length);
+	BufferedUart_TxCommit(bu, messageSize);
+	return true;
+}
+
+/// number of statistics counters which do not match what the simulated hardware saw
+static uint64_t checkStatistics(const struct BufferedUart *bu, const struct SimUart *su, uint64_t rejected)
+{
+#ifdef BUFFERED_UART_STATISTICS
+	struct BufferedUartStatistics statistics;
+	BufferedUart_GetStatistics(bu, &statistics);
+	uint64_t mismatches = 0;
+	mismatches += statistics.txBytes != (uint32_t)su->stats.txBytes;
+	mismatches += statistics.txTransfers != (uint32_t)su->stats.txTransfers;
+	mismatches += statistics.txRejected != (uint32_t)rejected;
+	mismatches += statistics.txHighWater > bu->txqueue.length;
+	if (bu->rxqueue.length > 0) {
+		// bytes which the DMA wrote after the last reception event are not reported yet
+		uint32_t unreported = (2 * bu->rxqueue.length - su->rxChannel.CNDTR - bu->rxDmaPosition) % bu->rxqueue.length;
+		mismatches += statistics.rxBytes + unreported != (uint32_t)su->stats.rxBytes;
+	}
+#ifdef BUFFERED_UART_RX_BLOCKS
+	if (bu->rxBlockSize > 0) {
+		// neither are the bytes in the block which is being filled
+		uint32_t unreported = bu->rxBlock != NULL ? bu->rxBlockSize - su->rxChannel.CNDTR : 0;
+		mismatches += statistics.rxBytes + unreported != (uint32_t)su->stats.rxBytes;
+	}
+#endif
+	mismatches += statistics.rxHighWater > bu->rxqueue.length;
+	mismatches += statistics.txCpltCalls != (uint32_t)su->stats.txTransfers;
+	return mismatches;
+#else
+	(void)bu;
+	(void)su;
+	(void)rejected;
+	return 0;
+#endif
+}
+
+/**
+ * number of latency histograms which are inconsistent, every enqueued message (samples) has to be
+ * measured once in txQueued and txSent or counted as unsampled. Also takes the latencies for the result
+ */
+static uint64_t checkLatency(const struct BufferedUart *bu, struct Result *result, uint64_t samples)
+{
+#ifdef BUFFERED_UART_LATENCY
+	BufferedUart_GetLatency(bu, &result->latency);
+	const struct BufferedUartLatency *latency = &result->latency;
+	uint64_t mismatches = 0;
+	mismatches += latency->txQueued.count != latency->txSent.count;
+	mismatches += latency->txQueued.max > latency->txSent.max;
+	mismatches += samples != UINT64_MAX && latency->txSent.count + latency->txUnsampled != samples;
+	return mismatches;
+#else
+	(void)bu;
+	(void)result;
+	(void)samples;
+	return 0;
+#endif
+}
+
+/**
+ * saturated producer: encode and enqueue messages as fast as possible, whenever the ring is full
+ * let the simulation run until the next interrupt freed some space
+ * the per call cost covers encoding the message plus all enqueue attempts, per enqueued message
+ */
+static struct Result benchTransmit(enum TransmitMethod method, uint32_t baud, unsigned int ringSize, unsigned int messageSize, uint64_t dmaStartLatencyNs, uint64_t windowBytes)
+{
+	struct Result result = { .baud = baud, .ringSize = ringSize, .messageSize = messageSize };
+	struct SimUart su;
+	struct BufferedUart bu;
+	struct PatternChecker checker = { 0 };
+	struct CallCost cost = { 0 };
+	uint8_t message[BENCH_MAX_RING_SIZE];
+	uint8_t counter = 0;
+
+	setupUart(&su, &bu, baud, ringSize, 0);
+	Sim_SetDmaStartLatency(dmaStartLatencyNs);
+	SimUart_SetTxSink(&su, txSink, &checker);
+
+	uint64_t window = windowBytes * SimUart_ByteTimeNs(&su);
+	bool encoded = false;
+	while (Sim_Now() < window) {
+		uint64_t start = hostNs();
+		bool ok = transmitMessage(&bu, method, &counter, message, messageSize, &encoded);
+		cost.ns += hostNs() - start;
+
+		if (ok) {
+			cost.calls++;
+		} else {
+			result.rejected++;
+			if (!Sim_RunNextEvent()) {
+				break;
+			}
+		}
+	}
+	// timer overhead of all attempts
+	cost.ns -= min64(cost.ns, (cost.calls + result.rejected) * s_timerOverhead);
+
+	// let the ring drain, the line stays saturated until its last byte left the wire
+	while (Sim_RunNextEvent()) {
+	}
+
+	result.throughput = (double)checker.bytes * 1e9 / (double)su.lineFreeNs;
+	result.utilisation = result.throughput / wireCapacity(&su);
+	result.dmaTransfers = su.stats.txTransfers;
+	result.interrupts = su.stats.interrupts;
+	result.errors = checker.errors + su.stats.txModifiedBytes + checkStatistics(&bu, &su, result.rejected);
+	result.nsPerCall = costPerCall(&cost);
+	result.gapNs = su.stats.txGaps ? (double)su.stats.txGapNs / (double)su.stats.txGaps : 0.0;
+	result.maxGapNs = su.stats.txMaxGapNs;
+
+	BufferedUart_DeInit(&bu);
+	SimUart_DeInit(&su);
+	return result;
+}
+
+enum FmtMethod {
+	FMT_SNPRINTF,		///< snprintf into a stack buffer, then BufferedUart_Transmit
+	FMT_PRINTF			///< BufferedUart_Printf, rendered directly into the ring
+};
+
+// log line of a fixed length (53 bytes), channel names of known length without terminator
+#define BENCH_FMT_FORMAT "t=%08lu adc=%+5d v=%9.3f id=%08lX %-6.*s\r\n"
+#define BENCH_FMT_ARGUMENTS(i) (unsigned long)((i) * 125), (int)((i) % 4096) - 2048, \
+		(double)((int64_t)((i) % 10000) - 5000) / 8.0, (unsigned long)(((i) * 2654435761U) & 0xFFFFFFFFU), \
+		4, &s_fmtChannels[4 * ((i) % 2)]
+
+static const char s_fmtChannels[] = { 't', 'e', 'm', 'p', 'v', 'o', 'l', 't' };
+
+/// compares the sent bytes against the log lines rendered by snprintf
+struct FmtChecker {
+	char expected[128];
+	unsigned int length;
+	unsigned int offset;
+	uint64_t messages;
+	uint64_t bytes;
+	uint64_t errors;
+};
+
+static void fmtSink(void *context, const uint8_t *data, uint32_t length)
+{
+	struct FmtChecker *checker = context;
+	for (uint32_t i = 0; i < length; i++) {
+		if (checker->offset == checker->length) {
+			checker->length = (unsigned int)snprintf(checker->expected, sizeof(checker->expected), BENCH_FMT_FORMAT, BENCH_FMT_ARGUMENTS(checker->messages));
+			checker->offset = 0;
+			checker->messages++;
+		}
+		if (data[i] != (uint8_t)checker->expected[checker->offset++]) {
+			checker->errors++;
+		}
+	}
+	checker->bytes += length;
+}
+
+/**
+ * saturated producer of formatted log lines, like benchTransmit. snprintf formats every line once,
+ * BufferedUart_Printf formats again at every attempt, as it only renders once the line fits
+ * also checks that an unsupported conversion and a line longer than the ring queue nothing
+ */
+static struct Result benchTransmitFmt(enum FmtMethod method, uint32_t baud, unsigned int ringSize, uint64_t windowBytes)
+{
+	struct Result result = { .baud = baud, .ringSize = ringSize };
+	struct SimUart su;
+	struct BufferedUart bu;
+	struct FmtChecker checker = { .length = 0 };
+	struct CallCost cost = { 0 };
+	char message[128];
+
+	setupUart(&su, &bu, baud, ringSize, 0);
+	SimUart_SetTxSink(&su, fmtSink, &checker);
+	result.messageSize = (unsigned int)snprintf(message, sizeof(message), BENCH_FMT_FORMAT, BENCH_FMT_ARGUMENTS(0));
+
+	result.errors += BufferedUart_Printf(&bu, "%e", 1.0) != HAL_ERROR;
+	result.errors += BufferedUart_Printf(&bu, "%*s", (int)ringSize + 1, "") != HAL_BUSY;
+
+	uint64_t window = windowBytes * SimUart_ByteTimeNs(&su);
+	uint64_t sent = 0;
+	unsigned int length = 0;
+	while (Sim_Now() < window) {
+		uint64_t start = hostNs();
+		bool ok;
+		if (method == FMT_SNPRINTF) {
+			if (length == 0) {
+				length = (unsigned int)snprintf(message, sizeof(message), BENCH_FMT_FORMAT, BENCH_FMT_ARGUMENTS(sent));
+			}
+			ok = BufferedUart_Transmit(&bu, (const uint8_t *)message, length) == HAL_OK;
+			if (ok) {
+				length = 0;
+			}
+		} else {
+			ok = BufferedUart_Printf(&bu, BENCH_FMT_FORMAT, BENCH_FMT_ARGUMENTS(sent)) == HAL_OK;
+		}
+		cost.ns += hostNs() - start;
+
+		if (ok) {
+			cost.calls++;
+			sent++;
+		} else {
+			result.rejected++;
+			if (!Sim_RunNextEvent()) {
+				break;
+			}
+		}
+	}
+	cost.ns -= min64(cost.ns, (cost.calls + result.rejected) * s_timerOverhead);
+
+	while (Sim_RunNextEvent()) {
+	}
+
+	result.throughput = (double)checker.bytes * 1e9 / (double)su.lineFreeNs;
+	result.utilisation = result.throughput / wireCapacity(&su);
+	result.dmaTransfers = su.stats.txTransfers;
+	result.interrupts = su.stats.interrupts;
+	result.messages = sent;
+	result.errors += checker.errors + (sent != checker.messages) + (checker.offset != checker.length) + su.stats.txModifiedBytes;
+	result.nsPerCall = costPerCall(&cost);
+
+	BufferedUart_DeInit(&bu);
+	SimUart_DeInit(&su);
+	return result;
+}
+
+/// counts the DMA transfers which start inside a message of a fixed size
+struct MessageChecker {
+	struct PatternChecker pattern;
+	unsigned int messageSize;
+	uint64_t splitMessages;
+};
+
+static void messageSink(void *context, const uint8_t *data, uint32_t length)
+{
+	struct MessageChecker *checker = context;
+	if (checker->pattern.bytes % checker->messageSize != 0) {
+		checker->splitMessages++;
+	}
+	checkPattern(&checker->pattern, data, length);
+}
+
+/**
+ * paced producer: one message every two message frame times, so the line runs idle in between and
+ * every message is sent on its own. Shows how many messages are split into two DMA transfers at the
+ * end of the ring buffer (see BUFFERED_UART_TX_BIPBUFFER)
+ * with coalesceBytes > 0 the messages are coalesced via BufferedUart_SetTxCoalescing and
+ * BufferedUart_TxPoll is called after every message, like from a SysTick interrupt
+ */
+static struct Result benchTransmitPaced(uint32_t baud, unsigned int ringSize, unsigned int messageSize, unsigned int coalesceBytes, uint64_t windowBytes)
+{
+	struct Result result = { .baud = baud, .ringSize = ringSize, .messageSize = messageSize };
+	struct SimUart su;
+	struct BufferedUart bu;
+	struct MessageChecker checker = { .messageSize = messageSize };
+	uint8_t message[BENCH_MAX_RING_SIZE];
+	uint8_t counter = 0;
+
+	setupUart(&su, &bu, baud, ringSize, 0);
+	SimUart_SetTxSink(&su, messageSink, &checker);
+
+	BufferedUart_SetTxCoalescing(&bu, coalesceBytes, BENCH_COALESCE_TIMEOUT_MS);
+
+	uint64_t period = 2ULL * messageSize * SimUart_ByteTimeNs(&su);
+	uint64_t window = windowBytes * SimUart_ByteTimeNs(&su);
+	while (Sim_Now() < window) {
+		fillPattern(&counter, message, messageSize);
+		if (BufferedUart_Transmit(&bu, message, messageSize) != HAL_OK) {
+			result.rejected++;
+			// keep the pattern continuous
+			counter -= messageSize;
+		} else {
+			result.messages++;
+		}
+		Sim_Advance(period);
+		BufferedUart_TxPoll(&bu);
+	}
+	BufferedUart_Flush(&bu);
+	while (Sim_RunNextEvent()) {
+	}
+
+	result.throughput = (double)checker.pattern.bytes * 1e9 / (double)su.lineFreeNs;
+	result.utilisation = result.throughput / wireCapacity(&su);
+	result.dmaTransfers = su.stats.txTransfers;
+	result.interrupts = su.stats.interrupts;
+	result.splitMessages = checker.splitMessages;
+	result.errors = checker.pattern.errors + su.stats.txModifiedBytes + (result.messages * messageSize - checker.pattern.bytes);
+	result.errors += checkLatency(&bu, &result, result.messages);
+
+	BufferedUart_DeInit(&bu);
+	SimUart_DeInit(&su);
+	return result;
+}
+
+#define BENCH_URGENT_SIZE 8
+#define BENCH_URGENT_QUEUE 64
+
+/// separates the urgent transfers (BufferedUart_TransmitUrgent) from the bulk stream on the wire
+struct UrgentChecker {
+	const struct BufferedUart *bu;
+	struct PatternChecker bulk;
+	struct PatternChecker urgent;
+	uint64_t enqueued[BENCH_URGENT_QUEUE / BENCH_URGENT_SIZE];	///< enqueue times of the queued urgent messages
+	uint64_t queued;
+	uint64_t sent;
+	uint64_t latencyNs;
+	uint64_t maxLatencyNs;
+};
+
+static void urgentSink(void *context, const uint8_t *data, uint32_t length)
+{
+	struct UrgentChecker *checker = context;
+	if (checker->bu->txSource != BUFFERED_UART_TX_SOURCE_URGENT) {
+		checkPattern(&checker->bulk, data, length);
+		return;
+	}
+
+	checkPattern(&checker->urgent, data, length);
+	// the DMA of the transfer completed, its messages are on the wire (but for the last byte)
+	while (checker->sent < checker->urgent.bytes / BENCH_URGENT_SIZE) {
+		uint64_t latency = Sim_Now() - checker->enqueued[checker->sent % (BENCH_URGENT_QUEUE / BENCH_URGENT_SIZE)];
+		checker->latencyNs += latency;
+		if (latency > checker->maxLatencyNs) {
+			checker->maxLatencyNs = latency;
+		}
+		checker->sent++;
+	}
+}
+
+/**
+ * saturated bulk producer (64 byte messages) sharing the uart with a short urgent message every
+ * urgentPeriodBytes frame times, sent via BufferedUart_TransmitUrgent. Measures how long the urgent
+ * messages take from the enqueue until their DMA transfer completed, with the bulk transfers limited
+ * to chunkSize bytes (0 unlimited)
+ */
+static struct Result benchTransmitUrgent(uint32_t baud, unsigned int ringSize, unsigned int chunkSize, unsigned int urgentPeriodBytes, uint64_t windowBytes)
+{
+	struct Result result = { .baud = baud, .ringSize = ringSize, .messageSize = chunkSize };
+	struct SimUart su;
+	struct BufferedUart bu;
+	struct UrgentChecker checker = { .bu = &bu };
+	static char urgentBuffer[BENCH_URGENT_QUEUE];
+	uint8_t message[64];
+	uint8_t command[BENCH_URGENT_SIZE];
+	uint8_t counter = 0;
+	uint8_t urgentCounter = 0;
+	uint64_t bulkMessages = 0;
+
+	setupUart(&su, &bu, baud, ringSize, 0);
+	SimUart_SetTxSink(&su, urgentSink, &checker);
+	checkSetup(BufferedUart_SetUrgentQueue(&bu, urgentBuffer, sizeof(urgentBuffer)), "BufferedUart_SetUrgentQueue");
+	BufferedUart_SetTxChunkSize(&bu, chunkSize);
+
+	uint64_t urgentPeriod = urgentPeriodBytes * SimUart_ByteTimeNs(&su);
+	uint64_t nextUrgent = urgentPeriod;
+	uint64_t window = windowBytes * SimUart_ByteTimeNs(&su);
+	bool encoded = false;
+	while (Sim_Now() < window) {
+		if (Sim_Now() >= nextUrgent) {
+			fillPattern(&urgentCounter, command, sizeof(command));
+			checker.enqueued[checker.queued % (BENCH_URGENT_QUEUE / BENCH_URGENT_SIZE)] = Sim_Now();
+			if (BufferedUart_TransmitUrgent(&bu, command, sizeof(command)) == HAL_OK) {
+				checker.queued++;
+			} else {
+				result.rejected++;
+				urgentCounter -= sizeof(command);
+			}
+			nextUrgent += urgentPeriod;
+		}
+
+		if (!encoded) {
+			fillPattern(&counter, message, sizeof(message));
+			encoded = true;
+		}
+		if (BufferedUart_Transmit(&bu, message, sizeof(message)) == HAL_OK) {
+			encoded = false;
+			bulkMessages++;
+		} else {
+			result.rejected++;
+			if (Sim_NextEventTime() > nextUrgent) {
+				Sim_Advance(nextUrgent - Sim_Now());
+			} else if (!Sim_RunNextEvent()) {
+				break;
+			}
+		}
+	}
+	while (Sim_RunNextEvent()) {
+	}
+
+	result.messages = checker.sent;
+	result.throughput = (double)checker.bulk.bytes * 1e9 / (double)su.lineFreeNs;
+	result.utilisation = result.throughput / wireCapacity(&su);
+	result.dmaTransfers = su.stats.txTransfers;
+	result.interrupts = su.stats.interrupts;
+	result.nsPerCall = checker.sent ? (double)checker.latencyNs / (double)checker.sent : 0.0;
+	result.nsPerReceive = (double)checker.maxLatencyNs;
+	result.errors = checker.bulk.errors + checker.urgent.errors + su.stats.txModifiedBytes
+			+ (bulkMessages * sizeof(message) - checker.bulk.bytes) + (checker.queued - checker.sent)
+			+ checkStatistics(&bu, &su, result.rejected);
+
+	BufferedUart_DeInit(&bu);
+	SimUart_DeInit(&su);
+	return result;
+}
+
+enum TxSentMethod {
+	TX_SENT_DELAY,		///< wait for the frame time of the request plus a margin of one HAL tick
+	TX_SENT_NOTIFY,		///< BufferedUart_NotifyTxSent
+};
+
+#define BENCH_TX_SENT_MARGIN_NS 1000000
+
+static bool s_txSentNotified;
+static uint32_t s_txSentSequence;
+
+static void txSentHandler(struct BufferedUart *uart, uint32_t sequence)
+{
+	(void)uart;
+	s_txSentNotified = true;
+	s_txSentSequence = sequence;
+}
+
+/**
+ * half-duplex master: send a request and turn the line around for the response (as long as the
+ * request) once the request left the wire. Measures the time from the last stop bit of the request
+ * until the application turns the line around. A request that is turned around too early counts
+ * as error. With chunkSize > 0 the request is sent in several DMA transfers
+ */
+static struct Result benchTxSent(enum TxSentMethod method, uint32_t baud, unsigned int ringSize, unsigned int messageSize, unsigned int chunkSize, uint64_t windowBytes)
+{
+	struct Result result = { .baud = baud, .ringSize = ringSize, .messageSize = messageSize };
+	struct SimUart su;
+	struct BufferedUart bu;
+	struct PatternChecker checker = { 0 };
+	uint8_t message[BENCH_MAX_RING_SIZE];
+	uint8_t counter = 0;
+	uint64_t turnaroundNs = 0;
+	uint64_t maxTurnaroundNs = 0;
+
+	setupUart(&su, &bu, baud, ringSize, 0);
+	SimUart_SetTxSink(&su, txSink, &checker);
+	BufferedUart_SetTxChunkSize(&bu, chunkSize);
+
+	uint64_t frameTime = messageSize * SimUart_ByteTimeNs(&su);
+	uint64_t window = windowBytes * SimUart_ByteTimeNs(&su);
+	while (Sim_Now() < window) {
+		fillPattern(&counter, message, messageSize);
+		uint32_t sequence;
+		if (BufferedUart_TransmitSequenced(&bu, message, messageSize, &sequence) != HAL_OK) {
+			// the queue is empty at every request
+			result.rejected++;
+			break;
+		}
+		result.messages++;
+
+		if (method == TX_SENT_NOTIFY) {
+			s_txSentNotified = false;
+			if (BufferedUart_NotifyTxSent(&bu, sequence, txSentHandler)) {
+				while (!s_txSentNotified && Sim_RunNextEvent()) {
+				}
+				if (s_txSentSequence != sequence) {
+					result.errors++;
+				}
+			}
+		} else {
+			Sim_Advance(frameTime + BENCH_TX_SENT_MARGIN_NS);
+		}
+
+		if (su.lineFreeNs > Sim_Now() || !BufferedUart_IsTxSent(&bu, sequence)) {
+			result.errors++;
+		}
+		uint64_t turnaround = Sim_Now() - su.lineFreeNs;
+		turnaroundNs += turnaround;
+		if (turnaround > maxTurnaroundNs) {
+			maxTurnaroundNs = turnaround;
+		}
+
+		// the response of the peer
+		Sim_Advance(frameTime);
+	}
+	while (Sim_RunNextEvent()) {
+	}
+
+	result.throughput = (double)result.messages * 1e9 / (double)Sim_Now();
+	result.utilisation = (double)checker.bytes * 1e9 / (double)Sim_Now() / wireCapacity(&su);
+	result.dmaTransfers = su.stats.txTransfers;
+	result.interrupts = su.stats.interrupts;
+	result.nsPerCall = result.messages ? (double)turnaroundNs / (double)result.messages : 0.0;
+	result.nsPerReceive = (double)maxTurnaroundNs;
+	result.errors += checker.errors + su.stats.txModifiedBytes + (result.messages * messageSize - checker.bytes)
+			+ result.rejected + checkStatistics(&bu, &su, result.rejected);
+
+	BufferedUart_DeInit(&bu);
+	SimUart_DeInit(&su);
+	return result;
+}
+
+enum HalfDuplexMethod {
+	HALF_DUPLEX_DELAY,		///< the application waits for the frame time plus a margin of one HAL tick and drops the echo
+	HALF_DUPLEX_HANDLER,	///< BUFFERED_UART_HALF_DUPLEX_HANDLER, the DriverEnableHandler drives a GPIO
+	HALF_DUPLEX_DE			///< BUFFERED_UART_HALF_DUPLEX_DE, the USART drives DE
+};
+
+/// the RS-485 bus of the half-duplex benchmark
+static struct {
+	bool driving;			///< DE as set by the DriverEnableHandler
+	uint64_t releasedNs;	///< time at which the DriverEnableHandler released the bus
+	unsigned int echo;		///< echoed bytes of the request the application still has to drop
+	struct PatternChecker response;
+} s_bus;
+
+static void driverEnableHandler(struct BufferedUart *uart, bool enable)
+{
+	(void)uart;
+	s_bus.driving = enable;
+	if (!enable) {
+		s_bus.releasedNs = Sim_Now();
+	}
+}
+
+static enum DataHandledResult busResponseHandler(const char *data, unsigned int length)
+{
+	unsigned int echo = length < s_bus.echo ? length : s_bus.echo;
+	s_bus.echo -= echo;
+	checkPattern(&s_bus.response, (const uint8_t *)data + echo, length - echo);
+	return BUFFERED_UART_DATA_HANDLED;
+}
+
+/**
+ * RS-485 master polling a slave: send a request, release the bus and receive the response (as long
+ * as the request), which the slave sends right after the bus was released. The transceiver echoes
+ * the request into the receiver. Measures the time from the last stop bit of the request until the
+ * bus is released and the receiver is ready. Releasing the bus too early, echo in the rx queue of the
+ * half-duplex mode or a corrupted response count as error. With chunkSize > 0 the request is sent in
+ * several DMA transfers
+ */
+static struct Result benchHalfDuplex(enum HalfDuplexMethod method, uint32_t baud, unsigned int ringSize, unsigned int messageSize, unsigned int chunkSize, uint64_t windowBytes)
+{
+	struct Result result = { .baud = baud, .ringSize = ringSize, .messageSize = messageSize };
+	struct SimUart su;
+	struct BufferedUart bu;
+	struct PatternChecker checker = { 0 };
+	uint8_t message[BENCH_MAX_RING_SIZE];
+	uint8_t counter = 0;
+	uint8_t responseCounter = 0;
+	uint64_t turnaroundNs = 0;
+	uint64_t maxTurnaroundNs = 0;
+
+	setupUart(&su, &bu, baud, ringSize, ringSize);
+	SimUart_SetTxSink(&su, txSink, &checker);
+	SimUart_SetEcho(&su, true);
+	memset(&s_bus, 0, sizeof(s_bus));
+	BufferedUart_SetTxChunkSize(&bu, chunkSize);
+	bu.DataReceivedHandler = busResponseHandler;
+	HAL_StatusTypeDef status = HAL_OK;
+	if (method == HALF_DUPLEX_HANDLER) {
+		status = BufferedUart_SetHalfDuplex(&bu, BUFFERED_UART_HALF_DUPLEX_HANDLER, driverEnableHandler);
+	} else if (method == HALF_DUPLEX_DE) {
+		HAL_RS485Ex_Init(&su.huart, UART_DE_POLARITY_HIGH, 0, 0);
+		status = BufferedUart_SetHalfDuplex(&bu, BUFFERED_UART_HALF_DUPLEX_DE, NULL);
+	}
+	checkSetup(status, "BufferedUart_SetHalfDuplex");
+	checkSetup(BufferedUart_StartReception(&bu), "BufferedUart_StartReception");
+
+	uint64_t frameTime = messageSize * SimUart_ByteTimeNs(&su);
+	uint64_t window = windowBytes * SimUart_ByteTimeNs(&su);
+	while (Sim_Now() < window) {
+		fillPattern(&counter, message, messageSize);
+		if (method == HALF_DUPLEX_DELAY) {
+			s_bus.echo += messageSize;
+		}
+		if (BufferedUart_Transmit(&bu, message, messageSize) != HAL_OK) {
+			// the queue is empty at every request
+			result.rejected++;
+			break;
+		}
+		result.messages++;
+
+		if (method == HALF_DUPLEX_DELAY) {
+			Sim_Advance(frameTime + BENCH_TX_SENT_MARGIN_NS);
+		} else {
+			// the receiver is ready and the bus released, by the USART or the DriverEnableHandler
+			while ((!(su.regs.CR1 & USART_CR1_RE) || s_bus.driving || su.lineFreeNs > Sim_Now()) && Sim_RunNextEvent()) {
+			}
+			if (method == HALF_DUPLEX_HANDLER && s_bus.releasedNs < su.lineFreeNs) {
+				result.errors++;
+			}
+		}
+		uint64_t turnaround = Sim_Now() - su.lineFreeNs;
+		turnaroundNs += turnaround;
+		if (turnaround > maxTurnaroundNs) {
+			maxTurnaroundNs = turnaround;
+		}
+
+		// the response of the slave, the application waits for it
+		uint64_t expected = s_bus.response.bytes + messageSize;
+		fillPattern(&responseCounter, message, messageSize);
+		SimUart_Feed(&su, message, messageSize);
+		while (s_bus.response.bytes < expected && Sim_RunNextEvent()) {
+		}
+		if (s_bus.response.bytes != expected) {
+			result.errors++;
+			break;
+		}
+	}
+	while (Sim_RunNextEvent()) {
+	}
+
+	result.throughput = (double)result.messages * 1e9 / (double)Sim_Now();
+	result.utilisation = (double)checker.bytes * 1e9 / (double)Sim_Now() / wireCapacity(&su);
+	result.dmaTransfers = su.stats.txTransfers;
+	result.interrupts = su.stats.interrupts;
+	result.nsPerCall = result.messages ? (double)turnaroundNs / (double)result.messages : 0.0;
+	result.nsPerReceive = (double)maxTurnaroundNs;
+	result.errors += checker.errors + s_bus.response.errors + su.stats.rxLostBytes + s_bus.echo + result.rejected
+			+ (result.messages * messageSize - checker.bytes) + (method != HALF_DUPLEX_DELAY ? su.stats.rxEchoBytes : 0)
+			+ checkStatistics(&bu, &su, result.rejected);
+
+	BufferedUart_DeInit(&bu);
+	SimUart_DeInit(&su);
+	return result;
+}
+
+#define BENCH_IMAGE_SIZE 65536
+#define BENCH_IMAGE_HEADER 16
+
+enum ImageMethod {
+	IMAGE_COPY,			///< the image is copied through the ring in blocks, like BufferedUart_TransmitTimed
+	IMAGE_ZEROCOPY		///< BufferedUart_TransmitZeroCopy
+};
+
+static uint8_t s_image[BENCH_IMAGE_SIZE];
+static uint64_t s_imagesCompleted;
+
+#ifdef BUFFERED_UART_TX_ZEROCOPY
+static void imageCompleted(struct BufferedUart *uart, const void *data, unsigned int length)
+{
+	(void)uart;
+	if (data == s_image && length == sizeof(s_image)) {
+		s_imagesCompleted++;
+	}
+}
+#endif
+
+/**
+ * a large constant image framed by a header and a trailer which are sent via BufferedUart_Transmit,
+ * the pattern runs through all three, so the order on the wire is checked. The per call cost is the
+ * host time spent in the driver calls for one image
+ */
+static struct Result benchTransmitImage(enum ImageMethod method, uint32_t baud, unsigned int ringSize, uint64_t windowBytes)
+{
+	struct Result result = { .baud = baud, .ringSize = ringSize, .messageSize = BENCH_IMAGE_SIZE };
+	struct SimUart su;
+	struct BufferedUart bu;
+	struct PatternChecker checker = { 0 };
+	struct CallCost cost = { 0 };
+	uint8_t header[BENCH_IMAGE_HEADER];
+	uint8_t trailer[BENCH_IMAGE_HEADER];
+	uint8_t counter = 0;
+
+	setupUart(&su, &bu, baud, ringSize, 0);
+	SimUart_SetTxSink(&su, txSink, &checker);
+	s_imagesCompleted = 0;
+
+	uint64_t images = windowBytes / BENCH_IMAGE_SIZE > 0 ? windowBytes / BENCH_IMAGE_SIZE : 1;
+	for (uint64_t i = 0; i < images; i++) {
+		fillPattern(&counter, header, sizeof(header));
+		fillPattern(&counter, s_image, sizeof(s_image));
+		fillPattern(&counter, trailer, sizeof(trailer));
+
+		uint64_t start = hostNs();
+		bool ok = BufferedUart_Transmit(&bu, header, sizeof(header)) == HAL_OK;
+		if (method == IMAGE_ZEROCOPY) {
+#ifdef BUFFERED_UART_TX_ZEROCOPY
+			ok = ok && BufferedUart_TransmitZeroCopy(&bu, s_image, sizeof(s_image), imageCompleted) == HAL_OK;
+#endif
+		} else {
+			unsigned int blockSize = ringSize;
+#ifdef BUFFERED_UART_TX_BIPBUFFER
+			blockSize = ringSize / 2;
+#endif
+			for (unsigned int sent = 0; sent < sizeof(s_image); ) {
+				unsigned int length = sizeof(s_image) - sent < blockSize ? sizeof(s_image) - sent : blockSize;
+				if (BufferedUart_Transmit(&bu, s_image + sent, length) == HAL_OK) {
+					sent += length;
+				} else {
+					cost.ns += hostNs() - start;
+					if (!Sim_RunNextEvent()) {
+						break;
+					}
+					start = hostNs();
+				}
+			}
+			s_imagesCompleted++;
+		}
+		while (BufferedUart_Transmit(&bu, trailer, sizeof(trailer)) != HAL_OK) {
+			cost.ns += hostNs() - start;
+			if (!Sim_RunNextEvent()) {
+				break;
+			}
+			start = hostNs();
+		}
+		cost.ns += hostNs() - start;
+		cost.calls++;
+		result.errors += !ok;
+
+		// the image has to stay unchanged until it is sent
+		while (Sim_RunNextEvent()) {
+		}
+	}
+
+	result.messages = s_imagesCompleted;
+	result.throughput = (double)checker.bytes * 1e9 / (double)su.lineFreeNs;
+	result.utilisation = result.throughput / wireCapacity(&su);
+	result.dmaTransfers = su.stats.txTransfers;
+	result.interrupts = su.stats.interrupts;
+	result.errors += checker.errors + su.stats.txModifiedBytes + (images - s_imagesCompleted)
+			+ (images * (BENCH_IMAGE_SIZE + 2 * BENCH_IMAGE_HEADER) - checker.bytes);
+	result.nsPerCall = costPerCall(&cost);
+
+	BufferedUart_DeInit(&bu);
+	SimUart_DeInit(&su);
+	return result;
+}
+
+enum ReceiveMethod {
+	RECEIVE_DEQUEUE,	///< BufferedUart_Dequeue into a buffer of one message size, then parse it
+	RECEIVE_PEEK,		///< parse directly in the ring via BufferedUart_RxPeek/RxConsume
+	RECEIVE_BLOCKS		///< parse received blocks (BUFFERED_UART_RX_BLOCKS), each is released after the next one arrived
+};
+
+#ifdef BUFFERED_UART_RX_BLOCKS
+static struct BufferedUartRxBlock s_rxBlocks[BENCH_RX_BLOCKS];
+static struct BufferedUartRxBlock *s_heldBlock;
+#endif
+
+/// returns the number of parsed bytes
+static unsigned int receiveAndParse(struct BufferedUart *bu, enum ReceiveMethod method, struct PatternChecker *checker, uint8_t *buffer, unsigned int bufferSize)
+{
+	if (method == RECEIVE_DEQUEUE) {
+		unsigned int length = BufferedUart_Dequeue(bu, buffer, bufferSize);
+		checkPattern(checker, buffer, length);
+		return length;
+	}
+#ifdef BUFFERED_UART_RX_BLOCKS
+	if (method == RECEIVE_BLOCKS) {
+		struct BufferedUartRxBlock *block = BufferedUart_GetRxBlock(bu);
+		if (block == NULL) {
+			return 0;
+		}
+		checkPattern(checker, (const uint8_t *)block->data, block->length);
+		// the application still holds one block, e.g. in its processing queue
+		if (s_heldBlock != NULL) {
+			BufferedUart_ReleaseRxBlock(bu, s_heldBlock);
+		}
+		s_heldBlock = block;
+		return block->length;
+	}
+#endif
+
+	struct BufferedUartSpan first;
+	struct BufferedUartSpan second;
+	unsigned int length = BufferedUart_RxPeek(bu, &first, &second);
+	checkPattern(checker, (const uint8_t *)first.data, first.length);
+	checkPattern(checker, (const uint8_t *)second.data, second.length);
+	BufferedUart_RxConsume(bu, length);
+	return length;
+}
+
+/**
+ * the peer sends messages separated by two idle frames, so every message ends with an IDLE event
+ * and the offered load is messageSize / (messageSize + 2) of the wire capacity
+ * the application polls for data after every interrupt until nothing is left
+ * the per call cost covers fetching and parsing, per call that returned data
+ */
+static struct Result benchReceive(enum ReceiveMethod method, uint32_t baud, unsigned int ringSize, unsigned int messageSize, uint64_t windowBytes)
+{
+	struct Result result = { .baud = baud, .ringSize = ringSize, .messageSize = messageSize };
+	struct SimUart su;
+	struct BufferedUart bu;
+	struct PatternChecker checker = { 0 };
+	struct CallCost cost = { 0 };
+	uint8_t message[BENCH_MAX_RING_SIZE];
+	uint8_t counter = 0;
+
+	HAL_StatusTypeDef status;
+#ifdef BUFFERED_UART_RX_BLOCKS
+	if (method == RECEIVE_BLOCKS) {
+		unsigned int blockSize = ringSize / BENCH_RX_BLOCKS / BUFFERED_UART_BUFFER_ALIGNMENT * BUFFERED_UART_BUFFER_ALIGNMENT;
+		if (blockSize == 0) {
+			blockSize = BUFFERED_UART_BUFFER_ALIGNMENT;
+		}
+		for (unsigned int i = 0; i < BENCH_RX_BLOCKS; i++) {
+			s_rxBlocks[i].data = s_rxBuffer + i * blockSize;
+		}
+		s_heldBlock = NULL;
+		result.ringSize = BENCH_RX_BLOCKS * blockSize;
+		setupUart(&su, &bu, baud, 0, 0);
+		status = BufferedUart_StartBlockReception(&bu, s_rxBlocks, BENCH_RX_BLOCKS, blockSize, NULL);
+	} else
+#endif
+	{
+		setupUart(&su, &bu, baud, 0, ringSize);
+		status = BufferedUart_StartReception(&bu);
+	}
+	checkSetup(status, "BufferedUart_StartReception");
+
+	uint64_t byteTime = SimUart_ByteTimeNs(&su);
+	uint64_t window = windowBytes * byteTime;
+	uint64_t nextMessage = 0;
+	while (Sim_Now() < window) {
+		if (Sim_Now() >= nextMessage) {
+			fillPattern(&counter, message, messageSize);
+			SimUart_Feed(&su, message, messageSize);
+			nextMessage += (messageSize + 2) * byteTime;
+		}
+
+		uint64_t next = Sim_NextEventTime();
+		if (next > nextMessage) {
+			Sim_Advance(nextMessage - Sim_Now());
+		} else {
+			Sim_RunNextEvent();
+		}
+
+		for (;;) {
+			uint64_t start = hostNs();
+			unsigned int length = receiveAndParse(&bu, method, &checker, message, messageSize);
+			if (length == 0) {
+				break;
+			}
+			addCost(&cost, start);
+		}
+	}
+
+	result.throughput = (double)checker.bytes * 1e9 / (double)Sim_Now();
+	result.utilisation = result.throughput / wireCapacity(&su);
+	result.interrupts = su.stats.interrupts;
+	result.errors = checker.errors + su.stats.rxLostBytes + checkStatistics(&bu, &su, 0);
+	result.nsPerCall = costPerCall(&cost);
+
+	BufferedUart_DeInit(&bu);
+	SimUart_DeInit(&su);
+	return result;
+}
+
+/**
+ * the peer sends one continuous stream without IDLE gaps, the application only polls every pollBytes
+ * frame times and reads everything via BufferedUart_RxPeek/RxConsume. If the reader is too slow, the
+ * circular DMA overwrites unread data: every byte must then either be received or reported as dropped
+ */
+static struct Result benchReceiveContinuous(uint32_t baud, unsigned int ringSize, unsigned int pollBytes, uint64_t windowBytes)
+{
+	struct Result result = { .baud = baud, .ringSize = ringSize, .messageSize = pollBytes };
+	struct SimUart su;
+	struct BufferedUart bu;
+	struct PatternChecker checker = { 0 };
+	uint8_t chunk[256];
+	uint8_t counter = 0;
+
+	setupUart(&su, &bu, baud, 0, ringSize);
+	checkSetup(BufferedUart_StartReception(&bu), "BufferedUart_StartReception");
+
+	for (uint64_t sent = 0; sent < windowBytes; sent += sizeof(chunk)) {
+		fillPattern(&counter, chunk, sizeof(chunk));
+		SimUart_Feed(&su, chunk, sizeof(chunk));
+	}
+
+	uint64_t pollInterval = pollBytes * SimUart_ByteTimeNs(&su);
+	uint64_t sent = windowBytes + (sizeof(chunk) - windowBytes % sizeof(chunk)) % sizeof(chunk);
+	while (SimUart_RxPending(&su) > 0 || Sim_NextEventTime() != UINT64_MAX) {
+		Sim_Advance(pollInterval);
+
+		struct BufferedUartSpan first;
+		struct BufferedUartSpan second;
+		unsigned int droppedBefore = bu.rxDroppedBytes;
+		unsigned int length = BufferedUart_RxPeek(&bu, &first, &second);
+		// skip the dropped bytes in the expected pattern, so only unreported corruption is an error
+		checker.expected += (uint8_t)(bu.rxDroppedBytes - droppedBefore);
+		checkPattern(&checker, (const uint8_t *)first.data, first.length);
+		checkPattern(&checker, (const uint8_t *)second.data, second.length);
+		BufferedUart_RxConsume(&bu, length);
+	}
+
+	result.throughput = (double)checker.bytes * 1e9 / (double)Sim_Now();
+	result.utilisation = result.throughput / wireCapacity(&su);
+	result.interrupts = su.stats.interrupts;
+	result.dropped = bu.rxDroppedBytes;
+	result.overruns = bu.rxOverruns;
+	result.errors = checker.errors + su.stats.rxLostBytes + (sent - checker.bytes - bu.rxDroppedBytes);
+	result.errors += checkLatency(&bu, &result, UINT64_MAX);
+
+	BufferedUart_DeInit(&bu);
+	SimUart_DeInit(&su);
+	return result;
+}
+
+static struct SimUart *s_flowPeer;
+static uint64_t s_flowStops;
+
+/// RTS line of the application, wired to the CTS input of the peer
+static void flowRts(struct BufferedUart *uart, bool stop)
+{
+	(void)uart;
+	SimUart_SetPeerPaused(s_flowPeer, stop);
+	s_flowStops += stop;
+}
+
+/// the peer follows the XOFF/XON which the application sends, and counts every other byte as error
+static void flowXonXoffSink(void *context, const uint8_t *data, uint32_t length)
+{
+	uint64_t *errors = context;
+	for (uint32_t i = 0; i < length; i++) {
+		if (data[i] == BUFFERED_UART_XOFF || data[i] == BUFFERED_UART_XON) {
+			SimUart_SetPeerPaused(s_flowPeer, data[i] == BUFFERED_UART_XOFF);
+			s_flowStops += data[i] == BUFFERED_UART_XOFF;
+		} else {
+			(*errors)++;
+		}
+	}
+}
+
+/**
+ * the peer sends windowBytes back to back, the application reads only readBytes every readFrames frame
+ * times (a quarter of the line rate). Without flow control the circular DMA overwrites what the
+ * application did not read yet, with flow control the peer is stopped at the high watermark
+ */
+static struct Result benchFlowControl(enum BufferedUartFlowControl mode, uint32_t baud, unsigned int ringSize, uint64_t windowBytes)
+{
+	const unsigned int readBytes = 16;
+	const unsigned int readFrames = 64;
+	unsigned int highWatermark = ringSize / 2 - ringSize / 8;
+	unsigned int lowWatermark = ringSize / 8;
+	struct Result result = { .baud = baud, .ringSize = ringSize, .messageSize = mode == BUFFERED_UART_FLOW_NONE ? 0 : highWatermark };
+	struct SimUart su;
+	struct BufferedUart bu;
+	struct PatternChecker checker = { 0 };
+	uint64_t peerErrors = 0;
+	uint8_t chunk[256];
+	uint8_t buffer[16];
+	uint8_t counter = 0;
+
+	setupUart(&su, &bu, baud, 64, ringSize);
+	s_flowPeer = &su;
+	s_flowStops = 0;
+	SimUart_SetTxSink(&su, flowXonXoffSink, &peerErrors);
+	checkSetup(BufferedUart_SetFlowControl(&bu, mode, highWatermark, lowWatermark, mode == BUFFERED_UART_FLOW_RTS ? flowRts : NULL), "BufferedUart_SetFlowControl");
+	checkSetup(BufferedUart_StartReception(&bu), "BufferedUart_StartReception");
+
+	uint64_t sent = 0;
+	while (sent < windowBytes) {
+		fillPattern(&counter, chunk, sizeof(chunk));
+		SimUart_Feed(&su, chunk, sizeof(chunk));
+		sent += sizeof(chunk);
+	}
+
+	uint64_t readInterval = readFrames * SimUart_ByteTimeNs(&su);
+	uint64_t deadline = 2 * (sent / readBytes + 1) * readInterval;
+	while (checker.bytes + bu.rxDroppedBytes < sent && Sim_Now() < deadline) {
+		Sim_Advance(readInterval);
+
+		unsigned int droppedBefore = bu.rxDroppedBytes;
+		unsigned int length = BufferedUart_Dequeue(&bu, buffer, readBytes);
+		// skip the dropped bytes in the expected pattern, so only unreported corruption is an error
+		checker.expected += (uint8_t)(bu.rxDroppedBytes - droppedBefore);
+		checkPattern(&checker, buffer, length);
+	}
+
+	result.throughput = (double)checker.bytes * 1e9 / (double)Sim_Now();
+	result.utilisation = result.throughput / wireCapacity(&su);
+	result.interrupts = su.stats.interrupts;
+	result.messages = s_flowStops;
+	result.dropped = bu.rxDroppedBytes;
+	result.overruns = bu.rxOverruns;
+	result.errors = checker.errors + peerErrors + su.stats.rxLostBytes + (sent - checker.bytes - bu.rxDroppedBytes);
+	if (mode != BUFFERED_UART_FLOW_NONE) {
+		// flow control must not lose anything
+		result.errors += bu.rxDroppedBytes;
+	}
+
+	BufferedUart_DeInit(&bu);
+	SimUart_DeInit(&su);
+	return result;
+}
+
+/// data of the XON/XOFF race benchmark, a running counter which skips the flow control characters
+static uint8_t nextDataByte(uint8_t *counter)
+{
+	do {
+		(*counter)++;
+	} while (*counter == BUFFERED_UART_XON || *counter == BUFFERED_UART_XOFF);
+	return *counter;
+}
+
+struct XonRaceChecker {
+	uint8_t counter;
+	uint64_t bytes;
+	uint64_t flowCharacters;
+	uint64_t errors;
+};
+
+static void xonRaceSink(void *context, const uint8_t *data, uint32_t length)
+{
+	struct XonRaceChecker *checker = context;
+	for (uint32_t i = 0; i < length; i++) {
+		if (data[i] == BUFFERED_UART_XON || data[i] == BUFFERED_UART_XOFF) {
+			checker->flowCharacters++;
+		} else {
+			checker->errors += data[i] != nextDataByte(&checker->counter);
+			checker->bytes++;
+		}
+	}
+}
+
+/// a timer interrupt which polls the reception, it preempts the application at every HAL call
+static void xonRacePoll(void *context)
+{
+	BufferedUart_RxPoll(context);
+}
+
+/**
+ * XON/XOFF against a transmitting application: the application sends a message whenever the line
+ * is idle, while the peer's XON or enough received data to reach the high watermark arrived just
+ * before, but is only found by an interrupt which preempts BufferedUart_Transmit. The interrupt then
+ * starts a transmission itself (the queued message or XOFF) in the middle of the one of the application.
+ * Lost or corrupted data counts as error, a broken start ends in Error_Handler
+ */
+static struct Result benchTxXonRace(uint32_t baud, unsigned int messageSize, uint64_t windowBytes)
+{
+	const unsigned int highWatermark = 24;
+	struct Result result = { .baud = baud, .ringSize = 64, .messageSize = messageSize };
+	struct SimUart su;
+	struct BufferedUart bu;
+	struct XonRaceChecker checker = { 0 };
+	uint8_t message[64];
+	uint8_t burst[24];
+	uint8_t received[64];
+	uint8_t counter = 0;
+	const char xon = BUFFERED_UART_XON;
+
+	setupUart(&su, &bu, baud, 256, result.ringSize);
+	SimUart_SetTxSink(&su, xonRaceSink, &checker);
+	checkSetup(BufferedUart_SetFlowControl(&bu, BUFFERED_UART_FLOW_XON_XOFF, highWatermark, 8, NULL), "BufferedUart_SetFlowControl");
+	checkSetup(BufferedUart_StartReception(&bu), "BufferedUart_StartReception");
+	memset(burst, 'a', sizeof(burst));
+	Sim_SetPreemptionHook(xonRacePoll, &bu, 1);
+
+	uint64_t byteNs = SimUart_ByteTimeNs(&su);
+	uint64_t sent = 0;
+	while (sent < windowBytes) {
+		// every fourth request races with the high watermark, the others with a (repeated) XON
+		if (result.messages % 4 == 3) {
+			SimUart_Feed(&su, burst, highWatermark);
+			Sim_Advance(highWatermark * byteNs);
+		} else {
+			SimUart_Feed(&su, &xon, 1);
+			Sim_Advance(byteNs);
+		}
+
+		for (unsigned int i = 0; i < messageSize; i++) {
+			message[i] = nextDataByte(&counter);
+		}
+		if (BufferedUart_Transmit(&bu, message, messageSize) != HAL_OK) {
+			result.rejected++;
+			break;
+		}
+		result.messages++;
+		sent += messageSize;
+
+		// the line goes idle and the peer paused by the XOFF is resumed
+		while (Sim_RunNextEvent()) {
+		}
+		while (BufferedUart_Dequeue(&bu, received, sizeof(received)) > 0) {
+		}
+		while (Sim_RunNextEvent()) {
+		}
+	}
+	Sim_SetPreemptionHook(NULL, NULL, 0);
+
+	result.calls = checker.flowCharacters;
+	result.dmaTransfers = su.stats.txTransfers;
+	result.interrupts = su.stats.interrupts;
+	result.errors = checker.errors + (sent - checker.bytes) + result.rejected + su.stats.rxLostBytes;
+
+	BufferedUart_DeInit(&bu);
+	SimUart_DeInit(&su);
+	return result;
+}
+
+struct XoffChecker {
+	struct PatternChecker pattern;
+	bool paused;			///< the peer sent XOFF and waits for the application to stop
+	uint64_t pausedBytes;	///< bytes which arrived since then
+	uint64_t maxPausedBytes;
+};
+
+static void xoffSink(void *context, const uint8_t *data, uint32_t length)
+{
+	struct XoffChecker *checker = context;
+	checkPattern(&checker->pattern, data, length);
+	if (checker->paused) {
+		checker->pausedBytes += length;
+		if (checker->pausedBytes > checker->maxPausedBytes) {
+			checker->maxPausedBytes = checker->pausedBytes;
+		}
+	}
+}
+
+/**
+ * the application keeps the tx queue full, the peer sends XOFF and XON after pauseFrames frame times
+ * several times. Counts the bytes which still arrive after the XOFF, the rest of the running DMA
+ * transfer, which chunkSize limits
+ */
+static struct Result benchTxXoff(uint32_t baud, unsigned int chunkSize, unsigned int pauseFrames, uint64_t windowBytes)
+{
+	struct Result result = { .baud = baud, .ringSize = 1024, .messageSize = chunkSize };
+	struct SimUart su;
+	struct BufferedUart bu;
+	struct XoffChecker checker = { .paused = false };
+	uint8_t message[64];
+	uint8_t received[64];
+	bool encoded = false;
+	uint8_t counter = 0;
+	const char xoff = BUFFERED_UART_XOFF;
+	const char xon = BUFFERED_UART_XON;
+
+	setupUart(&su, &bu, baud, result.ringSize, 64);
+	SimUart_SetTxSink(&su, xoffSink, &checker);
+	checkSetup(BufferedUart_SetFlowControl(&bu, BUFFERED_UART_FLOW_XON_XOFF, 24, 8, NULL), "BufferedUart_SetFlowControl");
+	checkSetup(BufferedUart_StartReception(&bu), "BufferedUart_StartReception");
+	BufferedUart_SetTxChunkSize(&bu, chunkSize);
+
+	uint64_t queued = 0;
+	uint64_t nextPause = 4 * pauseFrames;
+	uint64_t pauseEnd = 0;
+	uint64_t byteNs = SimUart_ByteTimeNs(&su);
+	while (checker.pattern.bytes < windowBytes) {
+		while (queued < windowBytes) {
+			if (!encoded) {
+				fillPattern(&counter, message, sizeof(message));
+				encoded = true;
+			}
+			if (BufferedUart_Transmit(&bu, message, sizeof(message)) != HAL_OK) {
+				break;
+			}
+			encoded = false;
+			queued += sizeof(message);
+		}
+		if (!checker.paused && checker.pattern.bytes >= nextPause) {
+			// the XOFF arrives one frame later
+			SimUart_Feed(&su, &xoff, 1);
+			Sim_Advance(byteNs);
+			checker.paused = true;
+			checker.pausedBytes = 0;
+			pauseEnd = Sim_Now() + pauseFrames * byteNs;
+		} else if (checker.paused && Sim_Now() >= pauseEnd) {
+			SimUart_Feed(&su, &xon, 1);
+			checker.paused = false;
+			nextPause = checker.pattern.bytes + 4 * pauseFrames;
+			result.messages++;
+		}
+		Sim_Advance(byteNs);
+		BufferedUart_Dequeue(&bu, received, sizeof(received));
+	}
+
+	result.throughput = (double)checker.pattern.bytes * 1e9 / (double)Sim_Now();
+	result.utilisation = result.throughput / wireCapacity(&su);
+	result.interrupts = su.stats.interrupts;
+	result.dmaTransfers = su.stats.txTransfers;
+	result.maxGapNs = checker.maxPausedBytes;
+	result.errors += checker.pattern.errors;
+	// the XOFF is noticed at the IDLE event one frame after it, a transfer may start in between
+	if (checker.maxPausedBytes > 2 * chunkSize + 2) {
+		result.errors++;
+	}
+
+	BufferedUart_DeInit(&bu);
+	SimUart_DeInit(&su);
+	return result;
+}
+
+enum LineMethod {
+	LINES_RESCAN,		///< BufferedUart_Dequeue into a line buffer, which is searched from its start at every poll
+	LINES_PEEK,			///< BufferedUart_PeekLine + BufferedUart_RxConsume
+	LINES_DEQUEUE,		///< BufferedUart_DequeueLine
+};
+
+/// NMEA-like line number index of length bytes: '$', letters and "\r\n"
+static void fillLine(char *line, uint64_t index, unsigned int length)
+{
+	line[0] = '$';
+	for (unsigned int i = 1; i < length - 2; i++) {
+		line[i] = (char)('A' + (index + i) % 26);
+	}
+	line[length - 2] = '\r';
+	line[length - 1] = '\n';
+}
+
+struct LineChecker {
+	unsigned int lineLength;
+	uint64_t lines;
+	uint64_t errors;
+};
+
+static void checkLine(struct LineChecker *checker, const char *line, unsigned int length)
+{
+	char expected[BENCH_MAX_RING_SIZE];
+	fillLine(expected, checker->lines, checker->lineLength);
+	if (length != checker->lineLength || memcmp(line, expected, length) != 0) {
+		checker->errors++;
+	}
+	checker->lines++;
+}
+
+/**
+ * the peer sends NMEA-like lines back to back (a GNSS receiver), the application polls every pollBytes
+ * frame times for complete lines. The ring is read either by copying everything out and searching the
+ * copied data from its start again at every poll, or by the line functions of the driver, which search
+ * every byte once
+ */
+static struct Result benchReceiveLines(enum LineMethod method, uint32_t baud, unsigned int ringSize, unsigned int lineLength, unsigned int pollBytes, uint64_t windowBytes)
+{
+	struct Result result = { .baud = baud, .ringSize = ringSize, .messageSize = lineLength };
+	struct SimUart su;
+	struct BufferedUart bu;
+	struct LineChecker checker = { .lineLength = lineLength };
+	struct CallCost cost = { 0 };
+	static char pending[2 * BENCH_MAX_RING_SIZE];
+	unsigned int pendingLength = 0;
+	char line[BENCH_MAX_RING_SIZE];
+
+	setupUart(&su, &bu, baud, 0, ringSize);
+	checkSetup(BufferedUart_StartReception(&bu), "BufferedUart_StartReception");
+
+	uint64_t lines = windowBytes / lineLength;
+	for (uint64_t i = 0; i < lines; i++) {
+		fillLine(line, i, lineLength);
+		SimUart_Feed(&su, (const uint8_t *)line, lineLength);
+	}
+
+	uint64_t pollInterval = pollBytes * SimUart_ByteTimeNs(&su);
+	while (SimUart_RxPending(&su) > 0 || Sim_NextEventTime() != UINT64_MAX) {
+		Sim_Advance(pollInterval);
+
+		uint64_t start = hostNs();
+		uint64_t before = checker.lines;
+		if (method == LINES_RESCAN) {
+			pendingLength += BufferedUart_Dequeue(&bu, pending + pendingLength, sizeof(pending) - pendingLength);
+			unsigned int offset = 0;
+			const char *end;
+			while ((end = memchr(pending + offset, '\n', pendingLength - offset)) != NULL) {
+				unsigned int length = (unsigned int)(end - (pending + offset)) + 1;
+				checkLine(&checker, pending + offset, length);
+				offset += length;
+			}
+			memmove(pending, pending + offset, pendingLength - offset);
+			pendingLength -= offset;
+		} else if (method == LINES_PEEK) {
+			const char *received;
+			unsigned int length;
+			while ((length = BufferedUart_PeekLine(&bu, &received, line, sizeof(line))) > 0) {
+				checkLine(&checker, received, length);
+				BufferedUart_RxConsume(&bu, length);
+			}
+		} else {
+			unsigned int length;
+			while ((length = BufferedUart_DequeueLine(&bu, line, sizeof(line))) > 0) {
+				checkLine(&checker, line, length);
+			}
+		}
+		addCost(&cost, start);
+		if (checker.lines == before) {
+			result.emptyCalls++;
+		}
+	}
+
+	result.throughput = (double)(checker.lines * lineLength) * 1e9 / (double)Sim_Now();
+	result.utilisation = result.throughput / wireCapacity(&su);
+	result.interrupts = su.stats.interrupts;
+	result.messages = checker.lines;
+	result.calls = cost.calls;
+	result.nsPerCall = costPerCall(&cost);
+	result.errors = checker.errors + (lines - checker.lines) + su.stats.rxLostBytes + bu.rxDroppedBytes + pendingLength;
+
+	BufferedUart_DeInit(&bu);
+	SimUart_DeInit(&su);
+	return result;
+}
+
+#define BENCH_LINE_LENGTH 12
+
+struct RxDeliveryPolicy {
+	const char *name;
+	unsigned int fillThreshold;
+	unsigned int pollBytes;			///< BufferedUart_RxPoll every pollBytes frame times, 0 never
+	unsigned int timeoutBits;
+	int matchCharacter;
+};
+
+/// delivery latency of the line ends, the DataReceivedHandler has no context argument
+static struct {
+	uint64_t periodNs;				///< time between the starts of two lines on the wire
+	uint64_t byteTimeNs;
+	uint64_t delivered;
+	uint64_t lines;
+	uint64_t latencyNs;
+	uint64_t maxLatencyNs;
+	uint64_t errors;
+} s_latency;
+
+static enum DataHandledResult latencyHandler(const char *data, unsigned int length)
+{
+	for (unsigned int i = 0; i < length; i++) {
+		uint64_t index = s_latency.delivered++;
+		bool lineEnd = index % BENCH_LINE_LENGTH == BENCH_LINE_LENGTH - 1;
+		if (lineEnd != (data[i] == '\n')) {
+			s_latency.errors++;
+		}
+		if (lineEnd) {
+			// the last stop bit of the line end left the wire at arrival
+			uint64_t arrival = (index / BENCH_LINE_LENGTH) * s_latency.periodNs + BENCH_LINE_LENGTH * s_latency.byteTimeNs;
+			uint64_t latency = Sim_Now() - arrival;
+			s_latency.lines++;
+			s_latency.latencyNs += latency;
+			if (latency > s_latency.maxLatencyNs) {
+				s_latency.maxLatencyNs = latency;
+			}
+		}
+	}
+	return BUFFERED_UART_DATA_HANDLED;
+}
+
+/**
+ * the peer sends lines of BENCH_LINE_LENGTH bytes, followed by gapBytes idle frame times (0 is a
+ * continuous stream), the DataReceivedHandler measures how long after its arrival every line end is
+ * delivered with the given delivery policy
+ */
+static struct Result benchRxLatency(const struct RxDeliveryPolicy *policy, uint32_t baud, unsigned int ringSize, unsigned int gapBytes, uint64_t windowBytes)
+{
+	struct Result result = { .baud = baud, .ringSize = ringSize, .messageSize = gapBytes };
+	struct SimUart su;
+	struct BufferedUart bu;
+	char line[BENCH_LINE_LENGTH];
+
+	setupUart(&su, &bu, baud, 0, ringSize);
+	SimUart_SetIrqHandler(&su, BufferedUart_UART_IRQHandler);
+	memset(&s_latency, 0, sizeof(s_latency));
+	checkSetup(BufferedUart_SetRxTimeout(&bu, policy->timeoutBits), "BufferedUart_SetRxTimeout");
+	checkSetup(BufferedUart_SetRxCharacterMatch(&bu, policy->matchCharacter), "BufferedUart_SetRxCharacterMatch");
+	BufferedUart_SetRxFillThreshold(&bu, policy->fillThreshold);
+	bu.DataReceivedHandler = latencyHandler;
+	checkSetup(BufferedUart_StartReception(&bu), "BufferedUart_StartReception");
+
+	for (unsigned int i = 0; i < BENCH_LINE_LENGTH - 1; i++) {
+		line[i] = (char)('a' + i);
+	}
+	line[BENCH_LINE_LENGTH - 1] = '\n';
+
+	uint64_t byteTime = SimUart_ByteTimeNs(&su);
+	s_latency.byteTimeNs = byteTime;
+	s_latency.periodNs = (uint64_t)(BENCH_LINE_LENGTH + gapBytes) * byteTime;
+	uint64_t lines = windowBytes / (BENCH_LINE_LENGTH + gapBytes);
+	uint64_t sent = 0;
+	for (uint64_t step = 0; sent < lines || Sim_NextEventTime() != UINT64_MAX; step++) {
+		// a continuous stream is fed at once, otherwise the IDLE detection of the last line could fire
+		while (sent < lines && (gapBytes == 0 || Sim_Now() >= sent * s_latency.periodNs)) {
+			SimUart_Feed(&su, line, sizeof(line));
+			sent++;
+		}
+		Sim_Advance(byteTime);
+		if (policy->pollBytes > 0 && step % policy->pollBytes == 0) {
+			BufferedUart_RxPoll(&bu);
+		}
+	}
+
+	result.messages = s_latency.lines;
+	result.interrupts = su.stats.interrupts;
+	result.nsPerCall = s_latency.lines ? (double)s_latency.latencyNs / (double)s_latency.lines : 0.0;
+	result.nsPerReceive = (double)s_latency.maxLatencyNs;
+	result.errors = s_latency.errors + su.stats.rxUnhandledIrqs + su.stats.rxLostBytes + bu.rxDroppedBytes
+			+ (sent * BENCH_LINE_LENGTH - s_latency.delivered);
+
+	BufferedUart_DeInit(&bu);
+	SimUart_DeInit(&su);
+	return result;
+}
+
+static void printLatencyHeader(const char *title)
+{
+	if (s_csv) {
+		printf("benchmark,policy,baud,ring,gap_bytes,lines,interrupts,errors,avg_latency_us,max_latency_us\n");
+	} else {
+		printf("\n%s\n", title);
+		printf("%-10s %8s %6s %6s %9s %9s %7s %12s %12s\n", "policy", "baud", "ring", "gap", "lines", "irqs", "errors",
+				"avg us", "max us");
+	}
+}
+
+static void printLatencyResult(const char *name, const char *policy, const struct Result *r)
+{
+	if (s_csv) {
+		printf("%s,%s,%u,%u,%u,%llu,%llu,%llu,%.2f,%.2f\n", name, policy, (unsigned int)r->baud, r->ringSize, r->messageSize,
+				(unsigned long long)r->messages, (unsigned long long)r->interrupts, (unsigned long long)r->errors,
+				r->nsPerCall / 1000.0, r->nsPerReceive / 1000.0);
+	} else {
+		printf("%-10s %8u %6u %6u %9llu %9llu %7llu %12.2f %12.2f\n", policy, (unsigned int)r->baud, r->ringSize, r->messageSize,
+				(unsigned long long)r->messages, (unsigned long long)r->interrupts, (unsigned long long)r->errors,
+				r->nsPerCall / 1000.0, r->nsPerReceive / 1000.0);
+	}
+}
+
+#ifdef BUFFERED_UART_TRACE
+#define BENCH_TRACE_SIZE (1024 * 1024)
+#define BENCH_TRACE_RING_SIZE 2048
+#define BENCH_TRACE_RX_RING_SIZE 256
+
+/// what the DataReceivedHandler saw, a hash over the length and the bytes of every call
+static struct {
+	uint64_t calls;
+	uint64_t bytes;
+	uint64_t hash;
+} s_traceHandler;
+
+static uint8_t s_trace[BENCH_TRACE_SIZE];
+static uint32_t s_traceLength;
+
+static enum DataHandledResult traceHandler(const char *data, unsigned int length)
+{
+	uint64_t hash = (s_traceHandler.hash ^ length) * 1099511628211ULL;
+	for (unsigned int i = 0; i < length; i++) {
+		hash = (hash ^ (uint8_t)data[i]) * 1099511628211ULL;
+	}
+	s_traceHandler.hash = hash;
+	s_traceHandler.calls++;
+	s_traceHandler.bytes += length;
+	return BUFFERED_UART_DATA_HANDLED;
+}
+
+static void traceInit(struct SimUart *su, struct BufferedUart *bu, uint32_t baud)
+{
+	setupUart(su, bu, baud, 256, BENCH_TRACE_RX_RING_SIZE);
+	memset(&s_traceHandler, 0, sizeof(s_traceHandler));
+	bu->DataReceivedHandler = traceHandler;
+	checkSetup(BufferedUart_StartReception(bu), "BufferedUart_StartReception");
+}
+
+/**
+ * the peer sends messages of 1 to 1.5 rx ring sizes with gaps of 0 to 15 frame times, so the handler
+ * sees IDLE, half and complete transfer events in all combinations, an overrun restarts the reception
+ * in the middle and every message is answered. The trace is recorded into a small ring which is drained
+ * into s_trace after every message. Returns what the handler saw in hash
+ */
+static struct Result benchTraceRecord(uint32_t baud, uint64_t windowBytes, uint64_t *hash)
+{
+	struct Result result = { .baud = baud, .ringSize = BENCH_TRACE_RX_RING_SIZE };
+	struct SimUart su;
+	struct BufferedUart bu;
+	static char traceRing[BENCH_TRACE_RING_SIZE];
+	uint8_t message[BENCH_TRACE_RX_RING_SIZE * 3 / 2];
+	uint8_t counter = 0;
+	uint32_t random = 1;
+
+	traceInit(&su, &bu, baud);
+	checkSetup(BufferedUart_SetTrace(&bu, traceRing, sizeof(traceRing)), "BufferedUart_SetTrace");
+
+	s_traceLength = 0;
+	uint64_t fed = 0;
+	bool restarted = false;
+	uint64_t start = hostNs();
+	while (fed < windowBytes && s_traceLength + sizeof(traceRing) <= sizeof(s_trace)) {
+		random = random * 1103515245U + 12345U;
+		unsigned int length = 1 + (random >> 8) % sizeof(message);
+		fillPattern(&counter, message, length);
+		SimUart_Feed(&su, message, length);
+		fed += length;
+		while (SimUart_RxPending(&su) > 0 && Sim_RunNextEvent()) {
+		}
+		BufferedUart_Transmit(&bu, "ok\r\n", 4);
+		Sim_Advance(((random >> 20) % 16) * SimUart_ByteTimeNs(&su));
+		if (!restarted && fed >= windowBytes / 2) {
+			SimUart_InjectError(&su, HAL_UART_ERROR_ORE);
+			restarted = true;
+		}
+		s_traceLength += BufferedUart_TraceRead(&bu, s_trace + s_traceLength, sizeof(s_trace) - s_traceLength);
+	}
+	while (Sim_RunNextEvent()) {
+	}
+	uint64_t ns = hostNs() - start;
+	s_traceLength += BufferedUart_TraceRead(&bu, s_trace + s_traceLength, sizeof(s_trace) - s_traceLength);
+
+	for (uint32_t offset = 0; offset < s_traceLength; result.calls++) {
+		struct BufferedUartTraceRecord record;
+		memcpy(&record, s_trace + offset, sizeof(record));
+		offset += sizeof(record) + record.length;
+	}
+	*hash = s_traceHandler.hash;
+	result.messages = s_traceHandler.calls;
+	result.nsPerCall = s_traceHandler.calls ? (double)ns / (double)s_traceHandler.calls : 0.0;
+	result.errors = bu.traceDroppedTotal + su.stats.rxLostBytes + (fed - s_traceHandler.bytes);
+
+	BufferedUart_DeInit(&bu);
+	SimUart_DeInit(&su);
+	return result;
+}
+
+/**
+ * replay the recorded trace into a new buffered uart at speedup times the original speed, the handler
+ * has to see exactly the same calls. The per call cost covers the simulated interrupt, the driver and
+ * the handler
+ */
+static struct Result benchTraceReplay(uint32_t baud, unsigned int speedup, uint64_t expectedHash, uint64_t expectedCalls)
+{
+	struct Result result = { .baud = baud, .ringSize = BENCH_TRACE_RX_RING_SIZE, .messageSize = speedup };
+	struct SimUart su;
+	struct BufferedUart bu;
+
+	traceInit(&su, &bu, baud);
+	int scheduled = SimUart_Replay(&su, s_trace, s_traceLength, 1.0, speedup);
+	uint64_t start = hostNs();
+	while (Sim_RunNextEvent()) {
+	}
+	uint64_t ns = hostNs() - start;
+
+	result.calls = scheduled > 0 ? (uint64_t)scheduled : 0;
+	result.messages = s_traceHandler.calls;
+	result.nsPerCall = s_traceHandler.calls ? (double)ns / (double)s_traceHandler.calls : 0.0;
+	result.errors = (scheduled <= 0) + (s_traceHandler.hash != expectedHash) + (s_traceHandler.calls != expectedCalls)
+			+ su.stats.rxLostBytes;
+
+	BufferedUart_DeInit(&bu);
+	SimUart_DeInit(&su);
+	return result;
+}
+
+static void printTraceHeader(const char *title)
+{
+	if (s_csv) {
+		printf("benchmark,baud,ring,speedup,records,handler_calls,errors,ns_per_call\n");
+	} else {
+		printf("\n%s\n", title);
+		printf("%-13s %8s %6s %8s %9s %9s %7s %12s\n", "", "baud", "ring", "speedup", "records", "calls", "errors", "ns/call");
+	}
+}
+
+static void printTraceResult(const char *name, const struct Result *r)
+{
+	if (s_csv) {
+		printf("%s,%u,%u,%u,%llu,%llu,%llu,%.1f\n", name, (unsigned int)r->baud, r->ringSize, r->messageSize,
+				(unsigned long long)r->calls, (unsigned long long)r->messages, (unsigned long long)r->errors, r->nsPerCall);
+	} else {
+		printf("%-13s %8u %6u %8u %9llu %9llu %7llu %12.1f\n", name, (unsigned int)r->baud, r->ringSize, r->messageSize,
+				(unsigned long long)r->calls, (unsigned long long)r->messages, (unsigned long long)r->errors, r->nsPerCall);
+	}
+}
+#endif
+
+/// application side of the blocking read and write benchmarks
+struct BlockingBench {
+	struct SimUart su;
+	struct BufferedUart bu;
+	unsigned int messageSize;
+	uint64_t messages;
+	uint64_t periodNs;				///< time between the starts of two received messages on the wire
+	bool started;
+	bool done;
+	struct PatternChecker checker;
+	struct CallCost cost;
+	uint64_t calls;
+	uint64_t emptyCalls;
+	uint64_t latencyNs;
+	uint64_t maxLatencyNs;
+};
+
+/// check received bytes and take the delivery latency of every message end among them
+static void blockingReceived(struct BlockingBench *b, const uint8_t *data, unsigned int length)
+{
+	b->calls++;
+	b->emptyCalls += length == 0;
+	uint64_t before = b->checker.bytes;
+	checkPattern(&b->checker, data, length);
+	for (uint64_t end = (before / b->messageSize + 1) * b->messageSize; end <= b->checker.bytes; end += b->messageSize) {
+		// the last stop bit of the message left the wire at arrival
+		uint64_t arrival = (end / b->messageSize - 1) * b->periodNs + b->messageSize * SimUart_ByteTimeNs(&b->su);
+		uint64_t latency = Sim_Now() - arrival;
+		b->latencyNs += latency;
+		b->maxLatencyNs = latency > b->maxLatencyNs ? latency : b->maxLatencyNs;
+	}
+}
+
+static void blockingInit(struct BlockingBench *b, enum BufferedUartMode mode, uint32_t baud, unsigned int ringSize, unsigned int messageSize, uint64_t windowBytes)
+{
+	memset(b, 0, sizeof(*b));
+	setupUart(&b->su, &b->bu, baud, mode == BUFFERED_UART_RX ? 0 : ringSize, mode == BUFFERED_UART_TX ? 0 : ringSize);
+	SimUart_SetTxSink(&b->su, txSink, &b->checker);
+	if (mode == BUFFERED_UART_RX) {
+		checkSetup(BufferedUart_StartReception(&b->bu), "BufferedUart_StartReception");
+	}
+	b->messageSize = messageSize;
+	b->messages = windowBytes / messageSize;
+	b->periodNs = (messageSize + 2) * SimUart_ByteTimeNs(&b->su);
+}
+
+static struct Result blockingResult(struct BlockingBench *b, uint32_t baud, unsigned int ringSize)
+{
+	struct Result result = { .baud = baud, .ringSize = ringSize, .messageSize = b->messageSize };
+	uint64_t messages = b->checker.bytes / b->messageSize;
+	result.messages = messages;
+	result.calls = b->calls;
+	result.emptyCalls = b->emptyCalls;
+	result.interrupts = b->su.stats.interrupts;
+	result.nsPerCall = messages ? (double)b->latencyNs / (double)messages : 0.0;
+	result.nsPerReceive = (double)b->maxLatencyNs;
+	result.errors = b->checker.errors + b->su.stats.rxLostBytes + b->bu.rxDroppedBytes + (b->messages - messages) * b->messageSize;
+
+	BufferedUart_DeInit(&b->bu);
+	SimUart_DeInit(&b->su);
+	return result;
+}
+
+/**
+ * messages separated by two idle frames like benchReceive, the application polls pollsPerMessage times
+ * per message with BufferedUart_RxPoll and BufferedUart_Dequeue. Polls cost wake ups without data, or delay the messages
+ */
+static struct Result benchReceivePolled(uint32_t baud, unsigned int ringSize, unsigned int messageSize, unsigned int pollsPerMessage, uint64_t windowBytes)
+{
+	static struct BlockingBench b;
+	uint8_t message[BENCH_MAX_RING_SIZE];
+	uint8_t counter = 0;
+	blockingInit(&b, BUFFERED_UART_RX, baud, ringSize, messageSize, windowBytes);
+	uint64_t pollNs = b.periodNs / pollsPerMessage;
+
+	uint64_t fed = 0;
+	uint64_t nextPoll = pollNs;
+	uint64_t end = (b.messages + 2) * b.periodNs;
+	while (b.checker.bytes < b.messages * messageSize && Sim_Now() < end) {
+		if (fed < b.messages && Sim_Now() >= fed * b.periodNs) {
+			fillPattern(&counter, message, messageSize);
+			SimUart_Feed(&b.su, message, messageSize);
+			fed++;
+		}
+		if (Sim_Now() >= nextPoll) {
+			BufferedUart_RxPoll(&b.bu);
+			unsigned int length = BufferedUart_Dequeue(&b.bu, message, messageSize);
+			blockingReceived(&b, message, length);
+			nextPoll += pollNs;
+		}
+		uint64_t next = fed < b.messages && fed * b.periodNs < nextPoll ? fed * b.periodNs : nextPoll;
+		Sim_Advance(next - Sim_Now());
+	}
+
+	return blockingResult(&b, baud, ringSize);
+}
+
+#ifdef BUFFERED_UART_OS_PTHREAD
+#define BENCH_BLOCKING_TIMEOUT_MS 1000
+
+static void *blockingReader(void *context)
+{
+	struct BlockingBench *b = context;
+	uint8_t message[BENCH_MAX_RING_SIZE];
+	BufferedUartOs_ThreadEnter();
+	b->started = true;
+	while (b->checker.bytes < b->messages * b->messageSize) {
+		// a lost message would block forever in virtual time, the real time timeout ends the run
+		unsigned int length = BufferedUart_Read(&b->bu, message, b->messageSize, b->messageSize, BENCH_BLOCKING_TIMEOUT_MS);
+		blockingReceived(b, message, length);
+		if (length < b->messageSize) {
+			break;
+		}
+	}
+	b->done = true;
+	BufferedUartOs_ThreadExit();
+	return NULL;
+}
+
+static void *blockingWriter(void *context)
+{
+	struct BlockingBench *b = context;
+	uint8_t message[BENCH_MAX_RING_SIZE];
+	uint8_t counter = 0;
+	BufferedUartOs_ThreadEnter();
+	b->started = true;
+	for (uint64_t i = 0; i < b->messages; i++) {
+		fillPattern(&counter, message, b->messageSize);
+		uint64_t start = hostNs();
+		HAL_StatusTypeDef status = BufferedUart_Write(&b->bu, message, b->messageSize, BENCH_BLOCKING_TIMEOUT_MS);
+		addCost(&b->cost, start);
+		if (status != HAL_OK) {
+			break;
+		}
+	}
+	// sleep until the last message left the wire
+	if (BufferedUart_WaitTxSent(&b->bu, BufferedUart_GetTxSequence(&b->bu), BENCH_BLOCKING_TIMEOUT_MS) != HAL_OK
+			|| b->checker.bytes != b->messages * b->messageSize) {
+		b->checker.errors++;
+	}
+	b->done = true;
+	BufferedUartOs_ThreadExit();
+	return NULL;
+}
+
+/**
+ * an application thread blocks in BufferedUart_Read (messages separated by two idle frames like
+ * benchReceive) or BufferedUart_Write (saturated), while this thread runs the simulation as its
+ * interrupts. Latency and throughput are in virtual time, the thread switches do not count there
+ */
+static struct Result benchBlocking(enum BufferedUartMode mode, uint32_t baud, unsigned int ringSize, unsigned int messageSize, uint64_t windowBytes)
+{
+	static struct BlockingBench b;
+	uint8_t message[BENCH_MAX_RING_SIZE];
+	uint8_t counter = 0;
+	pthread_t thread;
+	blockingInit(&b, mode, baud, ringSize, messageSize, windowBytes);
+	if (pthread_create(&thread, NULL, mode == BUFFERED_UART_RX ? blockingReader : blockingWriter, &b) != 0) {
+		fprintf(stderr, "pthread_create failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	uint64_t fed = mode == BUFFERED_UART_RX ? 0 : b.messages;
+	for (;;) {
+		BufferedUartOs_InterruptEnter();
+		if (b.done) {
+			BufferedUartOs_InterruptExit();
+			break;
+		}
+		if (b.started) {
+			if (fed < b.messages && Sim_Now() >= fed * b.periodNs) {
+				fillPattern(&counter, message, messageSize);
+				SimUart_Feed(&b.su, message, messageSize);
+				fed++;
+			}
+			if (fed < b.messages && Sim_NextEventTime() > fed * b.periodNs) {
+				Sim_Advance(fed * b.periodNs - Sim_Now());
+			} else {
+				Sim_RunNextEvent();
+			}
+		}
+		BufferedUartOs_InterruptExit();
+	}
+	pthread_join(thread, NULL);
+
+	// the application thread is gone, send what is left
+	while (Sim_RunNextEvent()) {
+	}
+	struct Result result;
+	if (mode == BUFFERED_UART_RX) {
+		result = blockingResult(&b, baud, ringSize);
+	} else {
+		double throughput = (double)b.checker.bytes * 1e9 / (double)b.su.lineFreeNs;
+		double utilisation = throughput / wireCapacity(&b.su);
+		double nsPerCall = costPerCall(&b.cost);
+		uint64_t dmaTransfers = b.su.stats.txTransfers;
+		uint64_t rejected = 0;
+#ifdef BUFFERED_UART_STATISTICS
+		// every HAL_BUSY inside BufferedUart_Write was followed by a wait or one more check
+		struct BufferedUartStatistics statistics;
+		BufferedUart_GetStatistics(&b.bu, &statistics);
+		rejected = statistics.txRejected;
+#endif
+		result = blockingResult(&b, baud, ringSize);
+		result.throughput = throughput;
+		result.utilisation = utilisation;
+		result.dmaTransfers = dmaTransfers;
+		result.rejected = rejected;
+		result.nsPerCall = nsPerCall;
+	}
+	return result;
+}
+#endif
+
+static void printBlockingHeader(const char *title)
+{
+	if (s_csv) {
+		printf("benchmark,baud,ring,message,messages,calls,empty_calls,interrupts,errors,avg_latency_us,max_latency_us\n");
+	} else {
+		printf("\n%s\n", title);
+		printf("%-13s %8s %6s %6s %9s %9s %9s %9s %7s %12s %12s\n", "benchmark", "baud", "ring", "msg", "messages", "calls", "empty",
+				"irqs", "errors", "avg us", "max us");
+	}
+}
+
+static void printBlockingResult(const char *name, const struct Result *r)
+{
+	if (s_csv) {
+		printf("%s,%u,%u,%u,%llu,%llu,%llu,%llu,%llu,%.2f,%.2f\n", name, (unsigned int)r->baud, r->ringSize, r->messageSize,
+				(unsigned long long)r->messages, (unsigned long long)r->calls, (unsigned long long)r->emptyCalls,
+				(unsigned long long)r->interrupts, (unsigned long long)r->errors, r->nsPerCall / 1000.0, r->nsPerReceive / 1000.0);
+	} else {
+		printf("%-13s %8u %6u %6u %9llu %9llu %9llu %9llu %7llu %12.2f %12.2f\n", name, (unsigned int)r->baud, r->ringSize, r->messageSize,
+				(unsigned long long)r->messages, (unsigned long long)r->calls, (unsigned long long)r->emptyCalls,
+				(unsigned long long)r->interrupts, (unsigned long long)r->errors, r->nsPerCall / 1000.0, r->nsPerReceive / 1000.0);
+	}
+}
+
+#if MAX_NUMBER_BUFFERED_UARTS > 1
+#define BENCH_MULTI_MESSAGE 16
+#define BENCH_MULTI_RING 256
+
+enum MultiPollMethod {
+	MULTI_POLL_EACH,	///< BufferedUart_Dequeue on every buffered uart
+	MULTI_POLL_ALL		///< BufferedUart_PollAll, then BufferedUart_Dequeue on the ready ones
+};
+
+static struct SimUart s_multiSim[MAX_NUMBER_BUFFERED_UARTS];
+static struct BufferedUart s_multiUarts[MAX_NUMBER_BUFFERED_UARTS];
+static char s_multiRx[MAX_NUMBER_BUFFERED_UARTS][BENCH_MULTI_RING] __attribute__((aligned(BUFFERED_UART_BUFFER_ALIGNMENT)));
+
+/**
+ * numberUarts buffered uarts receive messages with IDLE gaps, shifted against each other, so the
+ * reception events of the uarts interleave. After every interrupt the main loop looks for data.
+ * The main loop cost is per iteration, the callback cost per rx event (BUFFERED_UART_STATISTICS)
+ */
+static struct Result benchMultiUart(enum MultiPollMethod method, unsigned int numberUarts, uint32_t baud, uint64_t windowBytes)
+{
+	struct Result result = { .baud = baud, .ringSize = BENCH_MULTI_RING, .messageSize = numberUarts };
+	struct PatternChecker checkers[MAX_NUMBER_BUFFERED_UARTS] = { 0 };
+	uint8_t counters[MAX_NUMBER_BUFFERED_UARTS] = { 0 };
+	uint64_t nextMessage[MAX_NUMBER_BUFFERED_UARTS];
+	uint8_t buffer[BENCH_MULTI_RING];
+	struct CallCost cost = { 0 };
+
+	Sim_Reset();
+	for (unsigned int i = 0; i < numberUarts; i++) {
+		SimUart_Init(&s_multiSim[i], baud);
+		memset(&s_multiUarts[i], 0, sizeof(s_multiUarts[i]));
+		checkSetup(BufferedUart_Init(&s_multiUarts[i], &s_multiSim[i].huart, BUFFERED_UART_RX, NULL, 0, s_multiRx[i], BENCH_MULTI_RING), "BufferedUart_Init");
+		checkSetup(BufferedUart_StartReception(&s_multiUarts[i]), "BufferedUart_StartReception");
+	}
+
+	uint64_t period = (BENCH_MULTI_MESSAGE + 2) * SimUart_ByteTimeNs(&s_multiSim[0]);
+	for (unsigned int i = 0; i < numberUarts; i++) {
+		nextMessage[i] = i * period / numberUarts;
+	}
+	uint64_t window = windowBytes * SimUart_ByteTimeNs(&s_multiSim[0]);
+	uint64_t fed = 0;
+	bool feeding = true;
+	while (feeding || Sim_NextEventTime() != UINT64_MAX) {
+		uint64_t nextFeed = UINT64_MAX;
+		for (unsigned int i = 0; feeding && i < numberUarts; i++) {
+			if (Sim_Now() >= nextMessage[i]) {
+				uint8_t message[BENCH_MULTI_MESSAGE];
+				fillPattern(&counters[i], message, sizeof(message));
+				SimUart_Feed(&s_multiSim[i], message, sizeof(message));
+				nextMessage[i] += period;
+				fed += sizeof(message);
+			}
+			nextFeed = nextMessage[i] < nextFeed ? nextMessage[i] : nextFeed;
+		}
+		feeding = Sim_Now() < window;
+		if (feeding && Sim_NextEventTime() > nextFeed) {
+			Sim_Advance(nextFeed - Sim_Now());
+			continue;
+		}
+		Sim_RunNextEvent();
+
+		uint64_t start = hostNs();
+		if (method == MULTI_POLL_ALL) {
+			struct BufferedUartReadiness ready;
+			BufferedUart_PollAll(&ready);
+			for (uint32_t pending = ready.rx; pending != 0; pending &= pending - 1) {
+				struct BufferedUart *bu = BufferedUart_GetByIndex(__builtin_ctz(pending));
+				unsigned int length = BufferedUart_Dequeue(bu, buffer, sizeof(buffer));
+				checkPattern(&checkers[bu - s_multiUarts], buffer, length);
+			}
+		} else {
+			for (unsigned int i = 0; i < numberUarts; i++) {
+				unsigned int length = BufferedUart_Dequeue(&s_multiUarts[i], buffer, sizeof(buffer));
+				checkPattern(&checkers[i], buffer, length);
+			}
+		}
+		addCost(&cost, start);
+	}
+
+	uint64_t received = 0;
+	uint64_t rxEventCalls = 0;
+	uint64_t rxEventNs = 0;
+	for (unsigned int i = 0; i < numberUarts; i++) {
+		received += checkers[i].bytes;
+		result.errors += checkers[i].errors + s_multiSim[i].stats.rxLostBytes + s_multiUarts[i].rxDroppedBytes;
+		result.interrupts += s_multiSim[i].stats.interrupts;
+#ifdef BUFFERED_UART_STATISTICS
+		struct BufferedUartStatistics statistics;
+		BufferedUart_GetStatistics(&s_multiUarts[i], &statistics);
+		rxEventCalls += statistics.rxEventCalls;
+		rxEventNs += statistics.rxEventCycles;
+#endif
+		BufferedUart_DeInit(&s_multiUarts[i]);
+		SimUart_DeInit(&s_multiSim[i]);
+	}
+	result.errors += fed - received;
+	result.messages = received / BENCH_MULTI_MESSAGE;
+	result.calls = cost.calls;
+	result.nsPerCall = costPerCall(&cost);
+	result.nsPerReceive = rxEventCalls ? (double)rxEventNs / (double)rxEventCalls : 0.0;
+	return result;
+}
+
+static void printMultiHeader(const char *title)
+{
+	if (s_csv) {
+		printf("benchmark,baud,ring,uarts,messages,loops,interrupts,errors,ns_per_loop,ns_per_rx_event\n");
+	} else {
+		printf("\n%s\n", title);
+		printf("%-10s %8s %6s %6s %9s %9s %9s %7s %12s %12s\n", "method", "baud", "ring", "uarts", "messages", "loops", "irqs",
+				"errors", "ns/loop", "ns/rx event");
+	}
+}
+
+static void printMultiResult(const char *name, const struct Result *r)
+{
+	if (s_csv) {
+		printf("%s,%u,%u,%u,%llu,%llu,%llu,%llu,%.1f,%.1f\n", name, (unsigned int)r->baud, r->ringSize, r->messageSize,
+				(unsigned long long)r->messages, (unsigned long long)r->calls, (unsigned long long)r->interrupts,
+				(unsigned long long)r->errors, r->nsPerCall, r->nsPerReceive);
+	} else {
+		printf("%-10s %8u %6u %6u %9llu %9llu %9llu %7llu %12.1f %12.1f\n", name, (unsigned int)r->baud, r->ringSize, r->messageSize,
+				(unsigned long long)r->messages, (unsigned long long)r->calls, (unsigned long long)r->interrupts,
+				(unsigned long long)r->errors, r->nsPerCall, r->nsPerReceive);
+	}
+}
+#endif
+
+static void loopbackSink(void *context, const uint8_t *data, uint32_t length)
+{
+	SimUart_Feed(context, data, length);
+}
+
+static unsigned int receiveFrames(struct BufferedUartFrameDecoder *decoder, struct PatternChecker *checker, bool rescan, unsigned int payloadSize)
+{
+	const char *frame;
+	unsigned int length;
+	unsigned int frames = 0;
+	if (rescan) {
+		decoder->scanned = 0;
+	}
+	while ((length = BufferedUartFrame_Receive(decoder, &frame)) > 0) {
+		if (length != payloadSize) {
+			checker->errors++;
+		}
+		checkPattern(checker, (const uint8_t *)frame, length);
+		frames++;
+	}
+	return frames;
+}
+
+/**
+ * frames in a loop back: BufferedUartFrame_Transmit as fast as possible, the tx line is connected
+ * to the rx line of the same uart, the application calls BufferedUartFrame_Receive after every
+ * interrupt. With rescan, the saved scan state is dropped before every call, like a parser which
+ * searches all unread bytes again every time
+ * the per call costs are per frame, nsPerCall for encoding, nsPerReceive for decoding (all polls)
+ */
+static struct Result benchFrameLoopback(enum BufferedUartFrameEncoding encoding, bool rescan, uint32_t baud, unsigned int ringSize, unsigned int payloadSize, uint64_t windowBytes)
+{
+	struct Result result = { .baud = baud, .ringSize = ringSize, .messageSize = payloadSize };
+	struct SimUart su;
+	struct BufferedUart bu;
+	struct BufferedUartFrameDecoder decoder;
+	struct PatternChecker checker = { 0 };
+	struct CallCost txCost = { 0 };
+	struct CallCost rxCost = { 0 };
+	static char frameBuffer[BENCH_MAX_RING_SIZE];
+	uint8_t payload[BENCH_MAX_RING_SIZE];
+	uint8_t counter = 0;
+
+	setupUart(&su, &bu, baud, ringSize, ringSize);
+	SimUart_SetTxSink(&su, loopbackSink, &su);
+	checkSetup(BufferedUart_StartReception(&bu), "BufferedUart_StartReception");
+	checkSetup(BufferedUartFrame_InitDecoder(&decoder, &bu, encoding, frameBuffer, sizeof(frameBuffer)), "BufferedUartFrame_InitDecoder");
+
+	uint64_t window = windowBytes * SimUart_ByteTimeNs(&su);
+	bool encoded = false;
+	uint64_t sent = 0;
+	while (Sim_Now() < window) {
+		if (!encoded) {
+			fillPattern(&counter, payload, payloadSize);
+			encoded = true;
+		}
+		uint64_t start = hostNs();
+		if (BufferedUartFrame_Transmit(&bu, encoding, payload, payloadSize) == HAL_OK) {
+			addCost(&txCost, start);
+			encoded = false;
+			sent++;
+			continue;
+		}
+		result.rejected++;
+
+		if (!Sim_RunNextEvent()) {
+			break;
+		}
+
+		start = hostNs();
+		result.messages += receiveFrames(&decoder, &checker, rescan, payloadSize);
+		rxCost.ns += hostNs() - start;
+	}
+	// the application keeps polling while the queued frames go out
+	while (Sim_RunNextEvent()) {
+		result.messages += receiveFrames(&decoder, &checker, rescan, payloadSize);
+	}
+
+	result.throughput = (double)checker.bytes * 1e9 / (double)su.lineFreeNs;
+	result.utilisation = result.throughput / wireCapacity(&su);
+	result.dmaTransfers = su.stats.txTransfers;
+	result.interrupts = su.stats.interrupts;
+	result.dropped = bu.rxDroppedBytes;
+	result.errors = checker.errors + decoder.invalidFrames + decoder.discardedFrames + (sent - result.messages) + bu.rxDroppedBytes;
+	result.nsPerCall = costPerCall(&txCost);
+	result.nsPerReceive = result.messages ? (double)rxCost.ns / (double)result.messages : 0.0;
+
+	BufferedUart_DeInit(&bu);
+	SimUart_DeInit(&su);
+	return result;
+}
+
+static void printFrameHeader(const char *title)
+{
+	if (s_csv) {
+		printf("benchmark,baud,ring,payload,frames,throughput_Bps,utilisation,errors,tx_ns_per_frame,rx_ns_per_frame\n");
+	} else {
+		printf("\n%s\n", title);
+		printf("%8s %6s %7s %9s %12s %7s %7s %12s %12s\n", "baud", "ring", "payload", "frames", "payload B/s", "util%",
+				"errors", "tx ns/frame", "rx ns/frame");
+	}
+}
+
+static void printFrameResult(const char *name, const struct Result *r)
+{
+	if (s_csv) {
+		printf("%s,%u,%u,%u,%llu,%.0f,%.4f,%llu,%.1f,%.1f\n", name, (unsigned int)r->baud, r->ringSize, r->messageSize,
+				(unsigned long long)r->messages, r->throughput, r->utilisation, (unsigned long long)r->errors,
+				r->nsPerCall, r->nsPerReceive);
+	} else {
+		printf("%8u %6u %7u %9llu %12.0f %7.2f %7llu %12.1f %12.1f\n", (unsigned int)r->baud, r->ringSize, r->messageSize,
+				(unsigned long long)r->messages, r->throughput, 100.0 * r->utilisation, (unsigned long long)r->errors,
+				r->nsPerCall, r->nsPerReceive);
+	}
+}
+
+static void printOverrunHeader(const char *title)
+{
+	if (s_csv) {
+		printf("benchmark,baud,ring,poll_bytes,throughput_Bps,utilisation,interrupts,dropped,overruns,errors\n");
+	} else {
+		printf("\n%s\n", title);
+		printf("%8s %6s %6s %12s %7s %9s %9s %9s %7s\n", "baud", "ring", "poll", "payload B/s", "util%",
+				"irqs", "dropped", "overruns", "errors");
+	}
+}
+
+static void printOverrunResult(const char *name, const struct Result *r)
+{
+	if (s_csv) {
+		printf("%s,%u,%u,%u,%.0f,%.4f,%llu,%llu,%llu,%llu\n", name, (unsigned int)r->baud, r->ringSize, r->messageSize,
+				r->throughput, r->utilisation, (unsigned long long)r->interrupts, (unsigned long long)r->dropped,
+				(unsigned long long)r->overruns, (unsigned long long)r->errors);
+	} else {
+		printf("%8u %6u %6u %12.0f %7.2f %9llu %9llu %9llu %7llu\n", (unsigned int)r->baud, r->ringSize, r->messageSize,
+				r->throughput, 100.0 * r->utilisation, (unsigned long long)r->interrupts, (unsigned long long)r->dropped,
+				(unsigned long long)r->overruns, (unsigned long long)r->errors);
+	}
+}
+
+static void printLineHeader(const char *title)
+{
+	if (s_csv) {
+		printf("benchmark,baud,ring,line,lines,polls,empty_polls,interrupts,errors,ns_per_poll\n");
+	} else {
+		printf("\n%s\n", title);
+		printf("%-13s %8s %6s %6s %9s %9s %9s %9s %7s %12s\n", "benchmark", "baud", "ring", "line", "lines", "polls", "empty",
+				"irqs", "errors", "ns/poll");
+	}
+}
+
+static void printLineResult(const char *name, const struct Result *r)
+{
+	if (s_csv) {
+		printf("%s,%u,%u,%u,%llu,%llu,%llu,%llu,%llu,%.1f\n", name, (unsigned int)r->baud, r->ringSize, r->messageSize,
+				(unsigned long long)r->messages, (unsigned long long)r->calls, (unsigned long long)r->emptyCalls,
+				(unsigned long long)r->interrupts, (unsigned long long)r->errors, r->nsPerCall);
+	} else {
+		printf("%-13s %8u %6u %6u %9llu %9llu %9llu %9llu %7llu %12.1f\n", name, (unsigned int)r->baud, r->ringSize, r->messageSize,
+				(unsigned long long)r->messages, (unsigned long long)r->calls, (unsigned long long)r->emptyCalls,
+				(unsigned long long)r->interrupts, (unsigned long long)r->errors, r->nsPerCall);
+	}
+}
+
+static void printFlowHeader(const char *title)
+{
+	if (s_csv) {
+		printf("benchmark,baud,ring,high_watermark,throughput_Bps,utilisation,stops,interrupts,dropped,errors\n");
+	} else {
+		printf("\n%s\n", title);
+		printf("%-10s %8s %6s %6s %12s %7s %9s %9s %9s %7s\n", "flow", "baud", "ring", "high", "payload B/s", "util%",
+				"stops", "irqs", "dropped", "errors");
+	}
+}
+
+static void printFlowResult(const char *name, const struct Result *r)
+{
+	if (s_csv) {
+		printf("%s,%u,%u,%u,%.0f,%.4f,%llu,%llu,%llu,%llu\n", name, (unsigned int)r->baud, r->ringSize, r->messageSize,
+				r->throughput, r->utilisation, (unsigned long long)r->messages, (unsigned long long)r->interrupts,
+				(unsigned long long)r->dropped, (unsigned long long)r->errors);
+	} else {
+		printf("%-10s %8u %6u %6u %12.0f %7.2f %9llu %9llu %9llu %7llu\n", name, (unsigned int)r->baud, r->ringSize, r->messageSize,
+				r->throughput, 100.0 * r->utilisation, (unsigned long long)r->messages, (unsigned long long)r->interrupts,
+				(unsigned long long)r->dropped, (unsigned long long)r->errors);
+	}
+}
+
+static void printXonRaceHeader(const char *title)
+{
+	if (s_csv) {
+		printf("benchmark,baud,message,requests,flow_characters,dma_transfers,interrupts,errors\n");
+	} else {
+		printf("\n%s\n", title);
+		printf("%-10s %8s %6s %9s %9s %9s %9s %7s\n", "benchmark", "baud", "msg", "requests", "xon/xoff", "dma", "irqs", "errors");
+	}
+}
+
+static void printXonRaceResult(const char *name, const struct Result *r)
+{
+	if (s_csv) {
+		printf("%s,%u,%u,%llu,%llu,%llu,%llu,%llu\n", name, (unsigned int)r->baud, r->messageSize, (unsigned long long)r->messages,
+				(unsigned long long)r->calls, (unsigned long long)r->dmaTransfers, (unsigned long long)r->interrupts,
+				(unsigned long long)r->errors);
+	} else {
+		printf("%-10s %8u %6u %9llu %9llu %9llu %9llu %7llu\n", name, (unsigned int)r->baud, r->messageSize, (unsigned long long)r->messages,
+				(unsigned long long)r->calls, (unsigned long long)r->dmaTransfers, (unsigned long long)r->interrupts,
+				(unsigned long long)r->errors);
+	}
+}
+
+static void printXoffHeader(const char *title)
+{
+	if (s_csv) {
+		printf("benchmark,baud,chunk,pauses,throughput_Bps,utilisation,dma_transfers,interrupts,max_bytes_after_xoff,errors\n");
+	} else {
+		printf("\n%s\n", title);
+		printf("%-10s %8s %6s %6s %12s %7s %9s %9s %11s %7s\n", "benchmark", "baud", "chunk", "pauses", "payload B/s", "util%",
+				"dma", "irqs", "after xoff", "errors");
+	}
+}
+
+static void printXoffResult(const char *name, const struct Result *r)
+{
+	if (s_csv) {
+		printf("%s,%u,%u,%llu,%.0f,%.4f,%llu,%llu,%llu,%llu\n", name, (unsigned int)r->baud, r->messageSize,
+				(unsigned long long)r->messages, r->throughput, r->utilisation, (unsigned long long)r->dmaTransfers,
+				(unsigned long long)r->interrupts, (unsigned long long)r->maxGapNs, (unsigned long long)r->errors);
+	} else {
+		printf("%-10s %8u %6u %6llu %12.0f %7.2f %9llu %9llu %11llu %7llu\n", name, (unsigned int)r->baud, r->messageSize,
+				(unsigned long long)r->messages, r->throughput, 100.0 * r->utilisation, (unsigned long long)r->dmaTransfers,
+				(unsigned long long)r->interrupts, (unsigned long long)r->maxGapNs, (unsigned long long)r->errors);
+	}
+}
+
+static void printUrgentHeader(const char *title)
+{
+	if (s_csv) {
+		printf("benchmark,baud,ring,chunk,urgent_messages,dma_transfers,interrupts,bulk_utilisation,errors,avg_latency_us,max_latency_us\n");
+	} else {
+		printf("\n%s\n", title);
+		printf("%8s %6s %6s %9s %9s %9s %7s %7s %12s %12s\n", "baud", "ring", "chunk", "urgent", "dma", "irqs", "util%", "errors",
+				"avg us", "max us");
+	}
+}
+
+static void printUrgentResult(const char *name, const struct Result *r)
+{
+	if (s_csv) {
+		printf("%s,%u,%u,%u,%llu,%llu,%llu,%.4f,%llu,%.2f,%.2f\n", name, (unsigned int)r->baud, r->ringSize, r->messageSize,
+				(unsigned long long)r->messages, (unsigned long long)r->dmaTransfers, (unsigned long long)r->interrupts,
+				r->utilisation, (unsigned long long)r->errors, r->nsPerCall / 1000.0, r->nsPerReceive / 1000.0);
+	} else {
+		printf("%8u %6u %6u %9llu %9llu %9llu %7.2f %7llu %12.2f %12.2f\n", (unsigned int)r->baud, r->ringSize, r->messageSize,
+				(unsigned long long)r->messages, (unsigned long long)r->dmaTransfers, (unsigned long long)r->interrupts,
+				100.0 * r->utilisation, (unsigned long long)r->errors, r->nsPerCall / 1000.0, r->nsPerReceive / 1000.0);
+	}
+}
+
+static void printTxSentHeader(const char *title)
+{
+	if (s_csv) {
+		printf("benchmark,baud,ring,message,requests,requests_per_s,dma_transfers,interrupts,errors,avg_turnaround_us,max_turnaround_us\n");
+	} else {
+		printf("\n%s\n", title);
+		printf("%-15s %8s %6s %6s %9s %9s %9s %9s %7s %12s %12s\n", "benchmark", "baud", "ring", "msg", "requests", "req/s", "dma", "irqs",
+				"errors", "avg turn us", "max turn us");
+	}
+}
+
+static void printTxSentResult(const char *name, const struct Result *r)
+{
+	if (s_csv) {
+		printf("%s,%u,%u,%u,%llu,%.0f,%llu,%llu,%llu,%.2f,%.2f\n", name, (unsigned int)r->baud, r->ringSize, r->messageSize,
+				(unsigned long long)r->messages, r->throughput, (unsigned long long)r->dmaTransfers, (unsigned long long)r->interrupts,
+				(unsigned long long)r->errors, r->nsPerCall / 1000.0, r->nsPerReceive / 1000.0);
+	} else {
+		printf("%-15s %8u %6u %6u %9llu %9.0f %9llu %9llu %7llu %12.2f %12.2f\n", name, (unsigned int)r->baud, r->ringSize, r->messageSize,
+				(unsigned long long)r->messages, r->throughput, (unsigned long long)r->dmaTransfers, (unsigned long long)r->interrupts,
+				(unsigned long long)r->errors, r->nsPerCall / 1000.0, r->nsPerReceive / 1000.0);
+	}
+}
+
+static void printPacedHeader(const char *title)
+{
+	if (s_csv) {
+		printf("benchmark,baud,ring,message,messages,dma_transfers,interrupts,split_messages,errors\n");
+	} else {
+		printf("\n%s\n", title);
+		printf("%8s %6s %6s %9s %9s %9s %9s %7s\n", "baud", "ring", "msg", "messages", "dma", "irqs", "split", "errors");
+	}
+}
+
+static void printPacedResult(const char *name, const struct Result *r)
+{
+	if (s_csv) {
+		printf("%s,%u,%u,%u,%llu,%llu,%llu,%llu,%llu\n", name, (unsigned int)r->baud, r->ringSize, r->messageSize,
+				(unsigned long long)r->messages, (unsigned long long)r->dmaTransfers, (unsigned long long)r->interrupts,
+				(unsigned long long)r->splitMessages, (unsigned long long)r->errors);
+	} else {
+		printf("%8u %6u %6u %9llu %9llu %9llu %9llu %7llu\n", (unsigned int)r->baud, r->ringSize, r->messageSize,
+				(unsigned long long)r->messages, (unsigned long long)r->dmaTransfers, (unsigned long long)r->interrupts,
+				(unsigned long long)r->splitMessages, (unsigned long long)r->errors);
+	}
+}
+
+static void printGapHeader(const char *title)
+{
+	if (s_csv) {
+		printf("benchmark,baud,ring,message,utilisation,dma_transfers,interrupts,errors,avg_gap_ns,max_gap_ns\n");
+	} else {
+		printf("\n%s\n", title);
+		printf("%8s %6s %6s %7s %9s %9s %7s %12s %12s\n", "baud", "ring", "msg", "util%", "dma", "irqs", "errors",
+				"avg gap ns", "max gap ns");
+	}
+}
+
+static void printGapResult(const char *name, const struct Result *r)
+{
+	if (s_csv) {
+		printf("%s,%u,%u,%u,%.4f,%llu,%llu,%llu,%.1f,%llu\n", name, (unsigned int)r->baud, r->ringSize, r->messageSize,
+				r->utilisation, (unsigned long long)r->dmaTransfers, (unsigned long long)r->interrupts,
+				(unsigned long long)r->errors, r->gapNs, (unsigned long long)r->maxGapNs);
+	} else {
+		printf("%8u %6u %6u %7.2f %9llu %9llu %7llu %12.1f %12llu\n", (unsigned int)r->baud, r->ringSize, r->messageSize,
+				100.0 * r->utilisation, (unsigned long long)r->dmaTransfers, (unsigned long long)r->interrupts,
+				(unsigned long long)r->errors, r->gapNs, (unsigned long long)r->maxGapNs);
+	}
+}
+
+#ifdef BUFFERED_UART_LATENCY
+static void printQueueLatencyHeader(const char *title)
+{
+	if (s_csv) {
+		printf("benchmark,baud,ring,message,histogram,samples,p50_us,p99_us,max_us,unsampled\n");
+	} else {
+		printf("\n%s\n", title);
+		printf("%-13s %8s %6s %6s %10s %9s %10s %10s %10s %9s\n", "benchmark", "baud", "ring", "msg", "histogram", "samples", "p50 us", "p99 us", "max us", "unsampled");
+	}
+}
+
+/// the simulator counts latency ticks in nanoseconds
+static void printQueueLatencyResult(const char *name, const struct Result *r, const char *histogramName, const struct BufferedUartHistogram *h, uint32_t unsampled)
+{
+	double p50 = BufferedUart_GetPercentile(h, 50) / 1e3;
+	double p99 = BufferedUart_GetPercentile(h, 99) / 1e3;
+	double max = h->max / 1e3;
+	if (s_csv) {
+		printf("%s,%u,%u,%u,%s,%u,%.1f,%.1f,%.1f,%u\n", name, (unsigned int)r->baud, r->ringSize, r->messageSize,
+				histogramName, (unsigned int)h->count, p50, p99, max, (unsigned int)unsampled);
+	} else {
+		printf("%-13s %8u %6u %6u %10s %9u %10.1f %10.1f %10.1f %9u\n", name, (unsigned int)r->baud, r->ringSize, r->messageSize,
+				histogramName, (unsigned int)h->count, p50, p99, max, (unsigned int)unsampled);
+	}
+}
+#endif
+
+static void printHeader(const char *title, const char *callName)
+{
+	if (s_csv) {
+		printf("benchmark,baud,ring,message,throughput_Bps,utilisation,dma_transfers,interrupts,rejected,errors,ns_per_call\n");
+	} else {
+		printf("\n%s\n", title);
+		printf("%8s %6s %6s %12s %7s %9s %9s %9s %7s %12s\n", "baud", "ring", "msg", "payload B/s", "util%",
+				"dma", "irqs", "busy", "errors", callName);
+	}
+}
+
+static void printResult(const char *name, const struct Result *r)
+{
+	if (s_csv) {
+		printf("%s,%u,%u,%u,%.0f,%.4f,%llu,%llu,%llu,%llu,%.1f\n", name, (unsigned int)r->baud, r->ringSize, r->messageSize,
+				r->throughput, r->utilisation, (unsigned long long)r->dmaTransfers, (unsigned long long)r->interrupts,
+				(unsigned long long)r->rejected, (unsigned long long)r->errors, r->nsPerCall);
+	} else {
+		printf("%8u %6u %6u %12.0f %7.2f %9llu %9llu %9llu %7llu %12.1f\n", (unsigned int)r->baud, r->ringSize, r->messageSize,
+				r->throughput, 100.0 * r->utilisation, (unsigned long long)r->dmaTransfers, (unsigned long long)r->interrupts,
+				(unsigned long long)r->rejected, (unsigned long long)r->errors, r->nsPerCall);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	bool quick = false;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--quick") == 0) {
+			quick = true;
+		} else if (strcmp(argv[i], "--csv") == 0) {
+			s_csv = true;
+		} else {
+			fprintf(stderr, "usage: %s [--quick] [--csv]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	static const uint32_t bauds[] = { 115200, 1000000, 3000000 };
+#ifdef BUFFERED_UART_DCACHE
+	// the rx buffer has to be a multiple of the cache line, 992 is not a power of 2 either
+	static const unsigned int rings[] = { 64, 256, 992, 1024, 4096 };
+#else
+	static const unsigned int rings[] = { 64, 256, 1000, 1024, 4096 };
+#endif
+	static const unsigned int messages[] = { 4, 16, 64, 256 };
+	static const uint32_t quickBauds[] = { 1000000 };
+	static const unsigned int quickRings[] = { 64, 1024 };
+	static const unsigned int quickMessages[] = { 4, 64 };
+
+	const uint32_t *baudList = quick ? quickBauds : bauds;
+	size_t numberBauds = quick ? 1 : sizeof(bauds) / sizeof(bauds[0]);
+	const unsigned int *ringList = quick ? quickRings : rings;
+	size_t numberRings = quick ? 2 : sizeof(rings) / sizeof(rings[0]);
+	const unsigned int *messageList = quick ? quickMessages : messages;
+	size_t numberMessages = quick ? 2 : sizeof(messages) / sizeof(messages[0]);
+	uint64_t windowBytes = quick ? 20000 : 200000;
+#ifdef BUFFERED_UART_DCACHE
+	// every benchmark runs against the data cache model, stale rx data shows up as corrupted bytes
+	Sim_SetDCache(true);
+#endif
+
+	calibrateTimer();
+	uint64_t errors = 0;
+
+	static const struct {
+		enum TransmitMethod method;
+		const char *name;
+		const char *title;
+	} transmitBenchmarks[] = {
+		{ TRANSMIT_COPY, "tx", "TX: saturated encode + BufferedUart_Transmit" },
+		{ TRANSMIT_RESERVE, "tx-reserve", "TX: saturated BufferedUart_TxReserve + encode + BufferedUart_TxCommit" },
+	};
+
+	for (size_t t = 0; t < sizeof(transmitBenchmarks) / sizeof(transmitBenchmarks[0]); t++) {
+		printHeader(transmitBenchmarks[t].title, "ns/message");
+		for (size_t b = 0; b < numberBauds; b++) {
+			for (size_t r = 0; r < numberRings; r++) {
+				for (size_t m = 0; m < numberMessages; m++) {
+					if (messageList[m] > ringList[r]) {
+						continue;
+					}
+					struct Result result = benchTransmit(transmitBenchmarks[t].method, baudList[b], ringList[r], messageList[m], 0, windowBytes);
+					printResult(transmitBenchmarks[t].name, &result);
+					errors += result.errors;
+				}
+			}
+		}
+	}
+
+	static const struct {
+		enum FmtMethod method;
+		const char *name;
+		const char *title;
+	} fmtBenchmarks[] = {
+		{ FMT_SNPRINTF, "tx-snprintf", "TX: saturated log lines, snprintf + BufferedUart_Transmit" },
+		{ FMT_PRINTF, "tx-printf", "TX: saturated log lines, BufferedUart_Printf" },
+	};
+
+	for (size_t t = 0; t < sizeof(fmtBenchmarks) / sizeof(fmtBenchmarks[0]); t++) {
+		printHeader(fmtBenchmarks[t].title, "ns/message");
+		for (size_t b = 0; b < numberBauds; b++) {
+			for (size_t r = 0; r < numberRings; r++) {
+				struct Result result = benchTransmitFmt(fmtBenchmarks[t].method, baudList[b], ringList[r], windowBytes);
+				printResult(fmtBenchmarks[t].name, &result);
+				errors += result.errors;
+			}
+		}
+	}
+
+#ifdef BUFFERED_UART_TX_GAPLESS
+	printGapHeader("TX: saturated BufferedUart_Transmit, " BENCH_STRINGIFY(BENCH_DMA_START_LATENCY_NS) " ns from the interrupt to the DMA start, next transfer chained at DMA transfer complete (BUFFERED_UART_TX_GAPLESS)");
+#else
+	printGapHeader("TX: saturated BufferedUart_Transmit, " BENCH_STRINGIFY(BENCH_DMA_START_LATENCY_NS) " ns from the interrupt to the DMA start, next transfer started at USART transfer complete");
+#endif
+	for (size_t b = 0; b < numberBauds; b++) {
+		for (size_t r = 0; r < numberRings; r++) {
+			for (size_t m = 0; m < numberMessages; m++) {
+				if (messageList[m] > ringList[r]) {
+					continue;
+				}
+				struct Result result = benchTransmit(TRANSMIT_COPY, baudList[b], ringList[r], messageList[m], BENCH_DMA_START_LATENCY_NS, windowBytes);
+				printGapResult("tx-gap", &result);
+				errors += result.errors;
+			}
+		}
+	}
+
+	// message sizes which do not divide the ring sizes, so messages end up at the end of the ring
+	static const unsigned int pacedMessages[] = { 5, 24, 100 };
+	static const unsigned int quickPacedMessages[] = { 24 };
+	const unsigned int *pacedList = quick ? quickPacedMessages : pacedMessages;
+	size_t numberPaced = quick ? 1 : sizeof(pacedMessages) / sizeof(pacedMessages[0]);
+
+	printPacedHeader("TX: one message every two message frame times, BufferedUart_Transmit");
+	for (size_t b = 0; b < numberBauds; b++) {
+		for (size_t r = 0; r < numberRings; r++) {
+			for (size_t m = 0; m < numberPaced; m++) {
+				if (2 * pacedList[m] > ringList[r]) {
+					continue;
+				}
+				struct Result result = benchTransmitPaced(baudList[b], ringList[r], pacedList[m], 0, windowBytes);
+				printPacedResult("tx-paced", &result);
+				errors += result.errors;
+			}
+		}
+	}
+
+	printPacedHeader("TX: the same, coalesced up to half the ring or " BENCH_STRINGIFY(BENCH_COALESCE_TIMEOUT_MS) " ms, BufferedUart_TxPoll after every message");
+	for (size_t b = 0; b < numberBauds; b++) {
+		for (size_t r = 0; r < numberRings; r++) {
+			for (size_t m = 0; m < numberPaced; m++) {
+				if (2 * pacedList[m] > ringList[r]) {
+					continue;
+				}
+				struct Result result = benchTransmitPaced(baudList[b], ringList[r], pacedList[m], ringList[r] / 2, windowBytes);
+				printPacedResult("tx-coalesce", &result);
+				errors += result.errors;
+			}
+		}
+	}
+
+	static const struct {
+		enum ImageMethod method;
+		const char *name;
+		const char *title;
+	} imageBenchmarks[] = {
+		{ IMAGE_COPY, "tx-image", "TX: " BENCH_STRINGIFY(BENCH_IMAGE_SIZE) " byte image between header and trailer, copied through the ring like BufferedUart_TransmitTimed" },
+#ifdef BUFFERED_UART_TX_ZEROCOPY
+		{ IMAGE_ZEROCOPY, "tx-zerocopy", "TX: the same, the image via BufferedUart_TransmitZeroCopy" },
+#endif
+	};
+
+	for (size_t t = 0; t < sizeof(imageBenchmarks) / sizeof(imageBenchmarks[0]); t++) {
+		printHeader(imageBenchmarks[t].title, "ns/image");
+		for (size_t b = 0; b < numberBauds; b++) {
+			for (size_t r = 0; r < numberRings; r++) {
+				struct Result result = benchTransmitImage(imageBenchmarks[t].method, baudList[b], ringList[r], windowBytes);
+				printResult(imageBenchmarks[t].name, &result);
+				errors += result.errors;
+			}
+		}
+	}
+
+	static const unsigned int chunks[] = { 0, 256, 64 };
+	printUrgentHeader("TX: " BENCH_STRINGIFY(BENCH_URGENT_SIZE) " byte BufferedUart_TransmitUrgent every 500 frame times next to a saturated bulk producer, bulk transfers of at most 'chunk' bytes");
+	for (size_t b = 0; b < numberBauds; b++) {
+		for (size_t r = 0; r < numberRings; r++) {
+			for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+				if (chunks[c] >= ringList[r]) {
+					continue;
+				}
+				struct Result result = benchTransmitUrgent(baudList[b], ringList[r], chunks[c], 500, windowBytes);
+				printUrgentResult("tx-urgent", &result);
+				errors += result.errors;
+			}
+		}
+	}
+
+	printTxSentHeader("TX: half-duplex requests, the line is turned around after a fixed delay (frame time + 1 ms) or by BufferedUart_NotifyTxSent");
+	for (size_t b = 0; b < numberBauds; b++) {
+		for (size_t r = 0; r < numberRings; r++) {
+			for (size_t m = 0; m < numberMessages; m++) {
+				if (messageList[m] > ringList[r]) {
+					continue;
+				}
+				struct Result result = benchTxSent(TX_SENT_DELAY, baudList[b], ringList[r], messageList[m], 0, windowBytes);
+				printTxSentResult("tx-sent-delay", &result);
+				errors += result.errors;
+				result = benchTxSent(TX_SENT_NOTIFY, baudList[b], ringList[r], messageList[m], 0, windowBytes);
+				printTxSentResult("tx-sent-notify", &result);
+				errors += result.errors;
+				// several DMA transfers per request, chained with BUFFERED_UART_TX_GAPLESS
+				result = benchTxSent(TX_SENT_NOTIFY, baudList[b], ringList[r], messageList[m], 4, windowBytes);
+				printTxSentResult("tx-sent-chunked", &result);
+				errors += result.errors;
+			}
+		}
+	}
+
+	printTxSentHeader("RS-485: requests and responses over an echoing transceiver, the bus is released after a fixed delay or by BufferedUart_SetHalfDuplex");
+	for (size_t b = 0; b < numberBauds; b++) {
+		for (size_t r = 0; r < numberRings; r++) {
+			for (size_t m = 0; m < numberMessages; m++) {
+				if (messageList[m] > ringList[r]) {
+					continue;
+				}
+				struct Result result = benchHalfDuplex(HALF_DUPLEX_DELAY, baudList[b], ringList[r], messageList[m], 0, windowBytes);
+				printTxSentResult("rs485-delay", &result);
+				errors += result.errors;
+				result = benchHalfDuplex(HALF_DUPLEX_HANDLER, baudList[b], ringList[r], messageList[m], 0, windowBytes);
+				printTxSentResult("rs485-handler", &result);
+				errors += result.errors;
+				result = benchHalfDuplex(HALF_DUPLEX_HANDLER, baudList[b], ringList[r], messageList[m], 4, windowBytes);
+				printTxSentResult("rs485-chunked", &result);
+				errors += result.errors;
+				result = benchHalfDuplex(HALF_DUPLEX_DE, baudList[b], ringList[r], messageList[m], 0, windowBytes);
+				printTxSentResult("rs485-de", &result);
+				errors += result.errors;
+			}
+		}
+	}
+
+#ifdef BUFFERED_UART_LATENCY
+	printQueueLatencyHeader("Latency: time in the queues, tx paced (plain and coalesced) and rx continuous (poll every third ring)");
+	for (size_t b = 0; b < numberBauds; b++) {
+		for (size_t r = 0; r < numberRings; r++) {
+			if (2 * pacedList[0] > ringList[r]) {
+				continue;
+			}
+			for (int coalesce = 0; coalesce < 2; coalesce++) {
+				const char *name = coalesce ? "tx-coalesce" : "tx-paced";
+				struct Result result = benchTransmitPaced(baudList[b], ringList[r], pacedList[0], coalesce ? ringList[r] / 2 : 0, windowBytes);
+				printQueueLatencyResult(name, &result, "txQueued", &result.latency.txQueued, result.latency.txUnsampled);
+				printQueueLatencyResult(name, &result, "txSent", &result.latency.txSent, result.latency.txUnsampled);
+				errors += result.errors;
+			}
+			struct Result result = benchReceiveContinuous(baudList[b], ringList[r], ringList[r] / 3, windowBytes);
+			printQueueLatencyResult("rx-continuous", &result, "rxWaiting", &result.latency.rxWaiting, result.latency.rxUnsampled);
+			errors += result.errors;
+		}
+	}
+#endif
+
+	static const struct {
+		enum ReceiveMethod method;
+		const char *name;
+		const char *title;
+	} receiveBenchmarks[] = {
+		{ RECEIVE_DEQUEUE, "rx", "RX: messages with IDLE gaps, BufferedUart_Dequeue + parse" },
+		{ RECEIVE_PEEK, "rx-peek", "RX: messages with IDLE gaps, BufferedUart_RxPeek + parse + BufferedUart_RxConsume" },
+#ifdef BUFFERED_UART_RX_BLOCKS
+		{ RECEIVE_BLOCKS, "rx-blocks", "RX: the same into " BENCH_STRINGIFY(BENCH_RX_BLOCKS) " blocks of ring/" BENCH_STRINGIFY(BENCH_RX_BLOCKS) " bytes, BufferedUart_GetRxBlock + parse, released after the next block" },
+#endif
+	};
+
+	for (size_t t = 0; t < sizeof(receiveBenchmarks) / sizeof(receiveBenchmarks[0]); t++) {
+		printHeader(receiveBenchmarks[t].title, "ns/call");
+		for (size_t b = 0; b < numberBauds; b++) {
+			for (size_t r = 0; r < numberRings; r++) {
+				for (size_t m = 0; m < numberMessages; m++) {
+					if (messageList[m] > ringList[r]) {
+						continue;
+					}
+					struct Result result = benchReceive(receiveBenchmarks[t].method, baudList[b], ringList[r], messageList[m], windowBytes);
+					printResult(receiveBenchmarks[t].name, &result);
+					errors += result.errors;
+				}
+			}
+		}
+	}
+
+	printOverrunHeader("RX: continuous stream, BufferedUart_RxPeek/RxConsume every 'poll' frame times");
+	for (size_t b = 0; b < numberBauds; b++) {
+		for (size_t r = 0; r < numberRings; r++) {
+			// the first poll interval keeps up with the circular DMA, the second one does not
+			unsigned int polls[] = { ringList[r] / 2, 2 * ringList[r] - ringList[r] / 4 };
+			for (size_t p = 0; p < sizeof(polls) / sizeof(polls[0]); p++) {
+				struct Result result = benchReceiveContinuous(baudList[b], ringList[r], polls[p], windowBytes);
+				printOverrunResult("rx-continuous", &result);
+				errors += result.errors;
+			}
+		}
+	}
+
+	static const struct {
+		enum BufferedUartFlowControl mode;
+		const char *name;
+	} flowBenchmarks[] = {
+		{ BUFFERED_UART_FLOW_NONE, "none" },
+		{ BUFFERED_UART_FLOW_RTS, "rts" },
+		{ BUFFERED_UART_FLOW_XON_XOFF, "xon-xoff" },
+	};
+
+	printFlowHeader("RX: peer sends back to back, the application reads a quarter of the line rate, flow control at the high watermark");
+	for (size_t b = 0; b < numberBauds; b++) {
+		for (size_t r = 0; r < numberRings; r++) {
+			for (size_t f = 0; f < sizeof(flowBenchmarks) / sizeof(flowBenchmarks[0]); f++) {
+				struct Result result = benchFlowControl(flowBenchmarks[f].mode, baudList[b], ringList[r], windowBytes / 4);
+				printFlowResult(flowBenchmarks[f].name, &result);
+				errors += result.errors;
+			}
+		}
+	}
+
+	static const unsigned int xoffChunks[] = { 16, 64, 256 };
+	printXoffHeader("TX: saturated, the peer sends XOFF and XON 512 frame times later, bytes which arrive after the XOFF");
+	for (size_t b = 0; b < numberBauds; b++) {
+		for (size_t c = 0; c < sizeof(xoffChunks) / sizeof(xoffChunks[0]); c++) {
+			struct Result result = benchTxXoff(baudList[b], xoffChunks[c], 512, windowBytes);
+			printXoffResult("tx-xoff", &result);
+			errors += result.errors;
+		}
+	}
+
+	printXonRaceHeader("TX: XON/XOFF, a polling interrupt finds XON or the high watermark while BufferedUart_Transmit starts the DMA");
+	for (size_t b = 0; b < numberBauds; b++) {
+		static const unsigned int raceMessages[] = { 1, 16 };
+		for (size_t m = 0; m < sizeof(raceMessages) / sizeof(raceMessages[0]); m++) {
+			struct Result result = benchTxXonRace(baudList[b], raceMessages[m], windowBytes / 16);
+			printXonRaceResult("tx-xon-race", &result);
+			errors += result.errors;
+		}
+	}
+
+	static const struct {
+		enum LineMethod method;
+		const char *name;
+	} lineBenchmarks[] = {
+		{ LINES_RESCAN, "lines-rescan" },
+		{ LINES_PEEK, "lines-peek" },
+		{ LINES_DEQUEUE, "lines-dequeue" },
+	};
+	static const unsigned int lineLengths[] = { 40, 82 };
+
+	printLineHeader("RX: back to back NMEA-like lines, polled every 8 frame times, BufferedUart_Dequeue + search from the start versus BufferedUart_PeekLine/BufferedUart_DequeueLine");
+	for (size_t b = 0; b < numberBauds; b++) {
+		for (size_t r = 0; r < numberRings; r++) {
+			for (size_t l = 0; l < sizeof(lineLengths) / sizeof(lineLengths[0]); l++) {
+				if (2 * lineLengths[l] > ringList[r]) {
+					continue;
+				}
+				for (size_t t = 0; t < sizeof(lineBenchmarks) / sizeof(lineBenchmarks[0]); t++) {
+					struct Result result = benchReceiveLines(lineBenchmarks[t].method, baudList[b], ringList[r], lineLengths[l], 8, windowBytes);
+					printLineResult(lineBenchmarks[t].name, &result);
+					errors += result.errors;
+				}
+			}
+		}
+	}
+
+	static const struct RxDeliveryPolicy policies[] = {
+		{ .name = "idle", .matchCharacter = -1 },
+		{ .name = "threshold", .fillThreshold = BENCH_LINE_LENGTH, .pollBytes = 4, .matchCharacter = -1 },
+		{ .name = "timeout", .timeoutBits = 3, .matchCharacter = -1 },
+		{ .name = "match", .matchCharacter = '\n' },
+	};
+	static const unsigned int gaps[] = { 20, 0 };
+
+	printLatencyHeader("RX: delivery latency of " BENCH_STRINGIFY(BENCH_LINE_LENGTH) " byte lines to the DataReceivedHandler, 'gap' idle frames between the lines");
+	for (size_t g = 0; g < sizeof(gaps) / sizeof(gaps[0]); g++) {
+		for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]); p++) {
+			for (size_t b = 0; b < numberBauds; b++) {
+				for (size_t r = 0; r < numberRings; r++) {
+					struct Result result = benchRxLatency(&policies[p], baudList[b], ringList[r], gaps[g], windowBytes);
+					printLatencyResult("rx-latency", policies[p].name, &result);
+					errors += result.errors;
+				}
+			}
+		}
+	}
+
+#ifdef BUFFERED_UART_TRACE
+	printTraceHeader("RX: messages with gaps and one overrun recorded by BUFFERED_UART_TRACE, then replayed by SimUart_Replay, the handler sees the same calls");
+	for (size_t b = 0; b < numberBauds; b++) {
+		uint64_t hash;
+		struct Result recorded = benchTraceRecord(baudList[b], windowBytes, &hash);
+		printTraceResult("trace-record", &recorded);
+		errors += recorded.errors;
+		static const unsigned int speedups[] = { 1, 16 };
+		for (size_t i = 0; i < sizeof(speedups) / sizeof(speedups[0]); i++) {
+			struct Result result = benchTraceReplay(baudList[b], speedups[i], hash, recorded.messages);
+			printTraceResult("trace-replay", &result);
+			errors += result.errors;
+		}
+	}
+
+#endif
+	printBlockingHeader("RX: messages with IDLE gaps, BufferedUart_RxPoll + BufferedUart_Dequeue once per message or 4 times as often"
+#ifdef BUFFERED_UART_OS_PTHREAD
+			", BufferedUart_Read woken by the driver"
+#endif
+			);
+	for (size_t b = 0; b < numberBauds; b++) {
+		for (size_t r = 0; r < numberRings; r++) {
+			for (size_t m = 0; m < numberMessages; m++) {
+				if (messageList[m] > ringList[r] / 2) {
+					continue;
+				}
+				struct Result result = benchReceivePolled(baudList[b], ringList[r], messageList[m], 1, windowBytes);
+				printBlockingResult("rx-poll", &result);
+				errors += result.errors;
+				result = benchReceivePolled(baudList[b], ringList[r], messageList[m], 4, windowBytes);
+				printBlockingResult("rx-poll-4x", &result);
+				errors += result.errors;
+#ifdef BUFFERED_UART_OS_PTHREAD
+				result = benchBlocking(BUFFERED_UART_RX, baudList[b], ringList[r], messageList[m], windowBytes);
+				printBlockingResult("rx-read", &result);
+				errors += result.errors;
+#endif
+			}
+		}
+	}
+
+#ifdef BUFFERED_UART_OS_PTHREAD
+	printHeader("TX: saturated BufferedUart_Write, woken by the driver once the message fits", "ns/message");
+	for (size_t b = 0; b < numberBauds; b++) {
+		for (size_t r = 0; r < numberRings; r++) {
+			for (size_t m = 0; m < numberMessages; m++) {
+				if (messageList[m] > ringList[r]) {
+					continue;
+				}
+				struct Result result = benchBlocking(BUFFERED_UART_TX, baudList[b], ringList[r], messageList[m], windowBytes);
+				printResult("tx-write", &result);
+				errors += result.errors;
+			}
+		}
+	}
+#endif
+
+#if MAX_NUMBER_BUFFERED_UARTS > 1
+	static const unsigned int uartCounts[] = { 1, 2, 4, 8, 16, 32 };
+	static const unsigned int quickUartCounts[] = { 1, 8, 32 };
+	const unsigned int *uartCountList = quick ? quickUartCounts : uartCounts;
+	size_t numberUartCounts = quick ? 3 : sizeof(uartCounts) / sizeof(uartCounts[0]);
+	printMultiHeader("RX: " BENCH_STRINGIFY(BENCH_MULTI_MESSAGE) " byte messages on several uarts, main loop after every simulator event");
+	for (size_t b = 0; b < numberBauds; b++) {
+		for (size_t u = 0; u < numberUartCounts; u++) {
+			if (uartCountList[u] > MAX_NUMBER_BUFFERED_UARTS) {
+				continue;
+			}
+			struct Result result = benchMultiUart(MULTI_POLL_EACH, uartCountList[u], baudList[b], windowBytes);
+			printMultiResult("poll-each", &result);
+			errors += result.errors;
+			result = benchMultiUart(MULTI_POLL_ALL, uartCountList[u], baudList[b], windowBytes);
+			printMultiResult("poll-all", &result);
+			errors += result.errors;
+		}
+	}
+#endif
+
+	static const struct {
+		enum BufferedUartFrameEncoding encoding;
+		bool rescan;
+		const char *name;
+		const char *title;
+	} frameBenchmarks[] = {
+		{ BUFFERED_UART_FRAME_COBS, false, "frame-cobs", "Frames: COBS loop back, BufferedUartFrame_Transmit/BufferedUartFrame_Receive" },
+		{ BUFFERED_UART_FRAME_COBS, true, "frame-cobs-rescan", "Frames: the same, but every poll searches all unread bytes again" },
+		{ BUFFERED_UART_FRAME_SLIP, false, "frame-slip", "Frames: SLIP loop back, BufferedUartFrame_Transmit/BufferedUartFrame_Receive" },
+	};
+	static const unsigned int payloads[] = { 8, 64, 400 };
+
+	for (size_t t = 0; t < sizeof(frameBenchmarks) / sizeof(frameBenchmarks[0]); t++) {
+		printFrameHeader(frameBenchmarks[t].title);
+		for (size_t b = 0; b < numberBauds; b++) {
+			for (size_t r = 0; r < numberRings; r++) {
+				for (size_t p = 0; p < sizeof(payloads) / sizeof(payloads[0]); p++) {
+					// a frame has to fit into half of the rx ring to be received while the DMA goes on
+					if (2 * BufferedUartFrame_GetMaxEncodedLength(frameBenchmarks[t].encoding, payloads[p]) > ringList[r]) {
+						continue;
+					}
+					struct Result result = benchFrameLoopback(frameBenchmarks[t].encoding, frameBenchmarks[t].rescan, baudList[b], ringList[r], payloads[p], windowBytes);
+					printFrameResult(frameBenchmarks[t].name, &result);
+					errors += result.errors;
+				}
+			}
+		}
+	}
+
+#ifdef BUFFERED_UART_DCACHE
+	const struct SimDCacheStats *dcache = Sim_GetDCacheStats();
+	if (s_csv) {
+		printf("dcache,cleans,clean_bytes,invalidates,invalidate_bytes,misaligned,outside,tx_uncleaned_bytes\n");
+		printf("dcache,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n", (unsigned long long)dcache->cleans, (unsigned long long)dcache->cleanBytes,
+				(unsigned long long)dcache->invalidates, (unsigned long long)dcache->invalidateBytes, (unsigned long long)dcache->misaligned,
+				(unsigned long long)dcache->outside, (unsigned long long)dcache->txUncleanedBytes);
+	} else {
+		printf("\nData cache model (BUFFERED_UART_DCACHE), all benchmarks\n");
+		printf("%9s %12s %11s %12s %10s %8s %12s\n", "cleans", "clean B", "invalidates", "invalid B", "misaligned", "outside", "tx uncleaned");
+		printf("%9llu %12llu %11llu %12llu %10llu %8llu %12llu\n", (unsigned long long)dcache->cleans, (unsigned long long)dcache->cleanBytes,
+				(unsigned long long)dcache->invalidates, (unsigned long long)dcache->invalidateBytes, (unsigned long long)dcache->misaligned,
+				(unsigned long long)dcache->outside, (unsigned long long)dcache->txUncleanedBytes);
+	}
+	errors += dcache->misaligned + dcache->outside + dcache->txUncleanedBytes;
+#endif
+
+	if (errors > 0) {
+		fprintf(stderr, "bench: %llu bytes were lost or corrupted\n", (unsigned long long)errors);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
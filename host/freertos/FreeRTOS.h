@@ -0,0 +1,25 @@
+// minimal stand-in for the FreeRTOS headers, only so the host build compiles the BUFFERED_UART_OS_FREERTOS
+// backend of stm32_buffered_uart_os.c. It declares what the backend uses and is never linked or run
+
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+#include <stdint.h>
+
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE ((BaseType_t)0)
+#define pdTRUE ((BaseType_t)1)
+
+// an odd rate, so the tick to millisecond conversion is not the identity
+#define configTICK_RATE_HZ ((TickType_t)1024)
+
+#define portMAX_DELAY ((TickType_t)0xFFFFFFFFUL)
+#define pdMS_TO_TICKS(xTimeInMs) ((TickType_t)(((TickType_t)(xTimeInMs) * (TickType_t)configTICK_RATE_HZ) / (TickType_t)1000U))
+
+void vPortYieldFromISR(BaseType_t higherPriorityTaskWoken);
+#define portYIELD_FROM_ISR(x) vPortYieldFromISR(x)
+
+#endif /* FREERTOS_H */
@@ -0,0 +1,10 @@
+// minimal stand-in for the FreeRTOS task api, see FreeRTOS.h
+
+#ifndef INC_TASK_H
+#define INC_TASK_H
+
+#include "FreeRTOS.h"
+
+TickType_t xTaskGetTickCount(void);
+
+#endif /* INC_TASK_H */
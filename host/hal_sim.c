@@ -0,0 +1,1239 @@
+/**
+
+hal_sim
+discrete event simulation of an STM32 USART with DMA, see hal_sim.h
+
+
+MIT License
+
+Copyright (c) 2022 Jonas Rahlf
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "hal_sim.h"
+// only for the trace record format of SimUart_Replay
+#include "stm32_buffered_uart.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SIM_CONTAINER_OF(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+
+enum SimEventType {
+	SIM_EVENT_TX_DMA_HALF,
+	SIM_EVENT_TX_DMA_CPLT,
+	SIM_EVENT_UART_TC,
+	SIM_EVENT_RX_BYTE,
+	SIM_EVENT_RX_IDLE,
+	SIM_EVENT_RX_TIMEOUT,
+	SIM_EVENT_RX_REPLAY,		///< generation is the offset of the record in the replayed trace
+	SIM_EVENT_RX_ECHO			///< generation is the transmitted byte the transceiver echoes
+};
+
+enum SimIrqType {
+	SIM_IRQ_TX_DMA_HALF,
+	SIM_IRQ_TX_DMA_CPLT,
+	SIM_IRQ_UART_TC,
+	SIM_IRQ_RX_DMA_HALF,
+	SIM_IRQ_RX_DMA_CPLT,
+	SIM_IRQ_UART_IDLE,
+	SIM_IRQ_UART_RX_FLAG,
+	SIM_IRQ_UART_ERROR
+};
+
+struct SimEvent {
+	uint64_t time;
+	uint64_t sequence;
+	enum SimEventType type;
+	struct SimUart *su;
+	uint32_t generation;
+};
+
+struct SimIrq {
+	enum SimIrqType type;
+	struct SimUart *su;
+	uint32_t argument;
+};
+
+static uint64_t s_now;
+static uint64_t s_sequence;
+static uint64_t s_dmaStartLatency;
+
+static struct SimEvent *s_events;
+static unsigned int s_numberEvents;
+static unsigned int s_eventCapacity;
+
+#define SIM_MAX_PENDING_IRQS 64
+static struct SimIrq s_irqs[SIM_MAX_PENDING_IRQS];
+static unsigned int s_irqHead;
+static unsigned int s_irqTail;
+
+static uint32_t s_primask;
+static bool s_inInterrupt;
+
+static void (*s_preemptionHook)(void *context);
+static void *s_preemptionContext;
+static unsigned int s_preemptionPeriod;
+static unsigned int s_preemptionCounter;
+static void (*s_primaskHook)(bool masked);
+
+// uarts whose RX DMA memory the data cache model knows, cleared by Sim_Reset
+#define SIM_MAX_UARTS 64
+static struct SimUart *s_uarts[SIM_MAX_UARTS];
+static unsigned int s_numberUarts;
+
+#define SIM_DCACHE_LINE_SIZE 32
+// ranges cleaned since the last TX DMA start, the oldest is overwritten
+#define SIM_DCACHE_CLEANED_RANGES 8
+static bool s_dcache;
+static struct SimDCacheStats s_dcacheStats;
+static uintptr_t s_cleanedStart[SIM_DCACHE_CLEANED_RANGES];
+static uintptr_t s_cleanedEnd[SIM_DCACHE_CLEANED_RANGES];
+static unsigned int s_numberCleaned;
+
+/// ==== event queue (binary min heap ordered by time, then insertion order) ====
+
+static bool eventBefore(const struct SimEvent *a, const struct SimEvent *b)
+{
+	if (a->time != b->time) {
+		return a->time < b->time;
+	}
+	return a->sequence < b->sequence;
+}
+
+static void eventSiftDown(unsigned int i)
+{
+	for (;;) {
+		unsigned int smallest = i;
+		unsigned int left = 2 * i + 1;
+		unsigned int right = left + 1;
+		if (left < s_numberEvents && eventBefore(&s_events[left], &s_events[smallest])) {
+			smallest = left;
+		}
+		if (right < s_numberEvents && eventBefore(&s_events[right], &s_events[smallest])) {
+			smallest = right;
+		}
+		if (smallest == i) {
+			return;
+		}
+		struct SimEvent tmp = s_events[i];
+		s_events[i] = s_events[smallest];
+		s_events[smallest] = tmp;
+		i = smallest;
+	}
+}
+
+static void schedule(uint64_t time, enum SimEventType type, struct SimUart *su, uint32_t generation)
+{
+	if (s_numberEvents == s_eventCapacity) {
+		s_eventCapacity = s_eventCapacity ? 2 * s_eventCapacity : 64;
+		s_events = realloc(s_events, s_eventCapacity * sizeof(*s_events));
+		if (s_events == NULL) {
+			abort();
+		}
+	}
+
+	unsigned int i = s_numberEvents++;
+	s_events[i] = (struct SimEvent){ time, s_sequence++, type, su, generation };
+	while (i > 0) {
+		unsigned int parent = (i - 1) / 2;
+		if (!eventBefore(&s_events[i], &s_events[parent])) {
+			break;
+		}
+		struct SimEvent tmp = s_events[i];
+		s_events[i] = s_events[parent];
+		s_events[parent] = tmp;
+		i = parent;
+	}
+}
+
+static struct SimEvent popEvent(void)
+{
+	struct SimEvent first = s_events[0];
+	s_events[0] = s_events[--s_numberEvents];
+	eventSiftDown(0);
+	return first;
+}
+
+/// ==== interrupts ====
+
+static void raiseIrq(enum SimIrqType type, struct SimUart *su, uint32_t argument)
+{
+	if (s_irqTail - s_irqHead == SIM_MAX_PENDING_IRQS) {
+		fprintf(stderr, "hal_sim: too many pending interrupts\n");
+		abort();
+	}
+	s_irqs[s_irqTail++ % SIM_MAX_PENDING_IRQS] = (struct SimIrq){ type, su, argument };
+}
+
+static void rxEndTransfer(struct SimUart *su)
+{
+	UART_HandleTypeDef *huart = &su->huart;
+	huart->Instance->CR1 &= ~USART_CR1_IDLEIE;
+	huart->Instance->CR3 &= ~USART_CR3_DMAR;
+	huart->ReceptionType = HAL_UART_RECEPTION_STANDARD;
+	huart->RxState = HAL_UART_STATE_READY;
+}
+
+/// writes to ICR clear the corresponding ISR flags
+static void clearFlags(struct SimUart *su)
+{
+	su->regs.ISR &= ~su->regs.ICR;
+	su->regs.ICR = 0;
+}
+
+static void dispatchIrq(const struct SimIrq *irq)
+{
+	struct SimUart *su = irq->su;
+	UART_HandleTypeDef *huart = &su->huart;
+	su->stats.interrupts++;
+
+	switch (irq->type) {
+	case SIM_IRQ_TX_DMA_HALF:
+		if (irq->argument == su->txGeneration && su->hdmatx.XferHalfCpltCallback != NULL) {
+			su->hdmatx.XferHalfCpltCallback(&su->hdmatx);
+		}
+		break;
+	case SIM_IRQ_TX_DMA_CPLT:
+		if (irq->argument == su->txGeneration) {
+			su->hdmatx.State = HAL_DMA_STATE_READY;
+			if (su->hdmatx.XferCpltCallback != NULL) {
+				su->hdmatx.XferCpltCallback(&su->hdmatx);
+			}
+		}
+		break;
+	case SIM_IRQ_UART_TC:
+		if (irq->argument == su->txGeneration && (huart->Instance->CR1 & USART_CR1_TCIE)) {
+			huart->Instance->CR1 &= ~USART_CR1_TCIE;
+			huart->gState = HAL_UART_STATE_READY;
+			HAL_UART_TxCpltCallback(huart);
+		}
+		break;
+	case SIM_IRQ_RX_DMA_HALF:
+		huart->RxEventType = HAL_UART_RXEVENT_HT;
+		if (su->hdmarx.XferHalfCpltCallback != NULL) {
+			su->hdmarx.XferHalfCpltCallback(&su->hdmarx);
+		}
+		break;
+	case SIM_IRQ_RX_DMA_CPLT:
+		if (su->hdmarx.Init.Mode != DMA_CIRCULAR) {
+			su->hdmarx.State = HAL_DMA_STATE_READY;
+		}
+		huart->RxEventType = HAL_UART_RXEVENT_TC;
+		if (su->hdmarx.XferCpltCallback != NULL) {
+			su->hdmarx.XferCpltCallback(&su->hdmarx);
+		}
+		break;
+	case SIM_IRQ_UART_IDLE:
+		// mirrors the IDLE handling of HAL_UART_IRQHandler for HAL_UART_RECEPTION_TOIDLE
+		if (huart->ReceptionType != HAL_UART_RECEPTION_TOIDLE || !(huart->Instance->CR1 & USART_CR1_IDLEIE)) {
+			break;
+		}
+		su->stats.rxIdleEvents++;
+		if (huart->Instance->CR3 & USART_CR3_DMAR) {
+			uint16_t remaining = (uint16_t)__HAL_DMA_GET_COUNTER(huart->hdmarx);
+			if (remaining > 0 && remaining < huart->RxXferSize) {
+				huart->RxXferCount = remaining;
+				huart->RxEventType = HAL_UART_RXEVENT_IDLE;
+				if (huart->hdmarx->Init.Mode != DMA_CIRCULAR) {
+					rxEndTransfer(su);
+					HAL_DMA_Abort(huart->hdmarx);
+				}
+				HAL_UARTEx_RxEventCallback(huart, huart->RxXferSize - huart->RxXferCount);
+			}
+		}
+		break;
+	case SIM_IRQ_UART_RX_FLAG:
+		// receiver timeout or character match: first the application's USARTx_IRQHandler code in
+		// front of HAL_UART_IRQHandler, then whatever the HAL does with flags that are still set
+		clearFlags(su);
+		if (su->irqHandler != NULL) {
+			su->irqHandler(huart);
+			clearFlags(su);
+		}
+		if ((huart->Instance->ISR & USART_ISR_RTOF) && (huart->Instance->CR1 & USART_CR1_RTOIE)) {
+			// the HAL reports the receiver timeout as blocking error and aborts the DMA reception
+			su->stats.rxUnhandledIrqs++;
+			huart->Instance->ISR &= ~USART_ISR_RTOF;
+			huart->ErrorCode |= HAL_UART_ERROR_RTO;
+			bool dma = (huart->Instance->CR3 & USART_CR3_DMAR) != 0;
+			rxEndTransfer(su);
+			if (dma) {
+				HAL_DMA_Abort(huart->hdmarx);
+			}
+			HAL_UART_ErrorCallback(huart);
+		}
+		if ((huart->Instance->ISR & USART_ISR_CMF) && (huart->Instance->CR1 & USART_CR1_CMIE)) {
+			// the HAL does not handle the character match flag, the interrupt would fire again and again
+			su->stats.rxUnhandledIrqs++;
+			huart->Instance->ISR &= ~USART_ISR_CMF;
+		}
+		break;
+	case SIM_IRQ_UART_ERROR:
+		huart->ErrorCode |= irq->argument;
+		if (irq->argument & HAL_UART_ERROR_ORE) {
+			// blocking error: the HAL aborts the reception before reporting it
+			bool dma = (huart->Instance->CR3 & USART_CR3_DMAR) != 0;
+			rxEndTransfer(su);
+			if (dma) {
+				HAL_DMA_Abort(huart->hdmarx);
+			}
+			HAL_UART_ErrorCallback(huart);
+		} else {
+			HAL_UART_ErrorCallback(huart);
+			huart->ErrorCode = HAL_UART_ERROR_NONE;
+		}
+		break;
+	}
+}
+
+static void serviceInterrupts(void)
+{
+	if (s_inInterrupt || s_primask) {
+		return;
+	}
+
+	s_inInterrupt = true;
+	while (s_irqHead != s_irqTail) {
+		struct SimIrq irq = s_irqs[s_irqHead++ % SIM_MAX_PENDING_IRQS];
+		dispatchIrq(&irq);
+	}
+	s_inInterrupt = false;
+}
+
+/// called on every HAL entry, this is where simulated interrupts preempt thread code
+static void preemptionPoint(void)
+{
+	if (s_inInterrupt || s_primask) {
+		return;
+	}
+
+	serviceInterrupts();
+
+	if (s_preemptionHook != NULL && s_preemptionPeriod > 0 && ++s_preemptionCounter >= s_preemptionPeriod) {
+		s_preemptionCounter = 0;
+		s_inInterrupt = true;
+		s_preemptionHook(s_preemptionContext);
+		s_inInterrupt = false;
+	}
+}
+
+/// ==== physical model ====
+
+static struct SimUart * simUartFromDma(DMA_HandleTypeDef *hdma)
+{
+	return SIM_CONTAINER_OF((UART_HandleTypeDef *)hdma->Parent, struct SimUart, huart);
+}
+
+static void txStart(struct SimUart *su, uint32_t length)
+{
+	uint64_t bt = su->byteTimeNs;
+	uint64_t start = s_now + s_dmaStartLatency;
+	if (start < su->lineFreeNs) {
+		start = su->lineFreeNs;
+	}
+
+	if (su->stats.txTransfers > 0) {
+		uint64_t gap = start - su->lineFreeNs;
+		su->stats.txGaps++;
+		su->stats.txGapNs += gap;
+		if (gap > su->stats.txMaxGapNs) {
+			su->stats.txMaxGapNs = gap;
+		}
+	}
+
+	// the DMA fills TDR whenever the previous byte moved to the shift register,
+	// so the last byte is fetched about two frames before it left the wire
+	uint64_t dmaCplt = start + (length >= 2 ? (uint64_t)(length - 2) * bt : 0);
+	uint64_t dmaHalf = start + (length / 2 >= 2 ? (uint64_t)(length / 2 - 2) * bt : 0);
+
+	// a real DMA reads the memory while the transfer runs, taking it at the start reveals data
+	// which was handed to the DMA before it was completely written
+	memcpy(su->txData, (const void *)su->hdmatx.Instance->CMAR, length);
+
+	if (s_dcache) {
+		// the data has to be written back from the cache after it was written, i.e. right before the start
+		uintptr_t start = su->hdmatx.Instance->CMAR;
+		bool cleaned = false;
+		for (unsigned int i = 0; i < s_numberCleaned && i < SIM_DCACHE_CLEANED_RANGES; i++) {
+			cleaned |= s_cleanedStart[i] <= start && start + length <= s_cleanedEnd[i];
+		}
+		if (!cleaned) {
+			s_dcacheStats.txUncleanedBytes += length;
+		}
+		s_numberCleaned = 0;
+	}
+
+	su->stats.txTransfers++;
+	su->stats.txBusyNs += (uint64_t)length * bt;
+	su->lineFreeNs = start + (uint64_t)length * bt;
+	su->txEndNs = su->lineFreeNs;
+
+	if (su->rxEcho) {
+		for (uint32_t i = 0; i < length; i++) {
+			schedule(start + (uint64_t)(i + 1) * bt, SIM_EVENT_RX_ECHO, su, su->txData[i]);
+		}
+	}
+
+	if (length >= 2) {
+		schedule(dmaHalf, SIM_EVENT_TX_DMA_HALF, su, su->txGeneration);
+	}
+	schedule(dmaCplt, SIM_EVENT_TX_DMA_CPLT, su, su->txGeneration);
+}
+
+static void txDmaCplt(struct SimUart *su)
+{
+	DMA_Channel_TypeDef *channel = su->hdmatx.Instance;
+	uint32_t length = (uint32_t)channel->CNDTR;
+	const uint8_t *data = (const uint8_t *)channel->CMAR;
+
+	channel->CNDTR = 0;
+	if (su->hdmatx.Init.Mode != DMA_CIRCULAR) {
+		channel->CCR &= ~DMA_CCR_EN;
+	}
+
+	for (uint32_t i = 0; i < length; i++) {
+		if (data[i] != su->txData[i]) {
+			su->stats.txModifiedBytes++;
+		}
+	}
+
+	su->stats.txBytes += length;
+	if (su->txSink != NULL) {
+		su->txSink(su->txSinkContext, su->txData, length);
+	}
+
+	if (channel->CCR & DMA_CCR_TCIE) {
+		raiseIrq(SIM_IRQ_TX_DMA_CPLT, su, su->txGeneration);
+	}
+}
+
+/// the RX DMA writes one received byte, false if no reception is armed
+static bool rxDmaWrite(struct SimUart *su, uint8_t byte)
+{
+	UART_HandleTypeDef *huart = &su->huart;
+	DMA_Channel_TypeDef *channel = su->hdmarx.Instance;
+	bool armed = (channel->CCR & DMA_CCR_EN) && (huart->Instance->CR3 & USART_CR3_DMAR) && (huart->Instance->CR1 & USART_CR1_RE);
+	if (!armed) {
+		su->stats.rxLostBytes++;
+		return false;
+	}
+
+	uint32_t size = huart->RxXferSize;
+	uint32_t position = size - (uint32_t)channel->CNDTR;
+	// with the data cache model the CPU sees the byte once its line is invalidated
+	((uint8_t *)(s_dcache ? (uintptr_t)su->rxMemory : channel->CMAR))[position] = byte;
+	huart->Instance->RDR = byte;
+	channel->CNDTR--;
+	su->rxPosition = position + 1;
+	su->stats.rxBytes++;
+	if (channel->CNDTR == 0) {
+		if (su->hdmarx.Init.Mode == DMA_CIRCULAR) {
+			channel->CNDTR = size;
+		} else {
+			channel->CCR &= ~DMA_CCR_EN;
+		}
+	}
+	return true;
+}
+
+/// the last stop bit of byte was received at time
+static void rxReceive(struct SimUart *su, uint8_t byte, uint64_t time)
+{
+	su->rxLineFreeNs = time;
+	su->rxGeneration++;
+
+	UART_HandleTypeDef *huart = &su->huart;
+	DMA_Channel_TypeDef *channel = su->hdmarx.Instance;
+	if (rxDmaWrite(su, byte)) {
+		uint32_t size = huart->RxXferSize;
+		if ((huart->Instance->CR2 & USART_CR2_ADD) >> USART_CR2_ADD_Pos == byte) {
+			clearFlags(su);
+			huart->Instance->ISR |= USART_ISR_CMF;
+			if (huart->Instance->CR1 & USART_CR1_CMIE) {
+				su->stats.rxMatchEvents++;
+				raiseIrq(SIM_IRQ_UART_RX_FLAG, su, 0);
+			}
+		}
+
+		if (su->rxPosition == size / 2 && (channel->CCR & DMA_CCR_HTIE)) {
+			su->stats.rxHalfEvents++;
+			raiseIrq(SIM_IRQ_RX_DMA_HALF, su, 0);
+		}
+		if (su->rxPosition == size && (channel->CCR & DMA_CCR_TCIE)) {
+			su->stats.rxCpltEvents++;
+			raiseIrq(SIM_IRQ_RX_DMA_CPLT, su, 0);
+		}
+	}
+}
+
+/// the line stays idle after the byte received at time, unless more data follows
+static void rxLineIdle(struct SimUart *su, uint64_t time)
+{
+	schedule(time + su->byteTimeNs, SIM_EVENT_RX_IDLE, su, su->rxGeneration);
+	if (su->regs.CR2 & USART_CR2_RTOEN) {
+		// the receiver timeout counts bit times from the end of the last stop bit
+		uint32_t timeoutBits = su->regs.RTOR & USART_RTOR_RTO;
+		schedule(time + (uint64_t)timeoutBits * su->bitTimeNs, SIM_EVENT_RX_TIMEOUT, su, su->rxGeneration);
+	}
+}
+
+static void rxByte(struct SimUart *su, uint64_t time)
+{
+	uint8_t byte = su->rxPending[su->rxPendingHead++];
+	if (su->rxPendingHead == su->rxPendingTail) {
+		su->rxPendingHead = 0;
+		su->rxPendingTail = 0;
+	}
+
+	rxReceive(su, byte, time);
+	if (su->rxPendingHead != su->rxPendingTail && !su->rxPeerPaused) {
+		schedule(time + su->byteTimeNs, SIM_EVENT_RX_BYTE, su, 0);
+	} else {
+		su->rxByteScheduled = false;
+		rxLineIdle(su, time);
+	}
+}
+
+/// the transceiver echoes a transmitted byte, which only arrives if the receiver is enabled
+static void rxEcho(struct SimUart *su, uint8_t byte, uint64_t time)
+{
+	if (!(su->regs.CR1 & USART_CR1_RE)) {
+		su->stats.rxEchoIgnored++;
+		return;
+	}
+
+	su->stats.rxEchoBytes++;
+	rxReceive(su, byte, time);
+	rxLineIdle(su, time);
+}
+
+/// write the bytes of a trace record and raise its event, see SimUart_Replay
+static void rxReplay(struct SimUart *su, uint32_t offset)
+{
+	struct BufferedUartTraceRecord record;
+	memcpy(&record, su->replayTrace + offset, sizeof(record));
+	const uint8_t *data = su->replayTrace + offset + sizeof(record);
+	DMA_Channel_TypeDef *channel = su->hdmarx.Instance;
+
+	if (record.type == BUFFERED_UART_TRACE_ERROR) {
+		raiseIrq(SIM_IRQ_UART_ERROR, su, record.event);
+		return;
+	}
+
+	for (uint32_t i = 0; i < record.length; i++) {
+		rxDmaWrite(su, data[i]);
+	}
+	su->rxLineFreeNs = s_now;
+	switch (record.event) {
+	case BUFFERED_UART_RX_EVENT_HT:
+		if (channel->CCR & DMA_CCR_HTIE) {
+			su->stats.rxHalfEvents++;
+			raiseIrq(SIM_IRQ_RX_DMA_HALF, su, 0);
+		}
+		break;
+	case BUFFERED_UART_RX_EVENT_TC:
+		if (channel->CCR & DMA_CCR_TCIE) {
+			su->stats.rxCpltEvents++;
+			raiseIrq(SIM_IRQ_RX_DMA_CPLT, su, 0);
+		}
+		break;
+	case BUFFERED_UART_RX_EVENT_IDLE:
+	case BUFFERED_UART_RX_EVENT_TIMEOUT:
+		raiseIrq(SIM_IRQ_UART_IDLE, su, 0);
+		break;
+	default:
+		break;
+	}
+}
+
+static void processEvent(const struct SimEvent *event)
+{
+	struct SimUart *su = event->su;
+	switch (event->type) {
+	case SIM_EVENT_TX_DMA_HALF:
+		if (event->generation == su->txGeneration && (su->hdmatx.Instance->CCR & DMA_CCR_HTIE)) {
+			raiseIrq(SIM_IRQ_TX_DMA_HALF, su, su->txGeneration);
+		}
+		break;
+	case SIM_EVENT_TX_DMA_CPLT:
+		if (event->generation == su->txGeneration) {
+			txDmaCplt(su);
+		}
+		break;
+	case SIM_EVENT_UART_TC:
+		if (event->generation == su->txGeneration && s_now >= su->lineFreeNs) {
+			raiseIrq(SIM_IRQ_UART_TC, su, su->txGeneration);
+		}
+		break;
+	case SIM_EVENT_RX_BYTE:
+		rxByte(su, event->time);
+		break;
+	case SIM_EVENT_RX_IDLE:
+		if (event->generation == su->rxGeneration && (su->regs.CR1 & USART_CR1_IDLEIE)) {
+			raiseIrq(SIM_IRQ_UART_IDLE, su, 0);
+		}
+		break;
+	case SIM_EVENT_RX_REPLAY:
+		if (su->replayTrace != NULL) {
+			rxReplay(su, event->generation);
+		}
+		break;
+	case SIM_EVENT_RX_ECHO:
+		rxEcho(su, (uint8_t)event->generation, event->time);
+		break;
+	case SIM_EVENT_RX_TIMEOUT:
+		if (event->generation == su->rxGeneration && (su->regs.CR2 & USART_CR2_RTOEN)) {
+			clearFlags(su);
+			su->regs.ISR |= USART_ISR_RTOF;
+			if (su->regs.CR1 & USART_CR1_RTOIE) {
+				su->stats.rxTimeoutEvents++;
+				raiseIrq(SIM_IRQ_UART_RX_FLAG, su, 0);
+			}
+		}
+		break;
+	}
+}
+
+/// ==== HAL internal DMA callbacks ====
+
+static void uartDmaTransmitCplt(DMA_HandleTypeDef *hdma)
+{
+	struct SimUart *su = simUartFromDma(hdma);
+	UART_HandleTypeDef *huart = &su->huart;
+	if (hdma->Init.Mode != DMA_CIRCULAR) {
+		huart->TxXferCount = 0;
+		huart->Instance->CR3 &= ~USART_CR3_DMAT;
+		huart->Instance->CR1 |= USART_CR1_TCIE;
+		schedule(su->lineFreeNs > s_now ? su->lineFreeNs : s_now, SIM_EVENT_UART_TC, su, su->txGeneration);
+	}
+}
+
+static void uartDmaTxHalfCplt(DMA_HandleTypeDef *hdma)
+{
+	HAL_UART_TxHalfCpltCallback(&simUartFromDma(hdma)->huart);
+}
+
+static void uartDmaReceiveCplt(DMA_HandleTypeDef *hdma)
+{
+	struct SimUart *su = simUartFromDma(hdma);
+	UART_HandleTypeDef *huart = &su->huart;
+	if (hdma->Init.Mode != DMA_CIRCULAR) {
+		huart->RxXferCount = 0;
+		rxEndTransfer(su);
+	}
+	HAL_UARTEx_RxEventCallback(huart, huart->RxXferSize);
+}
+
+static void uartDmaRxHalfCplt(DMA_HandleTypeDef *hdma)
+{
+	UART_HandleTypeDef *huart = &simUartFromDma(hdma)->huart;
+	HAL_UARTEx_RxEventCallback(huart, huart->RxXferSize / 2U);
+}
+
+/// ==== simulation control ====
+
+void Sim_Reset(void)
+{
+	s_now = 0;
+	s_sequence = 0;
+	s_numberEvents = 0;
+	s_irqHead = 0;
+	s_irqTail = 0;
+	s_primask = 0;
+	s_inInterrupt = false;
+	s_dmaStartLatency = 0;
+	s_preemptionHook = NULL;
+	s_preemptionPeriod = 0;
+	s_preemptionCounter = 0;
+	s_primaskHook = NULL;
+	s_numberUarts = 0;
+	s_numberCleaned = 0;
+}
+
+uint64_t Sim_Now(void)
+{
+	return s_now;
+}
+
+uint64_t Sim_NextEventTime(void)
+{
+	return s_numberEvents > 0 ? s_events[0].time : UINT64_MAX;
+}
+
+bool Sim_InInterrupt(void)
+{
+	return s_inInterrupt;
+}
+
+void Sim_SetDmaStartLatency(uint64_t ns)
+{
+	s_dmaStartLatency = ns;
+}
+
+void Sim_SetDCache(bool enabled)
+{
+	s_dcache = enabled;
+	memset(&s_dcacheStats, 0, sizeof(s_dcacheStats));
+	s_numberCleaned = 0;
+}
+
+const struct SimDCacheStats * Sim_GetDCacheStats(void)
+{
+	return &s_dcacheStats;
+}
+
+void Sim_SetPreemptionHook(void (*hook)(void *context), void *context, unsigned int period)
+{
+	s_preemptionHook = hook;
+	s_preemptionContext = context;
+	s_preemptionPeriod = period;
+	s_preemptionCounter = 0;
+}
+
+void Sim_SetPrimaskHook(void (*hook)(bool masked))
+{
+	s_primaskHook = hook;
+}
+
+void Sim_Advance(uint64_t ns)
+{
+	uint64_t target = s_now + ns;
+	while (s_numberEvents > 0 && s_events[0].time <= target) {
+		struct SimEvent event = popEvent();
+		if (event.time > s_now) {
+			s_now = event.time;
+		}
+		processEvent(&event);
+		serviceInterrupts();
+	}
+	s_now = target;
+	serviceInterrupts();
+}
+
+bool Sim_RunNextEvent(void)
+{
+	if (s_numberEvents == 0) {
+		return false;
+	}
+
+	struct SimEvent event = popEvent();
+	if (event.time > s_now) {
+		s_now = event.time;
+	}
+	processEvent(&event);
+	serviceInterrupts();
+	return true;
+}
+
+void SimUart_Init(struct SimUart *su, uint32_t baudRate)
+{
+	memset(su, 0, sizeof(*su));
+
+	su->huart.Instance = &su->regs;
+	su->huart.Init.BaudRate = baudRate;
+	su->huart.Init.WordLength = UART_WORDLENGTH_8B;
+	su->huart.Init.StopBits = UART_STOPBITS_1;
+	su->huart.Init.Parity = UART_PARITY_NONE;
+	su->huart.hdmatx = &su->hdmatx;
+	su->huart.hdmarx = &su->hdmarx;
+	su->huart.gState = HAL_UART_STATE_READY;
+	su->huart.RxState = HAL_UART_STATE_READY;
+	su->regs.CR1 = USART_CR1_UE | USART_CR1_TE | USART_CR1_RE;
+
+	su->hdmatx.Instance = &su->txChannel;
+	su->hdmatx.Init.Mode = DMA_NORMAL;
+	su->hdmatx.State = HAL_DMA_STATE_READY;
+	su->hdmatx.Parent = &su->huart;
+
+	su->hdmarx.Instance = &su->rxChannel;
+	su->hdmarx.Init.Mode = DMA_CIRCULAR;
+	su->hdmarx.State = HAL_DMA_STATE_READY;
+	su->hdmarx.Parent = &su->huart;
+
+	// start bit + 8 data bits + stop bit
+	uint64_t frameBits = 10;
+	su->byteTimeNs = (frameBits * 1000000000ULL + baudRate / 2) / baudRate;
+	su->bitTimeNs = (1000000000ULL + baudRate / 2) / baudRate;
+
+	if (s_numberUarts == SIM_MAX_UARTS) {
+		fprintf(stderr, "hal_sim: more than %d uarts\n", SIM_MAX_UARTS);
+		abort();
+	}
+	s_uarts[s_numberUarts++] = su;
+}
+
+void SimUart_DeInit(struct SimUart *su)
+{
+	// drop everything that still refers to this uart
+	unsigned int kept = 0;
+	for (unsigned int i = 0; i < s_numberEvents; i++) {
+		if (s_events[i].su != su) {
+			s_events[kept++] = s_events[i];
+		}
+	}
+	s_numberEvents = kept;
+	for (unsigned int i = s_numberEvents / 2; i-- > 0;) {
+		eventSiftDown(i);
+	}
+
+	unsigned int tail = s_irqHead;
+	for (unsigned int i = s_irqHead; i != s_irqTail; i++) {
+		if (s_irqs[i % SIM_MAX_PENDING_IRQS].su != su) {
+			s_irqs[tail++ % SIM_MAX_PENDING_IRQS] = s_irqs[i % SIM_MAX_PENDING_IRQS];
+		}
+	}
+	s_irqTail = tail;
+
+	free(su->rxPending);
+	su->rxPending = NULL;
+	su->rxPendingCapacity = 0;
+	su->rxPendingHead = 0;
+	su->rxPendingTail = 0;
+
+	free(su->rxMemory);
+	su->rxMemory = NULL;
+	su->rxMemorySize = 0;
+	for (unsigned int i = 0; i < s_numberUarts; i++) {
+		if (s_uarts[i] == su) {
+			s_uarts[i] = s_uarts[--s_numberUarts];
+			break;
+		}
+	}
+}
+
+void SimUart_SetTxSink(struct SimUart *su, void (*sink)(void *context, const uint8_t *data, uint32_t length), void *context)
+{
+	su->txSink = sink;
+	su->txSinkContext = context;
+}
+
+/// let the peer start sending the pending bytes if it is not already sending
+static void rxStart(struct SimUart *su)
+{
+	if (!su->rxByteScheduled && !su->rxPeerPaused) {
+		su->rxByteScheduled = true;
+		// the start bit ends a running idle line or receiver timeout detection
+		su->rxGeneration++;
+		uint64_t start = s_now > su->rxLineFreeNs ? s_now : su->rxLineFreeNs;
+		schedule(start + su->byteTimeNs, SIM_EVENT_RX_BYTE, su, 0);
+	}
+}
+
+void SimUart_Feed(struct SimUart *su, const void *data, uint32_t length)
+{
+	if (length == 0) {
+		return;
+	}
+
+	if (su->rxPendingTail + length > su->rxPendingCapacity) {
+		uint32_t pending = su->rxPendingTail - su->rxPendingHead;
+		if (pending > 0) {
+			memmove(su->rxPending, su->rxPending + su->rxPendingHead, pending);
+		}
+		su->rxPendingHead = 0;
+		su->rxPendingTail = pending;
+		if (pending + length > su->rxPendingCapacity) {
+			su->rxPendingCapacity = 2 * (pending + length);
+			su->rxPending = realloc(su->rxPending, su->rxPendingCapacity);
+			if (su->rxPending == NULL) {
+				abort();
+			}
+		}
+	}
+	memcpy(su->rxPending + su->rxPendingTail, data, length);
+	su->rxPendingTail += length;
+	rxStart(su);
+}
+
+void SimUart_SetPeerPaused(struct SimUart *su, bool paused)
+{
+	su->rxPeerPaused = paused;
+	if (!paused && su->rxPendingHead != su->rxPendingTail) {
+		rxStart(su);
+	}
+}
+
+void SimUart_SetEcho(struct SimUart *su, bool echo)
+{
+	su->rxEcho = echo;
+}
+
+void SimUart_SetIrqHandler(struct SimUart *su, void (*handler)(UART_HandleTypeDef *huart))
+{
+	su->irqHandler = handler;
+}
+
+uint32_t SimUart_RxPending(const struct SimUart *su)
+{
+	return su->rxPendingTail - su->rxPendingHead;
+}
+
+void SimUart_InjectError(struct SimUart *su, uint32_t errorCode)
+{
+	raiseIrq(SIM_IRQ_UART_ERROR, su, errorCode);
+	if (!s_inInterrupt) {
+		serviceInterrupts();
+	}
+}
+
+int SimUart_Replay(struct SimUart *su, const void *trace, uint32_t length, double nsPerTick, unsigned int speedup)
+{
+	const uint8_t *records = trace;
+	if (speedup == 0) {
+		return -1;
+	}
+	for (uint32_t offset = 0; offset < length;) {
+		struct BufferedUartTraceRecord record;
+		if (length - offset < sizeof(record)) {
+			return -1;
+		}
+		memcpy(&record, records + offset, sizeof(record));
+		offset += sizeof(record);
+		if (length - offset < record.length) {
+			return -1;
+		}
+		offset += record.length;
+	}
+
+	su->replayTrace = records;
+	int scheduled = 0;
+	uint64_t ticks = 0;
+	uint32_t previous = 0;
+	for (uint32_t offset = 0; offset < length;) {
+		struct BufferedUartTraceRecord record;
+		memcpy(&record, records + offset, sizeof(record));
+		// the timestamps wrap around, only the distance to the previous record counts
+		if (offset > 0) {
+			ticks += record.time - previous;
+		}
+		previous = record.time;
+		if (record.type == BUFFERED_UART_TRACE_RX || record.type == BUFFERED_UART_TRACE_ERROR) {
+			schedule(s_now + (uint64_t)((double)ticks * nsPerTick / speedup), SIM_EVENT_RX_REPLAY, su, offset);
+			scheduled++;
+		}
+		offset += sizeof(record) + record.length;
+	}
+	return scheduled;
+}
+
+/// ==== HAL ====
+
+HAL_StatusTypeDef HAL_DMA_Init(DMA_HandleTypeDef *hdma)
+{
+	if (hdma == NULL) {
+		return HAL_ERROR;
+	}
+	hdma->State = HAL_DMA_STATE_READY;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_DMA_Start_IT(DMA_HandleTypeDef *hdma, uintptr_t SrcAddress, uintptr_t DstAddress, uint32_t DataLength)
+{
+	preemptionPoint();
+
+	if (hdma->State != HAL_DMA_STATE_READY) {
+		return HAL_BUSY;
+	}
+	if (DataLength == 0 || DataLength > SIM_MAX_DMA_LENGTH) {
+		return HAL_ERROR;
+	}
+
+	struct SimUart *su = simUartFromDma(hdma);
+	bool tx = hdma == &su->hdmatx;
+
+	hdma->State = HAL_DMA_STATE_BUSY;
+	hdma->ErrorCode = 0;
+	hdma->Instance->CNDTR = DataLength;
+	hdma->Instance->CPAR = tx ? DstAddress : SrcAddress;
+	hdma->Instance->CMAR = tx ? SrcAddress : DstAddress;
+	hdma->Instance->CCR |= DMA_CCR_TCIE | DMA_CCR_TEIE;
+	if (hdma->XferHalfCpltCallback != NULL) {
+		hdma->Instance->CCR |= DMA_CCR_HTIE;
+	} else {
+		hdma->Instance->CCR &= ~DMA_CCR_HTIE;
+	}
+	hdma->Instance->CCR |= DMA_CCR_EN;
+
+	if (tx) {
+		txStart(su, DataLength);
+	} else {
+		su->rxPosition = 0;
+	}
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_DMA_Abort(DMA_HandleTypeDef *hdma)
+{
+	if (hdma->State != HAL_DMA_STATE_BUSY) {
+		return HAL_ERROR;
+	}
+
+	hdma->Instance->CCR &= ~(DMA_CCR_EN | DMA_CCR_TCIE | DMA_CCR_HTIE | DMA_CCR_TEIE);
+	hdma->State = HAL_DMA_STATE_READY;
+
+	struct SimUart *su = simUartFromDma(hdma);
+	if (hdma == &su->hdmatx) {
+		su->txGeneration++;
+		if (su->lineFreeNs > s_now + su->byteTimeNs) {
+			su->lineFreeNs = s_now + su->byteTimeNs;
+		}
+	}
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size)
+{
+	preemptionPoint();
+
+	if (huart->gState != HAL_UART_STATE_READY) {
+		return HAL_BUSY;
+	}
+	if (pData == NULL || Size == 0) {
+		return HAL_ERROR;
+	}
+
+	huart->pTxBuffPtr = pData;
+	huart->TxXferSize = Size;
+	huart->TxXferCount = Size;
+	huart->ErrorCode = HAL_UART_ERROR_NONE;
+	huart->gState = HAL_UART_STATE_BUSY_TX;
+
+	huart->hdmatx->XferCpltCallback = uartDmaTransmitCplt;
+	huart->hdmatx->XferHalfCpltCallback = uartDmaTxHalfCplt;
+	huart->hdmatx->XferErrorCallback = NULL;
+	huart->hdmatx->XferAbortCallback = NULL;
+
+	if (HAL_DMA_Start_IT(huart->hdmatx, (uintptr_t)pData, (uintptr_t)&huart->Instance->TDR, Size) != HAL_OK) {
+		huart->ErrorCode = HAL_UART_ERROR_DMA;
+		huart->gState = HAL_UART_STATE_READY;
+		return HAL_ERROR;
+	}
+
+	huart->Instance->CR3 |= USART_CR3_DMAT;
+	return HAL_OK;
+}
+
+/// the driver enable output follows the transmission, DE is not modelled beyond USART_CR3_DEM
+HAL_StatusTypeDef HAL_RS485Ex_Init(UART_HandleTypeDef *huart, uint32_t Polarity, uint32_t AssertionTime, uint32_t DeassertionTime)
+{
+	(void)Polarity;
+	(void)AssertionTime;
+	(void)DeassertionTime;
+	huart->Instance->CR3 |= USART_CR3_DEM;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size)
+{
+	preemptionPoint();
+
+	if (huart->RxState != HAL_UART_STATE_READY) {
+		return HAL_BUSY;
+	}
+	if (pData == NULL || Size == 0) {
+		return HAL_ERROR;
+	}
+
+	if (s_dcache) {
+		struct SimUart *su = SIM_CONTAINER_OF(huart, struct SimUart, huart);
+		if (pData != huart->pRxBuffPtr || Size > su->rxMemorySize) {
+			// memory and cache agree on a new buffer
+			su->rxMemory = realloc(su->rxMemory, Size);
+			if (su->rxMemory == NULL) {
+				abort();
+			}
+			su->rxMemorySize = Size;
+			memcpy(su->rxMemory, pData, Size);
+		}
+	}
+
+	huart->ReceptionType = HAL_UART_RECEPTION_TOIDLE;
+	huart->pRxBuffPtr = pData;
+	huart->RxXferSize = Size;
+	huart->ErrorCode = HAL_UART_ERROR_NONE;
+	huart->RxState = HAL_UART_STATE_BUSY_RX;
+
+	huart->hdmarx->XferCpltCallback = uartDmaReceiveCplt;
+	huart->hdmarx->XferHalfCpltCallback = uartDmaRxHalfCplt;
+	huart->hdmarx->XferErrorCallback = NULL;
+	huart->hdmarx->XferAbortCallback = NULL;
+
+	if (HAL_DMA_Start_IT(huart->hdmarx, (uintptr_t)&huart->Instance->RDR, (uintptr_t)pData, Size) != HAL_OK) {
+		huart->ErrorCode = HAL_UART_ERROR_DMA;
+		huart->RxState = HAL_UART_STATE_READY;
+		return HAL_ERROR;
+	}
+
+	huart->Instance->CR3 |= USART_CR3_DMAR;
+	huart->Instance->ICR = USART_ICR_IDLECF;
+	huart->Instance->CR1 |= USART_CR1_IDLEIE;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_AbortTransmit(UART_HandleTypeDef *huart)
+{
+	preemptionPoint();
+
+	huart->Instance->CR1 &= ~USART_CR1_TCIE;
+	if (huart->Instance->CR3 & USART_CR3_DMAT) {
+		huart->Instance->CR3 &= ~USART_CR3_DMAT;
+	}
+	HAL_DMA_Abort(huart->hdmatx);
+	huart->TxXferCount = 0;
+	huart->gState = HAL_UART_STATE_READY;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_AbortReceive_IT(UART_HandleTypeDef *huart)
+{
+	preemptionPoint();
+
+	bool dma = (huart->Instance->CR3 & USART_CR3_DMAR) != 0;
+	huart->Instance->CR1 &= ~USART_CR1_IDLEIE;
+	huart->Instance->CR3 &= ~USART_CR3_DMAR;
+	if (dma) {
+		HAL_DMA_Abort(huart->hdmarx);
+	}
+
+	huart->RxXferCount = 0;
+	huart->ReceptionType = HAL_UART_RECEPTION_STANDARD;
+	huart->RxState = HAL_UART_STATE_READY;
+	HAL_UART_AbortReceiveCpltCallback(huart);
+	return HAL_OK;
+}
+
+HAL_UART_RxEventTypeTypeDef HAL_UARTEx_GetRxEventType(UART_HandleTypeDef *huart)
+{
+	return huart->RxEventType;
+}
+
+__attribute__((weak)) void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+{
+	(void)huart;
+}
+
+__attribute__((weak)) void HAL_UART_TxHalfCpltCallback(UART_HandleTypeDef *huart)
+{
+	(void)huart;
+}
+
+__attribute__((weak)) void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size)
+{
+	(void)huart;
+	(void)Size;
+}
+
+__attribute__((weak)) void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
+{
+	(void)huart;
+}
+
+__attribute__((weak)) void HAL_UART_AbortReceiveCpltCallback(UART_HandleTypeDef *huart)
+{
+	(void)huart;
+}
+
+uint32_t HAL_GetTick(void)
+{
+	preemptionPoint();
+	return (uint32_t)(s_now / 1000000U);
+}
+
+uint32_t Sim_CycleCounter(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)((uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec);
+}
+
+uint32_t Sim_LatencyTicks(void)
+{
+	return (uint32_t)Sim_Now();
+}
+
+void Sim_DCacheClean(uintptr_t address, int32_t size)
+{
+	s_dcacheStats.cleans++;
+	s_dcacheStats.cleanBytes += (uint64_t)size;
+	if (address % SIM_DCACHE_LINE_SIZE != 0 || size % SIM_DCACHE_LINE_SIZE != 0) {
+		s_dcacheStats.misaligned++;
+	}
+	unsigned int i = s_numberCleaned++ % SIM_DCACHE_CLEANED_RANGES;
+	s_cleanedStart[i] = address;
+	s_cleanedEnd[i] = address + (uintptr_t)size;
+}
+
+void Sim_DCacheInvalidate(uintptr_t address, int32_t size)
+{
+	s_dcacheStats.invalidates++;
+	s_dcacheStats.invalidateBytes += (uint64_t)size;
+	if (address % SIM_DCACHE_LINE_SIZE != 0 || size % SIM_DCACHE_LINE_SIZE != 0) {
+		s_dcacheStats.misaligned++;
+	}
+
+	uintptr_t end = address + (uintptr_t)size;
+	for (unsigned int i = 0; i < s_numberUarts; i++) {
+		struct SimUart *su = s_uarts[i];
+		uintptr_t buffer = (uintptr_t)su->huart.pRxBuffPtr;
+		if (su->rxMemory != NULL && address >= buffer && end <= buffer + su->rxMemorySize) {
+			if (s_dcache) {
+				memcpy((uint8_t *)address, su->rxMemory + (address - buffer), (size_t)size);
+			}
+			return;
+		}
+	}
+	// the lines may hold data which the CPU wrote and did not clean yet, it is lost
+	s_dcacheStats.outside++;
+}
+
+uint32_t __get_PRIMASK(void)
+{
+	return s_primask;
+}
+
+/// the exception number, 0 in thread code, the first external interrupt while a simulated interrupt runs
+uint32_t __get_IPSR(void)
+{
+	return s_inInterrupt ? 16U : 0U;
+}
+
+void __set_PRIMASK(uint32_t priMask)
+{
+	uint32_t masked = s_primask;
+	if (s_primaskHook != NULL && !masked && (priMask & 1U)) {
+		s_primaskHook(true);
+	}
+	s_primask = priMask & 1U;
+	if (s_primaskHook != NULL && masked && !s_primask) {
+		s_primaskHook(false);
+	}
+	if (!s_primask) {
+		serviceInterrupts();
+	}
+}
+
+void Error_Handler(void)
+{
+	fprintf(stderr, "hal_sim: Error_Handler called at %llu ns\n", (unsigned long long)s_now);
+	abort();
+}
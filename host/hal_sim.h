@@ -0,0 +1,211 @@
+/**
+
+hal_sim
+discrete event simulation of an STM32 USART with one TX and one RX DMA channel, used to run
+stm32_buffered_uart.c on a development machine. Time is virtual (nanoseconds) and only advances
+through Sim_Advance / Sim_RunNextEvent, so every run is reproducible.
+
+The model covers
+- the wire: one frame per byte at the configured baud rate, start/stop/parity bits included
+- TX DMA: half/complete transfer interrupts, followed by the USART transfer complete interrupt
+  once the last stop bit left the shift register (this is when the HAL reports TxCplt). The data
+  is taken when the transfer starts, memory of a running transfer must not change
+- RX DMA: circular or normal mode, half/complete transfer interrupts and IDLE line detection
+  exactly like HAL_UARTEx_ReceiveToIdle_DMA reports them
+- USART receiver timeout (RTOF) and character match (CMF) interrupts
+- a peer which can be paused by flow control (RTS or XOFF of the application)
+- a half-duplex transceiver (RS-485) which echoes the transmitted bytes into the receiver
+- replay of the reception of a trace recorded by BUFFERED_UART_TRACE, event by event
+- interrupt masking via __set_PRIMASK and ISR preemption of thread code: pending interrupts are
+  serviced at every HAL call from thread context, optionally together with a user supplied
+  "foreign" interrupt that can be used to call the driver reentrantly
+
+
+MIT License
+
+Copyright (c) 2022 Jonas Rahlf
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "main.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SIM_MAX_DMA_LENGTH 0xFFFF
+
+struct SimUartStats {
+	uint64_t txBytes;			///< bytes of completed TX DMA transfers
+	uint64_t txTransfers;		///< number of started TX DMA transfers
+	uint64_t txBusyNs;			///< time the TX line was busy
+	uint64_t txGaps;			///< number of TX DMA transfers that followed a previous one
+	uint64_t txGapNs;			///< accumulated idle time on the line in front of these transfers
+	uint64_t txMaxGapNs;
+	uint64_t txModifiedBytes;	///< bytes that changed in memory while their TX DMA transfer was running
+	uint64_t rxBytes;			///< bytes written into memory by the RX DMA
+	uint64_t rxLostBytes;		///< bytes that arrived while no reception was armed
+	uint64_t rxHalfEvents;
+	uint64_t rxCpltEvents;
+	uint64_t rxIdleEvents;
+	uint64_t rxTimeoutEvents;	///< receiver timeout interrupts (RTOF)
+	uint64_t rxMatchEvents;		///< character match interrupts (CMF)
+	uint64_t rxUnhandledIrqs;	///< RTOF/CMF interrupts which were left to the HAL
+	uint64_t rxEchoBytes;		///< echoed tx bytes which reached the receiver, see SimUart_SetEcho
+	uint64_t rxEchoIgnored;		///< echoed tx bytes which arrived while the receiver was disabled
+	uint64_t interrupts;		///< all serviced interrupts of this uart (USART and both DMA channels)
+};
+
+/// see Sim_SetDCache
+struct SimDCacheStats {
+	uint64_t cleans;
+	uint64_t cleanBytes;
+	uint64_t invalidates;
+	uint64_t invalidateBytes;
+	uint64_t misaligned;		///< operations whose address or size is not a multiple of the cache line
+	uint64_t outside;			///< invalidations which are not within an RX DMA buffer and discard unrelated data
+	uint64_t txUncleanedBytes;	///< bytes of TX DMA transfers which were not cleaned right before they started
+};
+
+struct SimUart {
+	UART_HandleTypeDef huart;
+	DMA_HandleTypeDef hdmatx;
+	DMA_HandleTypeDef hdmarx;
+	USART_TypeDef regs;
+	DMA_Channel_TypeDef txChannel;
+	DMA_Channel_TypeDef rxChannel;
+
+	uint64_t byteTimeNs;
+	uint64_t bitTimeNs;
+	struct SimUartStats stats;
+
+	// transmitter
+	uint64_t lineFreeNs;			///< time at which the last queued frame left the wire
+	uint64_t txEndNs;				///< end of the current DMA transfer on the wire
+	uint32_t txGeneration;			///< invalidates scheduled events on abort
+	uint8_t txData[SIM_MAX_DMA_LENGTH];	///< memory of the running transfer at its start
+	void (*txSink)(void *context, const uint8_t *data, uint32_t length);
+	void *txSinkContext;
+
+	// receiver
+	uint8_t *rxPending;				///< bytes sent by the peer that are not yet on the wire
+	uint32_t rxPendingHead;
+	uint32_t rxPendingTail;
+	uint32_t rxPendingCapacity;
+	bool rxByteScheduled;
+	bool rxPeerPaused;				///< see SimUart_SetPeerPaused
+	bool rxEcho;					///< see SimUart_SetEcho
+	uint64_t rxLineFreeNs;
+	uint32_t rxGeneration;			///< invalidates scheduled idle detection on new data
+	uint32_t rxPosition;			///< DMA write index into pRxBuffPtr
+	uint8_t *rxMemory;				///< memory behind the data cache for pRxBuffPtr, see Sim_SetDCache
+	uint32_t rxMemorySize;
+	void (*irqHandler)(UART_HandleTypeDef *huart);
+	const uint8_t *replayTrace;		///< see SimUart_Replay
+};
+
+/// reset virtual time and drop all scheduled events
+void Sim_Reset(void);
+/// current virtual time in nanoseconds
+uint64_t Sim_Now(void);
+/// advance virtual time by ns and service everything that happens until then
+void Sim_Advance(uint64_t ns);
+/// advance virtual time to the next scheduled event and service it, false if nothing is scheduled
+bool Sim_RunNextEvent(void);
+/// time of the next scheduled event or UINT64_MAX
+uint64_t Sim_NextEventTime(void);
+/// true while a simulated interrupt handler is running
+bool Sim_InInterrupt(void);
+/// latency between a DMA start request in software and the first byte on the wire, default 0
+void Sim_SetDmaStartLatency(uint64_t ns);
+/**
+ * Model a data cache (BUFFERED_UART_DCACHE): the RX DMA writes into memory which the CPU sees only once
+ * Sim_DCacheInvalidate discarded the cached lines, and every TX DMA transfer has to be cleaned by
+ * Sim_DCacheClean right before it starts. Not changed by Sim_Reset, (re)enabling it clears the statistics
+ */
+void Sim_SetDCache(bool enabled);
+const struct SimDCacheStats * Sim_GetDCacheStats(void);
+/**
+ * Inject a foreign interrupt that preempts thread code every period-th preemption point
+ * (HAL calls from thread context with interrupts enabled). period 0 disables it
+ */
+void Sim_SetPreemptionHook(void (*hook)(void *context), void *context, unsigned int period);
+/**
+ * Called when __set_PRIMASK masks (before) or unmasks (after) the interrupts, e.g. to block the
+ * signals which act as interrupts of a host test as well. NULL disables it
+ */
+void Sim_SetPrimaskHook(void (*hook)(bool masked));
+
+/**
+ * Initialize a simulated uart. The returned handle &su->huart can be passed to BufferedUart_Init.
+ * TX DMA defaults to normal mode, RX DMA to circular mode (see doc/dma_tx.png and doc/dma_rx.png)
+ */
+void SimUart_Init(struct SimUart *su, uint32_t baudRate);
+void SimUart_DeInit(struct SimUart *su);
+/// receive every transmitted block as soon as its DMA transfer completed
+void SimUart_SetTxSink(struct SimUart *su, void (*sink)(void *context, const uint8_t *data, uint32_t length), void *context);
+/// let the peer send data, bytes go out back to back after anything that is still pending
+void SimUart_Feed(struct SimUart *su, const void *data, uint32_t length);
+/**
+ * Stop or resume the peer like its CTS input or a received XOFF/XON would: a frame which is already
+ * on the wire is still received, pending bytes follow once resumed
+ */
+void SimUart_SetPeerPaused(struct SimUart *su, bool paused);
+/**
+ * Echo every transmitted byte into the receiver once its stop bit left the wire, like an RS-485
+ * transceiver whose receiver stays enabled while it drives the bus. The echo is ignored while
+ * USART_CR1_RE is cleared
+ */
+void SimUart_SetEcho(struct SimUart *su, bool echo);
+/**
+ * Code of the application's USARTx_IRQHandler which runs in front of HAL_UART_IRQHandler, e.g.
+ * BufferedUart_UART_IRQHandler. Called for receiver timeout and character match interrupts
+ */
+void SimUart_SetIrqHandler(struct SimUart *su, void (*handler)(UART_HandleTypeDef *huart));
+/// number of fed bytes that did not arrive yet
+uint32_t SimUart_RxPending(const struct SimUart *su);
+/// raise a UART error interrupt (HAL_UART_ERROR_xxx), ORE aborts a running DMA reception like the HAL does
+void SimUart_InjectError(struct SimUart *su, uint32_t errorCode);
+/**
+ * Replay the reception of a trace recorded by BUFFERED_UART_TRACE (the data of BufferedUart_TraceRead).
+ * At the time of every rx record the RX DMA writes its bytes and the recorded event is raised (DMA half
+ * or complete transfer, IDLE, a receiver timeout or character match as IDLE), so the driver sees the
+ * same chunks as the original. Bytes reported by BufferedUart_RxPoll are written without an event, the
+ * application's own polls or the next event report them. Error records raise the recorded error, TX
+ * and dropped records are skipped. The first record is replayed now, the others at their original
+ * distance divided by speedup. The trace must stay valid until it was replayed
+ * @param[in]	nsPerTick	duration of a tick of BUFFERED_UART_TRACE_TIMESTAMP
+ * @return		number of scheduled records, -1 if the trace is truncated or speedup is 0
+ */
+int SimUart_Replay(struct SimUart *su, const void *trace, uint32_t length, double nsPerTick, unsigned int speedup);
+/// time one frame (one byte) occupies the wire
+static inline uint64_t SimUart_ByteTimeNs(const struct SimUart *su)
+{
+	return su->byteTimeNs;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,242 @@
+/**
+
+host simulator replacement for the CubeMX generated main.h
+provides just enough of the ST HAL types, registers and functions to build stm32_buffered_uart.c on a
+development machine. The behaviour behind these definitions is implemented in hal_sim.c
+
+
+MIT License
+
+Copyright (c) 2022 Jonas Rahlf
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define USE_HAL_UART_REGISTER_CALLBACKS 0U
+
+typedef enum {
+	HAL_OK       = 0x00U,
+	HAL_ERROR    = 0x01U,
+	HAL_BUSY     = 0x02U,
+	HAL_TIMEOUT  = 0x03U
+} HAL_StatusTypeDef;
+
+/// ==== DMA ====
+
+typedef struct {
+	volatile uint32_t CCR;
+	volatile uint32_t CNDTR;
+	volatile uintptr_t CPAR;
+	volatile uintptr_t CMAR;
+} DMA_Channel_TypeDef;
+
+#define DMA_CCR_EN		(1U << 0)
+#define DMA_CCR_TCIE	(1U << 1)
+#define DMA_CCR_HTIE	(1U << 2)
+#define DMA_CCR_TEIE	(1U << 3)
+
+#define DMA_IT_TC		DMA_CCR_TCIE
+#define DMA_IT_HT		DMA_CCR_HTIE
+#define DMA_IT_TE		DMA_CCR_TEIE
+
+#define DMA_NORMAL		0x00000000U
+#define DMA_CIRCULAR	0x00000020U
+
+typedef enum {
+	HAL_DMA_STATE_RESET = 0x00U,
+	HAL_DMA_STATE_READY = 0x01U,
+	HAL_DMA_STATE_BUSY  = 0x02U
+} HAL_DMA_StateTypeDef;
+
+typedef struct {
+	uint32_t Mode;
+} DMA_InitTypeDef;
+
+typedef struct __DMA_HandleTypeDef {
+	DMA_Channel_TypeDef *Instance;
+	DMA_InitTypeDef Init;
+	volatile HAL_DMA_StateTypeDef State;
+	void *Parent;
+	void (* XferCpltCallback)(struct __DMA_HandleTypeDef *hdma);
+	void (* XferHalfCpltCallback)(struct __DMA_HandleTypeDef *hdma);
+	void (* XferErrorCallback)(struct __DMA_HandleTypeDef *hdma);
+	void (* XferAbortCallback)(struct __DMA_HandleTypeDef *hdma);
+	volatile uint32_t ErrorCode;
+} DMA_HandleTypeDef;
+
+#define __HAL_DMA_ENABLE_IT(__HANDLE__, __INTERRUPT__)	((__HANDLE__)->Instance->CCR |= (__INTERRUPT__))
+#define __HAL_DMA_DISABLE_IT(__HANDLE__, __INTERRUPT__)	((__HANDLE__)->Instance->CCR &= ~(__INTERRUPT__))
+#define __HAL_DMA_GET_COUNTER(__HANDLE__)				((__HANDLE__)->Instance->CNDTR)
+
+HAL_StatusTypeDef HAL_DMA_Init(DMA_HandleTypeDef *hdma);
+HAL_StatusTypeDef HAL_DMA_Start_IT(DMA_HandleTypeDef *hdma, uintptr_t SrcAddress, uintptr_t DstAddress, uint32_t DataLength);
+HAL_StatusTypeDef HAL_DMA_Abort(DMA_HandleTypeDef *hdma);
+
+/// ==== USART ====
+
+typedef struct {
+	volatile uint32_t CR1;
+	volatile uint32_t CR2;
+	volatile uint32_t CR3;
+	volatile uint32_t BRR;
+	volatile uint32_t RTOR;
+	volatile uint32_t ISR;
+	volatile uint32_t ICR;
+	volatile uint32_t RDR;
+	volatile uint32_t TDR;
+} USART_TypeDef;
+
+#define USART_CR1_UE		(1U << 0)
+#define USART_CR1_RE		(1U << 2)
+#define USART_CR1_TE		(1U << 3)
+#define USART_CR1_IDLEIE	(1U << 4)
+#define USART_CR1_TCIE		(1U << 6)
+#define USART_CR1_CMIE		(1U << 14)
+#define USART_CR1_RTOIE		(1U << 26)
+
+#define USART_CR2_RTOEN		(1U << 23)
+#define USART_CR2_ADD_Pos	(24U)
+#define USART_CR2_ADD		(0xFFU << USART_CR2_ADD_Pos)
+
+#define USART_CR3_DMAR		(1U << 6)
+#define USART_CR3_DMAT		(1U << 7)
+#define USART_CR3_DEM		(1U << 14)
+
+#define USART_ISR_IDLE		(1U << 4)
+#define USART_ISR_TC		(1U << 6)
+#define USART_ISR_RTOF		(1U << 11)
+#define USART_ISR_CMF		(1U << 17)
+
+#define USART_ICR_IDLECF	(1U << 4)
+#define USART_ICR_TCCF		(1U << 6)
+#define USART_ICR_RTOCF		(1U << 11)
+#define USART_ICR_CMCF		(1U << 17)
+
+#define USART_TDR_TDR		0x01FFU
+
+#define USART_RTOR_RTO		0x00FFFFFFU
+
+#define UART_WORDLENGTH_8B	0x00000000U
+#define UART_STOPBITS_1		0x00000000U
+#define UART_STOPBITS_2		0x00002000U
+#define UART_PARITY_NONE	0x00000000U
+#define UART_PARITY_EVEN	0x00000400U
+
+#define UART_DE_POLARITY_HIGH	0x00000000U
+
+typedef struct {
+	uint32_t BaudRate;
+	uint32_t WordLength;
+	uint32_t StopBits;
+	uint32_t Parity;
+} UART_InitTypeDef;
+
+typedef enum {
+	HAL_UART_STATE_RESET      = 0x00U,
+	HAL_UART_STATE_READY      = 0x20U,
+	HAL_UART_STATE_BUSY       = 0x24U,
+	HAL_UART_STATE_BUSY_TX    = 0x21U,
+	HAL_UART_STATE_BUSY_RX    = 0x22U,
+	HAL_UART_STATE_BUSY_TX_RX = 0x23U,
+	HAL_UART_STATE_ERROR      = 0xE0U
+} HAL_UART_StateTypeDef;
+
+#define HAL_UART_ERROR_NONE		0x00000000U
+#define HAL_UART_ERROR_PE		0x00000001U
+#define HAL_UART_ERROR_NE		0x00000002U
+#define HAL_UART_ERROR_FE		0x00000004U
+#define HAL_UART_ERROR_ORE		0x00000008U
+#define HAL_UART_ERROR_DMA		0x00000010U
+#define HAL_UART_ERROR_RTO		0x00000020U
+
+#define HAL_UART_RECEPTION_STANDARD		0x00000000U
+#define HAL_UART_RECEPTION_TOIDLE		0x00000001U
+
+typedef uint32_t HAL_UART_RxEventTypeTypeDef;
+#define HAL_UART_RXEVENT_TC		0x00000000U
+#define HAL_UART_RXEVENT_HT		0x00000001U
+#define HAL_UART_RXEVENT_IDLE	0x00000002U
+
+typedef struct __UART_HandleTypeDef {
+	USART_TypeDef *Instance;
+	UART_InitTypeDef Init;
+	const uint8_t *pTxBuffPtr;
+	uint16_t TxXferSize;
+	volatile uint16_t TxXferCount;
+	uint8_t *pRxBuffPtr;
+	uint16_t RxXferSize;
+	volatile uint16_t RxXferCount;
+	volatile uint32_t ReceptionType;
+	volatile HAL_UART_RxEventTypeTypeDef RxEventType;
+	DMA_HandleTypeDef *hdmatx;
+	DMA_HandleTypeDef *hdmarx;
+	volatile HAL_UART_StateTypeDef gState;
+	volatile HAL_UART_StateTypeDef RxState;
+	volatile uint32_t ErrorCode;
+} UART_HandleTypeDef;
+
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_UART_AbortTransmit(UART_HandleTypeDef *huart);
+HAL_StatusTypeDef HAL_UART_AbortReceive_IT(UART_HandleTypeDef *huart);
+HAL_UART_RxEventTypeTypeDef HAL_UARTEx_GetRxEventType(UART_HandleTypeDef *huart);
+HAL_StatusTypeDef HAL_RS485Ex_Init(UART_HandleTypeDef *huart, uint32_t Polarity, uint32_t AssertionTime, uint32_t DeassertionTime);
+
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart);
+void HAL_UART_TxHalfCpltCallback(UART_HandleTypeDef *huart);
+void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size);
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart);
+void HAL_UART_AbortReceiveCpltCallback(UART_HandleTypeDef *huart);
+
+/// ==== core ====
+
+/// the host has no DWT, the statistics of the driver (BUFFERED_UART_STATISTICS) count host nanoseconds instead of cycles
+uint32_t Sim_CycleCounter(void);
+#define BUFFERED_UART_CYCLE_COUNTER() Sim_CycleCounter()
+#define BUFFERED_UART_CYCLE_COUNTER_INIT() do { } while (0)
+/// data waits in the queues in virtual time, so BUFFERED_UART_LATENCY counts virtual nanoseconds
+uint32_t Sim_LatencyTicks(void);
+#define BUFFERED_UART_LATENCY_TICKS() Sim_LatencyTicks()
+/// trace records of BUFFERED_UART_TRACE are stamped in virtual nanoseconds, so SimUart_Replay reproduces their timing
+#define BUFFERED_UART_TRACE_TIMESTAMP() Sim_LatencyTicks()
+/// the cache maintenance of BUFFERED_UART_DCACHE goes to the data cache model of the simulation (Sim_SetDCache)
+void Sim_DCacheClean(uintptr_t address, int32_t size);
+void Sim_DCacheInvalidate(uintptr_t address, int32_t size);
+#define BUFFERED_UART_DCACHE_CLEAN(address, size) Sim_DCacheClean(address, (int32_t)(size))
+#define BUFFERED_UART_DCACHE_INVALIDATE(address, size) Sim_DCacheInvalidate(address, (int32_t)(size))
+
+uint32_t HAL_GetTick(void);
+uint32_t __get_PRIMASK(void);
+uint32_t __get_IPSR(void);
+void __set_PRIMASK(uint32_t priMask);
+void Error_Handler(void);
+
+#ifdef __cplusplus
+}
+#endif
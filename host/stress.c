@@ -0,0 +1,510 @@
+/**
+
+stress
+multi producer stress test of the BUFFERED_UART_LOCKFREE transmit path
+
+Three producers share one buffered uart: the main loop (thread context) and two POSIX interval
+timer signals which act as interrupts of different priority. SIGPROF may preempt SIGALRM and both
+may preempt the main loop at any instruction, including in the middle of a reservation, copy or
+commit. The simulated uart is only advanced from the main loop with both signals blocked. The
+signals are blocked as well while the driver disables interrupts via __set_PRIMASK.
+
+Every message carries its producer, a per producer sequence number and a checksum. The receiving
+end of the wire checks that no message is torn, interleaved, lost or duplicated and that every
+producer's messages arrive in order.
+
+The main loop writes every other message via BufferedUart_TxReserve into a reservation of the
+maximum message size and commits only the message. If the unused end can not be given back, it
+commits the filler behind the message as well. With BUFFERED_UART_TX_ZEROCOPY the signal handlers
+send some of their messages via BufferedUart_TransmitZeroCopy. The messages of the signal handlers
+must arrive behind all messages the main loop reserved before, also while its reservation is still
+open.
+
+usage: buffered_uart_stress [--quick] [--duration ms]
+
+
+MIT License
+
+Copyright (c) 2022 Jonas Rahlf
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "hal_sim.h"
+#include "stm32_buffered_uart.h"
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#ifndef BUFFERED_UART_LOCKFREE
+	#error "the stress test has to be built with BUFFERED_UART_LOCKFREE"
+#endif
+
+#define STRESS_PRODUCERS 3
+#define STRESS_RING_SIZE 256
+#define STRESS_MAX_PAYLOAD 40
+#define STRESS_HEADER_SIZE 4			// producer, sequence (2 bytes), payload length
+#define STRESS_MAX_MESSAGE (STRESS_HEADER_SIZE + STRESS_MAX_PAYLOAD + 1)
+#define STRESS_FILLER 0xFF				// committed unused end of a reservation, skipped between messages
+#define STRESS_ORDER_SLOTS 256			// more than the messages of a producer in flight
+#define STRESS_ZEROCOPY_BUFFERS 8
+
+struct Producer {
+	const char *name;
+	uint32_t random;
+	uint16_t sequence;					///< sequence number of the next message
+	uint64_t accepted;
+	uint64_t rejected;
+	uint32_t txSequence;				///< BufferedUart_TransmitSequenced result of the last accepted message
+	uint64_t preemptions;				///< entries while a lower priority producer was inside BufferedUart_Transmit
+	uint64_t zeroCopies;
+	volatile sig_atomic_t transmitting;
+	volatile sig_atomic_t reserved;		///< a BufferedUart_TxReserve reservation holds message number reservedMessages
+	uint64_t reservedMessages;
+	uint64_t threadMessages[STRESS_ORDER_SLOTS];	///< messages of the main loop which are queued in front of sequence
+};
+
+#ifdef BUFFERED_UART_TX_ZEROCOPY
+/// message sent via BufferedUart_TransmitZeroCopy, in use until its CompletionHandler was called
+struct ZeroCopyBuffer {
+	uint8_t message[STRESS_MAX_MESSAGE];
+	volatile sig_atomic_t busy;
+};
+#endif
+
+/// reassembles the messages from the byte stream on the wire
+struct Receiver {
+	uint8_t message[STRESS_MAX_MESSAGE];
+	unsigned int length;
+	uint16_t expected[STRESS_PRODUCERS];
+	uint64_t received[STRESS_PRODUCERS];
+	uint64_t bytes;
+	uint64_t fillerBytes;
+	uint64_t errors;
+};
+
+static struct SimUart s_sim;
+static struct BufferedUart s_uart;
+static char s_txBuffer[STRESS_RING_SIZE];
+static struct Producer s_producers[STRESS_PRODUCERS] = {
+	{ .name = "thread", .random = 0x12345678 },
+	{ .name = "SIGALRM", .random = 0x9E3779B9 },
+	{ .name = "SIGPROF", .random = 0x7F4A7C15 },
+};
+static struct Receiver s_receiver;
+#ifdef BUFFERED_UART_TX_ZEROCOPY
+static struct ZeroCopyBuffer s_zeroCopyBuffers[STRESS_PRODUCERS][STRESS_ZEROCOPY_BUFFERS];
+#endif
+
+static uint32_t nextRandom(uint32_t *state)
+{
+	// xorshift32, async signal safe
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+static uint8_t payloadByte(unsigned int producer, uint16_t sequence, unsigned int index)
+{
+	return (uint8_t)(sequence * 7U + producer * 31U + index);
+}
+
+static unsigned int encodeMessage(uint8_t *message, unsigned int producer, uint16_t sequence, unsigned int payloadLength)
+{
+	unsigned int length = 0;
+	message[length++] = (uint8_t)producer;
+	message[length++] = (uint8_t)sequence;
+	message[length++] = (uint8_t)(sequence >> 8);
+	message[length++] = (uint8_t)payloadLength;
+	for (unsigned int i = 0; i < payloadLength; i++) {
+		message[length++] = payloadByte(producer, sequence, i);
+	}
+
+	uint8_t checksum = 0;
+	for (unsigned int i = 0; i < length; i++) {
+		checksum += message[i];
+	}
+	message[length++] = checksum;
+
+	return length;
+}
+
+/// messages of the main loop which were reserved when a signal handler queues its message
+static uint64_t threadMessagesQueued(void)
+{
+	const struct Producer *thread = &s_producers[0];
+	uint64_t messages = thread->reserved ? thread->reservedMessages : thread->accepted;
+	atomic_signal_fence(memory_order_acquire);
+	return messages;
+}
+
+/// the message in the reservation of a maximum size message, the unused end is committed as filler if it can not be given back
+static HAL_StatusTypeDef transmitReserved(struct Producer *producer, const uint8_t *message, unsigned int length, uint32_t *txSequence)
+{
+	struct BufferedUartSpan first;
+	struct BufferedUartSpan second;
+	if (BufferedUart_TxReserve(&s_uart, STRESS_MAX_MESSAGE, &first, &second) != HAL_OK) {
+		return HAL_BUSY;
+	}
+	producer->reservedMessages = producer->accepted + 1;
+	atomic_signal_fence(memory_order_release);
+	producer->reserved = 1;
+
+	uint8_t reservation[STRESS_MAX_MESSAGE];
+	memcpy(reservation, message, length);
+	memset(reservation + length, STRESS_FILLER, sizeof(reservation) - length);
+	memcpy(first.data, reservation, first.length);
+	memcpy(second.data, reservation + first.length, second.length);
+	if (BufferedUart_TxCommit(&s_uart, length) != HAL_OK) {
+		BufferedUart_TxCommit(&s_uart, STRESS_MAX_MESSAGE);
+	}
+	*txSequence = BufferedUart_GetTxSequence(&s_uart);
+	return HAL_OK;
+}
+
+#ifdef BUFFERED_UART_TX_ZEROCOPY
+static void zeroCopyCompleted(struct BufferedUart *uart, const void *data, unsigned int length)
+{
+	(void)uart;
+	(void)length;
+	((struct ZeroCopyBuffer *)data)->busy = 0;
+}
+
+/// HAL_ERROR if all zero copy buffers of the producer are in use
+static HAL_StatusTypeDef transmitZeroCopy(unsigned int id, const uint8_t *message, unsigned int length)
+{
+	for (unsigned int i = 0; i < STRESS_ZEROCOPY_BUFFERS; i++) {
+		struct ZeroCopyBuffer *buffer = &s_zeroCopyBuffers[id][i];
+		if (!buffer->busy) {
+			memcpy(buffer->message, message, length);
+			buffer->busy = 1;
+			HAL_StatusTypeDef result = BufferedUart_TransmitZeroCopy(&s_uart, buffer->message, length, zeroCopyCompleted);
+			if (result != HAL_OK) {
+				buffer->busy = 0;
+			}
+			return result;
+		}
+	}
+	return HAL_ERROR;
+}
+#endif
+
+static void produce(unsigned int id, unsigned int count)
+{
+	struct Producer *producer = &s_producers[id];
+	for (unsigned int p = 0; p < id; p++) {
+		if (s_producers[p].transmitting) {
+			producer->preemptions++;
+		}
+	}
+
+	for (unsigned int i = 0; i < count; i++) {
+		uint8_t message[STRESS_MAX_MESSAGE];
+		unsigned int length = encodeMessage(message, id, producer->sequence, nextRandom(&producer->random) % (STRESS_MAX_PAYLOAD + 1));
+		uint32_t mode = nextRandom(&producer->random);
+		if (id > 0) {
+			producer->threadMessages[producer->sequence % STRESS_ORDER_SLOTS] = threadMessagesQueued();
+		}
+
+		producer->transmitting = 1;
+		uint32_t txSequence = producer->txSequence;
+		HAL_StatusTypeDef result = HAL_ERROR;
+		if (id == 0 && mode % 2 == 0) {
+			result = transmitReserved(producer, message, length, &txSequence);
+		}
+#ifdef BUFFERED_UART_TX_ZEROCOPY
+		if (id > 0 && mode % 4 == 0) {
+			result = transmitZeroCopy(id, message, length);
+			if (result == HAL_OK) {
+				producer->zeroCopies++;
+			}
+		}
+#endif
+		if (result == HAL_ERROR) {
+			result = BufferedUart_TransmitSequenced(&s_uart, message, length, &txSequence);
+		}
+		producer->transmitting = 0;
+
+		if (result == HAL_OK) {
+			producer->txSequence = txSequence;
+			producer->sequence++;
+			producer->accepted++;
+		} else {
+			producer->rejected++;
+		}
+		atomic_signal_fence(memory_order_release);
+		producer->reserved = 0;
+	}
+}
+
+static void onAlarm(int signal)
+{
+	(void)signal;
+	produce(1, 1 + nextRandom(&s_producers[1].random) % 3);
+}
+
+static void onProfile(int signal)
+{
+	(void)signal;
+	produce(2, 1 + nextRandom(&s_producers[2].random) % 2);
+}
+
+static void receiveMessage(struct Receiver *receiver)
+{
+	uint8_t checksum = 0;
+	for (unsigned int i = 0; i < receiver->length - 1; i++) {
+		checksum += receiver->message[i];
+	}
+
+	unsigned int producer = receiver->message[0];
+	uint16_t sequence = receiver->message[1] | (receiver->message[2] << 8);
+	if (checksum != receiver->message[receiver->length - 1] || sequence != receiver->expected[producer]) {
+		receiver->errors++;
+		return;
+	}
+	if (producer > 0 && receiver->received[0] < s_producers[producer].threadMessages[sequence % STRESS_ORDER_SLOTS]) {
+		// overtook a message of the main loop which was reserved before
+		receiver->errors++;
+		return;
+	}
+	for (unsigned int i = 0; i < receiver->message[3]; i++) {
+		if (receiver->message[STRESS_HEADER_SIZE + i] != payloadByte(producer, sequence, i)) {
+			receiver->errors++;
+			return;
+		}
+	}
+
+	receiver->expected[producer]++;
+	receiver->received[producer]++;
+}
+
+static void txSink(void *context, const uint8_t *data, uint32_t length)
+{
+	struct Receiver *receiver = context;
+	receiver->bytes += length;
+
+	for (uint32_t i = 0; i < length; i++) {
+		if (receiver->errors > 0) {
+			// framing is lost after an error
+			return;
+		}
+
+		if (receiver->length == 0 && data[i] == STRESS_FILLER) {
+			receiver->fillerBytes++;
+			continue;
+		}
+		receiver->message[receiver->length++] = data[i];
+		if (receiver->length == 1 && data[i] >= STRESS_PRODUCERS) {
+			receiver->errors++;
+		} else if (receiver->length == STRESS_HEADER_SIZE && data[i] > STRESS_MAX_PAYLOAD) {
+			receiver->errors++;
+		} else if (receiver->length > STRESS_HEADER_SIZE && receiver->length == STRESS_HEADER_SIZE + receiver->message[3] + 1U) {
+			receiveMessage(receiver);
+			receiver->length = 0;
+		}
+	}
+}
+
+static void blockSignals(bool block)
+{
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGALRM);
+	sigaddset(&set, SIGPROF);
+	sigprocmask(block ? SIG_BLOCK : SIG_UNBLOCK, &set, NULL);
+}
+
+static sigset_t s_unmaskedSignals;
+
+/// the signals are the interrupts of this test, so PRIMASK masks them as well
+static void maskSignals(bool masked)
+{
+	if (masked) {
+		sigset_t set;
+		sigemptyset(&set);
+		sigaddset(&set, SIGALRM);
+		sigaddset(&set, SIGPROF);
+		sigprocmask(SIG_BLOCK, &set, &s_unmaskedSignals);
+	} else {
+		sigprocmask(SIG_SETMASK, &s_unmaskedSignals, NULL);
+	}
+}
+
+static void installHandler(int signal, void (*handler)(int), int masked)
+{
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = handler;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	if (masked != 0) {
+		sigaddset(&action.sa_mask, masked);
+	}
+	sigaction(signal, &action, NULL);
+}
+
+static void startTimer(int which, long periodUs)
+{
+	struct itimerval timer;
+	timer.it_interval.tv_sec = 0;
+	timer.it_interval.tv_usec = periodUs;
+	timer.it_value = timer.it_interval;
+	setitimer(which, &timer, NULL);
+}
+
+static uint64_t hostMs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000ULL + (uint64_t)ts.tv_nsec / 1000000ULL;
+}
+
+/// advance the simulation, the simulator must not be entered by the signal handlers meanwhile
+static void runEvents(bool untilIdle)
+{
+	blockSignals(true);
+	while (Sim_RunNextEvent() && untilIdle) {
+	}
+	blockSignals(false);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int durationMs = 2000;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--quick") == 0) {
+			durationMs = 300;
+		} else if (strcmp(argv[i], "--duration") == 0 && i + 1 < argc) {
+			durationMs = (unsigned int)atoi(argv[++i]);
+		} else {
+			fprintf(stderr, "usage: %s [--quick] [--duration ms]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	Sim_Reset();
+	Sim_SetPrimaskHook(maskSignals);
+	SimUart_Init(&s_sim, 1000000);
+	SimUart_SetTxSink(&s_sim, txSink, &s_receiver);
+	if (BufferedUart_Init(&s_uart, &s_sim.huart, BUFFERED_UART_TX, s_txBuffer, sizeof(s_txBuffer), NULL, 0) != HAL_OK) {
+		fprintf(stderr, "BufferedUart_Init failed\n");
+		return EXIT_FAILURE;
+	}
+
+	// SIGPROF has the higher priority: it preempts SIGALRM, but not the other way round
+	installHandler(SIGALRM, onAlarm, 0);
+	installHandler(SIGPROF, onProfile, SIGALRM);
+	startTimer(ITIMER_REAL, 50);
+	startTimer(ITIMER_PROF, 70);
+
+	// every few messages the transmission runs idle, so that the next producer (maybe preempting
+	// another one) starts the DMA itself instead of the TxCplt callback
+	uint32_t random = 0xC0FFEE;
+	uint64_t end = hostMs() + durationMs;
+	produce(0, 1);
+	// sequence numbers are 32 bit byte counts, the first one stays sent although the queue positions wrap
+	uint32_t firstSequence = s_producers[0].txSequence;
+	while (hostMs() < end) {
+		produce(0, 1);
+		runEvents(nextRandom(&random) % 8 == 0);
+		// the sequence number lies behind the message, even if other producers preempted its enqueue
+		if (BufferedUart_IsTxSent(&s_uart, s_producers[0].txSequence) && s_receiver.received[0] < s_producers[0].accepted) {
+			s_receiver.errors++;
+		}
+	}
+
+	startTimer(ITIMER_REAL, 0);
+	startTimer(ITIMER_PROF, 0);
+	blockSignals(true);
+	while (Sim_RunNextEvent()) {
+	}
+
+	uint64_t accepted = 0;
+	uint64_t received = 0;
+	uint64_t preemptions = 0;
+	printf("%-8s %10s %10s %10s %12s %10s\n", "producer", "accepted", "rejected", "received", "preemptions", "zero copy");
+	for (unsigned int i = 0; i < STRESS_PRODUCERS; i++) {
+		const struct Producer *producer = &s_producers[i];
+		printf("%-8s %10llu %10llu %10llu %12llu %10llu\n", producer->name, (unsigned long long)producer->accepted,
+				(unsigned long long)producer->rejected, (unsigned long long)s_receiver.received[i], (unsigned long long)producer->preemptions,
+				(unsigned long long)producer->zeroCopies);
+		accepted += producer->accepted;
+		received += s_receiver.received[i];
+		preemptions += producer->preemptions;
+		if (producer->accepted != s_receiver.received[i] || !BufferedUart_IsTxSent(&s_uart, producer->txSequence)) {
+			s_receiver.errors++;
+		}
+	}
+	s_receiver.errors += s_sim.stats.txModifiedBytes;
+	if (s_producers[0].accepted == 0 || !BufferedUart_IsTxSent(&s_uart, firstSequence)) {
+		s_receiver.errors++;
+	}
+#if !defined(BUFFERED_UART_TX_BIPBUFFER) && !defined(BUFFERED_UART_TX_ZEROCOPY)
+	// every byte on the wire went through the queue, which has no unused end
+	if (BufferedUart_GetTxSentSequence(&s_uart) != (uint32_t)s_receiver.bytes) {
+		s_receiver.errors++;
+	}
+#endif
+
+#ifdef BUFFERED_UART_STATISTICS
+	// rejections are counted by concurrent producers, none may be lost
+	uint64_t rejected = 0;
+	for (unsigned int i = 0; i < STRESS_PRODUCERS; i++) {
+		rejected += s_producers[i].rejected;
+	}
+	struct BufferedUartStatistics statistics;
+	BufferedUart_GetStatistics(&s_uart, &statistics);
+	printf("statistics: %u transfers, %u bytes per transfer, %u rejected, tx high-water %u of %u bytes\n",
+			(unsigned int)statistics.txTransfers, BufferedUart_GetAverageTransferSize(&statistics),
+			(unsigned int)statistics.txRejected, (unsigned int)statistics.txHighWater, (unsigned int)sizeof(s_txBuffer));
+	if (statistics.txRejected != (uint32_t)rejected || statistics.txBytes != (uint32_t)s_sim.stats.txBytes) {
+		s_receiver.errors++;
+	}
+#endif
+#ifdef BUFFERED_UART_LATENCY
+	// enqueue marks are added by whichever context starts the DMA, every retired one is in both histograms
+	struct BufferedUartLatency latency;
+	BufferedUart_GetLatency(&s_uart, &latency);
+	printf("latency: %u blocks, tx sent p50 %u p99 %u max %u ns, %u unsampled\n", (unsigned int)latency.txSent.count,
+			(unsigned int)BufferedUart_GetPercentile(&latency.txSent, 50), (unsigned int)BufferedUart_GetPercentile(&latency.txSent, 99),
+			(unsigned int)latency.txSent.max, (unsigned int)latency.txUnsampled);
+	if (latency.txQueued.count != latency.txSent.count || latency.txSent.count == 0) {
+		s_receiver.errors++;
+	}
+#endif
+	printf("%llu bytes on the wire (%llu filler), %llu errors\n", (unsigned long long)s_receiver.bytes,
+			(unsigned long long)s_receiver.fillerBytes, (unsigned long long)s_receiver.errors);
+
+	if (s_receiver.errors > 0 || s_receiver.length != 0 || accepted == 0 || received != accepted) {
+		fprintf(stderr, "FAILED\n");
+		return EXIT_FAILURE;
+	}
+	if (preemptions == 0) {
+		printf("warning: no producer was preempted inside BufferedUart_Transmit\n");
+	}
+
+	return EXIT_SUCCESS;
+}
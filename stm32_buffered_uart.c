@@ -36,6 +36,8 @@ SOFTWARE.
 
 #if MAX_NUMBER_BUFFERED_UARTS == 0
 	#error "MAX_NUMBER_BUFFERED_UARTS must be defined and > 0"
+#elif MAX_NUMBER_BUFFERED_UARTS > 32
+	#error "MAX_NUMBER_BUFFERED_UARTS must be at most 32"
 #endif
 
 #ifdef BUFFERED_UART_PROVIDE_HAL_UART_TxCpltCallback
@@ -63,12 +65,141 @@ SOFTWARE.
 #endif
 
 
+#ifdef BUFFERED_UART_LOCKFREE
+// txReservation packs the end of all tx reservations and the number of pending (not yet committed)
+// reservations into one word, so both are updated by a single compare and swap
+#define TX_RESERVATION_PENDING_BITS (8)
+#define TX_RESERVATION_PENDING_MASK ((1U << TX_RESERVATION_PENDING_BITS) - 1)
+#endif
+
+// HAL_UART_Transmit_DMA takes a 16 bit size
+#define TX_MAX_DMA_LENGTH (0xFFFFU)
+
+#ifdef BUFFERED_UART_TX_GAPLESS
+	#ifdef USART_TDR_TDR
+		#define TX_DATA_REGISTER(huart) (&(huart)->Instance->TDR)
+	#else
+		#define TX_DATA_REGISTER(huart) (&(huart)->Instance->DR)
+	#endif
+#endif
+
+#ifdef BUFFERED_UART_DCACHE
+	BUFFERED_UART_STATIC_ASSERT((BUFFERED_UART_DCACHE_LINE_SIZE & (BUFFERED_UART_DCACHE_LINE_SIZE - 1)) == 0, "BUFFERED_UART_DCACHE_LINE_SIZE must be a power of 2");
+	#define DCACHE_LINE_MASK ((uintptr_t)BUFFERED_UART_DCACHE_LINE_SIZE - 1)
+	#define DCACHE_CLEAN(data, length)		DCache_Clean(data, length)
+	#define DCACHE_INVALIDATE(data, length)	DCache_Invalidate(data, length)
+
+/// write the cache lines which overlap [data, data + length) back to memory, so the DMA reads the current data
+static inline void DCache_Clean(const void * data, unsigned int length)
+{
+	uintptr_t start = (uintptr_t)data & ~DCACHE_LINE_MASK;
+	uintptr_t end = ((uintptr_t)data + length + DCACHE_LINE_MASK) & ~DCACHE_LINE_MASK;
+	BUFFERED_UART_DCACHE_CLEAN(start, end - start);
+}
+
+/// discard the cache lines which overlap [data, data + length), so the CPU reads what the DMA wrote
+static inline void DCache_Invalidate(const void * data, unsigned int length)
+{
+	uintptr_t start = (uintptr_t)data & ~DCACHE_LINE_MASK;
+	uintptr_t end = ((uintptr_t)data + length + DCACHE_LINE_MASK) & ~DCACHE_LINE_MASK;
+	BUFFERED_UART_DCACHE_INVALIDATE(start, end - start);
+}
+#else
+	#define DCACHE_CLEAN(data, length)
+	#define DCACHE_INVALIDATE(data, length)
+#endif
+
+#ifdef BUFFERED_UART_STATISTICS
+	#define STATISTICS_ADD(uart, counter, value)	((uart)->statistics.counter += (value))
+	#define STATISTICS_MAX(uart, counter, value)	do { if ((value) > (uart)->statistics.counter) { (uart)->statistics.counter = (value); } } while (0)
+	#define STATISTICS_CYCLES_START()				uint32_t statisticsStart = BUFFERED_UART_CYCLE_COUNTER()
+	#define STATISTICS_CYCLES_END(uart, calls, cycles)	do { (uart)->statistics.calls++; (uart)->statistics.cycles += BUFFERED_UART_CYCLE_COUNTER() - statisticsStart; } while (0)
+	#ifdef BUFFERED_UART_LOCKFREE
+		// several producers can be rejected at the same time
+		#define STATISTICS_ADD_SHARED(uart, counter, value)	__atomic_fetch_add(&(uart)->statistics.counter, (value), __ATOMIC_RELAXED)
+	#else
+		#define STATISTICS_ADD_SHARED(uart, counter, value)	STATISTICS_ADD(uart, counter, value)
+	#endif
+#else
+	#define STATISTICS_ADD(uart, counter, value)
+	#define STATISTICS_MAX(uart, counter, value)
+	#define STATISTICS_CYCLES_START()
+	#define STATISTICS_CYCLES_END(uart, calls, cycles)
+	#define STATISTICS_ADD_SHARED(uart, counter, value)
+#endif
+
+#ifdef BUFFERED_UART_LATENCY
+	BUFFERED_UART_STATIC_ASSERT((BUFFERED_UART_LATENCY_MARKS & (BUFFERED_UART_LATENCY_MARKS - 1)) == 0, "BUFFERED_UART_LATENCY_MARKS must be a power of 2");
+	static void BufferedUart_LatencyTxEnqueued(struct BufferedUart * uart, uint32_t time);
+	static void BufferedUart_LatencyTxSent(struct BufferedUart * uart);
+	static void BufferedUart_LatencyRxReceived(struct BufferedUart * uart);
+	static void BufferedUart_LatencyRxConsumed(struct BufferedUart * uart, bool record);
+	#define LATENCY_TIMESTAMP(name)				uint32_t name = BUFFERED_UART_LATENCY_TICKS()
+	#define LATENCY_TX_ENQUEUED(uart, time)		BufferedUart_LatencyTxEnqueued(uart, time)
+	#define LATENCY_TX_STARTED(uart)			((uart)->txStartTime = BUFFERED_UART_LATENCY_TICKS())
+	#define LATENCY_TX_SENT(uart)				BufferedUart_LatencyTxSent(uart)
+	#define LATENCY_RX_RECEIVED(uart)			BufferedUart_LatencyRxReceived(uart)
+	#define LATENCY_RX_CONSUMED(uart, record)	BufferedUart_LatencyRxConsumed(uart, record)
+#else
+	#define LATENCY_TIMESTAMP(name)
+	#define LATENCY_TX_ENQUEUED(uart, time)
+	#define LATENCY_TX_STARTED(uart)
+	#define LATENCY_TX_SENT(uart)
+	#define LATENCY_RX_RECEIVED(uart)
+	#define LATENCY_RX_CONSUMED(uart, record)
+#endif
+
+#ifdef BUFFERED_UART_TRACE
+	static void BufferedUart_Trace(struct BufferedUart * uart, enum BufferedUartTraceType type, unsigned int event, unsigned int size, const struct BufferedUartSpan * first, const struct BufferedUartSpan * second);
+	#define TRACE(uart, type, event, size)		do { if ((uart)->traceBuffer != NULL) { BufferedUart_Trace(uart, type, event, size, NULL, NULL); } } while (0)
+#else
+	#define TRACE(uart, type, event, size)
+#endif
+
 static struct BufferedUart * s_uarts[MAX_NUMBER_BUFFERED_UARTS];
 static int s_numberUartsInUse;
 
+#if MAX_NUMBER_BUFFERED_UARTS > 1
+// open addressing hash table from the HAL handle to the buffered uart, at most half full, so the
+// callbacks find their buffered uart in about one probe independent of the number of uarts
+#if MAX_NUMBER_BUFFERED_UARTS <= 2
+	#define HANDLE_TABLE_BITS (2)
+#elif MAX_NUMBER_BUFFERED_UARTS <= 4
+	#define HANDLE_TABLE_BITS (3)
+#elif MAX_NUMBER_BUFFERED_UARTS <= 8
+	#define HANDLE_TABLE_BITS (4)
+#elif MAX_NUMBER_BUFFERED_UARTS <= 16
+	#define HANDLE_TABLE_BITS (5)
+#else
+	#define HANDLE_TABLE_BITS (6)
+#endif
+#define HANDLE_TABLE_SIZE (1U << HANDLE_TABLE_BITS)
+static struct BufferedUart * s_handleTable[HANDLE_TABLE_SIZE];
+#endif
+
+// see struct BufferedUartReadiness. Set by the callbacks, cleared by BufferedUart_PollAll once the
+// buffered uart is no longer ready, so PollAll only looks at the buffered uarts with a set bit
+static uint32_t s_rxReady;
+static uint32_t s_txReady;
+
 static void BufferedUart_TryStartTransmission(struct BufferedUart * uart);
+static void BufferedUart_StartTransmission(struct BufferedUart * uart);
+static void BufferedUart_TXQueue_Write(struct BufferedUart * uart, unsigned int position, const void * data, unsigned int length);
+#ifndef BUFFERED_UART_LOCKFREE
 static bool BufferedUart_TXQueue_Enqueue(struct BufferedUart * uart, const void * data, unsigned int length);
-static const void* BufferedUart_TXQueue_Dequeue(const struct BufferedUart * uart, unsigned int * length);
+#endif
+static const void* BufferedUart_TXQueue_Dequeue(const struct BufferedUart * uart, unsigned int * length, unsigned int * skip);
+#ifdef BUFFERED_UART_TX_ZEROCOPY
+static const struct BufferedUartTxDescriptor * BufferedUart_TxDescriptor_Peek(const struct BufferedUart * uart);
+static void BufferedUart_TxDescriptor_Sent(struct BufferedUart * uart, unsigned int length, struct BufferedUartTxDescriptor * completed);
+#endif
+#ifdef BUFFERED_UART_RX_BLOCKS
+static void BufferedUart_RxBlockReceived(struct BufferedUart *uart, unsigned int length);
+#endif
+static void BufferedUart_RxDeliver(struct BufferedUart *uart, bool fill);
+static void BufferedUart_RxFlowSignal(struct BufferedUart * uart, bool stop);
+static void BufferedUart_RxFlowScan(struct BufferedUart * uart, unsigned int position, unsigned int length);
+static void BufferedUart_HalfDuplexRelease(struct BufferedUart * uart);
 void BufferedUart_TxCpltCallback(UART_HandleTypeDef *huart);
 void BufferedUart_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size);
 void BufferedUart_UART_ErrorCallback(UART_HandleTypeDef *huart);
@@ -86,10 +217,159 @@ static inline void disableHalfCompleteInterrupt(DMA_HandleTypeDef *dmaHandle)
 	__HAL_DMA_DISABLE_IT(dmaHandle, DMA_IT_HT);
 }
 
-static void registerBufferedUart(struct BufferedUart * uart)
+#if MAX_NUMBER_BUFFERED_UARTS > 1
+/// Fibonacci hashing, HAL handles are usually adjacent in memory
+static inline unsigned int HandleTable_Hash(const UART_HandleTypeDef * huart)
+{
+	return ((uint32_t)(uintptr_t)huart * 2654435761U) >> (32 - HANDLE_TABLE_BITS);
+}
+
+static void HandleTable_Insert(struct BufferedUart * uart)
+{
+	unsigned int i = HandleTable_Hash(uart->uart);
+	while (s_handleTable[i] != NULL) {
+		i = (i + 1) & (HANDLE_TABLE_SIZE - 1);
+	}
+	s_handleTable[i] = uart;
+}
+
+/// linear probing without tombstones: move later entries of the probe sequence into the gap
+static void HandleTable_Remove(const struct BufferedUart * uart)
+{
+	unsigned int gap = HandleTable_Hash(uart->uart);
+	while (s_handleTable[gap] != uart) {
+		if (s_handleTable[gap] == NULL) {
+			return;
+		}
+		gap = (gap + 1) & (HANDLE_TABLE_SIZE - 1);
+	}
+
+	s_handleTable[gap] = NULL;
+	for (unsigned int i = (gap + 1) & (HANDLE_TABLE_SIZE - 1); s_handleTable[i] != NULL; i = (i + 1) & (HANDLE_TABLE_SIZE - 1)) {
+		unsigned int home = HandleTable_Hash(s_handleTable[i]->uart);
+		// the entry stays if its home lies cyclically in (gap, i]
+		if (((i - home) & (HANDLE_TABLE_SIZE - 1)) < ((i - gap) & (HANDLE_TABLE_SIZE - 1))) {
+			continue;
+		}
+		s_handleTable[gap] = s_handleTable[i];
+		s_handleTable[i] = NULL;
+		gap = i;
+	}
+}
+#endif
+
+/// false if all MAX_NUMBER_BUFFERED_UARTS slots are in use
+static bool registerBufferedUart(struct BufferedUart * uart)
+{
+	for (unsigned int i = 0; i < MAX_NUMBER_BUFFERED_UARTS; i++) {
+		if (s_uarts[i] == NULL) {
+			uart->index = i;
+			s_uarts[i] = uart;
+			s_numberUartsInUse++;
+#if MAX_NUMBER_BUFFERED_UARTS > 1
+			HandleTable_Insert(uart);
+#endif
+			return true;
+		}
+	}
+	return false;
+}
+
+/// set bits of a readiness mask, from the callbacks of any priority
+static void Readiness_Set(uint32_t * mask, uint32_t bits)
+{
+	if ((*(volatile uint32_t *)mask & bits) == bits) {
+		return;
+	}
+#ifdef BUFFERED_UART_LOCKFREE
+	__atomic_fetch_or(mask, bits, __ATOMIC_RELEASE);
+#else
+	uint32_t priMask = __get_PRIMASK();
+	__set_PRIMASK(1);
+	*mask |= bits;
+	__set_PRIMASK(priMask);
+#endif
+}
+
+static void Readiness_Clear(uint32_t * mask, uint32_t bits)
+{
+#ifdef BUFFERED_UART_LOCKFREE
+	__atomic_fetch_and(mask, ~bits, __ATOMIC_ACQ_REL);
+#else
+	uint32_t priMask = __get_PRIMASK();
+	__set_PRIMASK(1);
+	*mask &= ~bits;
+	__set_PRIMASK(priMask);
+#endif
+}
+
+#ifdef BUFFERED_UART_RX_BLOCKS
+/// push a block onto a block list (Treiber stack), from any context
+static void RxBlockList_Push(struct BufferedUartRxBlock ** list, struct BufferedUartRxBlock * block)
+{
+#ifdef BUFFERED_UART_LOCKFREE
+	struct BufferedUartRxBlock * head = __atomic_load_n(list, __ATOMIC_RELAXED);
+	do {
+		block->next = head;
+	} while (!__atomic_compare_exchange_n(list, &head, block, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+#else
+	uint32_t priMask = __get_PRIMASK();
+	__set_PRIMASK(1);
+	block->next = *list;
+	*list = block;
+	__set_PRIMASK(priMask);
+#endif
+}
+
+/**
+ * pop the block pushed last, NULL if the list is empty
+ * Only one context may pop from a list: no other context can then remove the head and push it
+ * again in between (ABA), so its next pointer stays valid until the compare and swap
+ */
+static struct BufferedUartRxBlock * RxBlockList_Pop(struct BufferedUartRxBlock ** list)
+{
+#ifdef BUFFERED_UART_LOCKFREE
+	struct BufferedUartRxBlock * head = __atomic_load_n(list, __ATOMIC_ACQUIRE);
+	while (head != NULL && !__atomic_compare_exchange_n(list, &head, head->next, true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+	}
+	return head;
+#else
+	uint32_t priMask = __get_PRIMASK();
+	__set_PRIMASK(1);
+	struct BufferedUartRxBlock * head = *list;
+	if (head != NULL) {
+		*list = head->next;
+	}
+	__set_PRIMASK(priMask);
+	return head;
+#endif
+}
+
+/// take all blocks of a list at once, newest first
+static struct BufferedUartRxBlock * RxBlockList_TakeAll(struct BufferedUartRxBlock ** list)
+{
+#ifdef BUFFERED_UART_LOCKFREE
+	return __atomic_exchange_n(list, NULL, __ATOMIC_ACQUIRE);
+#else
+	uint32_t priMask = __get_PRIMASK();
+	__set_PRIMASK(1);
+	struct BufferedUartRxBlock * head = *list;
+	*list = NULL;
+	__set_PRIMASK(priMask);
+	return head;
+#endif
+}
+#endif
+
+/// true if the reception runs into blocks instead of the rx ring buffer
+static inline bool BufferedUart_RxUsesBlocks(const struct BufferedUart * uart)
 {
-	s_uarts[s_numberUartsInUse] = uart;
-	s_numberUartsInUse++;
+#ifdef BUFFERED_UART_RX_BLOCKS
+	return uart->rxBlockSize > 0;
+#else
+	(void)uart;
+	return false;
+#endif
 }
 
 static void BlockRingbuffer_Init(struct BlockRingbuffer * buffer, void * underlying, unsigned int length)
@@ -98,6 +378,9 @@ static void BlockRingbuffer_Init(struct BlockRingbuffer * buffer, void * underly
 	buffer->length = length;
 	buffer->head = 0;
 	buffer->tail = 0;
+	buffer->mask = (length > 0 && (length & (length - 1)) == 0) ? length - 1 : 0;
+	// a multiple of length keeps the buffer index continuous when head or tail wrap around
+	buffer->wrap = length > 0 ? (0x80000000U / length) * length : 0;
 }
 
 static void BlockRingbuffer_Reset(struct BlockRingbuffer * buffer)
@@ -113,10 +396,28 @@ static bool BlockRingbuffer_IsValid(const struct BlockRingbuffer * buffer)
 	return buffer != NULL && buffer->buf != NULL && buffer->length > 0 && buffer->length <= 0xFFFF;
 }
 
+/// distance from position 'from' to position 'to', taking the wrap around of head and tail into account
+static inline unsigned int BlockRingbuffer_Distance(const struct BlockRingbuffer * buffer, unsigned int from, unsigned int to)
+{
+	if (to < from) {
+		return to + buffer->wrap - from;
+	}
+	return to - from;
+}
+
+static inline unsigned int BlockRingbuffer_Advance(const struct BlockRingbuffer * buffer, unsigned int position, unsigned int length)
+{
+	position += length;
+	if (position >= buffer->wrap) {
+		position -= buffer->wrap;
+	}
+	return position;
+}
+
 static inline unsigned int BlockRingbuffer_GetReadAvailable(const struct BlockRingbuffer * buffer)
 {
 	atomic_signal_fence(memory_order_acquire);
-	return buffer->head - buffer->tail;
+	return BlockRingbuffer_Distance(buffer, buffer->tail, buffer->head);
 }
 
 static inline unsigned int BlockRingbuffer_GetWriteAvailable(const struct BlockRingbuffer * buffer)
@@ -132,6 +433,160 @@ static inline unsigned int BlockRingbuffer_GetLength(const struct BlockRingbuffe
 	return buffer->length;
 }
 
+/// index in the underlying buffer for a head or tail position
+static inline unsigned int BlockRingbuffer_GetIndex(const struct BlockRingbuffer * buffer, unsigned int position)
+{
+#ifdef BUFFERED_UART_FIXED_BUFFER_SIZE
+	return position % BUFFERED_UART_FIXED_BUFFER_SIZE;
+#else
+	// avoid the division, especially on cores without hardware divider (e.g. Cortex-M0)
+	if (buffer->mask != 0) {
+		return position & buffer->mask;
+	}
+	return position % buffer->length;
+#endif
+}
+
+/// describe the region [position, position + length) of the buffer by up to two contiguous spans
+static inline void BlockRingbuffer_GetSpans(const struct BlockRingbuffer * buffer, unsigned int position, unsigned int length, struct BufferedUartSpan * first, struct BufferedUartSpan * second)
+{
+	unsigned int queueMaxSize = BlockRingbuffer_GetLength(buffer);
+	unsigned int index = BlockRingbuffer_GetIndex(buffer, position);
+	unsigned int sizeTillWrapAround = queueMaxSize - index;
+
+	first->data = buffer->buf + index;
+	first->length = min(length, sizeTillWrapAround);
+	second->data = buffer->buf;
+	second->length = length - first->length;
+}
+
+/// copy data into the region [position, position + length) of the buffer
+static inline void BlockRingbuffer_Write(struct BlockRingbuffer * buffer, unsigned int position, const void * data, unsigned int length)
+{
+	struct BufferedUartSpan first;
+	struct BufferedUartSpan second;
+	BlockRingbuffer_GetSpans(buffer, position, length, &first, &second);
+
+	memcpy(first.data, data, first.length);
+	// second part after wrap around
+	memcpy(second.data, (const char *)data + first.length, second.length);
+}
+
+static inline void BlockRingbuffer_Produce(struct BlockRingbuffer * buffer, unsigned int length)
+{
+	atomic_signal_fence(memory_order_acquire);
+	buffer->head = BlockRingbuffer_Advance(buffer, buffer->head, length);
+	atomic_signal_fence(memory_order_release);
+}
+
+static inline void BlockRingbuffer_Consume(struct BlockRingbuffer * buffer, unsigned int length)
+{
+	atomic_signal_fence(memory_order_acquire);
+	buffer->tail = BlockRingbuffer_Advance(buffer, buffer->tail, length);
+	atomic_signal_fence(memory_order_release);
+}
+
+#ifdef BUFFERED_UART_LATENCY
+/// true if the data up to position is still in the buffer (position is in (tail, head])
+static inline bool BlockRingbuffer_IsPending(const struct BlockRingbuffer * buffer, unsigned int position)
+{
+	unsigned int distance = BlockRingbuffer_Distance(buffer, buffer->tail, position);
+	return distance != 0 && distance <= BlockRingbuffer_GetReadAvailable(buffer);
+}
+
+static void Histogram_Add(struct BufferedUartHistogram * histogram, uint32_t ticks)
+{
+	unsigned int bucket = ticks == 0 ? 0 : 32 - __builtin_clz(ticks);
+	histogram->buckets[bucket]++;
+	histogram->count++;
+	if (ticks > histogram->max) {
+		histogram->max = ticks;
+	}
+}
+
+/**
+ * Remember the time at which the data up to position was enqueued/received
+ * Marks are only added by one context at a time and retired by one other context at a time
+ */
+static void LatencyMarks_Add(struct BufferedUartLatencyMarks * marks, const struct BlockRingbuffer * buffer, unsigned int position, uint32_t time, uint32_t * unsampled)
+{
+	unsigned int head = marks->head;
+	atomic_signal_fence(memory_order_acquire);
+	unsigned int tail = marks->tail;
+	if (head != tail && marks->marks[(head - 1) & (BUFFERED_UART_LATENCY_MARKS - 1)].position == position) {
+		return;
+	}
+	if (!BlockRingbuffer_IsPending(buffer, position)) {
+		// nothing new, or already sent/consumed in between
+		return;
+	}
+	if (head - tail == BUFFERED_UART_LATENCY_MARKS) {
+		(*unsampled)++;
+		return;
+	}
+
+	marks->marks[head & (BUFFERED_UART_LATENCY_MARKS - 1)].position = position;
+	marks->marks[head & (BUFFERED_UART_LATENCY_MARKS - 1)].time = time;
+	atomic_signal_fence(memory_order_release);
+	marks->head = head + 1;
+}
+
+/// remove the oldest mark if its data left the buffer, false if there is none
+static bool LatencyMarks_Retire(struct BufferedUartLatencyMarks * marks, const struct BlockRingbuffer * buffer, uint32_t * time)
+{
+	unsigned int tail = marks->tail;
+	atomic_signal_fence(memory_order_acquire);
+	if (tail == marks->head) {
+		return false;
+	}
+	atomic_signal_fence(memory_order_acquire);
+	const struct BufferedUartLatencyMark * mark = &marks->marks[tail & (BUFFERED_UART_LATENCY_MARKS - 1)];
+	if (BlockRingbuffer_IsPending(buffer, mark->position)) {
+		return false;
+	}
+
+	*time = mark->time;
+	atomic_signal_fence(memory_order_release);
+	marks->tail = tail + 1;
+	return true;
+}
+
+/// called by the context which enqueued data, or with BUFFERED_UART_LOCKFREE by the one which starts the DMA
+static void BufferedUart_LatencyTxEnqueued(struct BufferedUart * uart, uint32_t time)
+{
+	LatencyMarks_Add(&uart->txMarks, &uart->txqueue, uart->txqueue.head, time, &uart->latency.txUnsampled);
+}
+
+/// called from the TxCplt callback after the sent data was consumed
+static void BufferedUart_LatencyTxSent(struct BufferedUart * uart)
+{
+	uint32_t now = BUFFERED_UART_LATENCY_TICKS();
+	uint32_t enqueued;
+	while (LatencyMarks_Retire(&uart->txMarks, &uart->txqueue, &enqueued)) {
+		Histogram_Add(&uart->latency.txQueued, uart->txStartTime - enqueued);
+		Histogram_Add(&uart->latency.txSent, now - enqueued);
+	}
+}
+
+/// called from the rx event after the head was moved
+static void BufferedUart_LatencyRxReceived(struct BufferedUart * uart)
+{
+	LatencyMarks_Add(&uart->rxMarks, &uart->rxqueue, uart->rxqueue.head, BUFFERED_UART_LATENCY_TICKS(), &uart->latency.rxUnsampled);
+}
+
+/// called by the reader after data was consumed, or dropped (record false)
+static void BufferedUart_LatencyRxConsumed(struct BufferedUart * uart, bool record)
+{
+	uint32_t now = BUFFERED_UART_LATENCY_TICKS();
+	uint32_t received;
+	while (LatencyMarks_Retire(&uart->rxMarks, &uart->rxqueue, &received)) {
+		if (record) {
+			Histogram_Add(&uart->latency.rxWaiting, now - received);
+		}
+	}
+}
+#endif
+
 HAL_StatusTypeDef BufferedUart_Init(struct BufferedUart * bufferedUart, UART_HandleTypeDef * uart, enum BufferedUartMode mode, void *txBuffer, unsigned int txSize, void *rxBuffer, unsigned int rxSize)
 {
 	if (s_numberUartsInUse == MAX_NUMBER_BUFFERED_UARTS) {
@@ -149,6 +604,10 @@ HAL_StatusTypeDef BufferedUart_Init(struct BufferedUart * bufferedUart, UART_Han
 		if (!BlockRingbuffer_IsValid(&bufferedUart->txqueue)) {
 			return HAL_ERROR;
 		}
+#ifdef BUFFERED_UART_LOCKFREE
+		// tx positions have to fit into txReservation next to the number of pending reservations
+		bufferedUart->txqueue.wrap = ((0xFFFFFFFFU >> TX_RESERVATION_PENDING_BITS) / txSize) * txSize;
+#endif
 
 #if (USE_HAL_UART_REGISTER_CALLBACKS == 1)
 		HAL_StatusTypeDef status = HAL_UART_RegisterCallback(uart, HAL_UART_TX_COMPLETE_CB_ID, BufferedUart_TxCpltCallback);
@@ -163,9 +622,21 @@ HAL_StatusTypeDef BufferedUart_Init(struct BufferedUart * bufferedUart, UART_Han
 		struct BlockRingbuffer buffer;
 		BlockRingbuffer_Init(&buffer, rxBuffer, rxSize);
 		bufferedUart->rxqueue = buffer;
-		if (!BlockRingbuffer_IsValid(&bufferedUart->rxqueue)) {
+#ifdef BUFFERED_UART_RX_BLOCKS
+		// without rx buffer the uart can only receive into blocks (BufferedUart_StartBlockReception)
+		bool ringbuffer = rxBuffer != NULL || rxSize > 0;
+#else
+		bool ringbuffer = true;
+#endif
+		if (ringbuffer && !BlockRingbuffer_IsValid(&bufferedUart->rxqueue)) {
+			return HAL_ERROR;
+		}
+#ifdef BUFFERED_UART_DCACHE
+		// the rx buffer must not share a cache line with other data, its invalidation would discard it
+		if ((((uintptr_t)rxBuffer | rxSize) & DCACHE_LINE_MASK) != 0) {
 			return HAL_ERROR;
 		}
+#endif
 
 #if (USE_HAL_UART_REGISTER_CALLBACKS == 1)
 		HAL_StatusTypeDef status = HAL_UART_RegisterRxEventCallback(uart, BufferedUart_RxEventCallback);
@@ -183,10 +654,136 @@ HAL_StatusTypeDef BufferedUart_Init(struct BufferedUart * bufferedUart, UART_Han
 	}
 #endif
 
-	registerBufferedUart(bufferedUart);
 	bufferedUart->uart = uart;
+	if (!registerBufferedUart(bufferedUart)) {
+		return HAL_ERROR;
+	}
+	bool transmitter = mode == BUFFERED_UART_TX || mode == BUFFERED_UART_TX_RX;
+	bufferedUart->txReadyBytes = transmitter ? BlockRingbuffer_GetLength(&bufferedUart->txqueue) / 2 : 0;
 	bufferedUart->lastSendBlockSize = 0;
+	bufferedUart->txReserved = 0;
+	BlockRingbuffer_Init(&bufferedUart->txurgent, NULL, 0);
+	bufferedUart->txSource = BUFFERED_UART_TX_SOURCE_QUEUE;
+#ifdef BUFFERED_UART_TX_ZEROCOPY
+	bufferedUart->txDescriptorHead = 0;
+	bufferedUart->txDescriptorTail = 0;
+	bufferedUart->txDescriptorSent = 0;
+#endif
+	bufferedUart->txChunkSize = 0;
+	bufferedUart->txPaused = false;
+	bufferedUart->txInterruptStarts = false;
+	bufferedUart->txFlowCharacter = -1;
+#ifdef BUFFERED_UART_TX_BIPBUFFER
+	bufferedUart->txPaddingPosition = bufferedUart->txqueue.wrap;
+#endif
+	bufferedUart->rxDmaPosition = 0;
+	bufferedUart->rxDroppedBytes = 0;
+	bufferedUart->rxOverruns = 0;
+	bufferedUart->rxWrapReported = false;
+	bufferedUart->rxFillThreshold = 0;
+	bufferedUart->rxTimeoutBits = 0;
+	bufferedUart->rxMatchCharacter = -1;
+	bufferedUart->rxLineScanned = 0;
+	bufferedUart->rxFlowControl = BUFFERED_UART_FLOW_NONE;
+	bufferedUart->rxFlowHighWatermark = 0;
+	bufferedUart->rxFlowLowWatermark = 0;
+	bufferedUart->rxFlowStopped = false;
+	bufferedUart->RtsHandler = NULL;
+#ifdef BUFFERED_UART_RX_BLOCKS
+	bufferedUart->rxBlockSize = 0;
+	bufferedUart->rxBlock = NULL;
+	bufferedUart->rxBlockFree = NULL;
+	bufferedUart->rxBlockReceived = NULL;
+	bufferedUart->rxBlockTaken = NULL;
+	bufferedUart->rxBlockStarved = false;
+	bufferedUart->BlockReceivedHandler = NULL;
+#endif
+	bufferedUart->txCoalesceBytes = 0;
+	bufferedUart->txCoalesceTimeoutMs = 0;
+	bufferedUart->txHolding = false;
+	bufferedUart->txHoldStart = 0;
+	bufferedUart->txFlushPosition = 0;
+	bufferedUart->txSentSequence = 0;
+	bufferedUart->txSentPosition = 0;
+	bufferedUart->txNotifySequence = 0;
+	bufferedUart->TxSentHandler = NULL;
+	bufferedUart->txHalfDuplex = BUFFERED_UART_HALF_DUPLEX_OFF;
+	bufferedUart->txDriving = false;
+	bufferedUart->txEchoSuppressed = false;
+	bufferedUart->DriverEnableHandler = NULL;
+#ifdef BUFFERED_UART_TX_GAPLESS
+	bufferedUart->txHalDmaCplt = NULL;
+	bufferedUart->txChaining = false;
+#endif
+#ifdef BUFFERED_UART_LOCKFREE
+	atomic_init(&bufferedUart->txReservation, 0);
+	atomic_init(&bufferedUart->txStartRequests, 0);
+	bufferedUart->txReservePosition = 0;
+#endif
+#ifdef BUFFERED_UART_OS
+	BufferedUartOs_EventInit(&bufferedUart->rxEvent);
+	BufferedUartOs_EventInit(&bufferedUart->txEvent);
+	bufferedUart->rxWakeBytes = 0;
+	bufferedUart->txWakeBytes = 0;
+	BufferedUartOs_EventInit(&bufferedUart->txSentEvent);
+	bufferedUart->txWakeSequence = 0;
+	bufferedUart->txSentWaiting = false;
+#endif
+#ifdef BUFFERED_UART_STATISTICS
+	memset(&bufferedUart->statistics, 0, sizeof(bufferedUart->statistics));
+#endif
+#ifdef BUFFERED_UART_LATENCY
+	memset(&bufferedUart->latency, 0, sizeof(bufferedUart->latency));
+	memset(&bufferedUart->txMarks, 0, sizeof(bufferedUart->txMarks));
+	memset(&bufferedUart->rxMarks, 0, sizeof(bufferedUart->rxMarks));
+	bufferedUart->txStartTime = 0;
+#endif
+#ifdef BUFFERED_UART_TRACE
+	bufferedUart->traceBuffer = NULL;
+	bufferedUart->traceDropped = 0;
+	bufferedUart->traceDroppedTotal = 0;
+#endif
+#if defined(BUFFERED_UART_STATISTICS) || defined(BUFFERED_UART_LATENCY) || defined(BUFFERED_UART_TRACE)
+	BUFFERED_UART_CYCLE_COUNTER_INIT();
+#endif
+	if (transmitter) {
+		Readiness_Set(&s_txReady, 1U << bufferedUart->index);
+	}
+
+	return HAL_OK;
+}
+
+/**
+ * Unregister a buffered uart which was initialized via @ref BufferedUart_Init
+ * A running reception and transmission is aborted. Afterwards the buffered uart (and its slot
+ * of MAX_NUMBER_BUFFERED_UARTS) can be initialized again, e.g. with different buffers
+ * @param[in]	uart
+ * @return		HAL_StatusTypeDef	HAL_ERROR if the buffered uart was not initialized
+ */
+HAL_StatusTypeDef BufferedUart_DeInit(struct BufferedUart *uart)
+{
+	if (uart->index >= MAX_NUMBER_BUFFERED_UARTS || s_uarts[uart->index] != uart) {
+		return HAL_ERROR;
+	}
 
+	if (uart->uart->RxState == HAL_UART_STATE_BUSY_RX) {
+		BufferedUart_StopReception(uart);
+	}
+	HAL_UART_AbortTransmit(uart->uart);
+	BufferedUart_HalfDuplexRelease(uart);
+#ifdef BUFFERED_UART_OS
+	BufferedUartOs_EventDeInit(&uart->rxEvent);
+	BufferedUartOs_EventDeInit(&uart->txEvent);
+	BufferedUartOs_EventDeInit(&uart->txSentEvent);
+#endif
+
+#if MAX_NUMBER_BUFFERED_UARTS > 1
+	HandleTable_Remove(uart);
+#endif
+	Readiness_Clear(&s_rxReady, 1U << uart->index);
+	Readiness_Clear(&s_txReady, 1U << uart->index);
+	s_uarts[uart->index] = NULL;
+	s_numberUartsInUse--;
 	return HAL_OK;
 }
 
@@ -195,14 +792,99 @@ HAL_StatusTypeDef BufferedUart_StartReception(struct BufferedUart *uart)
 	if (!BlockRingbuffer_IsValid(&uart->rxqueue)) {
 		return HAL_ERROR;
 	}
+#ifdef BUFFERED_UART_RX_BLOCKS
+	if (uart->rxBlockSize > 0) {
+		// back from the block reception, the blocks belong to the application again
+		if (uart->uart->RxState == HAL_UART_STATE_BUSY_RX) {
+			BufferedUart_StopReception(uart);
+		}
+		uart->rxBlockSize = 0;
+		uart->rxBlock = NULL;
+	}
+#endif
+
+#ifdef DMA_CIRCULAR
+	// the reception runs continuously over the whole rx buffer, so it never has to be re-armed
+	DMA_HandleTypeDef * hdma = uart->uart->hdmarx;
+	if (hdma->Init.Mode != DMA_CIRCULAR) {
+		hdma->Init.Mode = DMA_CIRCULAR;
+		HAL_StatusTypeDef status = HAL_DMA_Init(hdma);
+		if (status != HAL_OK) {
+			return status;
+		}
+	}
+#endif
+
+	// unread data is lost, because the DMA starts again at the beginning of the buffer
+	unsigned int unread = BlockRingbuffer_GetReadAvailable(&uart->rxqueue);
+	if (unread > 0) {
+		uart->rxDroppedBytes += unread;
+		uart->rxOverruns++;
+	}
 
 	BlockRingbuffer_Reset(&uart->rxqueue);
+	uart->rxLineScanned = 0;
+	if (uart->rxFlowStopped) {
+		// the rx queue is empty again
+		BufferedUart_RxFlowSignal(uart, false);
+	}
+	uart->rxDmaPosition = 0;
+	uart->rxWrapReported = false;
+#ifdef BUFFERED_UART_LATENCY
+	uart->rxMarks.tail = uart->rxMarks.head;
+#endif
+
+	USART_TypeDef * usart = uart->uart->Instance;
+#ifdef USART_CR1_CMIE
+	if (uart->rxMatchCharacter >= 0) {
+		// ADD can only be written while the receiver is disabled, a half-duplex transmission keeps it disabled
+		uint32_t receiver = usart->CR1 & USART_CR1_RE;
+		usart->CR1 &= ~USART_CR1_RE;
+		usart->CR2 = (usart->CR2 & ~USART_CR2_ADD) | ((uint32_t)uart->rxMatchCharacter << USART_CR2_ADD_Pos);
+		usart->CR1 |= receiver;
+	}
+#endif
+#ifdef USART_CR2_RTOEN
+	if (uart->rxTimeoutBits > 0) {
+		usart->RTOR = (usart->RTOR & ~USART_RTOR_RTO) | uart->rxTimeoutBits;
+		usart->CR2 |= USART_CR2_RTOEN;
+	} else {
+		usart->CR2 &= ~USART_CR2_RTOEN;
+	}
+#endif
+
+	HAL_StatusTypeDef status = HAL_UARTEx_ReceiveToIdle_DMA(uart->uart, (uint8_t*)uart->rxqueue.buf, uart->rxqueue.length);
+	if (status != HAL_OK) {
+		return status;
+	}
+
+#ifdef USART_CR2_RTOEN
+	if (uart->rxTimeoutBits > 0) {
+		// the receiver timeout replaces the IDLE line detection enabled by the HAL
+		usart->CR1 &= ~USART_CR1_IDLEIE;
+		usart->ICR = USART_ICR_RTOCF;
+		usart->CR1 |= USART_CR1_RTOIE;
+	}
+#endif
+#ifdef USART_CR1_CMIE
+	if (uart->rxMatchCharacter >= 0) {
+		usart->ICR = USART_ICR_CMCF;
+		usart->CR1 |= USART_CR1_CMIE;
+	}
+#endif
+	(void)usart;
 
-	return HAL_UARTEx_ReceiveToIdle_DMA(uart->uart, (uint8_t*)uart->rxqueue.buf, uart->rxqueue.length);
+	return HAL_OK;
 }
 
 HAL_StatusTypeDef BufferedUart_StopReception(struct BufferedUart *uart)
 {
+#ifdef USART_CR1_RTOIE
+	uart->uart->Instance->CR1 &= ~USART_CR1_RTOIE;
+#endif
+#ifdef USART_CR1_CMIE
+	uart->uart->Instance->CR1 &= ~USART_CR1_CMIE;
+#endif
 	HAL_UART_AbortReceive_IT(uart->uart);
 	return HAL_DMA_Abort(uart->uart->hdmarx);
 }
@@ -210,11 +892,12 @@ HAL_StatusTypeDef BufferedUart_StopReception(struct BufferedUart *uart)
 struct BufferedUart * ContainerOf(const UART_HandleTypeDef * huart)
 {
 #if MAX_NUMBER_BUFFERED_UARTS == 1
+	(void)huart;
 	return s_uarts[0];
 #else
-	for (int i = 0; i < s_numberUartsInUse; i++) {
-		if (s_uarts[i]->uart == huart) {
-			return s_uarts[i];
+	for (unsigned int i = HandleTable_Hash(huart); s_handleTable[i] != NULL; i = (i + 1) & (HANDLE_TABLE_SIZE - 1)) {
+		if (s_handleTable[i]->uart == huart) {
+			return s_handleTable[i];
 		}
 	}
 
@@ -222,237 +905,2405 @@ struct BufferedUart * ContainerOf(const UART_HandleTypeDef * huart)
 #endif
 }
 
-void BufferedUart_TxCpltCallback(UART_HandleTypeDef *huart)
+/// release the data of the finished TX DMA transfer, completed receives a zero copy buffer which was sent completely
+static void BufferedUart_TxSent(struct BufferedUart * bufferedUart, struct BufferedUartTxDescriptor * completed)
 {
-	struct BufferedUart * bufferedUart = ContainerOf(huart);
-	if (bufferedUart == NULL) {
-		// error: the given uart handle was not registered before via BufferedUart_Init
-		Error_Handler();
+	(void)completed;
+	if (bufferedUart->lastSendBlockSize == 0) {
+		// already released when the DMA transfer completed (BUFFERED_UART_TX_GAPLESS)
+		return;
 	}
 
-	atomic_signal_fence(memory_order_acquire);
-	bufferedUart->txqueue.tail += bufferedUart->lastSendBlockSize;
-	atomic_signal_fence(memory_order_release);
-
-	BufferedUart_TryStartTransmission(bufferedUart);
+	if (bufferedUart->txSource == BUFFERED_UART_TX_SOURCE_URGENT) {
+		BlockRingbuffer_Consume(&bufferedUart->txurgent, bufferedUart->lastSendBlockSize);
+#ifdef BUFFERED_UART_TX_ZEROCOPY
+	} else if (bufferedUart->txSource == BUFFERED_UART_TX_SOURCE_DESCRIPTOR) {
+		BufferedUart_TxDescriptor_Sent(bufferedUart, bufferedUart->lastSendBlockSize, completed);
+#endif
+	} else if (bufferedUart->txSource == BUFFERED_UART_TX_SOURCE_FLOW) {
+		// the XON/XOFF character is not queued
+	} else {
+		BlockRingbuffer_Consume(&bufferedUart->txqueue, bufferedUart->lastSendBlockSize);
+		LATENCY_TX_SENT(bufferedUart);
+	}
+	bufferedUart->lastSendBlockSize = 0;
 }
 
-void BufferedUart_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size)
+/// the data of the tx queue up to position left the uart
+static inline void BufferedUart_TxSentUpTo(struct BufferedUart * bufferedUart, unsigned int position)
 {
-	struct BufferedUart * bufferedUart = ContainerOf(huart);
-	if (bufferedUart == NULL) {
-		// error: the given uart handle was not registered before via buffered_uart_init
-		Error_Handler();
-	}
-
-	atomic_signal_fence(memory_order_acquire);
-	bufferedUart->rxqueue.head = Size;
+	uint32_t sent = bufferedUart->txSentSequence + BlockRingbuffer_Distance(&bufferedUart->txqueue, bufferedUart->txSentPosition, position);
 	atomic_signal_fence(memory_order_release);
+	bufferedUart->txSentPosition = position;
+	atomic_signal_fence(memory_order_release);
+	bufferedUart->txSentSequence = sent;
+	atomic_signal_fence(memory_order_release);
+}
 
-	enum DataHandledResult handled = BUFFERED_UART_DATA_NOT_HANDLED;
-	if (bufferedUart->DataReceivedHandler != NULL) {
-		unsigned int length = BlockRingbuffer_GetReadAvailable(&bufferedUart->rxqueue);
-		// length would be 0 if a UART IDLE event happens exactly after (HALF) DMA COMPLETE interrupt
-		if (length > 0) {
-			handled = bufferedUart->DataReceivedHandler(bufferedUart->rxqueue.buf + bufferedUart->rxqueue.tail, length);
-		}
-	}
-
-	if (handled == BUFFERED_UART_DATA_HANDLED) {
+/**
+ * Sequence number of a tx queue position
+ * Positions wrap around with the queue (with BUFFERED_UART_LOCKFREE within 2^24), sequence numbers
+ * count the bytes up to them in 32 bits
+ * @param[in]	position	less than half of the position range away from the data which left the uart
+ */
+static uint32_t BufferedUart_TxSequenceOf(const struct BufferedUart * uart, unsigned int position)
+{
+	uint32_t sent;
+	unsigned int sentPosition;
+	do {
+		// the tx interrupt may advance both in between, read them again then
+		sent = uart->txSentSequence;
 		atomic_signal_fence(memory_order_acquire);
-		bufferedUart->rxqueue.tail = bufferedUart->rxqueue.head;
-		atomic_signal_fence(memory_order_release);
+		sentPosition = uart->txSentPosition;
+		atomic_signal_fence(memory_order_acquire);
+	} while (sent != *(volatile const uint32_t *)&uart->txSentSequence);
+
+	unsigned int ahead = BlockRingbuffer_Distance(&uart->txqueue, sentPosition, position);
+	if (ahead > uart->txqueue.wrap / 2) {
+		// the caller was preempted and the data up to position was sent meanwhile
+		return sent - BlockRingbuffer_Distance(&uart->txqueue, position, sentPosition);
 	}
+	return sent + ahead;
+}
 
-	if (bufferedUart->rxqueue.tail == bufferedUart->rxqueue.length) {
-		atomic_signal_fence(memory_order_acquire);
-		bufferedUart->rxqueue.tail = 0;
-		atomic_signal_fence(memory_order_release);
+/// remove the pending TxSentHandler, NULL if there is none or the interrupt took it before
+static void (*BufferedUart_TakeTxSentHandler(struct BufferedUart * uart))(struct BufferedUart *, uint32_t)
+{
+#ifdef BUFFERED_UART_LOCKFREE
+	return __atomic_exchange_n(&uart->TxSentHandler, NULL, __ATOMIC_ACQ_REL);
+#else
+	uint32_t priMask = __get_PRIMASK();
+	__set_PRIMASK(1);
+	void (*handler)(struct BufferedUart *, uint32_t) = uart->TxSentHandler;
+	uart->TxSentHandler = NULL;
+	__set_PRIMASK(priMask);
+	return handler;
+#endif
+}
+
+/// tell waiting producers about the released space, after the next transfer was started
+static void BufferedUart_TxNotify(struct BufferedUart * bufferedUart, const struct BufferedUartTxDescriptor * completed)
+{
+	(void)completed;
+	if (BlockRingbuffer_GetWriteAvailable(&bufferedUart->txqueue) >= bufferedUart->txReadyBytes) {
+		Readiness_Set(&s_txReady, 1U << bufferedUart->index);
+	}
+	if (bufferedUart->TxSentHandler != NULL && BufferedUart_IsTxSent(bufferedUart, bufferedUart->txNotifySequence)) {
+		void (*handler)(struct BufferedUart *, uint32_t) = BufferedUart_TakeTxSentHandler(bufferedUart);
+		if (handler != NULL) {
+			handler(bufferedUart, bufferedUart->txNotifySequence);
+		}
+	}
+#ifdef BUFFERED_UART_OS
+	unsigned int txWakeBytes = bufferedUart->txWakeBytes;
+	if (txWakeBytes > 0 && BlockRingbuffer_GetWriteAvailable(&bufferedUart->txqueue) >= txWakeBytes) {
+		bufferedUart->txWakeBytes = 0;
+		BufferedUartOs_EventSignal(&bufferedUart->txEvent);
+	}
+	if (bufferedUart->txSentWaiting && BufferedUart_IsTxSent(bufferedUart, bufferedUart->txWakeSequence)) {
+		bufferedUart->txSentWaiting = false;
+		BufferedUartOs_EventSignal(&bufferedUart->txSentEvent);
 	}
+#endif
+#ifdef BUFFERED_UART_TX_ZEROCOPY
+	// called once the next transfer runs, so the handler does not delay it
+	if (completed->CompletionHandler != NULL) {
+		completed->CompletionHandler(bufferedUart, completed->data, completed->length);
+	}
+#endif
 }
 
-/// the current strategy is to just restart the reception on error
-/// transmission will start automatically the next time something is enqueued
-void BufferedUart_UART_ErrorCallback(UART_HandleTypeDef *huart)
+void BufferedUart_TxCpltCallback(UART_HandleTypeDef *huart)
 {
+	STATISTICS_CYCLES_START();
 	struct BufferedUart * bufferedUart = ContainerOf(huart);
 	if (bufferedUart == NULL) {
-		return;
+		// error: the given uart handle was not registered before via BufferedUart_Init
+		Error_Handler();
 	}
 
-	BufferedUart_StopReception(bufferedUart);
-	HAL_StatusTypeDef result = BufferedUart_StartReception(bufferedUart);
-	if (result != HAL_OK) {
+	struct BufferedUartTxDescriptor completed = { .CompletionHandler = NULL };
+	BufferedUart_TxSent(bufferedUart, &completed);
+	// the USART finished the last frame
+	BufferedUart_TxSentUpTo(bufferedUart, bufferedUart->txqueue.tail);
+	BufferedUart_StartTransmission(bufferedUart);
+	if (huart->gState == HAL_UART_STATE_READY) {
+		// nothing more to send: the bus is released right after the last stop bit
+		BufferedUart_HalfDuplexRelease(bufferedUart);
+	}
+	BufferedUart_TxNotify(bufferedUart, &completed);
+	STATISTICS_CYCLES_END(bufferedUart, txCpltCalls, txCpltCycles);
+}
+
+#ifdef BUFFERED_UART_TX_GAPLESS
+/**
+ * Replaces the TX DMA transfer complete callback of the HAL (see BUFFERED_UART_TX_GAPLESS)
+ * The DMA wrote the last byte into the transmit data register, two frames are left on the wire. If
+ * more data is queued, the DMA channel is started again right away while the USART stays busy and
+ * keeps its DMA request enabled, otherwise the HAL ends the transmission at the USART transfer
+ * complete interrupt as usual.
+ */
+static void BufferedUart_TxDmaCpltCallback(DMA_HandleTypeDef *hdma)
+{
+	STATISTICS_CYCLES_START();
+	struct BufferedUart * bufferedUart = ContainerOf((UART_HandleTypeDef *)hdma->Parent);
+	if (bufferedUart == NULL) {
 		Error_Handler();
 	}
+
+	struct BufferedUartTxDescriptor completed = { .CompletionHandler = NULL };
+	BufferedUart_TxSent(bufferedUart, &completed);
+	unsigned int sent = bufferedUart->txqueue.tail;
+	bufferedUart->txChaining = true;
+	BufferedUart_StartTransmission(bufferedUart);
+	bufferedUart->txChaining = false;
+	bool chained = bufferedUart->lastSendBlockSize > 0;
+	if (chained) {
+		// the last two frames are still on the wire, but the line does not go idle in between
+		BufferedUart_TxSentUpTo(bufferedUart, sent);
+	} else {
+		// nothing queued, or a preempted context is about to start: the HAL waits for the USART transfer
+		// complete, BufferedUart_TxCpltCallback then starts the next transfer
+		bufferedUart->txHalDmaCplt(hdma);
+	}
+	BufferedUart_TxNotify(bufferedUart, &completed);
+	if (chained) {
+		STATISTICS_CYCLES_END(bufferedUart, txCpltCalls, txCpltCycles);
+	}
 }
+#endif
 
 /**
- * Transmit data
- * The data is first copied into an internal buffer and then immediately send as soon as the
- * uart peripheral becomes available
- * @note if this is called from interrupt and normal context (reentrant), BUFFERED_UART_REENTRANT must be defined
- * 		 if BUFFERED_UART_REENTRANT is defined, all interrupts are disabled in this function (default reentrant strategy)
+ * Move the rx queue head up to the current DMA position and pass the unread data to the DataReceivedHandler
+ * The DMA position is read from the DMA counter, not taken from the event: events of the USART and the
+ * RX DMA interrupt, and BufferedUart_RxPoll, can be serviced in a different order than they happened.
+ * A report which finds the DMA wrapped around before the transfer complete interrupt was serviced
+ * accounts for the wrap itself, the transfer complete interrupt then does not count it again.
  * @param[in]	uart
- * @param[in]	data
- * @param[in]	length
- * @return		HAL_StatusTypeDef
+ * @param[in]	transferComplete	the event is the RX DMA transfer complete interrupt
+ * @param[in]	event	on buffer fill events (DMA half/complete transfer or BufferedUart_RxPoll) the
+ * 						DataReceivedHandler is only called if at least rxFillThreshold bytes are unread
  */
-HAL_StatusTypeDef BufferedUart_Transmit(struct BufferedUart *uart, const void * data, unsigned int length)
+static void BufferedUart_RxReport(struct BufferedUart *uart, bool transferComplete, enum BufferedUartRxEvent event)
 {
-	BUFFERED_UART_REENTRANT_ENTER_CRITICAL_SECTION();
+	bool fill = event == BUFFERED_UART_RX_EVENT_TC || event == BUFFERED_UART_RX_EVENT_HT || event == BUFFERED_UART_RX_EVENT_POLL;
+	struct BlockRingbuffer * rxqueue = &uart->rxqueue;
+	unsigned int queueMaxSize = BlockRingbuffer_GetLength(rxqueue);
+	unsigned int position = queueMaxSize - __HAL_DMA_GET_COUNTER(uart->uart->hdmarx);
+	if (position >= queueMaxSize) {
+		position = 0;
+	}
 
-	HAL_StatusTypeDef result = HAL_OK;
-	bool ok = BufferedUart_TXQueue_Enqueue(uart, data, length);
-	if (!ok) {
-		result = HAL_BUSY;
+	if (transferComplete && uart->rxWrapReported) {
+		uart->rxWrapReported = false;
+		transferComplete = false;
+	}
+	unsigned int received;
+	if (!transferComplete && position >= uart->rxDmaPosition) {
+		received = position - uart->rxDmaPosition;
+	} else {
+		// the DMA wrapped around since the last report (a complete lap if the position did not change)
+		received = position + queueMaxSize - uart->rxDmaPosition;
+		uart->rxWrapReported = !transferComplete;
 	}
 
-	BufferedUart_TryStartTransmission(uart);
+#ifdef BUFFERED_UART_DCACHE
+	// the lines of the newly received range may have been cached by reads of the previous data in the same line
+	// or speculatively, so they are invalidated now instead of once when the reception is started
+	if (received >= queueMaxSize) {
+		DCACHE_INVALIDATE(rxqueue->buf, queueMaxSize);
+	} else if (received > 0) {
+		if (uart->rxDmaPosition + received <= queueMaxSize) {
+			DCACHE_INVALIDATE(rxqueue->buf + uart->rxDmaPosition, received);
+		} else {
+			DCACHE_INVALIDATE(rxqueue->buf + uart->rxDmaPosition, queueMaxSize - uart->rxDmaPosition);
+			DCACHE_INVALIDATE(rxqueue->buf, position);
+		}
+	}
+#endif
 
-	BUFFERED_UART_REENTRANT_EXIT_CRITICAL_SECTION();
+	atomic_signal_fence(memory_order_acquire);
+	unsigned int receivedStart = rxqueue->head;
+	rxqueue->head = BlockRingbuffer_Advance(rxqueue, receivedStart, received);
+	uart->rxDmaPosition = position;
+	atomic_signal_fence(memory_order_release);
+	STATISTICS_ADD(uart, rxBytes, received);
+	if (received > 0) {
+		LATENCY_RX_RECEIVED(uart);
+		Readiness_Set(&s_rxReady, 1U << uart->index);
+	}
+#ifdef BUFFERED_UART_OS
+	unsigned int rxWakeBytes = uart->rxWakeBytes;
+	if (rxWakeBytes > 0 && BlockRingbuffer_GetReadAvailable(rxqueue) >= rxWakeBytes) {
+		uart->rxWakeBytes = 0;
+		BufferedUartOs_EventSignal(&uart->rxEvent);
+	}
+#endif
+	STATISTICS_MAX(uart, rxHighWater, min(BlockRingbuffer_GetReadAvailable(rxqueue), queueMaxSize));
+#ifdef BUFFERED_UART_TRACE
+	if (uart->traceBuffer != NULL) {
+		// recorded before the DataReceivedHandler, which may modify the data in place
+		struct BufferedUartSpan first;
+		struct BufferedUartSpan second;
+		BlockRingbuffer_GetSpans(rxqueue, receivedStart, received, &first, &second);
+		BufferedUart_Trace(uart, BUFFERED_UART_TRACE_RX, event, position, &first, &second);
+	}
+#endif
 
-	return result;
+	if (uart->rxFlowControl == BUFFERED_UART_FLOW_XON_XOFF && received > 0) {
+		BufferedUart_RxFlowScan(uart, receivedStart, received);
+	}
+	BufferedUart_RxDeliver(uart, fill);
+	// checked after the delivery, a DataReceivedHandler which consumes the data does not stop the peer
+	if (uart->rxFlowControl != BUFFERED_UART_FLOW_NONE && !uart->rxFlowStopped
+			&& BlockRingbuffer_GetReadAvailable(rxqueue) >= uart->rxFlowHighWatermark) {
+		BufferedUart_RxFlowSignal(uart, true);
+	}
 }
 
-/**
- * Transmit data with a maximum timeout
- * The data is first copied into an internal buffer and then immediately send as soon as the
- * uart peripheral becomes available
- * @note the timeout parameter allows to call this function with a data length greater than the internal buffer size.
- *       Note that in this case the sent data can be incomplete if the timeout occurs before all data is sent
- * @note if this is called from interrupt and normal context (reentrant), BUFFERED_UART_REENTRANT must be defined
- * 		 if BUFFERED_UART_REENTRANT is defined, all interrupts are disabled in this function (default reentrant strategy)
- * @param[in]	uart
- * @param[in]	data
- * @param[in]	length
- * @return		HAL_StatusTypeDef
- */
-HAL_StatusTypeDef BufferedUart_TransmitTimed(struct BufferedUart *uart, const void * data, unsigned int length, unsigned int timeoutMs)
+/// pass the unread data to the DataReceivedHandler, on fill events only once rxFillThreshold bytes are unread
+static void BufferedUart_RxDeliver(struct BufferedUart *uart, bool fill)
 {
-    if (timeoutMs == 0) {
-        return BufferedUart_Transmit(uart, data, length);
-    }
+	if (uart->DataReceivedHandler != NULL) {
+		struct BufferedUartSpan first;
+		struct BufferedUartSpan second;
+		unsigned int length = BufferedUart_RxPeek(uart, &first, &second);
+		if (fill && length < uart->rxFillThreshold) {
+			return;
+		}
+		// length would be 0 if a UART IDLE event happens exactly after (HALF) DMA COMPLETE interrupt
+		// data wrapping around the end of the buffer is passed in two calls, the second one only if the first was handled
+		if (length > 0 && uart->DataReceivedHandler(first.data, first.length) == BUFFERED_UART_DATA_HANDLED) {
+			BufferedUart_RxConsume(uart, first.length);
+			if (second.length > 0 && uart->DataReceivedHandler(second.data, second.length) == BUFFERED_UART_DATA_HANDLED) {
+				BufferedUart_RxConsume(uart, second.length);
+			}
+		}
+	}
+}
 
-    uint32_t start = HAL_GetTick();
-    HAL_StatusTypeDef result = HAL_OK;
-    while (length > 0) {
-        if (HAL_GetTick() - start > timeoutMs) {
-            result = HAL_TIMEOUT;
-            break;
-        }
+/// Size is the index in the rx buffer up to which the DMA wrote data (half transfer, transfer complete or IDLE event)
+void BufferedUart_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size)
+{
+	STATISTICS_CYCLES_START();
+	struct BufferedUart * bufferedUart = ContainerOf(huart);
+	if (bufferedUart == NULL) {
+		// error: the given uart handle was not registered before via buffered_uart_init
+		Error_Handler();
+	}
 
-        unsigned int enqueueSize = min(length, uart->txqueue.length);
-        result = BufferedUart_Transmit(uart, data, enqueueSize);
-        if (result == HAL_OK) {
-            length -= enqueueSize;
-            data += length;
-        }
+#ifdef BUFFERED_UART_RX_BLOCKS
+	if (bufferedUart->rxBlockSize > 0) {
+		BufferedUart_RxBlockReceived(bufferedUart, Size);
+		STATISTICS_CYCLES_END(bufferedUart, rxEventCalls, rxEventCycles);
+		return;
+	}
+#endif
 
-    }
+	unsigned int queueMaxSize = BlockRingbuffer_GetLength(&bufferedUart->rxqueue);
+	bool transferComplete = Size == queueMaxSize;
+#ifdef HAL_UART_RXEVENT_IDLE
+	enum BufferedUartRxEvent event = (enum BufferedUartRxEvent)HAL_UARTEx_GetRxEventType(huart);
+#else
+	// older HAL versions do not report the event type, an IDLE event exactly at the half of the buffer counts as fill event
+	enum BufferedUartRxEvent event = transferComplete ? BUFFERED_UART_RX_EVENT_TC
+			: Size == queueMaxSize / 2 ? BUFFERED_UART_RX_EVENT_HT : BUFFERED_UART_RX_EVENT_IDLE;
+#endif
 
-    return result;
+	BufferedUart_RxReport(bufferedUart, transferComplete, event);
+	STATISTICS_CYCLES_END(bufferedUart, rxEventCalls, rxEventCycles);
 }
 
-bool BufferedUart_TXQueue_Enqueue(struct BufferedUart * uart, const void * data, unsigned int length)
+/**
+ * Has to be called from the USARTx_IRQHandler in front of HAL_UART_IRQHandler if the receiver timeout
+ * or the character match delivery policy is used (see @ref BufferedUart_SetRxTimeout and
+ * @ref BufferedUart_SetRxCharacterMatch). It handles and clears the receiver timeout and character
+ * match flags, the HAL would abort the DMA reception on a receiver timeout and does not handle
+ * character matches at all.
+ * @param[in]	huart
+ */
+void BufferedUart_UART_IRQHandler(UART_HandleTypeDef *huart)
 {
-	if (length > BlockRingbuffer_GetWriteAvailable(&uart->txqueue)) {
-		return false;
+#if defined(USART_CR1_RTOIE) || defined(USART_CR1_CMIE)
+	struct BufferedUart * bufferedUart = ContainerOf(huart);
+	if (bufferedUart == NULL) {
+		return;
 	}
 
-	atomic_signal_fence(memory_order_acquire);
-	unsigned int head = uart->txqueue.head;
-	unsigned int queueMaxSize = BlockRingbuffer_GetLength(&uart->txqueue);
-	unsigned int sizeTillWrapAround = queueMaxSize - (head % queueMaxSize);
-	unsigned int firstLength = min(length, sizeTillWrapAround);
-	unsigned int secondLength = length - firstLength;
-
-	// first part
-	unsigned int insertIndex = head % queueMaxSize;
-	memcpy(uart->txqueue.buf + insertIndex, data, firstLength);
-	head += firstLength;
+	USART_TypeDef * usart = huart->Instance;
+	bool report = false;
+#ifdef USART_CR1_RTOIE
+	if ((usart->CR1 & USART_CR1_RTOIE) && (usart->ISR & USART_ISR_RTOF)) {
+		usart->ICR = USART_ICR_RTOCF;
+		report = true;
+	}
+#endif
+#ifdef USART_CR1_CMIE
+	if ((usart->CR1 & USART_CR1_CMIE) && (usart->ISR & USART_ISR_CMF)) {
+		usart->ICR = USART_ICR_CMCF;
+		report = true;
+	}
+#endif
 
-	// second part after wrap around
-	memcpy(uart->txqueue.buf, data + firstLength, secondLength);
-	head += secondLength;
+	if (report && huart->RxState == HAL_UART_STATE_BUSY_RX && !BufferedUart_RxUsesBlocks(bufferedUart)) {
+		BufferedUart_RxReport(bufferedUart, false, BUFFERED_UART_RX_EVENT_TIMEOUT);
+	}
+#endif
+}
 
-	atomic_signal_fence(memory_order_acquire);
-	uart->txqueue.head = head;
-	atomic_signal_fence(memory_order_release);
+/**
+ * Report data which was received since the last reception event, if at least rxFillThreshold bytes are unread
+ * The DMA only reports fill events at the half and at the end of the rx buffer. Calling this periodically
+ * (e.g. from the SysTick interrupt) bounds the delivery latency of a continuous stream to the fill
+ * threshold plus the poll period.
+ * @note the DataReceivedHandler is called with interrupts disabled
+ * @param[in]	uart
+ */
+void BufferedUart_RxPoll(struct BufferedUart *uart)
+{
+	uint32_t priMask = __get_PRIMASK();
+	__set_PRIMASK(1);
+	if (uart->uart->RxState == HAL_UART_STATE_BUSY_RX && !BufferedUart_RxUsesBlocks(uart)) {
+		BufferedUart_RxReport(uart, false, BUFFERED_UART_RX_EVENT_POLL);
+	}
+	__set_PRIMASK(priMask);
+}
 
-	return true;
+/**
+ * Call the DataReceivedHandler on DMA fill events (half/complete transfer, @ref BufferedUart_RxPoll)
+ * only once this many bytes are unread. Receiver timeout, character match and IDLE events always
+ * call it. Takes effect immediately.
+ * @param[in]	uart
+ * @param[in]	thresholdBytes	0 calls the handler on every event (default)
+ */
+void BufferedUart_SetRxFillThreshold(struct BufferedUart *uart, unsigned int thresholdBytes)
+{
+	uart->rxFillThreshold = thresholdBytes;
 }
 
-const void * BufferedUart_TXQueue_Dequeue(const struct BufferedUart *uart, unsigned int * length)
+/**
+ * Deliver received data after the line was silent for bitTimes bit durations (USART receiver timeout)
+ * instead of after one idle frame (IDLE line detection). A timeout shorter than a frame delivers
+ * short commands earlier, a longer one keeps messages with small gaps together.
+ * Takes effect at the next @ref BufferedUart_StartReception, requires @ref BufferedUart_UART_IRQHandler.
+ * @param[in]	uart
+ * @param[in]	bitTimes	0 uses IDLE line detection (default)
+ * @return		HAL_StatusTypeDef	HAL_ERROR if the USART has no receiver timeout or bitTimes is too large
+ */
+HAL_StatusTypeDef BufferedUart_SetRxTimeout(struct BufferedUart *uart, unsigned int bitTimes)
 {
-	unsigned int txAvailable = BlockRingbuffer_GetReadAvailable(&uart->txqueue);
-	if (txAvailable == 0) {
-		*length = 0;
-		return NULL;
+#ifdef USART_CR2_RTOEN
+	if (bitTimes > USART_RTOR_RTO) {
+		return HAL_ERROR;
 	}
+	uart->rxTimeoutBits = bitTimes;
+	return HAL_OK;
+#else
+	return bitTimes == 0 ? HAL_OK : HAL_ERROR;
+#endif
+}
 
-	atomic_signal_fence(memory_order_acquire);
+/**
+ * Deliver received data as soon as character was received (USART character match), e.g. the
+ * delimiter of a line or frame, in addition to the other events.
+ * Takes effect at the next @ref BufferedUart_StartReception, requires @ref BufferedUart_UART_IRQHandler.
+ * @param[in]	uart
+ * @param[in]	character	0 to 255, -1 disables the character match (default)
+ * @return		HAL_StatusTypeDef	HAL_ERROR if the USART has no character match or character is invalid
+ */
+HAL_StatusTypeDef BufferedUart_SetRxCharacterMatch(struct BufferedUart *uart, int character)
+{
+#ifdef USART_CR1_CMIE
+	if (character < -1 || character > 0xFF) {
+		return HAL_ERROR;
+	}
+	uart->rxMatchCharacter = character;
+	return HAL_OK;
+#else
+	return character == -1 ? HAL_OK : HAL_ERROR;
+#endif
+}
 
-	unsigned int tail = uart->txqueue.tail;
-	unsigned int queueMaxSize = BlockRingbuffer_GetLength(&uart->txqueue);
-	unsigned int sizeTillWrapAround = queueMaxSize - (tail % queueMaxSize);
-	unsigned int dequeueLength = min(txAvailable, sizeTillWrapAround);
+/**
+ * Stop the peer before the rx queue overflows and resume it once the application caught up
+ * The fill level is checked at every reception event (DMA half/complete transfer, IDLE, receiver
+ * timeout, character match, @ref BufferedUart_RxPoll) after the DataReceivedHandler: at highWatermark
+ * unread bytes the RtsHandler deasserts RTS or XOFF is sent ahead of all queued data. Once the
+ * application consumed the queue down to lowWatermark, RTS is asserted again or XON is sent.
+ * A continuous stream is reported only every half rx buffer, so highWatermark plus the bytes the peer
+ * sends after the stop request must not exceed half the rx buffer, unless BufferedUart_RxPoll is
+ * called more often. XOFF waits for the running TX DMA transfer (see @ref BufferedUart_SetTxChunkSize).
+ * With BUFFERED_UART_FLOW_XON_XOFF received XOFF/XON pause and resume the transmission (see
+ * @ref BufferedUart_PauseTransmission), they stay in the received data. Both start transmissions from
+ * the rx interrupt, so without BUFFERED_UART_LOCKFREE the DMA start of the thread level then runs with
+ * interrupts disabled, BUFFERED_UART_REENTRANT is not required.
+ * @note not used by the block reception (BUFFERED_UART_RX_BLOCKS)
+ * @param[in]	uart
+ * @param[in]	mode
+ * @param[in]	highWatermark	unread bytes at which the peer is stopped
+ * @param[in]	lowWatermark	unread bytes at which the peer is resumed, less than highWatermark
+ * @param[in]	RtsHandler		sets the RTS line (BUFFERED_UART_FLOW_RTS), stop deasserts it. Called with interrupts disabled
+ * @return		HAL_StatusTypeDef	HAL_ERROR if the watermarks do not fit the rx queue or the RtsHandler is missing
+ */
+HAL_StatusTypeDef BufferedUart_SetFlowControl(struct BufferedUart *uart, enum BufferedUartFlowControl mode, unsigned int highWatermark, unsigned int lowWatermark, void (*RtsHandler)(struct BufferedUart * uart, bool stop))
+{
+	if (mode != BUFFERED_UART_FLOW_NONE && (lowWatermark >= highWatermark || highWatermark > BlockRingbuffer_GetLength(&uart->rxqueue)
+			|| (mode == BUFFERED_UART_FLOW_RTS && RtsHandler == NULL))) {
+		return HAL_ERROR;
+	}
 
-	*length = dequeueLength;
-	const void * dequeueData = uart->txqueue.buf + (tail % queueMaxSize);
+	uint32_t priMask = __get_PRIMASK();
+	__set_PRIMASK(1);
+	if (uart->rxFlowStopped) {
+		// resumed the way it was stopped
+		BufferedUart_RxFlowSignal(uart, false);
+	}
+	uart->rxFlowControl = mode;
+	if (mode == BUFFERED_UART_FLOW_XON_XOFF) {
+		uart->txInterruptStarts = true;
+	}
+	uart->rxFlowHighWatermark = highWatermark;
+	uart->rxFlowLowWatermark = lowWatermark;
+	uart->RtsHandler = RtsHandler;
+	__set_PRIMASK(priMask);
 
-	return dequeueData;
+	return HAL_OK;
 }
 
-void BufferedUart_TryStartTransmission(struct BufferedUart *uart)
+/**
+ * Transmit on a half-duplex bus like RS-485: the driver enable is asserted in front of the first TX DMA
+ * transfer and released by the USART transfer complete interrupt after the last stop bit, as long as no
+ * more data is queued. The receiver (USART_CR1_RE) is disabled in between, so the echo of the
+ * transceiver does not end up in the rx queue, and the response of the peer is received right away.
+ * With BUFFERED_UART_HALF_DUPLEX_DE the USART drives DE itself, after e.g. HAL_RS485Ex_Init configured
+ * it (USART_CR3_DEM), otherwise the DriverEnableHandler sets e.g. a GPIO.
+ * @param[in]	uart
+ * @param[in]	mode
+ * @param[in]	DriverEnableHandler	sets DE (BUFFERED_UART_HALF_DUPLEX_HANDLER). Called with interrupts disabled
+ * @return		HAL_StatusTypeDef	HAL_ERROR if the USART has no DE or the DriverEnableHandler is missing,
+ * 									HAL_BUSY while a transmission holds the bus
+ */
+HAL_StatusTypeDef BufferedUart_SetHalfDuplex(struct BufferedUart *uart, enum BufferedUartHalfDuplex mode, void (*DriverEnableHandler)(struct BufferedUart * uart, bool enable))
 {
-	if (BufferedUart_IsTXBusy(uart)) {
-		return;
+	if (mode == BUFFERED_UART_HALF_DUPLEX_HANDLER && DriverEnableHandler == NULL) {
+		return HAL_ERROR;
 	}
-
-	unsigned int length;
-	const void * data = BufferedUart_TXQueue_Dequeue(uart, &length);
-	if (length > 0) {
-		uart->lastSendBlockSize = length;
-		HAL_StatusTypeDef result = HAL_UART_Transmit_DMA(uart->uart, (uint8_t*)data, length);
-		disableHalfCompleteInterrupt(uart->uart->hdmatx);	// small optimization, disable unused interrupt
-		if (result != HAL_OK) {
-			Error_Handler();
+	if (mode == BUFFERED_UART_HALF_DUPLEX_DE) {
+#ifdef USART_CR3_DEM
+		if (!(uart->uart->Instance->CR3 & USART_CR3_DEM)) {
+			return HAL_ERROR;
 		}
+#else
+		return HAL_ERROR;
+#endif
+	}
+
+	HAL_StatusTypeDef status = HAL_BUSY;
+	uint32_t priMask = __get_PRIMASK();
+	__set_PRIMASK(1);
+	if (!uart->txDriving) {
+		uart->txHalfDuplex = mode;
+		uart->DriverEnableHandler = DriverEnableHandler;
+		status = HAL_OK;
 	}
+	__set_PRIMASK(priMask);
+
+	return status;
 }
 
-unsigned int BufferedUart_Dequeue(struct BufferedUart *uart, void * buffer, unsigned int maximumLength)
+/**
+ * Pause or resume the transmission, e.g. from the interrupt of a CTS input. A USART with hardware
+ * flow control (CTSE) pauses by itself and does not need it.
+ * A running DMA transfer is finished, @ref BufferedUart_SetTxChunkSize limits what is sent after the
+ * pause. XON/XOFF of the flow control are still sent while paused. With BUFFERED_UART_FLOW_XON_XOFF
+ * received XOFF and XON call it.
+ * Resuming starts the transmission, without BUFFERED_UART_LOCKFREE the DMA start of the thread level
+ * runs with interrupts disabled from the first call on. An application which pauses from an interrupt
+ * calls it once before it transmits, e.g. BufferedUart_PauseTransmission(uart, false) after the init.
+ * @param[in]	uart
+ * @param[in]	paused
+ */
+void BufferedUart_PauseTransmission(struct BufferedUart *uart, bool paused)
 {
-    uint32_t queueSize = BlockRingbuffer_GetReadAvailable(&uart->rxqueue);
-    if (queueSize == 0 || maximumLength == 0) {
-        return 0;
-    }
+	uart->txInterruptStarts = true;
+	uart->txPaused = paused;
+	atomic_signal_fence(memory_order_release);
+	if (!paused) {
+		BufferedUart_StartTransmission(uart);
+	}
+}
 
-    atomic_signal_fence(memory_order_acquire);
-    unsigned int tail = uart->rxqueue.tail;
-    unsigned int dequeueLength = min(queueSize, maximumLength);
-    unsigned int queueMaxSize = BlockRingbuffer_GetLength(&uart->rxqueue);
-    unsigned int sizeTillWrapAround = queueMaxSize - (tail % queueMaxSize);
-    unsigned int firstLength = min(dequeueLength, sizeTillWrapAround);
-    unsigned int secondLength = dequeueLength - firstLength;
+/// ask the peer to stop or to resume sending, with interrupts disabled or from interrupt context
+static void BufferedUart_RxFlowSignal(struct BufferedUart * uart, bool stop)
+{
+	uart->rxFlowStopped = stop;
+	if (uart->rxFlowControl == BUFFERED_UART_FLOW_RTS) {
+		uart->RtsHandler(uart, stop);
+		return;
+	}
 
-    // first part
-    const char *dequeueData = uart->rxqueue.buf + (tail % queueMaxSize);
-    memcpy(buffer, dequeueData, firstLength);
-    tail += firstLength;
+	// a character which was not sent yet is replaced, the peer only needs the latest state
+#ifdef BUFFERED_UART_LOCKFREE
+	__atomic_store_n(&uart->txFlowCharacter, stop ? BUFFERED_UART_XOFF : BUFFERED_UART_XON, __ATOMIC_RELEASE);
+#else
+	uart->txFlowCharacter = stop ? BUFFERED_UART_XOFF : BUFFERED_UART_XON;
+#endif
+	BufferedUart_StartTransmission(uart);
+}
 
-    // second part after wrap around
-    dequeueData = uart->rxqueue.buf;
-    char * dstPtr = ((char*)buffer) + firstLength;
-    memcpy(dstPtr, dequeueData, secondLength);
-    tail += secondLength;
+/// resume the peer if the rx queue was read down to the low watermark
+static void BufferedUart_RxFlowResume(struct BufferedUart * uart)
+{
+	uint32_t priMask = __get_PRIMASK();
+	__set_PRIMASK(1);
+	// the reception may have stopped the peer again in between
+	if (uart->rxFlowStopped && BlockRingbuffer_GetReadAvailable(&uart->rxqueue) <= uart->rxFlowLowWatermark) {
+		BufferedUart_RxFlowSignal(uart, false);
+	}
+	__set_PRIMASK(priMask);
+}
 
-    atomic_signal_fence(memory_order_acquire);
-    uart->rxqueue.tail = tail;
-    atomic_signal_fence(memory_order_release);
+/// the last XON/XOFF among the length received bytes from position resumes/pauses the transmission
+static void BufferedUart_RxFlowScan(struct BufferedUart * uart, unsigned int position, unsigned int length)
+{
+	struct BufferedUartSpan first;
+	struct BufferedUartSpan second;
+	BlockRingbuffer_GetSpans(&uart->rxqueue, position, length, &first, &second);
+
+	const struct BufferedUartSpan * spans[] = { &second, &first };
+	for (unsigned int s = 0; s < 2; s++) {
+		for (unsigned int i = spans[s]->length; i > 0; i--) {
+			char character = spans[s]->data[i - 1];
+			if (character == BUFFERED_UART_XOFF || character == BUFFERED_UART_XON) {
+				BufferedUart_PauseTransmission(uart, character == BUFFERED_UART_XOFF);
+				return;
+			}
+		}
+	}
+}
 
-    return dequeueLength;
+/// remove the pending XON/XOFF, -1 if there is none
+static int BufferedUart_TakeFlowCharacter(struct BufferedUart * uart)
+{
+#ifdef BUFFERED_UART_LOCKFREE
+	return __atomic_exchange_n(&uart->txFlowCharacter, -1, __ATOMIC_ACQ_REL);
+#else
+	uint32_t priMask = __get_PRIMASK();
+	__set_PRIMASK(1);
+	int character = uart->txFlowCharacter;
+	uart->txFlowCharacter = -1;
+	__set_PRIMASK(priMask);
+	return character;
+#endif
+}
+
+#ifdef BUFFERED_UART_RX_BLOCKS
+/// start the RX DMA into rxBlock
+static HAL_StatusTypeDef BufferedUart_RxBlockStart(struct BufferedUart *uart)
+{
+	HAL_StatusTypeDef status = HAL_UARTEx_ReceiveToIdle_DMA(uart->uart, (uint8_t*)uart->rxBlock->data, uart->rxBlockSize);
+	// the block is handed over when it is full or the line went idle, not when it is half full
+	disableHalfCompleteInterrupt(uart->uart->hdmarx);
+	return status;
+}
+
+/// arm the reception with the next free block, it stops (starves) if there is none
+static HAL_StatusTypeDef BufferedUart_RxBlockNext(struct BufferedUart *uart)
+{
+	uart->rxBlock = RxBlockList_Pop(&uart->rxBlockFree);
+	uart->rxBlockStarved = uart->rxBlock == NULL;
+	if (uart->rxBlockStarved) {
+		STATISTICS_ADD(uart, rxStarved, 1);
+		return HAL_OK;
+	}
+	return BufferedUart_RxBlockStart(uart);
 }
 
+/// reception event of the block reception, the block is handed over once the DMA stopped (full or IDLE)
+static void BufferedUart_RxBlockReceived(struct BufferedUart *uart, unsigned int length)
+{
+	struct BufferedUartRxBlock * block = uart->rxBlock;
+	if (block == NULL || uart->uart->RxState == HAL_UART_STATE_BUSY_RX) {
+		// half transfer event, the DMA still fills the block
+		return;
+	}
 
+	if (length == 0) {
+		if (BufferedUart_RxBlockStart(uart) != HAL_OK) {
+			Error_Handler();
+		}
+		return;
+	}
+
+	DCACHE_INVALIDATE(block->data, length);
+	block->length = length;
+	// re-arm first, the next frame is already on its way
+	if (BufferedUart_RxBlockNext(uart) != HAL_OK) {
+		Error_Handler();
+	}
+	STATISTICS_ADD(uart, rxBytes, length);
+	STATISTICS_ADD(uart, rxBlocks, 1);
+
+	if (uart->BlockReceivedHandler != NULL) {
+		uart->BlockReceivedHandler(uart, block);
+	} else {
+		RxBlockList_Push(&uart->rxBlockReceived, block);
+		Readiness_Set(&s_rxReady, 1U << uart->index);
+	}
+}
+
+/**
+ * Receive into blocks of a pool instead of the rx ring buffer (zero copy packet reception)
+ * The RX DMA (normal mode) fills one block at a time. The block is handed to the application when the
+ * line went idle or the block is full, and the DMA is re-armed with the next free block right away, so
+ * the reception goes on while the application still holds earlier blocks. A packet longer than a block
+ * arrives in several blocks. The application owns a received block until it returns it via
+ * @ref BufferedUart_ReleaseRxBlock, its data must not be modified. If no block is free the reception
+ * stops (rxStarved statistics) until the next block is released, data arriving meanwhile is lost.
+ * The receiver timeout and character match are not used. @ref BufferedUart_StartReception switches
+ * back to the rx ring buffer, without rx buffer the buffered uart can be initialized with rxBuffer NULL
+ * and rxSize 0.
+ * @param[in]	uart
+ * @param[in]	blocks	pool of numberBlocks blocks, the data of every block has blockSize bytes (aligned to
+ * 						and a multiple of BUFFERED_UART_DCACHE_LINE_SIZE with BUFFERED_UART_DCACHE)
+ * @param[in]	numberBlocks
+ * @param[in]	blockSize	at most 65535 (16 bit DMA transfer size of the HAL)
+ * @param[in]	BlockReceivedHandler	called with every received block from interrupt context, NULL
+ * 										queues the blocks for @ref BufferedUart_GetRxBlock
+ * @return		HAL_StatusTypeDef	HAL_ERROR for invalid blocks, the status of the HAL otherwise
+ */
+HAL_StatusTypeDef BufferedUart_StartBlockReception(struct BufferedUart *uart, struct BufferedUartRxBlock *blocks, unsigned int numberBlocks, unsigned int blockSize,
+		void (*BlockReceivedHandler)(struct BufferedUart * uart, struct BufferedUartRxBlock * block))
+{
+	if (blocks == NULL || numberBlocks == 0 || blockSize == 0 || blockSize > 0xFFFFU) {
+		return HAL_ERROR;
+	}
+#ifdef BUFFERED_UART_DCACHE
+	for (unsigned int i = 0; i < numberBlocks; i++) {
+		// the invalidation of a received block must not discard other data
+		if ((((uintptr_t)blocks[i].data | blockSize) & DCACHE_LINE_MASK) != 0) {
+			return HAL_ERROR;
+		}
+	}
+#endif
+
+	if (uart->uart->RxState == HAL_UART_STATE_BUSY_RX) {
+		BufferedUart_StopReception(uart);
+	}
+
+#ifdef DMA_CIRCULAR
+	// every block is a transfer of its own, the DMA stops when it is full
+	DMA_HandleTypeDef * hdma = uart->uart->hdmarx;
+	if (hdma->Init.Mode != DMA_NORMAL) {
+		hdma->Init.Mode = DMA_NORMAL;
+		HAL_StatusTypeDef status = HAL_DMA_Init(hdma);
+		if (status != HAL_OK) {
+			return status;
+		}
+	}
+#endif
+
+	uart->rxBlockFree = NULL;
+	for (unsigned int i = numberBlocks; i-- > 0;) {
+		blocks[i].length = 0;
+		blocks[i].next = uart->rxBlockFree;
+		uart->rxBlockFree = &blocks[i];
+	}
+	uart->rxBlockReceived = NULL;
+	uart->rxBlockTaken = NULL;
+	uart->BlockReceivedHandler = BlockReceivedHandler;
+	uart->rxBlockSize = blockSize;
+	Readiness_Clear(&s_rxReady, 1U << uart->index);
+
+	uint32_t priMask = __get_PRIMASK();
+	__set_PRIMASK(1);
+	HAL_StatusTypeDef status = BufferedUart_RxBlockNext(uart);
+	__set_PRIMASK(priMask);
+	return status;
+}
+
+/**
+ * Take the oldest received block which was not taken yet (blocks without BlockReceivedHandler)
+ * Only one context may take blocks.
+ * @param[in]	uart
+ * @return		struct BufferedUartRxBlock*	NULL if there is none, owned by the caller until
+ * 				@ref BufferedUart_ReleaseRxBlock
+ */
+struct BufferedUartRxBlock * BufferedUart_GetRxBlock(struct BufferedUart *uart)
+{
+	if (uart->rxBlockTaken == NULL) {
+		// the reception pushes the blocks newest first, reversing them once restores the order
+		struct BufferedUartRxBlock * received = RxBlockList_TakeAll(&uart->rxBlockReceived);
+		while (received != NULL) {
+			struct BufferedUartRxBlock * next = received->next;
+			received->next = uart->rxBlockTaken;
+			uart->rxBlockTaken = received;
+			received = next;
+		}
+	}
+
+	struct BufferedUartRxBlock * block = uart->rxBlockTaken;
+	if (block != NULL) {
+		uart->rxBlockTaken = block->next;
+	}
+	return block;
+}
+
+/**
+ * Return a received block to the pool, from any context
+ * Restarts a reception which stopped because no block was free.
+ * @param[in]	uart
+ * @param[in]	block
+ */
+void BufferedUart_ReleaseRxBlock(struct BufferedUart *uart, struct BufferedUartRxBlock *block)
+{
+	RxBlockList_Push(&uart->rxBlockFree, block);
+
+	atomic_signal_fence(memory_order_seq_cst);
+	if (*(volatile bool *)&uart->rxBlockStarved) {
+		// the reception is stopped, so popping here does not race with the rx interrupt
+		uint32_t priMask = __get_PRIMASK();
+		__set_PRIMASK(1);
+		if (uart->rxBlockStarved && uart->rxBlockSize > 0 && BufferedUart_RxBlockNext(uart) != HAL_OK) {
+			Error_Handler();
+		}
+		__set_PRIMASK(priMask);
+	}
+}
+#endif
+
+/// the current strategy is to just restart the reception on error
+/// transmission will start automatically the next time something is enqueued
+void BufferedUart_UART_ErrorCallback(UART_HandleTypeDef *huart)
+{
+	struct BufferedUart * bufferedUart = ContainerOf(huart);
+	if (bufferedUart == NULL) {
+		return;
+	}
+
+	STATISTICS_ADD(bufferedUart, errorRestarts, 1);
+	TRACE(bufferedUart, BUFFERED_UART_TRACE_ERROR, huart->ErrorCode & 0xFFU, 0);
+	BufferedUart_StopReception(bufferedUart);
+#ifdef BUFFERED_UART_RX_BLOCKS
+	if (bufferedUart->rxBlockSize > 0) {
+		// the current block is filled again from its beginning, nothing is armed if the reception starved
+		if (bufferedUart->rxBlock != NULL && BufferedUart_RxBlockStart(bufferedUart) != HAL_OK) {
+			Error_Handler();
+		}
+		return;
+	}
+#endif
+	HAL_StatusTypeDef result = BufferedUart_StartReception(bufferedUart);
+	if (result != HAL_OK) {
+		Error_Handler();
+	}
+}
+
+/// number of bytes to skip at position, so that a block of length bytes is contiguous in the tx buffer
+static inline unsigned int BufferedUart_TXQueue_GetPadding(const struct BufferedUart * uart, unsigned int position, unsigned int length)
+{
+#ifdef BUFFERED_UART_TX_BIPBUFFER
+	unsigned int sizeTillWrapAround = BlockRingbuffer_GetLength(&uart->txqueue) - BlockRingbuffer_GetIndex(&uart->txqueue, position);
+	if (length > sizeTillWrapAround) {
+		return sizeTillWrapAround;
+	}
+#else
+	(void)uart;
+	(void)position;
+	(void)length;
+#endif
+	return 0;
+}
+
+/// largest block which always fits into the tx queue once it ran empty
+static inline unsigned int BufferedUart_TXQueue_GetMaxBlockSize(const struct BufferedUart * uart)
+{
+#ifdef BUFFERED_UART_TX_BIPBUFFER
+	// a larger block may neither fit in front of the end of the buffer nor behind the padding
+	return uart->txqueue.length / 2;
+#else
+	return uart->txqueue.length;
+#endif
+}
+
+#ifdef BUFFERED_UART_LOCKFREE
+/**
+ * Reserve length bytes at the end of the tx queue
+ * Contexts preempting each other get consecutive, disjoint regions. A region is not sent before
+ * it is committed via @ref BufferedUart_TXQueue_Commit
+ * @return		false if there is not enough space
+ */
+static bool BufferedUart_TXQueue_Reserve(struct BufferedUart * uart, unsigned int length, unsigned int * position)
+{
+	struct BlockRingbuffer * txqueue = &uart->txqueue;
+	unsigned int reservation = atomic_load_explicit(&uart->txReservation, memory_order_acquire);
+	unsigned int desired;
+	unsigned int end;
+	unsigned int padding;
+
+	do {
+		end = reservation >> TX_RESERVATION_PENDING_BITS;
+		unsigned int pending = reservation & TX_RESERVATION_PENDING_MASK;
+		atomic_signal_fence(memory_order_acquire);
+		unsigned int used = BlockRingbuffer_Distance(txqueue, txqueue->tail, end);
+		padding = BufferedUart_TXQueue_GetPadding(uart, end, length);
+		if (pending == TX_RESERVATION_PENDING_MASK || padding + length > txqueue->length - used) {
+			return false;
+		}
+
+		desired = (BlockRingbuffer_Advance(txqueue, end, padding + length) << TX_RESERVATION_PENDING_BITS) | (pending + 1);
+	} while (!atomic_compare_exchange_weak_explicit(&uart->txReservation, &reservation, desired, memory_order_acq_rel, memory_order_acquire));
+
+#ifdef BUFFERED_UART_TX_BIPBUFFER
+	// the padding is published together with this reservation, so the consumer can not see it earlier
+	if (padding > 0) {
+		uart->txPaddingPosition = end;
+	}
+#endif
+	*position = BlockRingbuffer_Advance(txqueue, end, padding);
+
+	return true;
+}
+
+/**
+ * Give back the unused end of a reservation
+ * @return		false if another context reserved space or queued a zero copy buffer after it in the meantime
+ */
+static bool BufferedUart_TXQueue_Shrink(struct BufferedUart * uart, unsigned int position, unsigned int reserved, unsigned int length)
+{
+	struct BlockRingbuffer * txqueue = &uart->txqueue;
+	unsigned int end = BlockRingbuffer_Advance(txqueue, position, reserved);
+#ifdef BUFFERED_UART_TX_ZEROCOPY
+	// a zero copy buffer queued at the end of the reservation would end up behind the new end,
+	// BufferedUart_TransmitZeroCopy queues with interrupts disabled, so it can not slip in between
+	uint32_t priMask = __get_PRIMASK();
+	__set_PRIMASK(1);
+	unsigned int head = uart->txDescriptorHead;
+	if (head != uart->txDescriptorTail && uart->txDescriptors[(head - 1) % BUFFERED_UART_TX_ZEROCOPY_DESCRIPTORS].position == end) {
+		__set_PRIMASK(priMask);
+		return false;
+	}
+#endif
+	unsigned int reservation = atomic_load_explicit(&uart->txReservation, memory_order_acquire);
+	unsigned int desired;
+	bool shrunk = true;
+
+	do {
+		if ((reservation >> TX_RESERVATION_PENDING_BITS) != end) {
+			shrunk = false;
+			break;
+		}
+
+		desired = (BlockRingbuffer_Advance(txqueue, position, length) << TX_RESERVATION_PENDING_BITS) | (reservation & TX_RESERVATION_PENDING_MASK);
+	} while (!atomic_compare_exchange_weak_explicit(&uart->txReservation, &reservation, desired, memory_order_acq_rel, memory_order_acquire));
+#ifdef BUFFERED_UART_TX_ZEROCOPY
+	__set_PRIMASK(priMask);
+#endif
+
+	return shrunk;
+}
+
+/**
+ * Commit a region reserved via @ref BufferedUart_TXQueue_Reserve
+ * Only the last pending reservation moves the head of the tx queue, so the data is published in
+ * the order it was reserved, even if a preempting context commits first.
+ */
+static void BufferedUart_TXQueue_Commit(struct BufferedUart * uart)
+{
+	unsigned int reservation = atomic_load_explicit(&uart->txReservation, memory_order_acquire);
+
+	do {
+		if ((reservation & TX_RESERVATION_PENDING_MASK) == 1) {
+			// all other reservations are committed, publish them while this one still counts as pending,
+			// so no other context can publish an older position afterwards
+			atomic_thread_fence(memory_order_release);
+			uart->txqueue.head = reservation >> TX_RESERVATION_PENDING_BITS;
+			atomic_signal_fence(memory_order_release);
+		}
+	} while (!atomic_compare_exchange_weak_explicit(&uart->txReservation, &reservation, reservation - 1, memory_order_acq_rel, memory_order_acquire));
+}
+#endif
+
+/// start the transmission if the uart is idle, from any context
+static void BufferedUart_StartTransmission(struct BufferedUart * uart)
+{
+#ifdef BUFFERED_UART_LOCKFREE
+	// only the first requester starts the DMA, it also serves the requests of contexts preempting it
+	if (atomic_fetch_add_explicit(&uart->txStartRequests, 1, memory_order_acq_rel) != 0) {
+		return;
+	}
+
+	unsigned int requests = 1;
+	do {
+		BufferedUart_TryStartTransmission(uart);
+		requests = atomic_fetch_sub_explicit(&uart->txStartRequests, requests, memory_order_acq_rel) - requests;
+	} while (requests != 0);
+#else
+	if (!uart->txInterruptStarts) {
+		// TxCplt only starts while the uart is busy, when no other context gets past the idle check
+		BufferedUart_TryStartTransmission(uart);
+		return;
+	}
+
+	// a received XON, XON/XOFF of the flow control or a resume start from interrupts while the uart is idle,
+	// one must not preempt another between the idle check and the DMA start
+	uint32_t priMask = __get_PRIMASK();
+	__set_PRIMASK(1);
+	BufferedUart_TryStartTransmission(uart);
+	__set_PRIMASK(priMask);
+#endif
+}
+
+/**
+ * Transmit data
+ * The data is first copied into an internal buffer and then immediately send as soon as the
+ * uart peripheral becomes available
+ * @note if this is called from interrupt and normal context (reentrant), BUFFERED_UART_REENTRANT or BUFFERED_UART_LOCKFREE must be defined
+ * 		 if BUFFERED_UART_REENTRANT is defined, all interrupts are disabled in this function (default reentrant strategy)
+ * 		 if BUFFERED_UART_LOCKFREE is defined, interrupts stay enabled and only the space reservation is atomic
+ * @param[in]	uart
+ * @param[in]	data
+ * @param[in]	length
+ * @return		HAL_StatusTypeDef
+ */
+HAL_StatusTypeDef BufferedUart_Transmit(struct BufferedUart *uart, const void * data, unsigned int length)
+{
+	return BufferedUart_TransmitSequenced(uart, data, length, NULL);
+}
+
+/**
+ * Similar to @ref BufferedUart_Transmit, additionally returns the sequence number of the data
+ * The data has left the uart once @ref BufferedUart_IsTxSent is true for the sequence number, see
+ * also @ref BufferedUart_NotifyTxSent and @ref BufferedUart_WaitTxSent
+ * @param[in]	uart
+ * @param[in]	data
+ * @param[in]	length
+ * @param[out]	sequence	tx sequence number behind the data, only written if the data was queued. May be NULL
+ * @return		HAL_StatusTypeDef
+ */
+HAL_StatusTypeDef BufferedUart_TransmitSequenced(struct BufferedUart *uart, const void * data, unsigned int length, uint32_t *sequence)
+{
+#ifdef BUFFERED_UART_LOCKFREE
+	HAL_StatusTypeDef result = HAL_OK;
+	unsigned int position;
+	if (BufferedUart_TXQueue_Reserve(uart, length, &position)) {
+		BufferedUart_TXQueue_Write(uart, position, data, length);
+		BufferedUart_TXQueue_Commit(uart);
+		if (sequence != NULL) {
+			*sequence = BufferedUart_TxSequenceOf(uart, BlockRingbuffer_Advance(&uart->txqueue, position, length));
+		}
+	} else {
+		result = HAL_BUSY;
+		STATISTICS_ADD_SHARED(uart, txRejected, 1);
+	}
+
+	BufferedUart_StartTransmission(uart);
+
+	return result;
+#else
+	LATENCY_TIMESTAMP(enqueueTime);
+	BUFFERED_UART_REENTRANT_ENTER_CRITICAL_SECTION();
+
+	HAL_StatusTypeDef result = HAL_OK;
+	bool ok = BufferedUart_TXQueue_Enqueue(uart, data, length);
+	if (ok) {
+		LATENCY_TX_ENQUEUED(uart, enqueueTime);
+		if (sequence != NULL) {
+			*sequence = BufferedUart_TxSequenceOf(uart, uart->txqueue.head);
+		}
+	} else {
+		result = HAL_BUSY;
+		STATISTICS_ADD(uart, txRejected, 1);
+	}
+
+	BufferedUart_StartTransmission(uart);
+
+	BUFFERED_UART_REENTRANT_EXIT_CRITICAL_SECTION();
+
+	return result;
+#endif
+}
+
+/**
+ * Transmit data with a maximum timeout
+ * The data is first copied into an internal buffer and then immediately send as soon as the
+ * uart peripheral becomes available
+ * @note the timeout parameter allows to call this function with a data length greater than the internal buffer size.
+ *       Note that in this case the sent data can be incomplete if the timeout occurs before all data is sent
+ * @note if this is called from interrupt and normal context (reentrant), BUFFERED_UART_REENTRANT must be defined
+ * 		 if BUFFERED_UART_REENTRANT is defined, all interrupts are disabled in this function (default reentrant strategy)
+ * @param[in]	uart
+ * @param[in]	data
+ * @param[in]	length
+ * @return		HAL_StatusTypeDef
+ */
+HAL_StatusTypeDef BufferedUart_TransmitTimed(struct BufferedUart *uart, const void * data, unsigned int length, unsigned int timeoutMs)
+{
+    if (timeoutMs == 0) {
+        return BufferedUart_Transmit(uart, data, length);
+    }
+
+    uint32_t start = HAL_GetTick();
+    HAL_StatusTypeDef result = HAL_OK;
+    while (length > 0) {
+        if (HAL_GetTick() - start > timeoutMs) {
+            result = HAL_TIMEOUT;
+            break;
+        }
+
+        unsigned int enqueueSize = min(length, BufferedUart_TXQueue_GetMaxBlockSize(uart));
+        result = BufferedUart_Transmit(uart, data, enqueueSize);
+        if (result == HAL_OK) {
+            length -= enqueueSize;
+            data = (const char *)data + enqueueSize;
+        }
+
+    }
+
+    return result;
+}
+
+/**
+ * Add a high priority transmit queue for @ref BufferedUart_TransmitUrgent
+ * Urgent data is sent at the next DMA boundary before all data of the normal queue, and it is never
+ * held back by the coalescing. Combine it with @ref BufferedUart_SetTxChunkSize to bound how long
+ * it waits behind a large transfer.
+ * @note call after @ref BufferedUart_Init before transmitting urgent data. With
+ * 		 BUFFERED_UART_FIXED_BUFFER_SIZE the size must be that size as well
+ * @param[in]	uart
+ * @param[in]	buffer	ring buffer of the urgent queue, NULL removes the urgent queue
+ * @param[in]	size	size of buffer
+ * @return		HAL_StatusTypeDef	HAL_ERROR if the buffer is not usable as ring buffer
+ */
+HAL_StatusTypeDef BufferedUart_SetUrgentQueue(struct BufferedUart *uart, void *buffer, unsigned int size)
+{
+	struct BlockRingbuffer urgent;
+	BlockRingbuffer_Init(&urgent, buffer, buffer != NULL ? size : 0);
+	if (buffer != NULL) {
+#ifdef BUFFERED_UART_FIXED_BUFFER_SIZE
+		if (size != BUFFERED_UART_FIXED_BUFFER_SIZE) {
+			return HAL_ERROR;
+		}
+#endif
+		if (!BlockRingbuffer_IsValid(&urgent)) {
+			return HAL_ERROR;
+		}
+	}
+
+	uart->txurgent = urgent;
+	return HAL_OK;
+}
+
+/**
+ * Transmit data with priority over the data queued via the other transmit functions
+ * The data is copied into the urgent queue (see @ref BufferedUart_SetUrgentQueue) and sent as soon as
+ * the running DMA transfer completes. Urgent messages are sent in the order they were queued.
+ * @note if BUFFERED_UART_REENTRANT or BUFFERED_UART_LOCKFREE is defined, interrupts are disabled while
+ * 		 the data is copied, urgent messages are expected to be short
+ * @param[in]	uart
+ * @param[in]	data
+ * @param[in]	length
+ * @return		HAL_StatusTypeDef	HAL_BUSY if there is not enough space, HAL_ERROR without urgent queue
+ */
+HAL_StatusTypeDef BufferedUart_TransmitUrgent(struct BufferedUart *uart, const void * data, unsigned int length)
+{
+	if (uart->txurgent.length == 0) {
+		return HAL_ERROR;
+	}
+
+#if defined(BUFFERED_UART_REENTRANT) || defined(BUFFERED_UART_LOCKFREE)
+	uint32_t priMask = __get_PRIMASK();
+	__set_PRIMASK(1);
+#endif
+	HAL_StatusTypeDef result = HAL_OK;
+	if (length > BlockRingbuffer_GetWriteAvailable(&uart->txurgent)) {
+		result = HAL_BUSY;
+		STATISTICS_ADD(uart, txRejected, 1);
+	} else {
+		BlockRingbuffer_Write(&uart->txurgent, uart->txurgent.head, data, length);
+		BlockRingbuffer_Produce(&uart->txurgent, length);
+	}
+#ifdef BUFFERED_UART_LOCKFREE
+	__set_PRIMASK(priMask);
+	BufferedUart_StartTransmission(uart);
+#else
+	BufferedUart_StartTransmission(uart);
+#ifdef BUFFERED_UART_REENTRANT
+	__set_PRIMASK(priMask);
+#endif
+#endif
+
+	return result;
+}
+
+#ifdef BUFFERED_UART_TX_ZEROCOPY
+/**
+ * Transmit a buffer directly from its memory, without copying it into the transmit queue
+ * The buffer is sent after all data which was queued before via the other transmit functions (except
+ * @ref BufferedUart_TransmitUrgent) and before all data queued afterwards. Large buffers are sent with
+ * several DMA transfers (at most 65535 bytes or the tx chunk size each).
+ * @note the buffer must stay unchanged until the CompletionHandler is called, and it must be accessible
+ * 		 by the DMA (e.g. not in CCM or DTCM RAM)
+ * @note if BUFFERED_UART_REENTRANT or BUFFERED_UART_LOCKFREE is defined, interrupts are disabled while
+ * 		 the buffer is queued
+ * @param[in]	uart
+ * @param[in]	data
+ * @param[in]	length
+ * @param[in]	CompletionHandler	optional, called from the TxCplt interrupt once the whole buffer was handed
+ * 									to the uart (its last bytes are still in the shift register)
+ * @return		HAL_StatusTypeDef	HAL_BUSY if BUFFERED_UART_TX_ZEROCOPY_DESCRIPTORS buffers are queued already
+ * 									(or a tx reservation is open, with BUFFERED_UART_LOCKFREE the buffer is queued
+ * 									behind the reserved region instead), HAL_ERROR for an empty buffer
+ */
+HAL_StatusTypeDef BufferedUart_TransmitZeroCopy(struct BufferedUart *uart, const void * data, unsigned int length, void (*CompletionHandler)(struct BufferedUart * uart, const void * data, unsigned int length))
+{
+	if (data == NULL || length == 0) {
+		return HAL_ERROR;
+	}
+
+#if defined(BUFFERED_UART_REENTRANT) || defined(BUFFERED_UART_LOCKFREE)
+	uint32_t priMask = __get_PRIMASK();
+	__set_PRIMASK(1);
+#endif
+	HAL_StatusTypeDef result = HAL_OK;
+	unsigned int head = uart->txDescriptorHead;
+#ifdef BUFFERED_UART_LOCKFREE
+	// an open reservation is not in the way, the buffer is queued behind it
+	bool reserved = false;
+#else
+	bool reserved = uart->txReserved > 0;
+#endif
+	if (reserved || head - uart->txDescriptorTail == BUFFERED_UART_TX_ZEROCOPY_DESCRIPTORS) {
+		result = HAL_BUSY;
+		STATISTICS_ADD(uart, txRejected, 1);
+	} else {
+		struct BufferedUartTxDescriptor * descriptor = &uart->txDescriptors[head % BUFFERED_UART_TX_ZEROCOPY_DESCRIPTORS];
+		descriptor->data = data;
+		descriptor->length = length;
+		descriptor->CompletionHandler = CompletionHandler;
+#ifdef BUFFERED_UART_LOCKFREE
+		// behind the regions other contexts reserved before, also the uncommitted ones of the contexts
+		// this call preempted. The buffer waits until they are committed
+		descriptor->position = atomic_load_explicit(&uart->txReservation, memory_order_acquire) >> TX_RESERVATION_PENDING_BITS;
+#else
+		atomic_signal_fence(memory_order_acquire);
+		descriptor->position = uart->txqueue.head;
+#endif
+		atomic_signal_fence(memory_order_release);
+		uart->txDescriptorHead = head + 1;
+	}
+#ifdef BUFFERED_UART_LOCKFREE
+	__set_PRIMASK(priMask);
+	BufferedUart_StartTransmission(uart);
+#else
+	BufferedUart_StartTransmission(uart);
+#ifdef BUFFERED_UART_REENTRANT
+	__set_PRIMASK(priMask);
+#endif
+#endif
+
+	return result;
+}
+#endif
+
+/// unread data in the rx queue or received blocks which were not taken yet
+static bool BufferedUart_RxHasData(struct BufferedUart * uart)
+{
+#ifdef BUFFERED_UART_RX_BLOCKS
+	if (uart->rxBlockSize > 0) {
+		return uart->rxBlockTaken != NULL || *(struct BufferedUartRxBlock * volatile *)&uart->rxBlockReceived != NULL;
+	}
+#endif
+	return BlockRingbuffer_GetReadAvailable(&uart->rxqueue) > 0;
+}
+
+/**
+ * Which buffered uarts have unread data or space in the tx queue, in one call for all of them
+ * The rx/tx callbacks mark their buffered uart as ready, so this only checks the marked ones again
+ * (the application may have consumed the data or filled the queue since) and its cost does not
+ * grow with the number of buffered uarts. Data which the DMA wrote after the last reception event
+ * is not seen (see @ref BufferedUart_RxPoll).
+ * @code
+ * struct BufferedUartReadiness ready;
+ * for (uint32_t pending = BufferedUart_PollAll(&ready); pending != 0; pending &= pending - 1) {
+ *     struct BufferedUart * uart = BufferedUart_GetByIndex(__builtin_ctz(pending));
+ *     ...
+ * }
+ * @endcode
+ * @param[out]	ready	optional (can be NULL), the buffered uarts with rx data and with tx space
+ * @return		uint32_t	bit n is set if the buffered uart with index n is ready for rx or tx
+ */
+uint32_t BufferedUart_PollAll(struct BufferedUartReadiness *ready)
+{
+	uint32_t rx = *(volatile uint32_t *)&s_rxReady;
+	for (uint32_t pending = rx; pending != 0; pending &= pending - 1) {
+		uint32_t bit = pending & -pending;
+		struct BufferedUart * uart = s_uarts[__builtin_ctz(bit)];
+		if (BufferedUart_RxHasData(uart)) {
+			continue;
+		}
+		// clear before checking again, so data reported in between sets it again
+		Readiness_Clear(&s_rxReady, bit);
+		atomic_signal_fence(memory_order_seq_cst);
+		if (BufferedUart_RxHasData(uart)) {
+			Readiness_Set(&s_rxReady, bit);
+		} else {
+			rx &= ~bit;
+		}
+	}
+
+	uint32_t tx = *(volatile uint32_t *)&s_txReady;
+	for (uint32_t pending = tx; pending != 0; pending &= pending - 1) {
+		uint32_t bit = pending & -pending;
+		struct BufferedUart * uart = s_uarts[__builtin_ctz(bit)];
+		if (BlockRingbuffer_GetWriteAvailable(&uart->txqueue) >= uart->txReadyBytes) {
+			continue;
+		}
+		Readiness_Clear(&s_txReady, bit);
+		atomic_signal_fence(memory_order_seq_cst);
+		if (BlockRingbuffer_GetWriteAvailable(&uart->txqueue) >= uart->txReadyBytes) {
+			Readiness_Set(&s_txReady, bit);
+		} else {
+			tx &= ~bit;
+		}
+	}
+
+	if (ready != NULL) {
+		ready->rx = rx;
+		ready->tx = tx;
+	}
+	return rx | tx;
+}
+
+/**
+ * @param[in]	index	bit number in the result of @ref BufferedUart_PollAll
+ * @return		struct BufferedUart*	NULL if no buffered uart has this index
+ */
+struct BufferedUart * BufferedUart_GetByIndex(unsigned int index)
+{
+	return index < MAX_NUMBER_BUFFERED_UARTS ? s_uarts[index] : NULL;
+}
+
+/**
+ * A buffered uart counts as ready for tx in @ref BufferedUart_PollAll once this many bytes are free
+ * in its tx queue, by default half of the queue, so a producer is woken for a batch of data
+ * @param[in]	uart
+ * @param[in]	bytes
+ */
+void BufferedUart_SetTxReadyThreshold(struct BufferedUart *uart, unsigned int bytes)
+{
+	uart->txReadyBytes = bytes;
+}
+
+/**
+ * Limit the size of the DMA transfers of the normal transmit queue
+ * Urgent data (see @ref BufferedUart_TransmitUrgent) waits at most for one chunk on the wire.
+ * Smaller chunks mean more interrupts.
+ * @param[in]	uart
+ * @param[in]	chunkSize	maximum number of bytes per DMA transfer, 0 unlimited (default)
+ */
+void BufferedUart_SetTxChunkSize(struct BufferedUart *uart, unsigned int chunkSize)
+{
+	uart->txChunkSize = chunkSize;
+}
+
+/**
+ * Coalesce small transmissions into fewer, larger DMA transfers (Nagle-style)
+ * The transmission is held until thresholdBytes are queued or until it was held for timeoutMs.
+ * The timeout is only checked when the transmission is triggered, so call @ref BufferedUart_TxPoll
+ * periodically (e.g. from the SysTick interrupt) or start a one shot hardware timer from
+ * TxHoldStartedHandler which calls @ref BufferedUart_Flush.
+ * @note the HAL tick has a resolution of 1 ms, the timeout can be up to 1 ms shorter
+ * @param[in]	uart
+ * @param[in]	thresholdBytes	number of queued bytes which start the transmission, 0 disables coalescing
+ * @param[in]	timeoutMs		maximum time the transmission is held
+ */
+void BufferedUart_SetTxCoalescing(struct BufferedUart *uart, unsigned int thresholdBytes, unsigned int timeoutMs)
+{
+	uart->txCoalesceTimeoutMs = timeoutMs;
+	uart->txCoalesceBytes = thresholdBytes;
+
+	BufferedUart_TxPoll(uart);
+}
+
+/**
+ * Send all queued data now, without waiting for the coalescing threshold or timeout
+ * Data which is queued afterwards is coalesced again
+ * @param[in]	uart
+ */
+void BufferedUart_Flush(struct BufferedUart *uart)
+{
+	atomic_signal_fence(memory_order_acquire);
+	uart->txFlushPosition = uart->txqueue.head;
+	atomic_signal_fence(memory_order_release);
+
+	BufferedUart_TxPoll(uart);
+}
+
+/**
+ * Start the transmission of held data whose coalescing timeout expired
+ * @param[in]	uart
+ */
+void BufferedUart_TxPoll(struct BufferedUart *uart)
+{
+	BUFFERED_UART_REENTRANT_ENTER_CRITICAL_SECTION();
+
+	BufferedUart_StartTransmission(uart);
+
+	BUFFERED_UART_REENTRANT_EXIT_CRITICAL_SECTION();
+}
+
+/**
+ * Sequence number behind all data queued so far, e.g. after @ref BufferedUart_TxCommit or
+ * @ref BufferedUart_TransmitTimed
+ * Tx sequence numbers count the bytes queued since BufferedUart_Init (and the unused end of the queue
+ * skipped with BUFFERED_UART_TX_BIPBUFFER) in 32 bits. They wrap around after 4 GiB, so only compare
+ * them via @ref BufferedUart_IsTxSent, which is valid until 2 GiB were sent behind a sequence number.
+ * Urgent data and zero copy buffers are not counted, a zero copy buffer is sent in front of all data
+ * queued after it.
+ * @note with BUFFERED_UART_LOCKFREE this includes reservations of preempted contexts
+ * @param[in]	uart
+ * @return		uint32_t
+ */
+uint32_t BufferedUart_GetTxSequence(const struct BufferedUart *uart)
+{
+	atomic_signal_fence(memory_order_acquire);
+#ifdef BUFFERED_UART_LOCKFREE
+	return BufferedUart_TxSequenceOf(uart, atomic_load_explicit(&uart->txReservation, memory_order_acquire) >> TX_RESERVATION_PENDING_BITS);
+#else
+	return BufferedUart_TxSequenceOf(uart, uart->txqueue.head);
+#endif
+}
+
+/**
+ * Sequence number up to which the queued data left the uart
+ * It advances in the tx interrupt once the USART sent the last frame of a transfer. With
+ * BUFFERED_UART_TX_GAPLESS a transfer followed directly by the next one counts as sent when its DMA
+ * transfer completed, the last two frames of it are then still on the wire.
+ * @param[in]	uart
+ * @return		uint32_t
+ */
+uint32_t BufferedUart_GetTxSentSequence(const struct BufferedUart *uart)
+{
+	atomic_signal_fence(memory_order_acquire);
+	return uart->txSentSequence;
+}
+
+/**
+ * @param[in]	uart
+ * @param[in]	sequence	sequence number from @ref BufferedUart_TransmitSequenced or @ref BufferedUart_GetTxSequence
+ * @return		bool	true if all data up to sequence left the uart
+ */
+bool BufferedUart_IsTxSent(const struct BufferedUart *uart, uint32_t sequence)
+{
+	// sequence numbers up to 2 GiB behind the sent data count as sent, the queued data is far less ahead of it
+	return (int32_t)(sequence - BufferedUart_GetTxSentSequence(uart)) <= 0;
+}
+
+/**
+ * Call TxSentHandler from the tx interrupt once all data up to sequence left the uart, e.g. to
+ * switch a half-duplex line to reception or to open the window of a windowed protocol
+ * Only one notification can be pending per buffered uart, a new one replaces it.
+ * @note data held back by @ref BufferedUart_SetTxCoalescing is only sent after the coalescing
+ * 		 timeout, call @ref BufferedUart_Flush to send it right away
+ * @param[in]	uart
+ * @param[in]	sequence
+ * @param[in]	TxSentHandler	receives the buffered uart and sequence
+ * @return		bool	false if the data was already sent, TxSentHandler is then not called
+ */
+bool BufferedUart_NotifyTxSent(struct BufferedUart *uart, uint32_t sequence, void (*TxSentHandler)(struct BufferedUart * uart, uint32_t sequence))
+{
+	BufferedUart_TakeTxSentHandler(uart);
+	uart->txNotifySequence = sequence;
+	atomic_signal_fence(memory_order_release);
+	uart->TxSentHandler = TxSentHandler;
+	atomic_signal_fence(memory_order_seq_cst);
+	if (!BufferedUart_IsTxSent(uart, sequence)) {
+		return true;
+	}
+
+	// sent before the handler was set: withdraw it, unless the tx interrupt already called it
+	return BufferedUart_TakeTxSentHandler(uart) == NULL;
+}
+
+/**
+ * Reserve space in the transmit queue to write data directly into it, without an intermediate buffer
+ * Because the queue is a ring buffer, the reserved region is returned as up to two contiguous spans.
+ * With BUFFERED_UART_TX_BIPBUFFER the region is always contiguous and second.length is 0.
+ * The data must then be written to first and (if second.length > 0) second and published with
+ * @ref BufferedUart_TxCommit. Until then, other transmit functions return HAL_BUSY.
+ * @note if BUFFERED_UART_REENTRANT is defined, the caller must ensure that no other context
+ * 		 reserves space at the same time, reserve/commit are not protected as a pair
+ * @note if BUFFERED_UART_LOCKFREE is defined, other contexts can still transmit while the reservation
+ * 		 is open, their data is sent after the reserved region. Only one reservation via this function
+ * 		 can be open at a time
+ * @param[in]	uart
+ * @param[in]	length	number of bytes to reserve
+ * @param[out]	first	first span of the reserved region
+ * @param[out]	second	span after the wrap around of the ring buffer, length is 0 if there is no wrap around
+ * @return		HAL_StatusTypeDef	HAL_BUSY if there is not enough space or a reservation is still pending
+ */
+HAL_StatusTypeDef BufferedUart_TxReserve(struct BufferedUart *uart, unsigned int length, struct BufferedUartSpan *first, struct BufferedUartSpan *second)
+{
+#ifdef BUFFERED_UART_LOCKFREE
+	if (uart->txReserved > 0 || (length > 0 && !BufferedUart_TXQueue_Reserve(uart, length, &uart->txReservePosition))) {
+		first->length = 0;
+		second->length = 0;
+		STATISTICS_ADD_SHARED(uart, txRejected, 1);
+		return HAL_BUSY;
+	}
+
+	BlockRingbuffer_GetSpans(&uart->txqueue, uart->txReservePosition, length, first, second);
+#else
+	unsigned int padding = BufferedUart_TXQueue_GetPadding(uart, uart->txqueue.head, length);
+	if (uart->txReserved > 0 || padding + length > BlockRingbuffer_GetWriteAvailable(&uart->txqueue)) {
+		first->length = 0;
+		second->length = 0;
+		STATISTICS_ADD(uart, txRejected, 1);
+		return HAL_BUSY;
+	}
+
+	BlockRingbuffer_GetSpans(&uart->txqueue, BlockRingbuffer_Advance(&uart->txqueue, uart->txqueue.head, padding), length, first, second);
+#endif
+	uart->txReserved = length;
+
+	return HAL_OK;
+}
+
+/**
+ * Publish data written into space reserved by @ref BufferedUart_TxReserve and start the transmission
+ * The reservation ends with this call, even if less than the reserved length is committed
+ * @param[in]	uart
+ * @param[in]	length	number of bytes to send, at most the reserved length. 0 cancels the reservation
+ * @return		HAL_StatusTypeDef	HAL_ERROR if length exceeds the reservation. With BUFFERED_UART_LOCKFREE
+ * 									also if less than the reserved length is committed after another context
+ * 									enqueued data or a zero copy buffer, the reservation stays open and must be
+ * 									committed completely
+ */
+HAL_StatusTypeDef BufferedUart_TxCommit(struct BufferedUart *uart, unsigned int length)
+{
+	if (length > uart->txReserved) {
+		return HAL_ERROR;
+	}
+
+#ifdef BUFFERED_UART_LOCKFREE
+	if (uart->txReserved > 0) {
+		if (length < uart->txReserved && !BufferedUart_TXQueue_Shrink(uart, uart->txReservePosition, uart->txReserved, length)) {
+			return HAL_ERROR;
+		}
+		uart->txReserved = 0;
+		BufferedUart_TXQueue_Commit(uart);
+	}
+	BufferedUart_StartTransmission(uart);
+
+	return HAL_OK;
+#else
+	LATENCY_TIMESTAMP(enqueueTime);
+	BUFFERED_UART_REENTRANT_ENTER_CRITICAL_SECTION();
+
+	unsigned int padding = length > 0 ? BufferedUart_TXQueue_GetPadding(uart, uart->txqueue.head, uart->txReserved) : 0;
+	uart->txReserved = 0;
+#ifdef BUFFERED_UART_TX_BIPBUFFER
+	if (padding > 0) {
+		uart->txPaddingPosition = uart->txqueue.head;
+	}
+#endif
+	BlockRingbuffer_Produce(&uart->txqueue, padding + length);
+	LATENCY_TX_ENQUEUED(uart, enqueueTime);
+	BufferedUart_StartTransmission(uart);
+
+	BUFFERED_UART_REENTRANT_EXIT_CRITICAL_SECTION();
+
+	return HAL_OK;
+#endif
+}
+
+#ifndef BUFFERED_UART_LOCKFREE
+bool BufferedUart_TXQueue_Enqueue(struct BufferedUart * uart, const void * data, unsigned int length)
+{
+	unsigned int padding = BufferedUart_TXQueue_GetPadding(uart, uart->txqueue.head, length);
+	if (uart->txReserved > 0 || padding + length > BlockRingbuffer_GetWriteAvailable(&uart->txqueue)) {
+		return false;
+	}
+
+#ifdef BUFFERED_UART_TX_BIPBUFFER
+	if (padding > 0) {
+		uart->txPaddingPosition = uart->txqueue.head;
+	}
+#endif
+	BufferedUart_TXQueue_Write(uart, BlockRingbuffer_Advance(&uart->txqueue, uart->txqueue.head, padding), data, length);
+	BlockRingbuffer_Produce(&uart->txqueue, padding + length);
+
+	return true;
+}
+#endif
+
+/// copy data into the tx queue at position, without publishing it
+void BufferedUart_TXQueue_Write(struct BufferedUart * uart, unsigned int position, const void * data, unsigned int length)
+{
+	BlockRingbuffer_Write(&uart->txqueue, position, data, length);
+}
+
+/// skip is the number of bytes in front of the returned data which are not sent (unused end of the tx buffer)
+const void * BufferedUart_TXQueue_Dequeue(const struct BufferedUart *uart, unsigned int * length, unsigned int * skip)
+{
+	unsigned int txAvailable = BlockRingbuffer_GetReadAvailable(&uart->txqueue);
+	*skip = 0;
+	if (txAvailable == 0) {
+		*length = 0;
+		return NULL;
+	}
+
+	atomic_signal_fence(memory_order_acquire);
+
+	unsigned int tail = uart->txqueue.tail;
+	unsigned int queueMaxSize = BlockRingbuffer_GetLength(&uart->txqueue);
+#ifdef BUFFERED_UART_TX_BIPBUFFER
+	unsigned int paddingPosition = uart->txPaddingPosition;
+	if (tail == paddingPosition) {
+		*skip = queueMaxSize - BlockRingbuffer_GetIndex(&uart->txqueue, tail);
+		tail = BlockRingbuffer_Advance(&uart->txqueue, tail, *skip);
+		txAvailable -= *skip;
+	} else if (paddingPosition != uart->txqueue.wrap) {
+		// only the data in front of the padding
+		txAvailable = min(txAvailable, BlockRingbuffer_Distance(&uart->txqueue, tail, paddingPosition));
+	}
+#endif
+	unsigned int index = BlockRingbuffer_GetIndex(&uart->txqueue, tail);
+	unsigned int sizeTillWrapAround = queueMaxSize - index;
+	unsigned int dequeueLength = min(txAvailable, sizeTillWrapAround);
+
+	*length = dequeueLength;
+	const void * dequeueData = uart->txqueue.buf + index;
+
+	return dequeueData;
+}
+
+#ifdef BUFFERED_UART_TX_ZEROCOPY
+/// oldest queued zero copy buffer, NULL if there is none
+static const struct BufferedUartTxDescriptor * BufferedUart_TxDescriptor_Peek(const struct BufferedUart * uart)
+{
+	unsigned int tail = uart->txDescriptorTail;
+	atomic_signal_fence(memory_order_acquire);
+	if (tail == uart->txDescriptorHead) {
+		return NULL;
+	}
+	atomic_signal_fence(memory_order_acquire);
+	return &uart->txDescriptors[tail % BUFFERED_UART_TX_ZEROCOPY_DESCRIPTORS];
+}
+
+/// length bytes of the oldest zero copy buffer were sent, completed receives it if it was sent completely
+static void BufferedUart_TxDescriptor_Sent(struct BufferedUart * uart, unsigned int length, struct BufferedUartTxDescriptor * completed)
+{
+	const struct BufferedUartTxDescriptor * descriptor = BufferedUart_TxDescriptor_Peek(uart);
+	uart->txDescriptorSent += length;
+	if (uart->txDescriptorSent < descriptor->length) {
+		return;
+	}
+
+	*completed = *descriptor;
+	uart->txDescriptorSent = 0;
+	atomic_signal_fence(memory_order_release);
+	uart->txDescriptorTail++;
+}
+#endif
+
+/// take the half-duplex bus in front of the first transfer, the receiver ignores the echo of the transceiver
+static void BufferedUart_HalfDuplexDrive(struct BufferedUart * uart)
+{
+	USART_TypeDef * usart = uart->uart->Instance;
+	uint32_t priMask = __get_PRIMASK();
+	__set_PRIMASK(1);
+	uart->txDriving = true;
+	uart->txEchoSuppressed = (usart->CR1 & USART_CR1_RE) != 0;
+	usart->CR1 &= ~USART_CR1_RE;
+	if (uart->txHalfDuplex == BUFFERED_UART_HALF_DUPLEX_HANDLER) {
+		uart->DriverEnableHandler(uart, true);
+	}
+	__set_PRIMASK(priMask);
+}
+
+/// release the half-duplex bus once the last stop bit left the wire (transfer complete interrupt)
+static void BufferedUart_HalfDuplexRelease(struct BufferedUart * uart)
+{
+	uint32_t priMask = __get_PRIMASK();
+	__set_PRIMASK(1);
+	if (uart->txDriving) {
+		uart->txDriving = false;
+		if (uart->txHalfDuplex == BUFFERED_UART_HALF_DUPLEX_HANDLER) {
+			uart->DriverEnableHandler(uart, false);
+		}
+		if (uart->txEchoSuppressed) {
+			// the DMA reception kept running, it continues with the first byte of the response
+			uart->txEchoSuppressed = false;
+			uart->uart->Instance->CR1 |= USART_CR1_RE;
+		}
+	}
+	__set_PRIMASK(priMask);
+}
+
+/// start the TX DMA transfer of length bytes, blockSize bytes are consumed from the queue when it completes
+static void BufferedUart_StartDma(struct BufferedUart *uart, const void * data, unsigned int length, unsigned int blockSize, enum BufferedUartTxSource source)
+{
+	uart->lastSendBlockSize = blockSize;
+	uart->txSource = source;
+	STATISTICS_ADD(uart, txBytes, length);
+	STATISTICS_ADD(uart, txTransfers, 1);
+	LATENCY_TX_STARTED(uart);
+	TRACE(uart, BUFFERED_UART_TRACE_TX, source, length);
+	if (uart->txHalfDuplex != BUFFERED_UART_HALF_DUPLEX_OFF && !uart->txDriving) {
+		BufferedUart_HalfDuplexDrive(uart);
+	}
+	DCACHE_CLEAN(data, length);
+#ifdef BUFFERED_UART_TX_GAPLESS
+	DMA_HandleTypeDef * hdmatx = uart->uart->hdmatx;
+	HAL_StatusTypeDef result;
+	if (uart->txChaining) {
+		// the USART is still busy with the last two frames and keeps requesting data from the DMA
+		result = HAL_DMA_Start_IT(hdmatx, (uintptr_t)data, (uintptr_t)TX_DATA_REGISTER(uart->uart), length);
+	} else {
+		result = HAL_UART_Transmit_DMA(uart->uart, (uint8_t*)data, length);
+		// a short transfer may already have completed through the HAL callback, the hook then takes
+		// effect with the next one
+		uart->txHalDmaCplt = hdmatx->XferCpltCallback;
+		hdmatx->XferCpltCallback = BufferedUart_TxDmaCpltCallback;
+	}
+#else
+	HAL_StatusTypeDef result = HAL_UART_Transmit_DMA(uart->uart, (uint8_t*)data, length);
+#endif
+	disableHalfCompleteInterrupt(uart->uart->hdmatx);	// small optimization, disable unused interrupt
+	if (result != HAL_OK) {
+		Error_Handler();
+	}
+}
+
+/// true if the transmission of the queued data is held back to coalesce it with more data
+static bool BufferedUart_TXQueue_IsHeld(struct BufferedUart *uart)
+{
+	if (uart->txCoalesceBytes == 0) {
+		return false;
+	}
+
+	unsigned int available = BlockRingbuffer_GetReadAvailable(&uart->txqueue);
+	unsigned int flushed = BlockRingbuffer_Distance(&uart->txqueue, uart->txqueue.tail, uart->txFlushPosition);
+	if (available == 0 || available >= uart->txCoalesceBytes || (flushed > 0 && flushed <= available)) {
+		uart->txHolding = false;
+		return false;
+	}
+
+	uint32_t now = HAL_GetTick();
+	if (!uart->txHolding) {
+		uart->txHolding = true;
+		uart->txHoldStart = now;
+		if (uart->TxHoldStartedHandler != NULL) {
+			uart->TxHoldStartedHandler(uart);
+		}
+		return uart->txCoalesceTimeoutMs > 0;
+	}
+
+	if (now - uart->txHoldStart >= uart->txCoalesceTimeoutMs) {
+		uart->txHolding = false;
+		return false;
+	}
+
+	return true;
+}
+
+void BufferedUart_TryStartTransmission(struct BufferedUart *uart)
+{
+	// every enqueue ends here (serialised also with BUFFERED_UART_LOCKFREE), so the maximum is not missed
+	STATISTICS_MAX(uart, txHighWater, BlockRingbuffer_GetReadAvailable(&uart->txqueue));
+#ifdef BUFFERED_UART_LOCKFREE
+	// producers commit concurrently, the enqueue time is taken where they are serialised
+	LATENCY_TX_ENQUEUED(uart, BUFFERED_UART_LATENCY_TICKS());
+#endif
+
+	if (BufferedUart_IsTXBusy(uart)
+#ifdef BUFFERED_UART_TX_GAPLESS
+			// the DMA transfer complete callback chains the next transfer while the USART is still busy
+			&& !(uart->txChaining && uart->uart->hdmatx->State == HAL_DMA_STATE_READY)
+#endif
+			) {
+		return;
+	}
+
+	// XON/XOFF go out ahead of everything else, also while the transmission is paused
+	if (uart->txFlowCharacter >= 0) {
+		int character = BufferedUart_TakeFlowCharacter(uart);
+		if (character >= 0) {
+			uart->txFlowByte = (char)character;
+			BufferedUart_StartDma(uart, &uart->txFlowByte, 1, 1, BUFFERED_UART_TX_SOURCE_FLOW);
+			return;
+		}
+	}
+	if (uart->txPaused) {
+		return;
+	}
+
+	// urgent data goes first and is never held back
+	unsigned int urgent = BlockRingbuffer_GetReadAvailable(&uart->txurgent);
+	if (urgent > 0) {
+		struct BufferedUartSpan first;
+		struct BufferedUartSpan second;
+		BlockRingbuffer_GetSpans(&uart->txurgent, uart->txurgent.tail, urgent, &first, &second);
+		BufferedUart_StartDma(uart, first.data, first.length, first.length, BUFFERED_UART_TX_SOURCE_URGENT);
+		return;
+	}
+
+#ifdef BUFFERED_UART_TX_ZEROCOPY
+	const struct BufferedUartTxDescriptor * descriptor = BufferedUart_TxDescriptor_Peek(uart);
+	if (descriptor != NULL && descriptor->position == uart->txqueue.tail) {
+		// everything queued in front of the buffer was sent
+		unsigned int length = min(descriptor->length - uart->txDescriptorSent, TX_MAX_DMA_LENGTH);
+		if (uart->txChunkSize > 0) {
+			length = min(length, uart->txChunkSize);
+		}
+		BufferedUart_StartDma(uart, descriptor->data + uart->txDescriptorSent, length, length, BUFFERED_UART_TX_SOURCE_DESCRIPTOR);
+		return;
+	}
+
+	// a queued buffer flushes the data in front of it
+	if (descriptor == NULL && BufferedUart_TXQueue_IsHeld(uart)) {
+		return;
+	}
+#else
+	if (BufferedUart_TXQueue_IsHeld(uart)) {
+		return;
+	}
+#endif
+
+	unsigned int length;
+	unsigned int skip;
+	const void * data = BufferedUart_TXQueue_Dequeue(uart, &length, &skip);
+#ifdef BUFFERED_UART_TX_ZEROCOPY
+	if (descriptor == NULL && BufferedUart_TxDescriptor_Peek(uart) != NULL) {
+		// a preempting context queued a buffer after the peek above, the dequeue may already see data behind it
+		BufferedUart_TryStartTransmission(uart);
+		return;
+	}
+#endif
+#ifdef BUFFERED_UART_TX_BIPBUFFER
+	if (skip > 0) {
+		// the padding is released together with the block behind it, no producer can wrap around before
+		uart->txPaddingPosition = uart->txqueue.wrap;
+		if (length == 0) {
+			// nothing behind the padding (cancelled reservation), but maybe a zero copy buffer
+			BlockRingbuffer_Consume(&uart->txqueue, skip);
+			if (!BufferedUart_IsTXBusy(uart)) {
+				BufferedUart_TxSentUpTo(uart, uart->txqueue.tail);
+			}
+			BufferedUart_TryStartTransmission(uart);
+			return;
+		}
+	}
+#endif
+	if (length > 0) {
+#ifdef BUFFERED_UART_TX_ZEROCOPY
+		if (descriptor != NULL) {
+			unsigned int start = BlockRingbuffer_Advance(&uart->txqueue, uart->txqueue.tail, skip);
+			length = min(length, BlockRingbuffer_Distance(&uart->txqueue, start, descriptor->position));
+		}
+#endif
+		if (uart->txChunkSize > 0) {
+			length = min(length, uart->txChunkSize);
+		}
+		BufferedUart_StartDma(uart, data, length, skip + length, BUFFERED_UART_TX_SOURCE_QUEUE);
+	}
+}
+
+/**
+ * Number of unread bytes in the rx queue
+ * The circular DMA keeps writing after the last reception event, so the current DMA position is
+ * taken into account as well. If the DMA lapped the reader, the overwritten bytes are skipped and
+ * counted in rxDroppedBytes.
+ * @note data which the DMA overwrites while the caller is still processing it can not be detected
+ * @param[in]	uart
+ * @param[out]	unreported	bytes the DMA wrote after the last reception event, may be NULL
+ */
+static unsigned int BufferedUart_RxGetReadAvailable(struct BufferedUart * uart, unsigned int * unreported)
+{
+    struct BlockRingbuffer * rxqueue = &uart->rxqueue;
+    unsigned int queueMaxSize = BlockRingbuffer_GetLength(rxqueue);
+    unsigned int head;
+    unsigned int written = 0;
+
+    // retry if a reception event updates head and rxDmaPosition in between
+    do {
+        atomic_signal_fence(memory_order_acquire);
+        head = rxqueue->head;
+        if (uart->uart->RxState == HAL_UART_STATE_BUSY_RX) {
+            unsigned int reported = uart->rxDmaPosition;
+            unsigned int position = queueMaxSize - __HAL_DMA_GET_COUNTER(uart->uart->hdmarx);
+            if (position >= queueMaxSize) {
+                position = 0;
+            }
+            written = position >= reported ? position - reported : position + queueMaxSize - reported;
+        }
+        atomic_signal_fence(memory_order_acquire);
+    } while (head != rxqueue->head);
+
+    unsigned int available = BlockRingbuffer_Distance(rxqueue, rxqueue->tail, head);
+    if (available + written > queueMaxSize) {
+        unsigned int dropped = available + written - queueMaxSize;
+        BlockRingbuffer_Consume(rxqueue, dropped);
+        uart->rxDroppedBytes += dropped;
+        uart->rxOverruns++;
+        available -= dropped;
+        LATENCY_RX_CONSUMED(uart, false);
+    }
+    if (unreported != NULL) {
+        *unreported = min(written, queueMaxSize - available);
+    }
+
+    return available;
+}
+
+/**
+ * Access received data without copying it
+ * Because the queue is a ring buffer, the readable region is returned as up to two contiguous spans.
+ * The data stays valid until it is released via @ref BufferedUart_RxConsume, so a parser can work
+ * directly on the DMA buffer from thread context. With BUFFERED_UART_DCACHE it must not be modified.
+ * @param[in]	uart
+ * @param[out]	first	first span of the readable region
+ * @param[out]	second	span after the wrap around of the ring buffer, length is 0 if there is no wrap around
+ * @return		unsigned int	number of readable bytes (first.length + second.length)
+ */
+unsigned int BufferedUart_RxPeek(struct BufferedUart *uart, struct BufferedUartSpan *first, struct BufferedUartSpan *second)
+{
+    unsigned int queueSize = BufferedUart_RxGetReadAvailable(uart, NULL);
+
+    atomic_signal_fence(memory_order_acquire);
+    BlockRingbuffer_GetSpans(&uart->rxqueue, uart->rxqueue.tail, queueSize, first, second);
+
+    return queueSize;
+}
+
+/**
+ * Release received data which was accessed via @ref BufferedUart_RxPeek
+ * @param[in]	uart
+ * @param[in]	length	number of bytes to release, limited to the number of readable bytes
+ */
+void BufferedUart_RxConsume(struct BufferedUart *uart, unsigned int length)
+{
+    unsigned int queueSize = BlockRingbuffer_GetReadAvailable(&uart->rxqueue);
+
+    BlockRingbuffer_Consume(&uart->rxqueue, min(length, queueSize));
+    LATENCY_RX_CONSUMED(uart, true);
+    if (uart->rxFlowStopped) {
+        BufferedUart_RxFlowResume(uart);
+    }
+}
+
+unsigned int BufferedUart_Dequeue(struct BufferedUart *uart, void * buffer, unsigned int maximumLength)
+{
+    struct BufferedUartSpan first;
+    struct BufferedUartSpan second;
+    unsigned int queueSize = BufferedUart_RxPeek(uart, &first, &second);
+    if (queueSize == 0 || maximumLength == 0) {
+        return 0;
+    }
+
+    unsigned int dequeueLength = min(queueSize, maximumLength);
+    unsigned int firstLength = min(dequeueLength, first.length);
+    unsigned int secondLength = dequeueLength - firstLength;
+
+    // first part
+    memcpy(buffer, first.data, firstLength);
+
+    // second part after wrap around
+    memcpy((char*)buffer + firstLength, second.data, secondLength);
+
+    BufferedUart_RxConsume(uart, dequeueLength);
+
+    return dequeueLength;
+}
+
+/// offset of the first byte value in data, length if there is none. Compares a word at a time
+static unsigned int BufferedUart_FindByte(const char * data, unsigned int length, char value)
+{
+	unsigned int offset = 0;
+	while (offset < length && ((uintptr_t)(data + offset) & (sizeof(uint32_t) - 1)) != 0) {
+		if (data[offset] == value) {
+			return offset;
+		}
+		offset++;
+	}
+
+	uint32_t pattern = 0x01010101U * (uint8_t)value;
+	for (; offset + sizeof(uint32_t) <= length; offset += sizeof(uint32_t)) {
+		uint32_t word;
+		memcpy(&word, data + offset, sizeof(word));
+		word ^= pattern;
+		// true if a byte of word is 0, i.e. equal to value
+		if (((word - 0x01010101U) & ~word & 0x80808080U) != 0) {
+			break;
+		}
+	}
+
+	for (; offset < length; offset++) {
+		if (data[offset] == value) {
+			return offset;
+		}
+	}
+	return length;
+}
+
+/**
+ * Length of the next line (including the delimiter) in the readable region, which is returned in first
+ * and second, 0 if it is not complete yet. The bytes searched without finding the delimiter are
+ * remembered, the next call continues behind them. A line longer than maximumLength (with inPlace at
+ * least the first span, which needs no copy), or one which would soon be overwritten by the circular
+ * reception, is returned in parts without delimiter.
+ */
+static unsigned int BufferedUart_RxFindLine(struct BufferedUart * uart, struct BufferedUartSpan * first, struct BufferedUartSpan * second, unsigned int maximumLength, bool inPlace)
+{
+	unsigned int unreported;
+	unsigned int available = BufferedUart_RxGetReadAvailable(uart, &unreported);
+	unsigned int tail = uart->rxqueue.tail;
+	atomic_signal_fence(memory_order_acquire);
+	BlockRingbuffer_GetSpans(&uart->rxqueue, tail, available, first, second);
+	if (inPlace && maximumLength < first->length) {
+		maximumLength = first->length;
+	}
+
+	unsigned int scanned = BlockRingbuffer_Distance(&uart->rxqueue, tail, uart->rxLineScanned);
+	if (scanned > available) {
+		// consumed or dropped (overrun) since the last search
+		scanned = 0;
+	}
+
+	unsigned int end = min(available, maximumLength);
+	unsigned int found = end;
+	scanned = min(scanned, end);
+	if (scanned < first->length) {
+		unsigned int firstEnd = min(end, first->length);
+		found = scanned + BufferedUart_FindByte(first->data + scanned, firstEnd - scanned, BUFFERED_UART_LINE_DELIMITER);
+		if (found == firstEnd) {
+			found = end;
+		}
+		scanned = firstEnd;
+	}
+	if (found == end && scanned < end) {
+		// second part after wrap around
+		unsigned int secondOffset = scanned - first->length;
+		found = scanned + BufferedUart_FindByte(second->data + secondOffset, end - scanned, BUFFERED_UART_LINE_DELIMITER);
+	}
+
+	if (found < end) {
+		uart->rxLineScanned = tail;
+		return found + 1;
+	}
+	unsigned int queueLength = BlockRingbuffer_GetLength(&uart->rxqueue);
+	if (end > 0 && (end == maximumLength || available + unreported >= queueLength - queueLength / 4)) {
+		// overlong line, hand out what is there before the circular reception overwrites it
+		uart->rxLineScanned = tail;
+		return end;
+	}
+
+	uart->rxLineScanned = BlockRingbuffer_Advance(&uart->rxqueue, tail, end);
+	return 0;
+}
+
+/**
+ * Get the next line (ending with BUFFERED_UART_LINE_DELIMITER) from the rx queue without removing it
+ * Bytes which were searched for the delimiter before are not searched again, so polling for a line
+ * costs only the newly received bytes. A line which is contiguous in the rx buffer is returned without
+ * copying it, a line which wraps around the end of the rx buffer is copied into buffer.
+ * A returned line which does not end with the delimiter is the first part of an overlong line (longer
+ * than bufferSize and wrapping around, or filling three quarters of the rx buffer), the rest follows as
+ * next line.
+ * The line stays valid until it is released via @ref BufferedUart_RxConsume with the returned length.
+ * With BUFFERED_UART_DCACHE it must not be modified.
+ * @param[in]	uart
+ * @param[out]	line		start of the line, not zero terminated
+ * @param[out]	buffer		receives lines which wrap around
+ * @param[in]	bufferSize
+ * @return		unsigned int	length of the line including the delimiter, 0 if there is no complete line yet
+ */
+unsigned int BufferedUart_PeekLine(struct BufferedUart *uart, const char **line, char *buffer, unsigned int bufferSize)
+{
+	struct BufferedUartSpan first;
+	struct BufferedUartSpan second;
+	unsigned int length = BufferedUart_RxFindLine(uart, &first, &second, bufferSize, true);
+	if (length <= first.length) {
+		*line = first.data;
+	} else {
+		memcpy(buffer, first.data, first.length);
+		memcpy(buffer + first.length, second.data, length - first.length);
+		*line = buffer;
+	}
+
+	return length;
+}
+
+/**
+ * Copy the next line (ending with BUFFERED_UART_LINE_DELIMITER) out of the rx queue
+ * Like @ref BufferedUart_PeekLine, a line longer than maximumLength is returned in parts without
+ * delimiter.
+ * @param[in]	uart
+ * @param[out]	buffer
+ * @param[in]	maximumLength
+ * @return		unsigned int	length of the line including the delimiter, 0 if there is no complete line yet
+ */
+unsigned int BufferedUart_DequeueLine(struct BufferedUart *uart, char *buffer, unsigned int maximumLength)
+{
+	struct BufferedUartSpan first;
+	struct BufferedUartSpan second;
+	unsigned int length = BufferedUart_RxFindLine(uart, &first, &second, maximumLength, false);
+	if (length == 0) {
+		return 0;
+	}
+	unsigned int firstLength = min(length, first.length);
+	memcpy(buffer, first.data, firstLength);
+	memcpy(buffer + firstLength, second.data, length - firstLength);
+	BufferedUart_RxConsume(uart, length);
+
+	return length;
+}
+
+#ifdef BUFFERED_UART_OS
+/// milliseconds left of timeoutMs since start, 0 if it expired
+static uint32_t remainingMs(uint32_t start, uint32_t timeoutMs)
+{
+	if (timeoutMs == BUFFERED_UART_OS_WAIT_FOREVER) {
+		return BUFFERED_UART_OS_WAIT_FOREVER;
+	}
+	uint32_t elapsed = BufferedUartOs_GetTickMs() - start;
+	return elapsed < timeoutMs ? timeoutMs - elapsed : 0;
+}
+
+/**
+ * Receive at least minimumLength and up to maximumLength bytes, sleeping until the rx interrupts
+ * reported enough data instead of polling
+ * The thread is woken by reception events (see Delivery latency in the README), so a continuous
+ * stream wakes it at the latest at the next half/complete DMA transfer, unless BufferedUart_RxPoll
+ * is called in between.
+ * @note only one thread may read from a buffered uart at a time, without a DataReceivedHandler
+ * @param[in]	uart
+ * @param[out]	buffer
+ * @param[in]	minimumLength	limited to maximumLength and the rx buffer size
+ * @param[in]	maximumLength
+ * @param[in]	timeoutMs		BUFFERED_UART_OS_WAIT_FOREVER waits without timeout
+ * @return		unsigned int	number of received bytes, less than minimumLength if the timeout expired
+ */
+unsigned int BufferedUart_Read(struct BufferedUart *uart, void * buffer, unsigned int minimumLength, unsigned int maximumLength, uint32_t timeoutMs)
+{
+	minimumLength = min(min(minimumLength, maximumLength), BlockRingbuffer_GetLength(&uart->rxqueue));
+	uint32_t start = BufferedUartOs_GetTickMs();
+	unsigned int received = 0;
+	while (true) {
+		received += BufferedUart_Dequeue(uart, (char *)buffer + received, maximumLength - received);
+		if (received >= minimumLength) {
+			break;
+		}
+
+		// announce the wait before checking again, so data reported in between is not missed
+		unsigned int wanted = minimumLength - received;
+		uart->rxWakeBytes = wanted;
+		atomic_signal_fence(memory_order_seq_cst);
+		if (BufferedUart_RxGetReadAvailable(uart, NULL) >= wanted) {
+			continue;
+		}
+		uint32_t remaining = remainingMs(start, timeoutMs);
+		if (remaining == 0) {
+			break;
+		}
+		BufferedUartOs_EventWait(&uart->rxEvent, remaining);
+	}
+	uart->rxWakeBytes = 0;
+
+	return received;
+}
+
+/**
+ * Transmit data, sleeping until the tx interrupts freed enough space in the transmit queue instead of
+ * spinning like @ref BufferedUart_TransmitTimed. Data larger than the queue is enqueued in blocks as
+ * the transmission goes on.
+ * @note only one thread may wait in BufferedUart_Write of a buffered uart at a time
+ * @param[in]	uart
+ * @param[in]	data
+ * @param[in]	length
+ * @param[in]	timeoutMs	BUFFERED_UART_OS_WAIT_FOREVER waits without timeout
+ * @return		HAL_StatusTypeDef	HAL_TIMEOUT if not all data was enqueued in time, the enqueued part is sent
+ */
+HAL_StatusTypeDef BufferedUart_Write(struct BufferedUart *uart, const void * data, unsigned int length, uint32_t timeoutMs)
+{
+	uint32_t start = BufferedUartOs_GetTickMs();
+	HAL_StatusTypeDef result = HAL_OK;
+	bool rechecked = false;
+	while (length > 0) {
+		unsigned int blockSize = min(length, BufferedUart_TXQueue_GetMaxBlockSize(uart));
+		result = BufferedUart_Transmit(uart, data, blockSize);
+		if (result == HAL_OK) {
+			length -= blockSize;
+			data = (const char *)data + blockSize;
+			rechecked = false;
+			continue;
+		}
+		if (result != HAL_BUSY) {
+			break;
+		}
+
+		// announce the wait before checking again, so space freed in between is not missed. The space
+		// can also be taken by an open reservation, so check only once before waiting
+		unsigned int wanted = blockSize + BufferedUart_TXQueue_GetPadding(uart, uart->txqueue.head, blockSize);
+		uart->txWakeBytes = wanted;
+		atomic_signal_fence(memory_order_seq_cst);
+		if (!rechecked && BlockRingbuffer_GetWriteAvailable(&uart->txqueue) >= wanted) {
+			rechecked = true;
+			continue;
+		}
+		rechecked = false;
+		uint32_t remaining = remainingMs(start, timeoutMs);
+		if (remaining == 0) {
+			result = HAL_TIMEOUT;
+			break;
+		}
+		BufferedUartOs_EventWait(&uart->txEvent, remaining);
+	}
+	uart->txWakeBytes = 0;
+
+	return result;
+}
+
+/**
+ * Sleep until all data up to sequence left the uart, see @ref BufferedUart_NotifyTxSent
+ * @note only one thread may wait in BufferedUart_WaitTxSent of a buffered uart at a time
+ * @param[in]	uart
+ * @param[in]	sequence	sequence number from @ref BufferedUart_TransmitSequenced or @ref BufferedUart_GetTxSequence
+ * @param[in]	timeoutMs	BUFFERED_UART_OS_WAIT_FOREVER waits without timeout
+ * @return		HAL_StatusTypeDef	HAL_TIMEOUT if the data was not sent in time
+ */
+HAL_StatusTypeDef BufferedUart_WaitTxSent(struct BufferedUart *uart, uint32_t sequence, uint32_t timeoutMs)
+{
+	uint32_t start = BufferedUartOs_GetTickMs();
+	HAL_StatusTypeDef result = HAL_OK;
+	while (!BufferedUart_IsTxSent(uart, sequence)) {
+		// announce the wait before checking again, so a transfer completing in between is not missed
+		uart->txWakeSequence = sequence;
+		atomic_signal_fence(memory_order_release);
+		uart->txSentWaiting = true;
+		atomic_signal_fence(memory_order_seq_cst);
+		if (BufferedUart_IsTxSent(uart, sequence)) {
+			break;
+		}
+		uint32_t remaining = remainingMs(start, timeoutMs);
+		if (remaining == 0) {
+			result = HAL_TIMEOUT;
+			break;
+		}
+		BufferedUartOs_EventWait(&uart->txSentEvent, remaining);
+	}
+	uart->txSentWaiting = false;
+
+	return result;
+}
+#endif
+
+#ifdef BUFFERED_UART_STATISTICS
+/**
+ * Consistent snapshot of the statistics of a buffered uart (taken with interrupts disabled)
+ * @param[in]	uart
+ * @param[out]	statistics
+ */
+void BufferedUart_GetStatistics(const struct BufferedUart *uart, struct BufferedUartStatistics *statistics)
+{
+	uint32_t priMask = __get_PRIMASK();
+	__set_PRIMASK(1);
+	*statistics = uart->statistics;
+	__set_PRIMASK(priMask);
+}
+
+/**
+ * Reset the statistics of a buffered uart, e.g. at the start of every measurement window
+ * @param[in]	uart
+ * @param[out]	statistics	optional (can be NULL), receives the statistics before the reset, no update is lost in between
+ */
+void BufferedUart_ResetStatistics(struct BufferedUart *uart, struct BufferedUartStatistics *statistics)
+{
+	uint32_t priMask = __get_PRIMASK();
+	__set_PRIMASK(1);
+	if (statistics != NULL) {
+		*statistics = uart->statistics;
+	}
+	memset(&uart->statistics, 0, sizeof(uart->statistics));
+	__set_PRIMASK(priMask);
+}
+#endif
+
+#ifdef BUFFERED_UART_LATENCY
+/**
+ * Consistent snapshot of the latency histograms of a buffered uart (taken with interrupts disabled)
+ * @param[in]	uart
+ * @param[out]	latency
+ */
+void BufferedUart_GetLatency(const struct BufferedUart *uart, struct BufferedUartLatency *latency)
+{
+	uint32_t priMask = __get_PRIMASK();
+	__set_PRIMASK(1);
+	*latency = uart->latency;
+	__set_PRIMASK(priMask);
+}
+
+/**
+ * Reset the latency histograms of a buffered uart, data which is queued at the time is still measured
+ * @param[in]	uart
+ * @param[out]	latency	optional (can be NULL), receives the histograms before the reset
+ */
+void BufferedUart_ResetLatency(struct BufferedUart *uart, struct BufferedUartLatency *latency)
+{
+	uint32_t priMask = __get_PRIMASK();
+	__set_PRIMASK(1);
+	if (latency != NULL) {
+		*latency = uart->latency;
+	}
+	memset(&uart->latency, 0, sizeof(uart->latency));
+	__set_PRIMASK(priMask);
+}
+
+/**
+ * Latency below which the given percentage of the samples lies, e.g. 50 for the median or 99
+ * The result is the upper end of a log2 bucket, so it is at most twice the exact percentile,
+ * but never more than the maximum.
+ * @param[in]	histogram
+ * @param[in]	percent	0 to 100
+ * @return		uint32_t	ticks, 0 if the histogram is empty
+ */
+uint32_t BufferedUart_GetPercentile(const struct BufferedUartHistogram *histogram, unsigned int percent)
+{
+	if (histogram->count == 0) {
+		return 0;
+	}
+
+	// the sample with this rank (counted from 1) is the percentile
+	uint64_t rank = ((uint64_t)histogram->count * percent + 99) / 100;
+	if (rank == 0) {
+		rank = 1;
+	}
+	uint64_t seen = 0;
+	for (unsigned int bucket = 0; bucket < BUFFERED_UART_HISTOGRAM_BUCKETS; bucket++) {
+		seen += histogram->buckets[bucket];
+		if (seen >= rank) {
+			uint32_t upper = bucket == 0 ? 0 : (uint32_t)((2ULL << (bucket - 1)) - 1);
+			return upper < histogram->max ? upper : histogram->max;
+		}
+	}
+	return histogram->max;
+}
+#endif
+
+#ifdef BUFFERED_UART_TRACE
+/// copy length bytes to index of the trace buffer, wrapping around its end, returns the index behind them
+static unsigned int BufferedUart_TraceWrite(struct BufferedUart * uart, unsigned int index, const void * data, unsigned int length)
+{
+	unsigned int first = min(length, uart->traceSize - index);
+	memcpy(uart->traceBuffer + index, data, first);
+	memcpy(uart->traceBuffer, (const char *)data + first, length - first);
+	index += length;
+	return index >= uart->traceSize ? index - uart->traceSize : index;
+}
+
+/// append a record with the data of first and second (both optional), or count it as dropped if it does not fit
+static void BufferedUart_Trace(struct BufferedUart * uart, enum BufferedUartTraceType type, unsigned int event, unsigned int size, const struct BufferedUartSpan * first, const struct BufferedUartSpan * second)
+{
+	unsigned int length = (first != NULL ? first->length : 0) + (second != NULL ? second->length : 0);
+
+	// records are written from interrupts and, for TX transfers, from thread context
+	uint32_t priMask = __get_PRIMASK();
+	__set_PRIMASK(1);
+	struct BufferedUartTraceRecord record = {
+		.time = BUFFERED_UART_TRACE_TIMESTAMP(),
+		.size = (uint16_t)size,
+		.length = (uint16_t)length,
+		.type = (uint8_t)type,
+		.event = (uint8_t)event
+	};
+	unsigned int head = uart->traceHead;
+	unsigned int tail = uart->traceTail;
+	atomic_signal_fence(memory_order_acquire);
+	// one byte stays free, so a full buffer is not mistaken for an empty one
+	unsigned int free = (tail > head ? tail - head : uart->traceSize - head + tail) - 1;
+	unsigned int needed = sizeof(record) + length + (uart->traceDropped > 0 ? sizeof(record) : 0);
+	if (needed > free) {
+		uart->traceDropped++;
+		uart->traceDroppedTotal++;
+		__set_PRIMASK(priMask);
+		return;
+	}
+
+	if (uart->traceDropped > 0) {
+		struct BufferedUartTraceRecord dropped = {
+			.time = record.time,
+			.size = (uint16_t)min(uart->traceDropped, UINT16_MAX),
+			.type = BUFFERED_UART_TRACE_DROPPED
+		};
+		head = BufferedUart_TraceWrite(uart, head, &dropped, sizeof(dropped));
+		uart->traceDropped = 0;
+	}
+	head = BufferedUart_TraceWrite(uart, head, &record, sizeof(record));
+	if (first != NULL) {
+		head = BufferedUart_TraceWrite(uart, head, first->data, first->length);
+	}
+	if (second != NULL) {
+		head = BufferedUart_TraceWrite(uart, head, second->data, second->length);
+	}
+	atomic_signal_fence(memory_order_release);
+	uart->traceHead = head;
+	__set_PRIMASK(priMask);
+}
+
+/**
+ * Start recording a trace into buffer, or stop recording with NULL (see BUFFERED_UART_TRACE)
+ * Records which do not fit are dropped and counted (traceDroppedTotal), a BUFFERED_UART_TRACE_DROPPED
+ * record marks the gap. The recording copies the received bytes with interrupts disabled.
+ * @param[in]	uart
+ * @param[in]	buffer	NULL to stop recording, unread records are discarded
+ * @param[in]	size
+ * @return		HAL_StatusTypeDef	HAL_ERROR if the buffer can not hold two record headers
+ */
+HAL_StatusTypeDef BufferedUart_SetTrace(struct BufferedUart *uart, void *buffer, unsigned int size)
+{
+	if (buffer != NULL && size <= 2 * sizeof(struct BufferedUartTraceRecord)) {
+		return HAL_ERROR;
+	}
+
+	uint32_t priMask = __get_PRIMASK();
+	__set_PRIMASK(1);
+	uart->traceBuffer = buffer;
+	uart->traceSize = size;
+	uart->traceHead = 0;
+	uart->traceTail = 0;
+	uart->traceDropped = 0;
+	__set_PRIMASK(priMask);
+	return HAL_OK;
+}
+
+/**
+ * Copy recorded trace data out of the trace buffer, which frees its space
+ * The trace is a stream of records (struct BufferedUartTraceRecord followed by its data), the pieces
+ * returned by consecutive calls concatenate to it. Not to be called from several contexts at the same time
+ * @param[in]	uart
+ * @param[out]	data
+ * @param[in]	maximumLength
+ * @return		unsigned int	number of bytes copied
+ */
+unsigned int BufferedUart_TraceRead(struct BufferedUart *uart, void *data, unsigned int maximumLength)
+{
+	if (uart->traceBuffer == NULL) {
+		return 0;
+	}
+
+	unsigned int tail = uart->traceTail;
+	unsigned int head = uart->traceHead;
+	atomic_signal_fence(memory_order_acquire);
+	unsigned int available = head >= tail ? head - tail : uart->traceSize - tail + head;
+	unsigned int length = min(available, maximumLength);
+	unsigned int first = min(length, uart->traceSize - tail);
+	memcpy(data, uart->traceBuffer + tail, first);
+	memcpy((char *)data + first, uart->traceBuffer, length - first);
+	atomic_signal_fence(memory_order_release);
+	tail += length;
+	uart->traceTail = tail >= uart->traceSize ? tail - uart->traceSize : tail;
+	return length;
+}
+#endif
@@ -33,6 +33,9 @@ SOFTWARE.
 #include <stdbool.h>
 #include <string.h>
 #include "main.h"		// pull in ST definitions like UART_HandleTypeDef
+#ifdef BUFFERED_UART_LOCKFREE
+#include <stdatomic.h>
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -45,6 +48,131 @@ extern "C" {
 // default off
 //#define BUFFERED_UART_REENTRANT
 
+// define BUFFERED_UART_LOCKFREE to make the transmit functions reentrant without disabling interrupts
+// tx space is reserved with C11 atomics (LDREX/STREX, requires Cortex-M3 or higher), the data is copied
+// with interrupts enabled and the reservations are published in order. Replaces BUFFERED_UART_REENTRANT
+// for transmission, reception is not affected
+// default off
+//#define BUFFERED_UART_LOCKFREE
+
+// define BUFFERED_UART_TX_BIPBUFFER to keep every enqueued block contiguous in the tx buffer (bip buffer)
+// a block which does not fit in front of the end of the buffer is placed at its beginning instead of
+// being split, the unused end is skipped. Every block is then sent with a single DMA transfer, at the
+// cost of up to one block size of unused buffer space
+// default off
+//#define BUFFERED_UART_TX_BIPBUFFER
+
+// define BUFFERED_UART_TX_ZEROCOPY to send buffers which stay valid until they are sent (e.g. constant data in
+// flash) directly from their memory via BufferedUart_TransmitZeroCopy, without copying them into the tx queue
+// default off
+//#define BUFFERED_UART_TX_ZEROCOPY
+
+// define BUFFERED_UART_TX_GAPLESS to start the next TX DMA transfer from the DMA transfer complete interrupt,
+// while the last two frames of the previous transfer are still in the transmit data and shift register,
+// instead of from the USART transfer complete interrupt once the line went idle. Back-to-back blocks
+// then leave no gap on the line, and chained transfers need only one interrupt each
+// default off
+//#define BUFFERED_UART_TX_GAPLESS
+
+// define BUFFERED_UART_RX_BLOCKS to receive into blocks of a pool instead of the rx ring buffer (see
+// BufferedUart_StartBlockReception). Every packet is handed to the application as a whole block without
+// copying it, and the reception goes on into the next free block while the application still holds it
+// default off
+//#define BUFFERED_UART_RX_BLOCKS
+
+// define BUFFERED_UART_DCACHE if the buffers are in cacheable memory of a core with data cache (Cortex-M7)
+// tx data is cleaned from the cache before its DMA transfer starts, newly received data is invalidated before
+// it is reported. The rx buffer has to be aligned to and a multiple of BUFFERED_UART_DCACHE_LINE_SIZE
+// (BufferedUart_Init fails otherwise), since invalidating a cache line discards everything else in it.
+// Received data must not be modified in place
+// default off
+//#define BUFFERED_UART_DCACHE
+
+// cache line size and cache maintenance by address of BUFFERED_UART_DCACHE, the address and size passed
+// are multiples of the line size. Define them e.g. in main.h to check the maintenance in a simulation
+// default 32 byte lines and the CMSIS SCB functions
+#ifndef BUFFERED_UART_DCACHE_LINE_SIZE
+#define BUFFERED_UART_DCACHE_LINE_SIZE (32)
+#endif
+#ifndef BUFFERED_UART_DCACHE_CLEAN
+#define BUFFERED_UART_DCACHE_CLEAN(address, size) SCB_CleanDCache_by_Addr((uint32_t *)(address), (int32_t)(size))
+#endif
+#ifndef BUFFERED_UART_DCACHE_INVALIDATE
+#define BUFFERED_UART_DCACHE_INVALIDATE(address, size) SCB_InvalidateDCache_by_Addr((uint32_t *)(address), (int32_t)(size))
+#endif
+
+// number of BufferedUart_TransmitZeroCopy buffers which can be queued at the same time
+// default 4
+#ifndef BUFFERED_UART_TX_ZEROCOPY_DESCRIPTORS
+#define BUFFERED_UART_TX_ZEROCOPY_DESCRIPTORS (4)
+#endif
+
+// define BUFFERED_UART_STATISTICS to count transferred bytes, DMA transfers, rejections, error restarts,
+// the ring high-water marks and the cycles spent in the TxCplt and RxEvent callbacks per buffered uart
+// see BufferedUart_GetStatistics, without it no code or memory is spent on statistics
+// default off
+//#define BUFFERED_UART_STATISTICS
+
+// cycle counter used by BUFFERED_UART_STATISTICS, default the DWT cycle counter (Cortex-M3 or higher)
+// define both, e.g. in main.h, to use another free running counter, e.g. a timer on Cortex-M0
+#ifndef BUFFERED_UART_CYCLE_COUNTER
+#define BUFFERED_UART_CYCLE_COUNTER() (DWT->CYCCNT)
+#define BUFFERED_UART_CYCLE_COUNTER_INIT() do { CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk; DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk; } while (0)
+#endif
+
+// define BUFFERED_UART_LATENCY to measure how long data waits in the queues, as log2 histograms per buffered uart:
+// from the enqueue of a tx block until the DMA transfer which sends it starts and until it completes, and
+// from the rx event which reported received bytes until the application consumes them
+// see BufferedUart_GetLatency, without it no code or memory is spent on timestamps
+// default off
+//#define BUFFERED_UART_LATENCY
+
+// tick source of BUFFERED_UART_LATENCY, default the cycle counter (see BUFFERED_UART_CYCLE_COUNTER)
+// define it e.g. as HAL_GetTick() for millisecond resolution without the DWT
+#ifndef BUFFERED_UART_LATENCY_TICKS
+#define BUFFERED_UART_LATENCY_TICKS() BUFFERED_UART_CYCLE_COUNTER()
+#endif
+
+// number of tx blocks and rx events per direction which are timed at the same time (power of 2)
+// blocks/events which find all slots in use are not measured (counted as unsampled)
+// default 8
+#ifndef BUFFERED_UART_LATENCY_MARKS
+#define BUFFERED_UART_LATENCY_MARKS (8)
+#endif
+
+// define BUFFERED_UART_TRACE to record the reception events (with the received bytes), the TX DMA transfers
+// and the error restarts of a buffered uart into a ring buffer (see BufferedUart_SetTrace), e.g. to replay
+// captured traffic in the host simulation. Without it no code or memory is spent on tracing
+// default off
+//#define BUFFERED_UART_TRACE
+
+// timestamp of the trace records, default the cycle counter (see BUFFERED_UART_CYCLE_COUNTER)
+#ifndef BUFFERED_UART_TRACE_TIMESTAMP
+#define BUFFERED_UART_TRACE_TIMESTAMP() BUFFERED_UART_CYCLE_COUNTER()
+#endif
+
+// character which ends a line for BufferedUart_PeekLine and BufferedUart_DequeueLine
+// default '\n', which also ends "\r\n" terminated lines (e.g. NMEA), the '\r' is then part of the line
+#ifndef BUFFERED_UART_LINE_DELIMITER
+#define BUFFERED_UART_LINE_DELIMITER ('\n')
+#endif
+
+// characters of the software flow control (see BufferedUart_SetFlowControl)
+// default DC1 (XON) and DC3 (XOFF)
+#ifndef BUFFERED_UART_XON
+#define BUFFERED_UART_XON ('\x11')
+#endif
+#ifndef BUFFERED_UART_XOFF
+#define BUFFERED_UART_XOFF ('\x13')
+#endif
+
+// select an operating system backend for the blocking BufferedUart_Read and BufferedUart_Write, which
+// sleep until the rx/tx interrupts signal enough data or space (see stm32_buffered_uart_os.h)
+// BUFFERED_UART_OS_FREERTOS uses binary semaphores, BUFFERED_UART_OS_PTHREAD is used by the host simulation
+// default off
+//#define BUFFERED_UART_OS_FREERTOS
+//#define BUFFERED_UART_OS_PTHREAD
+
 // define BUFFERED_UART_PROVIDE_HAL_UART_TxCpltCallback if the API should provide the definition for the function
 // otherwise, if USE_HAL_UART_REGISTER_CALLBACKS==0 you have to call BufferedUart_TxCpltCallback from external glue code
 // default on
@@ -60,23 +188,91 @@ extern "C" {
 // default on
 #define BUFFERED_UART_PROVIDE_HAL_UART_ErrorCallback
 
-// set MAX_NUMBER_BUFFERED_UARTS to the number of required number of buffered uarts
+// set MAX_NUMBER_BUFFERED_UARTS to the number of required number of buffered uarts, at most 32
+// (one bit per buffered uart in BufferedUart_PollAll)
+// can also be set by the build system (e.g. -DMAX_NUMBER_BUFFERED_UARTS=4)
 // default 1
+#ifndef MAX_NUMBER_BUFFERED_UARTS
 #define MAX_NUMBER_BUFFERED_UARTS (1)
+#endif
 
 // if ALL ring buffer queue sizes are equal and known at compile time, you can specify the size here
 // to enable optimization for internal modulo operations (especially if size is power of 2)
+// note: ring buffers with a power of 2 size already use bitmasking without this option
 // default off
 //#define BUFFERED_UART_FIXED_BUFFER_SIZE (128) //set this accordingly
 
+// alignment of the ring buffers defined via BUFFERED_UART_DEFINE
+// default 4 (word aligned), a cache line with BUFFERED_UART_DCACHE
+#ifndef BUFFERED_UART_BUFFER_ALIGNMENT
+#ifdef BUFFERED_UART_DCACHE
+#define BUFFERED_UART_BUFFER_ALIGNMENT BUFFERED_UART_DCACHE_LINE_SIZE
+#else
+#define BUFFERED_UART_BUFFER_ALIGNMENT (4)
+#endif
+#endif
+
 /// ==== end configuration options ====
 
+#if defined(BUFFERED_UART_OS_FREERTOS) || defined(BUFFERED_UART_OS_PTHREAD)
+#define BUFFERED_UART_OS
+#include "stm32_buffered_uart_os.h"
+#endif
+
 enum BufferedUartMode {
 	BUFFERED_UART_TX_RX,
 	BUFFERED_UART_TX,
 	BUFFERED_UART_RX
 };
 
+enum BufferedUartTxSource {
+	BUFFERED_UART_TX_SOURCE_QUEUE,		// txqueue
+	BUFFERED_UART_TX_SOURCE_URGENT,		// txurgent
+	BUFFERED_UART_TX_SOURCE_DESCRIPTOR,	// the oldest BufferedUart_TransmitZeroCopy buffer
+	BUFFERED_UART_TX_SOURCE_FLOW		// XON/XOFF character
+};
+
+/// what reported received data, the first three are the event types of the HAL (HAL_UART_RXEVENT_xxx)
+enum BufferedUartRxEvent {
+	BUFFERED_UART_RX_EVENT_TC,			// RX DMA transfer complete
+	BUFFERED_UART_RX_EVENT_HT,			// RX DMA half transfer
+	BUFFERED_UART_RX_EVENT_IDLE,		// IDLE line
+	BUFFERED_UART_RX_EVENT_POLL,		// BufferedUart_RxPoll
+	BUFFERED_UART_RX_EVENT_TIMEOUT		// receiver timeout or character match, see BufferedUart_UART_IRQHandler
+};
+
+/// type of a record of BUFFERED_UART_TRACE
+enum BufferedUartTraceType {
+	BUFFERED_UART_TRACE_RX,				// event is the enum BufferedUartRxEvent, the newly received bytes follow the header
+	BUFFERED_UART_TRACE_TX,				// TX DMA transfer of size bytes started, event is its enum BufferedUartTxSource
+	BUFFERED_UART_TRACE_ERROR,			// error restart of the reception, event is the low byte of the HAL ErrorCode
+	BUFFERED_UART_TRACE_DROPPED			// size records in front of this one did not fit into the trace buffer
+};
+
+/// header of a trace record, followed by length bytes. Records are not aligned, copy the header with memcpy
+struct __attribute__((packed)) BufferedUartTraceRecord {
+	uint32_t time;		// BUFFERED_UART_TRACE_TIMESTAMP()
+	uint16_t size;		// RX: DMA position in the rx buffer (the Size of the HAL callback), TX: transfer length
+	uint16_t length;
+	uint8_t type;		// enum BufferedUartTraceType
+	uint8_t event;
+};
+
+/// how the peer is stopped before the rx queue overflows (see BufferedUart_SetFlowControl)
+enum BufferedUartFlowControl {
+	BUFFERED_UART_FLOW_NONE,
+	BUFFERED_UART_FLOW_RTS,			// the RtsHandler drives the RTS line, e.g. a GPIO
+	BUFFERED_UART_FLOW_XON_XOFF		// XOFF/XON are sent ahead of all queued data, received ones pause/resume the transmission
+									// (from the rx interrupt, see BufferedUart_SetFlowControl)
+};
+
+/// who drives the driver enable of a half-duplex bus like RS-485 (see BufferedUart_SetHalfDuplex)
+enum BufferedUartHalfDuplex {
+	BUFFERED_UART_HALF_DUPLEX_OFF,
+	BUFFERED_UART_HALF_DUPLEX_DE,		// the USART drives its DE pin (USART_CR3_DEM, e.g. set by HAL_RS485Ex_Init)
+	BUFFERED_UART_HALF_DUPLEX_HANDLER	// the DriverEnableHandler drives DE, e.g. a GPIO
+};
+
 enum DataHandledResult {
 	BUFFERED_UART_DATA_NOT_HANDLED,
 	BUFFERED_UART_DATA_HANDLED
@@ -87,16 +283,212 @@ struct BlockRingbuffer {
 	unsigned int head;
 	unsigned int tail;
 	unsigned int length;
+	unsigned int mask;	// length - 1 if length is a power of 2, otherwise 0
+	unsigned int wrap;	// head and tail run from 0 to wrap - 1, wrap is a multiple of length
+};
+
+/// see BUFFERED_UART_STATISTICS, all counters wrap around
+struct BufferedUartStatistics {
+	uint32_t txBytes;				// bytes handed to the TX DMA
+	uint32_t txTransfers;			// TX DMA transfers started
+	uint32_t txRejected;			// HAL_BUSY results of BufferedUart_Transmit and BufferedUart_TxReserve
+	uint32_t txHighWater;			// maximum number of bytes in the tx queue
+	uint32_t rxBytes;				// bytes written by the RX DMA
+	uint32_t rxHighWater;			// maximum number of unread bytes in the rx queue
+	uint32_t rxBlocks;				// received blocks handed to the application (BUFFERED_UART_RX_BLOCKS)
+	uint32_t rxStarved;				// block receptions which stopped because no block was free
+	uint32_t errorRestarts;			// receptions restarted by the error callback
+	uint32_t txCpltCalls;
+	uint32_t txCpltCycles;			// cycles spent in BufferedUart_TxCpltCallback
+	uint32_t rxEventCalls;
+	uint32_t rxEventCycles;			// cycles spent in BufferedUart_RxEventCallback, including the DataReceivedHandler
+};
+
+#define BUFFERED_UART_HISTOGRAM_BUCKETS (33)
+
+/// log2 histogram of latencies in ticks of BUFFERED_UART_LATENCY_TICKS
+struct BufferedUartHistogram {
+	uint32_t buckets[BUFFERED_UART_HISTOGRAM_BUCKETS];	// bucket 0 counts 0 ticks, bucket n counts 2^(n-1) to 2^n - 1 ticks
+	uint32_t count;
+	uint32_t max;
+};
+
+/// see BUFFERED_UART_LATENCY
+struct BufferedUartLatency {
+	struct BufferedUartHistogram txQueued;	// enqueue of a block until the DMA transfer which sends its end starts
+	struct BufferedUartHistogram txSent;	// enqueue of a block until that transfer completes
+	struct BufferedUartHistogram rxWaiting;	// rx event which reported bytes until they are consumed
+	uint32_t txUnsampled;					// tx blocks which were not measured, all marks were in use
+	uint32_t rxUnsampled;					// rx events which were not measured
+};
+
+/// queue position up to which data was enqueued/received at a time
+struct BufferedUartLatencyMark {
+	unsigned int position;
+	uint32_t time;
+};
+
+struct BufferedUartLatencyMarks {
+	struct BufferedUartLatencyMark marks[BUFFERED_UART_LATENCY_MARKS];
+	unsigned int head;		// free running, written by the context which marks
+	unsigned int tail;		// free running, written by the context which retires
+};
+
+struct BufferedUart;
+
+/// buffer queued via BufferedUart_TransmitZeroCopy
+struct BufferedUartTxDescriptor {
+	const char * data;
+	unsigned int length;
+	unsigned int position;	// tx queue position in front of which the buffer is sent
+	void (*CompletionHandler)(struct BufferedUart * uart, const void * data, unsigned int length);
+};
+
+/// DMA buffer of the block reception (see BufferedUart_StartBlockReception)
+struct BufferedUartRxBlock {
+	struct BufferedUartRxBlock * next;	// link in the lists of the driver, do not use
+	char * data;						// blockSize bytes, the RX DMA writes into them
+	unsigned int length;				// number of received bytes
+};
+
+/// contiguous part of a ring buffer, a region of a ring buffer is described by up to two spans
+struct BufferedUartSpan {
+	char * data;
+	unsigned int length;
+};
+
+/// bit n refers to the buffered uart with index n (see BufferedUart_GetByIndex)
+struct BufferedUartReadiness {
+	uint32_t rx;	// unread data in the rx queue, or received blocks (BUFFERED_UART_RX_BLOCKS)
+	uint32_t tx;	// at least txReadyBytes free in the tx queue
 };
 
 struct BufferedUart {
 	UART_HandleTypeDef * uart;
+	unsigned int index;					// slot of MAX_NUMBER_BUFFERED_UARTS, bit in struct BufferedUartReadiness
+	unsigned int txReadyBytes;			// see BufferedUart_SetTxReadyThreshold
 	struct BlockRingbuffer txqueue;
 	struct BlockRingbuffer rxqueue;
 	unsigned int lastSendBlockSize;
+	unsigned int txReserved;
+	struct BlockRingbuffer txurgent;	// optional high priority tx queue (see BufferedUart_SetUrgentQueue), length 0 if not used
+	enum BufferedUartTxSource txSource;	// queue of the running TX DMA transfer
+	unsigned int txChunkSize;			// maximum size of a TX DMA transfer from txqueue, 0 unlimited
+	bool txPaused;						// see BufferedUart_PauseTransmission, XOFF received
+	bool txInterruptStarts;				// not only TxCplt starts transmissions from interrupts (XON/XOFF, PauseTransmission)
+	int txFlowCharacter;				// XON/XOFF which is sent ahead of everything else, -1 if none
+	char txFlowByte;					// memory of the running XON/XOFF DMA transfer
+#ifdef BUFFERED_UART_TX_ZEROCOPY
+	struct BufferedUartTxDescriptor txDescriptors[BUFFERED_UART_TX_ZEROCOPY_DESCRIPTORS];
+	unsigned int txDescriptorHead;		// free running
+	unsigned int txDescriptorTail;		// free running
+	unsigned int txDescriptorSent;		// bytes of the oldest descriptor which were sent already
+#endif
+#ifdef BUFFERED_UART_TX_BIPBUFFER
+	unsigned int txPaddingPosition;	// tx position from which the end of the buffer is skipped, txqueue.wrap if none
+#endif
+	unsigned int rxDmaPosition;		// index in rxqueue.buf up to which the DMA reception was reported
+	unsigned int rxDroppedBytes;	// received bytes overwritten by the DMA before they were read
+	unsigned int rxOverruns;		// number of times the DMA overwrote unread data
+	bool rxWrapReported;			// the DMA wrap around was reported before the transfer complete interrupt
+	unsigned int rxFillThreshold;	// DataReceivedHandler is called on fill events once this many bytes are unread
+	unsigned int rxTimeoutBits;		// receiver timeout in bit times instead of IDLE line detection, 0 off
+	int rxMatchCharacter;			// character which is delivered immediately (character match), -1 off
+	unsigned int rxLineScanned;		// rx position up to which the line search found no delimiter
+	enum BufferedUartFlowControl rxFlowControl;
+	unsigned int rxFlowHighWatermark;	// the peer is stopped once this many bytes are unread
+	unsigned int rxFlowLowWatermark;	// and resumed once at most this many are left
+	bool rxFlowStopped;
+	void (*RtsHandler)(struct BufferedUart * uart, bool stop);	// BUFFERED_UART_FLOW_RTS, stop deasserts RTS
+#ifdef BUFFERED_UART_RX_BLOCKS
+	unsigned int rxBlockSize;					// 0 while the rx ring buffer is used
+	struct BufferedUartRxBlock * rxBlock;		// block the RX DMA writes into, NULL if none is armed
+	struct BufferedUartRxBlock * rxBlockFree;	// free blocks (Treiber stack), only the reception pops
+	struct BufferedUartRxBlock * rxBlockReceived;	// received blocks for BufferedUart_GetRxBlock, newest first
+	struct BufferedUartRxBlock * rxBlockTaken;	// received blocks BufferedUart_GetRxBlock took over, oldest first
+	bool rxBlockStarved;						// no block was free, the next BufferedUart_ReleaseRxBlock re-arms
+	void (*BlockReceivedHandler)(struct BufferedUart * uart, struct BufferedUartRxBlock * block);	// optional
+#endif
+#ifdef BUFFERED_UART_LOCKFREE
+	atomic_uint txReservation;		// end of all tx reservations << 8 | number of reservations not yet committed
+	atomic_uint txStartRequests;	// transmission start requests, only the first requester starts the DMA
+	unsigned int txReservePosition;	// start of the region reserved via BufferedUart_TxReserve
+#endif
 	enum DataHandledResult (*DataReceivedHandler)(const char * data, unsigned int length);
+	unsigned int txCoalesceBytes;		// hold the transmission until this many bytes are queued, 0 sends immediately
+	unsigned int txCoalesceTimeoutMs;	// or until the transmission was held this long
+	bool txHolding;
+	uint32_t txHoldStart;				// HAL tick at which the transmission was held first
+	unsigned int txFlushPosition;		// queued data up to this position is sent without holding it
+	void (*TxHoldStartedHandler)(struct BufferedUart * uart);	// optional, called when the transmission is held
+	uint32_t txSentSequence;			// bytes of the tx queue which left the uart (modulo 2^32)
+	unsigned int txSentPosition;		// tx queue position up to which the queued data left the uart
+	uint32_t txNotifySequence;			// TxSentHandler is called once the data up to here was sent
+	void (*TxSentHandler)(struct BufferedUart * uart, uint32_t sequence);	// NULL if no notification is pending
+	enum BufferedUartHalfDuplex txHalfDuplex;
+	bool txDriving;						// the half-duplex transmission holds the bus
+	bool txEchoSuppressed;				// and disabled the receiver, which is enabled again at its end
+	void (*DriverEnableHandler)(struct BufferedUart * uart, bool enable);	// BUFFERED_UART_HALF_DUPLEX_HANDLER
+#ifdef BUFFERED_UART_TX_GAPLESS
+	void (*txHalDmaCplt)(DMA_HandleTypeDef * hdma);	// TX DMA transfer complete callback of the HAL, ends the transmission
+	bool txChaining;					// inside the TX DMA transfer complete callback, the next transfer may start
+#endif
+#ifdef BUFFERED_UART_OS
+	struct BufferedUartOsEvent rxEvent;	// signaled once rxWakeBytes are unread
+	struct BufferedUartOsEvent txEvent;	// signaled once txWakeBytes are free
+	unsigned int rxWakeBytes;			// 0 if no thread waits in BufferedUart_Read
+	unsigned int txWakeBytes;			// 0 if no thread waits in BufferedUart_Write
+	struct BufferedUartOsEvent txSentEvent;	// signaled once txWakeSequence was sent
+	uint32_t txWakeSequence;
+	bool txSentWaiting;					// a thread waits in BufferedUart_WaitTxSent
+#endif
+#ifdef BUFFERED_UART_STATISTICS
+	struct BufferedUartStatistics statistics;
+#endif
+#ifdef BUFFERED_UART_LATENCY
+	struct BufferedUartLatency latency;
+	struct BufferedUartLatencyMarks txMarks;
+	struct BufferedUartLatencyMarks rxMarks;
+	uint32_t txStartTime;				// time at which the running TX DMA transfer was started
+#endif
+#ifdef BUFFERED_UART_TRACE
+	char * traceBuffer;					// see BufferedUart_SetTrace, NULL while not recording
+	unsigned int traceSize;
+	unsigned int traceHead;				// index of the next record, written with interrupts disabled
+	unsigned int traceTail;				// index of the next unread byte, written by BufferedUart_TraceRead
+	unsigned int traceDropped;			// records which did not fit since the last one which did
+	uint32_t traceDroppedTotal;
+#endif
 };
 
+#ifdef __cplusplus
+	#define BUFFERED_UART_STATIC_ASSERT(condition, message) static_assert(condition, message)
+#else
+	#define BUFFERED_UART_STATIC_ASSERT(condition, message) _Static_assert(condition, message)
+#endif
+
+/**
+ * Define a buffered uart together with its tx and rx ring buffers
+ * The sizes must be powers of 2 (checked at compile time), so every ring uses bitmasking instead of
+ * modulo operations. The buffers are aligned to BUFFERED_UART_BUFFER_ALIGNMENT, with BUFFERED_UART_DCACHE
+ * the rx size has to be at least one cache line.
+ * Use @ref BUFFERED_UART_INIT to initialize it.
+ * example: BUFFERED_UART_DEFINE(logUart, 4096, 64);
+ */
+#define BUFFERED_UART_DEFINE(name, txSize, rxSize)																		\
+	BUFFERED_UART_STATIC_ASSERT((txSize) > 0 && ((txSize) & ((txSize) - 1)) == 0, "tx size of " #name " must be a power of 2");	\
+	BUFFERED_UART_STATIC_ASSERT((rxSize) > 0 && ((rxSize) & ((rxSize) - 1)) == 0, "rx size of " #name " must be a power of 2");	\
+	static char name##_txBuffer[txSize] __attribute__((aligned(BUFFERED_UART_BUFFER_ALIGNMENT)));						\
+	static char name##_rxBuffer[rxSize] __attribute__((aligned(BUFFERED_UART_BUFFER_ALIGNMENT)));						\
+	struct BufferedUart name
+
+/**
+ * Initialize a buffered uart defined via @ref BUFFERED_UART_DEFINE
+ * example: BUFFERED_UART_INIT(logUart, &huart2, BUFFERED_UART_TX_RX);
+ */
+#define BUFFERED_UART_INIT(name, huart, mode)	\
+	BufferedUart_Init(&(name), (huart), (mode), name##_txBuffer, sizeof(name##_txBuffer), name##_rxBuffer, sizeof(name##_rxBuffer))
+
 #ifdef BUFFERED_UART_REENTRANT
     #define BUFFERED_UART_REENTRANT_ENTER_CRITICAL_SECTION()   \
        uint32_t PriMsk;                    						\
@@ -117,9 +509,74 @@ struct BufferedUart {
 HAL_StatusTypeDef BufferedUart_StartReception(struct BufferedUart *uart);
 HAL_StatusTypeDef BufferedUart_StopReception(struct BufferedUart *uart);
 HAL_StatusTypeDef BufferedUart_Init(struct BufferedUart * buffered_uart, UART_HandleTypeDef * uart, enum BufferedUartMode mode, void *txBuffer, unsigned int txSize, void *rxBuffer, unsigned int rxSize);
+HAL_StatusTypeDef BufferedUart_DeInit(struct BufferedUart * buffered_uart);
 HAL_StatusTypeDef BufferedUart_Transmit(struct BufferedUart *uart, const void * data, unsigned int length);
+HAL_StatusTypeDef BufferedUart_TransmitSequenced(struct BufferedUart *uart, const void * data, unsigned int length, uint32_t *sequence);
 HAL_StatusTypeDef BufferedUart_TransmitTimed(struct BufferedUart *uart, const void * data, unsigned int length, unsigned int timeoutMs);
+HAL_StatusTypeDef BufferedUart_SetUrgentQueue(struct BufferedUart *uart, void *buffer, unsigned int size);
+HAL_StatusTypeDef BufferedUart_TransmitUrgent(struct BufferedUart *uart, const void * data, unsigned int length);
+void BufferedUart_SetTxChunkSize(struct BufferedUart *uart, unsigned int chunkSize);
+#ifdef BUFFERED_UART_TX_ZEROCOPY
+HAL_StatusTypeDef BufferedUart_TransmitZeroCopy(struct BufferedUart *uart, const void * data, unsigned int length, void (*CompletionHandler)(struct BufferedUart * uart, const void * data, unsigned int length));
+#endif
 unsigned int BufferedUart_Dequeue(struct BufferedUart *uart, void * buffer, unsigned int maximumLength);
+unsigned int BufferedUart_PeekLine(struct BufferedUart *uart, const char **line, char *buffer, unsigned int bufferSize);
+unsigned int BufferedUart_DequeueLine(struct BufferedUart *uart, char *buffer, unsigned int maximumLength);
+uint32_t BufferedUart_PollAll(struct BufferedUartReadiness *ready);
+struct BufferedUart * BufferedUart_GetByIndex(unsigned int index);
+void BufferedUart_SetTxReadyThreshold(struct BufferedUart *uart, unsigned int bytes);
+HAL_StatusTypeDef BufferedUart_TxReserve(struct BufferedUart *uart, unsigned int length, struct BufferedUartSpan *first, struct BufferedUartSpan *second);
+HAL_StatusTypeDef BufferedUart_TxCommit(struct BufferedUart *uart, unsigned int length);
+void BufferedUart_SetTxCoalescing(struct BufferedUart *uart, unsigned int thresholdBytes, unsigned int timeoutMs);
+void BufferedUart_Flush(struct BufferedUart *uart);
+void BufferedUart_TxPoll(struct BufferedUart *uart);
+uint32_t BufferedUart_GetTxSequence(const struct BufferedUart *uart);
+uint32_t BufferedUart_GetTxSentSequence(const struct BufferedUart *uart);
+bool BufferedUart_IsTxSent(const struct BufferedUart *uart, uint32_t sequence);
+bool BufferedUart_NotifyTxSent(struct BufferedUart *uart, uint32_t sequence, void (*TxSentHandler)(struct BufferedUart * uart, uint32_t sequence));
+unsigned int BufferedUart_RxPeek(struct BufferedUart *uart, struct BufferedUartSpan *first, struct BufferedUartSpan *second);
+void BufferedUart_RxConsume(struct BufferedUart *uart, unsigned int length);
+void BufferedUart_RxPoll(struct BufferedUart *uart);
+void BufferedUart_SetRxFillThreshold(struct BufferedUart *uart, unsigned int thresholdBytes);
+HAL_StatusTypeDef BufferedUart_SetRxTimeout(struct BufferedUart *uart, unsigned int bitTimes);
+HAL_StatusTypeDef BufferedUart_SetRxCharacterMatch(struct BufferedUart *uart, int character);
+HAL_StatusTypeDef BufferedUart_SetFlowControl(struct BufferedUart *uart, enum BufferedUartFlowControl mode, unsigned int highWatermark, unsigned int lowWatermark, void (*RtsHandler)(struct BufferedUart * uart, bool stop));
+void BufferedUart_PauseTransmission(struct BufferedUart *uart, bool paused);
+HAL_StatusTypeDef BufferedUart_SetHalfDuplex(struct BufferedUart *uart, enum BufferedUartHalfDuplex mode, void (*DriverEnableHandler)(struct BufferedUart * uart, bool enable));
+#ifdef BUFFERED_UART_RX_BLOCKS
+HAL_StatusTypeDef BufferedUart_StartBlockReception(struct BufferedUart *uart, struct BufferedUartRxBlock *blocks, unsigned int numberBlocks, unsigned int blockSize, void (*BlockReceivedHandler)(struct BufferedUart * uart, struct BufferedUartRxBlock * block));
+struct BufferedUartRxBlock * BufferedUart_GetRxBlock(struct BufferedUart *uart);
+void BufferedUart_ReleaseRxBlock(struct BufferedUart *uart, struct BufferedUartRxBlock *block);
+#endif
+#ifdef BUFFERED_UART_OS
+unsigned int BufferedUart_Read(struct BufferedUart *uart, void * buffer, unsigned int minimumLength, unsigned int maximumLength, uint32_t timeoutMs);
+HAL_StatusTypeDef BufferedUart_Write(struct BufferedUart *uart, const void * data, unsigned int length, uint32_t timeoutMs);
+HAL_StatusTypeDef BufferedUart_WaitTxSent(struct BufferedUart *uart, uint32_t sequence, uint32_t timeoutMs);
+#endif
+/// call from USARTx_IRQHandler in front of HAL_UART_IRQHandler if the receiver timeout or character match is used
+void BufferedUart_UART_IRQHandler(UART_HandleTypeDef *huart);
+
+#ifdef BUFFERED_UART_STATISTICS
+void BufferedUart_GetStatistics(const struct BufferedUart *uart, struct BufferedUartStatistics *statistics);
+void BufferedUart_ResetStatistics(struct BufferedUart *uart, struct BufferedUartStatistics *statistics);
+
+/// average number of bytes per TX DMA transfer
+static inline unsigned int BufferedUart_GetAverageTransferSize(const struct BufferedUartStatistics *statistics)
+{
+	return statistics->txTransfers > 0 ? statistics->txBytes / statistics->txTransfers : 0;
+}
+#endif
+
+#ifdef BUFFERED_UART_LATENCY
+void BufferedUart_GetLatency(const struct BufferedUart *uart, struct BufferedUartLatency *latency);
+void BufferedUart_ResetLatency(struct BufferedUart *uart, struct BufferedUartLatency *latency);
+uint32_t BufferedUart_GetPercentile(const struct BufferedUartHistogram *histogram, unsigned int percent);
+#endif
+
+#ifdef BUFFERED_UART_TRACE
+HAL_StatusTypeDef BufferedUart_SetTrace(struct BufferedUart *uart, void *buffer, unsigned int size);
+unsigned int BufferedUart_TraceRead(struct BufferedUart *uart, void *data, unsigned int maximumLength);
+#endif
 
 #ifndef BUFFERED_UART_PROVIDE_HAL_UART_TxCpltCallback
 	/// this function must be called if USE_HAL_UART_REGISTER_CALLBACKS==0
@@ -0,0 +1,478 @@
+/**
+
+stm32_buffered_uart_frame
+streaming COBS/SLIP framing on top of the ring buffers of stm32_buffered_uart
+
+
+MIT License
+
+Copyright (c) 2022 Jonas Rahlf
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "stm32_buffered_uart_frame.h"
+#include <string.h>
+
+#define COBS_DELIMITER ((char)0x00)
+#define COBS_MAX_CODE (0xFF)
+
+#define SLIP_END ((char)0xC0)
+#define SLIP_ESC ((char)0xDB)
+#define SLIP_ESC_END ((char)0xDC)
+#define SLIP_ESC_ESC ((char)0xDD)
+
+#define FRAME_INVALID (0xFFFFFFFFU)
+
+#ifdef BUFFERED_UART_FRAME_CRC16
+	#define FRAME_CRC_SIZE (2)
+#else
+	#define FRAME_CRC_SIZE (0)
+#endif
+
+/// CRC-16/CCITT-FALSE, polynomial 0x1021
+static const uint16_t s_crc16Table[256] = {
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+	0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+	0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+	0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+	0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+	0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+	0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+	0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+	0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+	0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+	0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+	0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+	0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+	0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+	0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+	0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+	0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+	0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+	0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+	0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+	0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+	0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+	0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+	0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+	0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+	0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+	0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+	0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+	0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+	0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+	0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+	0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
+};
+
+/// sequential writer over the (up to two) spans of a tx queue reservation
+struct FrameWriter {
+	char * position;
+	char * end;
+	struct BufferedUartSpan next;
+	unsigned int written;
+};
+
+static inline char * FrameWriter_Put(struct FrameWriter * writer, char byte)
+{
+	if (writer->position == writer->end) {
+		writer->position = writer->next.data;
+		writer->end = writer->next.data + writer->next.length;
+	}
+
+	char * position = writer->position++;
+	*position = byte;
+	writer->written++;
+	return position;
+}
+
+struct CobsEncoder {
+	struct FrameWriter writer;
+	char * code;			// placeholder of the code byte of the current block
+	unsigned int count;		// code of the current block: number of its data bytes + 1
+};
+
+static inline void CobsEncoder_Put(struct CobsEncoder * encoder, uint8_t byte)
+{
+	if (byte != 0) {
+		FrameWriter_Put(&encoder->writer, (char)byte);
+		encoder->count++;
+		if (encoder->count < COBS_MAX_CODE) {
+			return;
+		}
+	}
+
+	// a zero (or a full block) ends the current block
+	*encoder->code = (char)encoder->count;
+	encoder->code = FrameWriter_Put(&encoder->writer, 0);
+	encoder->count = 1;
+}
+
+static inline void SlipEncoder_Put(struct FrameWriter * writer, char byte)
+{
+	if (byte == SLIP_END) {
+		FrameWriter_Put(writer, SLIP_ESC);
+		FrameWriter_Put(writer, SLIP_ESC_END);
+	} else if (byte == SLIP_ESC) {
+		FrameWriter_Put(writer, SLIP_ESC);
+		FrameWriter_Put(writer, SLIP_ESC_ESC);
+	} else {
+		FrameWriter_Put(writer, byte);
+	}
+}
+
+static inline char BufferedUartFrame_GetDelimiter(enum BufferedUartFrameEncoding encoding)
+{
+	return encoding == BUFFERED_UART_FRAME_COBS ? COBS_DELIMITER : SLIP_END;
+}
+
+/// decode a COBS frame (without delimiter), data and output may be the same buffer
+static unsigned int BufferedUartFrame_DecodeCobs(char * output, const char * data, unsigned int length)
+{
+	unsigned int in = 0;
+	unsigned int out = 0;
+
+	while (in < length) {
+		unsigned int code = (uint8_t)data[in++];
+		unsigned int blockLength = code - 1;
+		if (code == 0 || blockLength > length - in) {
+			return FRAME_INVALID;
+		}
+
+		// the output is always at least one byte behind the input
+		memmove(output + out, data + in, blockLength);
+		out += blockLength;
+		in += blockLength;
+		if (code != COBS_MAX_CODE && in < length) {
+			output[out++] = 0;
+		}
+	}
+
+	return out;
+}
+
+/// decode a SLIP frame (without delimiter), data and output may be the same buffer
+static unsigned int BufferedUartFrame_DecodeSlip(char * output, const char * data, unsigned int length)
+{
+	unsigned int in = 0;
+	unsigned int out = 0;
+
+	while (in < length) {
+		const char * escape = memchr(data + in, SLIP_ESC, length - in);
+		unsigned int plainLength = escape != NULL ? (unsigned int)(escape - (data + in)) : length - in;
+		memmove(output + out, data + in, plainLength);
+		out += plainLength;
+		in += plainLength;
+		if (escape == NULL) {
+			break;
+		}
+
+		in++;
+		if (in == length) {
+			return FRAME_INVALID;
+		}
+		char escaped = data[in++];
+		if (escaped == SLIP_ESC_END) {
+			output[out++] = SLIP_END;
+		} else if (escaped == SLIP_ESC_ESC) {
+			output[out++] = SLIP_ESC;
+		} else {
+			return FRAME_INVALID;
+		}
+	}
+
+	return out;
+}
+
+/// offset of the first delimiter at or after offset in the readable region, first->length + second->length if there is none
+static unsigned int BufferedUartFrame_FindDelimiter(const struct BufferedUartSpan * first, const struct BufferedUartSpan * second, unsigned int offset, char delimiter)
+{
+	if (offset < first->length) {
+		const char * found = memchr(first->data + offset, delimiter, first->length - offset);
+		if (found != NULL) {
+			return (unsigned int)(found - first->data);
+		}
+		offset = first->length;
+	}
+
+	unsigned int secondOffset = offset - first->length;
+	if (secondOffset < second->length) {
+		const char * found = memchr(second->data + secondOffset, delimiter, second->length - secondOffset);
+		if (found != NULL) {
+			return first->length + (unsigned int)(found - second->data);
+		}
+	}
+
+	return first->length + second->length;
+}
+
+static void BufferedUartFrame_Discard(struct BufferedUartFrameDecoder * decoder)
+{
+	if (!decoder->discarding) {
+		decoder->discarding = true;
+		decoder->discardedFrames++;
+	}
+}
+
+/**
+ * Initialize a frame decoder which reads from the rx queue of uart
+ * The buffered uart must not be read by other means (Dequeue, RxPeek, DataReceivedHandler which
+ * handles data) while the decoder is used.
+ * @param[in]	decoder
+ * @param[in]	uart		initialized buffered uart
+ * @param[in]	encoding
+ * @param[in]	buffer		frames which wrap around the end of the rx buffer are copied here before
+ * 							they are decoded. Should hold the largest encoded frame, larger frames which
+ * 							wrap around are discarded
+ * @param[in]	bufferSize
+ * @return		HAL_StatusTypeDef
+ */
+HAL_StatusTypeDef BufferedUartFrame_InitDecoder(struct BufferedUartFrameDecoder *decoder, struct BufferedUart *uart, enum BufferedUartFrameEncoding encoding, void *buffer, unsigned int bufferSize)
+{
+	if (decoder == NULL || uart == NULL || (buffer == NULL && bufferSize > 0)) {
+		return HAL_ERROR;
+	}
+
+	memset(decoder, 0, sizeof(*decoder));
+	decoder->uart = uart;
+	decoder->encoding = encoding;
+	decoder->buffer = buffer;
+	decoder->bufferSize = bufferSize;
+	decoder->rxDroppedBytes = uart->rxDroppedBytes;
+
+	return HAL_OK;
+}
+
+/**
+ * Get the next complete frame from the rx queue
+ * Bytes which were searched for the frame delimiter before are not searched again. A frame which is
+ * contiguous in the rx buffer is decoded in place and returned without copying it, otherwise it is
+ * decoded in the buffer of the decoder (always with BUFFERED_UART_DCACHE, frames longer than the buffer
+ * are then discarded). Empty, invalid and discarded frames are skipped.
+ * The frame stays valid until @ref BufferedUartFrame_Release or the next call of this function
+ * (which releases the previous frame).
+ * @param[in]	decoder
+ * @param[out]	frame		decoded payload (without CRC)
+ * @return		unsigned int	length of the frame, 0 if there is no complete frame yet
+ */
+unsigned int BufferedUartFrame_Receive(struct BufferedUartFrameDecoder *decoder, const char **frame)
+{
+	struct BufferedUart * uart = decoder->uart;
+	char delimiter = BufferedUartFrame_GetDelimiter(decoder->encoding);
+
+	BufferedUartFrame_Release(decoder);
+
+	for (;;) {
+		struct BufferedUartSpan first;
+		struct BufferedUartSpan second;
+		unsigned int available = BufferedUart_RxPeek(uart, &first, &second);
+
+		if (uart->rxDroppedBytes != decoder->rxDroppedBytes) {
+			// the DMA overwrote unread data, the scanned bytes are gone and the current frame is incomplete
+			decoder->rxDroppedBytes = uart->rxDroppedBytes;
+			decoder->scanned = 0;
+			BufferedUartFrame_Discard(decoder);
+		}
+
+		unsigned int end = BufferedUartFrame_FindDelimiter(&first, &second, decoder->scanned, delimiter);
+		if (end == available) {
+			if (decoder->discarding || available == uart->rxqueue.length) {
+				// free the space, the frame can not be completed (any more)
+				BufferedUartFrame_Discard(decoder);
+				BufferedUart_RxConsume(uart, available);
+				decoder->scanned = 0;
+				return 0;
+			}
+
+			decoder->scanned = available;
+			return 0;
+		}
+
+		decoder->scanned = 0;
+		decoder->frameLength = end + 1;
+		if (decoder->discarding || end == 0) {
+			// rest of a discarded frame or empty frame
+			decoder->discarding = false;
+			BufferedUartFrame_Release(decoder);
+			continue;
+		}
+
+		char * data;
+		const char * encoded;
+#ifndef BUFFERED_UART_DCACHE
+		if (end <= first.length) {
+			data = first.data;
+			encoded = data;
+		} else
+#endif
+		if (end <= decoder->bufferSize) {
+			data = decoder->buffer;
+			if (end <= first.length) {
+				// with BUFFERED_UART_DCACHE the rx buffer is not written, its next invalidation could discard the frame
+				encoded = first.data;
+			} else {
+				memcpy(data, first.data, first.length);
+				memcpy(data + first.length, second.data, end - first.length);
+				encoded = data;
+			}
+		} else {
+			decoder->discardedFrames++;
+			BufferedUartFrame_Release(decoder);
+			continue;
+		}
+
+		unsigned int length;
+		if (decoder->encoding == BUFFERED_UART_FRAME_COBS) {
+			length = BufferedUartFrame_DecodeCobs(data, encoded, end);
+		} else {
+			length = BufferedUartFrame_DecodeSlip(data, encoded, end);
+		}
+#ifdef BUFFERED_UART_FRAME_CRC16
+		// the CRC over the payload followed by its CRC is 0
+		if (length != FRAME_INVALID && (length < FRAME_CRC_SIZE || BufferedUartFrame_Crc16(0xFFFF, data, length) != 0)) {
+			length = FRAME_INVALID;
+		}
+#endif
+		if (length == FRAME_INVALID) {
+			decoder->invalidFrames++;
+			BufferedUartFrame_Release(decoder);
+			continue;
+		}
+		if (length == FRAME_CRC_SIZE) {
+			BufferedUartFrame_Release(decoder);
+			continue;
+		}
+
+		decoder->frames++;
+		*frame = data;
+		return length - FRAME_CRC_SIZE;
+	}
+}
+
+/**
+ * Release the frame returned by @ref BufferedUartFrame_Receive, its space in the rx queue is freed
+ * @param[in]	decoder
+ */
+void BufferedUartFrame_Release(struct BufferedUartFrameDecoder *decoder)
+{
+	if (decoder->frameLength > 0) {
+		BufferedUart_RxConsume(decoder->uart, decoder->frameLength);
+		decoder->frameLength = 0;
+	}
+}
+
+/**
+ * Maximum number of bytes a frame with length bytes of payload occupies on the wire
+ */
+unsigned int BufferedUartFrame_GetMaxEncodedLength(enum BufferedUartFrameEncoding encoding, unsigned int length)
+{
+	length += FRAME_CRC_SIZE;
+	if (encoding == BUFFERED_UART_FRAME_COBS) {
+		// one code byte per started block of 254 bytes and the delimiter
+		return length + length / (COBS_MAX_CODE - 1) + 2;
+	}
+	// every byte may be escaped, END in front (flushes line noise at the receiver) and at the end
+	return 2 * length + 2;
+}
+
+/**
+ * Encode data as one frame directly into the tx queue and send it
+ * Space for the worst case encoded length (see @ref BufferedUartFrame_GetMaxEncodedLength) is
+ * reserved, only the actually encoded bytes are sent.
+ * @note uses @ref BufferedUart_TxReserve, so it must not be called from several contexts concurrently
+ * @param[in]	uart
+ * @param[in]	encoding
+ * @param[in]	data		payload
+ * @param[in]	length
+ * @return		HAL_StatusTypeDef	HAL_BUSY if there is not enough space in the tx queue
+ */
+HAL_StatusTypeDef BufferedUartFrame_Transmit(struct BufferedUart *uart, enum BufferedUartFrameEncoding encoding, const void *data, unsigned int length)
+{
+	const uint8_t * bytes = data;
+	unsigned int maxLength = BufferedUartFrame_GetMaxEncodedLength(encoding, length);
+	struct BufferedUartSpan first;
+	struct BufferedUartSpan second;
+	HAL_StatusTypeDef status = BufferedUart_TxReserve(uart, maxLength, &first, &second);
+	if (status != HAL_OK) {
+		return status;
+	}
+
+	struct FrameWriter writer = { first.data, first.data + first.length, second, 0 };
+#ifdef BUFFERED_UART_FRAME_CRC16
+	uint16_t crc = BufferedUartFrame_Crc16(0xFFFF, data, length);
+	uint8_t crcBytes[FRAME_CRC_SIZE] = { (uint8_t)(crc >> 8), (uint8_t)crc };
+#endif
+
+	if (encoding == BUFFERED_UART_FRAME_COBS) {
+		struct CobsEncoder encoder;
+		encoder.writer = writer;
+		encoder.code = FrameWriter_Put(&encoder.writer, 0);
+		encoder.count = 1;
+		for (unsigned int i = 0; i < length; i++) {
+			CobsEncoder_Put(&encoder, bytes[i]);
+		}
+#ifdef BUFFERED_UART_FRAME_CRC16
+		CobsEncoder_Put(&encoder, crcBytes[0]);
+		CobsEncoder_Put(&encoder, crcBytes[1]);
+#endif
+		*encoder.code = (char)encoder.count;
+		FrameWriter_Put(&encoder.writer, COBS_DELIMITER);
+		writer = encoder.writer;
+	} else {
+		FrameWriter_Put(&writer, SLIP_END);
+		for (unsigned int i = 0; i < length; i++) {
+			SlipEncoder_Put(&writer, (char)bytes[i]);
+		}
+#ifdef BUFFERED_UART_FRAME_CRC16
+		SlipEncoder_Put(&writer, (char)crcBytes[0]);
+		SlipEncoder_Put(&writer, (char)crcBytes[1]);
+#endif
+		FrameWriter_Put(&writer, SLIP_END);
+	}
+
+	status = BufferedUart_TxCommit(uart, writer.written);
+	if (status != HAL_OK) {
+		// BUFFERED_UART_LOCKFREE: the reservation can not be shortened any more, fill it with empty frames
+		char delimiter = BufferedUartFrame_GetDelimiter(encoding);
+		while (writer.written < maxLength) {
+			FrameWriter_Put(&writer, delimiter);
+		}
+		status = BufferedUart_TxCommit(uart, maxLength);
+	}
+
+	return status;
+}
+
+/**
+ * Table driven CRC-16/CCITT-FALSE (polynomial 0x1021, not reflected, start with 0xFFFF, no final xor)
+ * @param[in]	crc		0xFFFF or the result of the previous call to continue the calculation
+ * @param[in]	data
+ * @param[in]	length
+ * @return		uint16_t
+ */
+uint16_t BufferedUartFrame_Crc16(uint16_t crc, const void *data, unsigned int length)
+{
+	const uint8_t * bytes = data;
+	for (unsigned int i = 0; i < length; i++) {
+		crc = (uint16_t)((crc << 8) ^ s_crc16Table[(uint8_t)((crc >> 8) ^ bytes[i])]);
+	}
+	return crc;
+}
@@ -0,0 +1,83 @@
+/**
+
+stm32_buffered_uart_frame
+streaming COBS/SLIP framing on top of the ring buffers of stm32_buffered_uart
+
+The decoder scans the rx queue incrementally (bytes are searched for the frame delimiter only
+once) and decodes complete frames in place, so frames which are contiguous in the rx buffer are
+delivered without copying them. The encoder writes directly into the tx queue.
+
+
+MIT License
+
+Copyright (c) 2022 Jonas Rahlf
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "stm32_buffered_uart.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/// ==== configuration options ====
+
+// define BUFFERED_UART_FRAME_CRC16 to protect every frame with a CRC-16/CCITT-FALSE (table driven)
+// the encoder appends it to the payload before encoding, the decoder drops frames with a wrong CRC
+// default off
+//#define BUFFERED_UART_FRAME_CRC16
+
+/// ==== end configuration options ====
+
+enum BufferedUartFrameEncoding {
+	BUFFERED_UART_FRAME_COBS,		// consistent overhead byte stuffing, frames are delimited by 0x00
+	BUFFERED_UART_FRAME_SLIP		// RFC 1055, frames are delimited by 0xC0
+};
+
+struct BufferedUartFrameDecoder {
+	struct BufferedUart * uart;
+	enum BufferedUartFrameEncoding encoding;
+	char * buffer;					// frames which wrap around the end of the rx buffer (all frames with BUFFERED_UART_DCACHE) are decoded here
+	unsigned int bufferSize;
+	unsigned int scanned;			// bytes after the rx tail which are known to contain no delimiter
+	unsigned int frameLength;		// encoded length (including the delimiter) of the frame handed out last
+	unsigned int rxDroppedBytes;	// rxDroppedBytes of the uart at the last scan
+	bool discarding;				// the start of the current frame was lost, skip it up to the next delimiter
+	unsigned int frames;
+	unsigned int invalidFrames;		// frames with an encoding or CRC error
+	unsigned int discardedFrames;	// frames which were too long or partially overwritten
+};
+
+HAL_StatusTypeDef BufferedUartFrame_InitDecoder(struct BufferedUartFrameDecoder *decoder, struct BufferedUart *uart, enum BufferedUartFrameEncoding encoding, void *buffer, unsigned int bufferSize);
+unsigned int BufferedUartFrame_Receive(struct BufferedUartFrameDecoder *decoder, const char **frame);
+void BufferedUartFrame_Release(struct BufferedUartFrameDecoder *decoder);
+HAL_StatusTypeDef BufferedUartFrame_Transmit(struct BufferedUart *uart, enum BufferedUartFrameEncoding encoding, const void *data, unsigned int length);
+unsigned int BufferedUartFrame_GetMaxEncodedLength(enum BufferedUartFrameEncoding encoding, unsigned int length);
+uint16_t BufferedUartFrame_Crc16(uint16_t crc, const void *data, unsigned int length);
+
+
+#ifdef __cplusplus
+}
+#endif
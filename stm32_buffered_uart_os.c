@@ -0,0 +1,184 @@
+/**
+
+stm32_buffered_uart_os
+operating system backends for the blocking BufferedUart_Read and BufferedUart_Write
+
+
+MIT License
+
+Copyright (c) 2022 Jonas Rahlf
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "stm32_buffered_uart.h"
+
+#ifdef BUFFERED_UART_OS
+
+#if defined(BUFFERED_UART_OS_FREERTOS)
+
+#include "task.h"
+
+void BufferedUartOs_EventInit(struct BufferedUartOsEvent *event)
+{
+	event->semaphore = xSemaphoreCreateBinaryStatic(&event->semaphoreBuffer);
+}
+
+void BufferedUartOs_EventDeInit(struct BufferedUartOsEvent *event)
+{
+	vSemaphoreDelete(event->semaphore);
+}
+
+/// from interrupt or task context
+void BufferedUartOs_EventSignal(struct BufferedUartOsEvent *event)
+{
+	if (__get_IPSR() != 0) {
+		BaseType_t higherPriorityTaskWoken = pdFALSE;
+		xSemaphoreGiveFromISR(event->semaphore, &higherPriorityTaskWoken);
+		portYIELD_FROM_ISR(higherPriorityTaskWoken);
+	} else {
+		xSemaphoreGive(event->semaphore);
+	}
+}
+
+/// false on timeout
+bool BufferedUartOs_EventWait(struct BufferedUartOsEvent *event, uint32_t timeoutMs)
+{
+	TickType_t ticks = timeoutMs == BUFFERED_UART_OS_WAIT_FOREVER ? portMAX_DELAY : pdMS_TO_TICKS(timeoutMs);
+	return xSemaphoreTake(event->semaphore, ticks) == pdTRUE;
+}
+
+/// portTICK_PERIOD_MS is 0 for tick rates above 1 kHz and truncated for rates which do not divide 1000
+uint32_t BufferedUartOs_GetTickMs(void)
+{
+	return (uint32_t)(((uint64_t)xTaskGetTickCount() * 1000U) / configTICK_RATE_HZ);
+}
+
+#elif defined(BUFFERED_UART_OS_PTHREAD)
+
+#include <errno.h>
+#include <time.h>
+
+// the driver expects thread code to be preempted by interrupts, never to run in parallel with them.
+// So the application threads and the simulated interrupts take turns on one "core": an application
+// thread holds it while it runs, the interrupts only run while no application thread does
+static pthread_mutex_t s_core = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_idle = PTHREAD_COND_INITIALIZER;
+static unsigned int s_runningThreads;
+
+/// take the core, for application threads before they use a buffered uart
+void BufferedUartOs_ThreadEnter(void)
+{
+	pthread_mutex_lock(&s_core);
+	s_runningThreads++;
+}
+
+/// release the core, e.g. before the thread ends
+void BufferedUartOs_ThreadExit(void)
+{
+	s_runningThreads--;
+	pthread_cond_broadcast(&s_idle);
+	pthread_mutex_unlock(&s_core);
+}
+
+/// take the core once no application thread runs, for the context which simulates the interrupts
+void BufferedUartOs_InterruptEnter(void)
+{
+	pthread_mutex_lock(&s_core);
+	while (s_runningThreads > 0) {
+		pthread_cond_wait(&s_idle, &s_core);
+	}
+}
+
+void BufferedUartOs_InterruptExit(void)
+{
+	pthread_mutex_unlock(&s_core);
+}
+
+void BufferedUartOs_EventInit(struct BufferedUartOsEvent *event)
+{
+	pthread_condattr_t attributes;
+	pthread_condattr_init(&attributes);
+	pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+	pthread_cond_init(&event->condition, &attributes);
+	pthread_condattr_destroy(&attributes);
+	event->signaled = false;
+	event->waiting = false;
+}
+
+void BufferedUartOs_EventDeInit(struct BufferedUartOsEvent *event)
+{
+	pthread_cond_destroy(&event->condition);
+}
+
+/// with the core held
+void BufferedUartOs_EventSignal(struct BufferedUartOsEvent *event)
+{
+	if (event->waiting) {
+		// the woken thread counts as running right away, the interrupts must not go on without it
+		event->waiting = false;
+		s_runningThreads++;
+	}
+	event->signaled = true;
+	pthread_cond_signal(&event->condition);
+}
+
+/// with the core held, releases it while waiting. False on timeout
+bool BufferedUartOs_EventWait(struct BufferedUartOsEvent *event, uint32_t timeoutMs)
+{
+	if (!event->signaled) {
+		struct timespec deadline;
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += timeoutMs / 1000U;
+		deadline.tv_nsec += (long)(timeoutMs % 1000U) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+
+		event->waiting = true;
+		s_runningThreads--;
+		pthread_cond_broadcast(&s_idle);
+		while (event->waiting) {
+			int result = timeoutMs == BUFFERED_UART_OS_WAIT_FOREVER
+					? pthread_cond_wait(&event->condition, &s_core)
+					: pthread_cond_timedwait(&event->condition, &s_core, &deadline);
+			if (result == ETIMEDOUT && event->waiting) {
+				event->waiting = false;
+				s_runningThreads++;
+			}
+		}
+	}
+
+	bool signaled = event->signaled;
+	event->signaled = false;
+	return signaled;
+}
+
+uint32_t BufferedUartOs_GetTickMs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint32_t)((uint64_t)now.tv_sec * 1000U + (uint64_t)now.tv_nsec / 1000000U);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,86 @@
+/**
+
+stm32_buffered_uart_os
+operating system backends for the blocking BufferedUart_Read and BufferedUart_Write
+
+A backend provides a binary event per direction and buffered uart: the rx/tx interrupts of the driver
+signal it once enough data or space is available for the waiting thread, which sleeps in between.
+Select the backend in stm32_buffered_uart.h (or via the build system):
+- BUFFERED_UART_OS_FREERTOS: statically allocated binary semaphores (configSUPPORT_STATIC_ALLOCATION)
+- BUFFERED_UART_OS_PTHREAD: condition variables, for the host simulation. The threads which use buffered
+  uarts run one at a time like tasks on one core (see BufferedUartOs_ThreadEnter)
+
+
+MIT License
+
+Copyright (c) 2022 Jonas Rahlf
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#if defined(BUFFERED_UART_OS_FREERTOS)
+#include "FreeRTOS.h"
+#include "semphr.h"
+#elif defined(BUFFERED_UART_OS_PTHREAD)
+#include <pthread.h>
+#else
+#error "stm32_buffered_uart_os.h requires BUFFERED_UART_OS_FREERTOS or BUFFERED_UART_OS_PTHREAD"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BUFFERED_UART_OS_WAIT_FOREVER (0xFFFFFFFFU)
+
+/// binary event, signaled from interrupts (or threads), waited for by one thread at a time
+struct BufferedUartOsEvent {
+#if defined(BUFFERED_UART_OS_FREERTOS)
+	SemaphoreHandle_t semaphore;
+	StaticSemaphore_t semaphoreBuffer;
+#elif defined(BUFFERED_UART_OS_PTHREAD)
+	pthread_cond_t condition;
+	bool signaled;
+	bool waiting;
+#endif
+};
+
+void BufferedUartOs_EventInit(struct BufferedUartOsEvent *event);
+void BufferedUartOs_EventDeInit(struct BufferedUartOsEvent *event);
+void BufferedUartOs_EventSignal(struct BufferedUartOsEvent *event);
+bool BufferedUartOs_EventWait(struct BufferedUartOsEvent *event, uint32_t timeoutMs);
+uint32_t BufferedUartOs_GetTickMs(void);
+
+#ifdef BUFFERED_UART_OS_PTHREAD
+void BufferedUartOs_ThreadEnter(void);
+void BufferedUartOs_ThreadExit(void);
+void BufferedUartOs_InterruptEnter(void);
+void BufferedUartOs_InterruptExit(void);
+#endif
+
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,577 @@
+/**
+
+stm32_buffered_uart_printf
+formatted transmission which renders directly into the tx queue of stm32_buffered_uart
+
+
+MIT License
+
+Copyright (c) 2022 Jonas Rahlf
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#include "stm32_buffered_uart_printf.h"
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define FMT_MAX_PRECISION (9)
+#define FMT_DEFAULT_PRECISION (6)
+#define FMT_MAX_DIGITS (20)
+#define FMT_INVALID (0xFFFFFFFFU)
+
+/// conversion specification, e.g. %-08lx
+struct FmtSpec {
+	char conversion;
+	bool left;			// '-'
+	bool zero;			// '0'
+	bool plus;			// '+'
+	unsigned int width;
+	int precision;		// -1 if none
+	char length;		// 'H' for hh, 'h', 'l', 'L' for ll, 'z', 0 if none
+};
+
+/// one conversion with its argument, laid out as padding, prefix, zeros, body (text or digits), padding
+struct FmtField {
+	bool left;
+	unsigned int padding;
+	char prefix[2];				// sign or "0x"
+	unsigned int prefixLength;
+	unsigned int zeros;
+	const char * text;			// body of %c %s %% and of non-finite %f, NULL for numbers
+	unsigned int textLength;
+	char character;				// text of %c
+	uint64_t value;				// %f scaled by 10^fraction
+	bool hex;
+	bool upper;
+	unsigned int digits;
+	unsigned int fraction;		// digits behind the point of %f, 0 if there is no point
+	const char * next;			// format behind the conversion
+};
+
+/// sequential writer over the (up to two) spans of a tx queue reservation
+struct FmtWriter {
+	char * position;
+	char * end;
+	struct BufferedUartSpan next;
+};
+
+static const uint64_t s_powersOf10[FMT_MAX_DIGITS] = {
+	1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL,
+	100000ULL, 1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL,
+	10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL, 100000000000000ULL,
+	1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+static const char s_digitPairs[200] =
+	"0001020304050607080910111213141516171819"
+	"2021222324252627282930313233343536373839"
+	"4041424344454647484950515253545556575859"
+	"6061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+// the pieces are a few bytes long, byte loops are faster than calls of memcpy and memset
+static void FmtWriter_Write(struct FmtWriter * writer, const char * data, unsigned int length)
+{
+	char * position = writer->position;
+	while (length-- > 0) {
+		if (position == writer->end) {
+			// wrap around of the ring buffer
+			position = writer->next.data;
+			writer->end = writer->next.data + writer->next.length;
+		}
+		*position++ = *data++;
+	}
+	writer->position = position;
+}
+
+static void FmtWriter_Fill(struct FmtWriter * writer, char character, unsigned int count)
+{
+	char * position = writer->position;
+	while (count-- > 0) {
+		if (position == writer->end) {
+			position = writer->next.data;
+			writer->end = writer->next.data + writer->next.length;
+		}
+		*position++ = character;
+	}
+	writer->position = position;
+}
+
+/// end of the literal text at the start of format, the next '%' or the terminator
+static const char * Fmt_FindConversion(const char * format)
+{
+	while (*format != '%' && *format != '\0') {
+		format++;
+	}
+	return format;
+}
+
+static unsigned int Fmt_DecimalDigits(uint64_t value)
+{
+	unsigned int digits = 1;
+	while (digits < FMT_MAX_DIGITS && value >= s_powersOf10[digits]) {
+		digits++;
+	}
+	return digits;
+}
+
+static unsigned int Fmt_HexDigits(uint64_t value)
+{
+	unsigned int digits = 1;
+	for (value >>= 4; value != 0; value >>= 4) {
+		digits++;
+	}
+	return digits;
+}
+
+/// digits decimal digits of value in front of end, with leading zeros. Two digits per division
+static void Fmt_RenderDecimal(char * end, uint64_t value, unsigned int digits)
+{
+	// 64 bit divisions are library calls on a Cortex-M, only the part beyond 32 bits uses them
+	while (value > UINT32_MAX) {
+		uint64_t quotient = value / 10;
+		*--end = (char)('0' + (unsigned int)(value - quotient * 10));
+		value = quotient;
+		digits--;
+	}
+
+	uint32_t small = (uint32_t)value;
+	while (digits >= 2) {
+		uint32_t quotient = small / 100;
+		end -= 2;
+		memcpy(end, &s_digitPairs[2 * (small - quotient * 100)], 2);
+		small = quotient;
+		digits -= 2;
+	}
+	if (digits > 0) {
+		*--end = (char)('0' + small % 10);
+	}
+}
+
+static void Fmt_RenderHex(char * end, uint64_t value, unsigned int digits, bool upper)
+{
+	const char * hex = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+	while (digits-- > 0) {
+		*--end = hex[value & 0xF];
+		value >>= 4;
+	}
+}
+
+/// parse the conversion specification behind a '%', the '*' width and precision are taken from the arguments
+static void Fmt_ParseSpec(const char ** format, va_list * arguments, struct FmtSpec * spec)
+{
+	const char * f = *format;
+	spec->left = false;
+	spec->zero = false;
+	spec->plus = false;
+	spec->width = 0;
+	spec->precision = -1;
+	spec->length = 0;
+
+	for (;; f++) {
+		if (*f == '-') {
+			spec->left = true;
+		} else if (*f == '0') {
+			spec->zero = true;
+		} else if (*f == '+') {
+			spec->plus = true;
+		} else {
+			break;
+		}
+	}
+
+	if (*f == '*') {
+		int width = va_arg(*arguments, int);
+		if (width < 0) {
+			spec->left = true;
+			width = -width;
+		}
+		spec->width = (unsigned int)width;
+		f++;
+	} else {
+		while (*f >= '0' && *f <= '9') {
+			spec->width = spec->width * 10 + (unsigned int)(*f++ - '0');
+		}
+	}
+
+	if (*f == '.') {
+		f++;
+		if (*f == '*') {
+			int precision = va_arg(*arguments, int);
+			spec->precision = precision < 0 ? -1 : precision;
+			f++;
+		} else {
+			spec->precision = 0;
+			while (*f >= '0' && *f <= '9') {
+				spec->precision = spec->precision * 10 + (*f++ - '0');
+			}
+		}
+	}
+
+	if (*f == 'h' || *f == 'l') {
+		spec->length = *f++;
+		if (*f == spec->length) {
+			spec->length = spec->length == 'h' ? 'H' : 'L';
+			f++;
+		}
+	} else if (*f == 'z') {
+		spec->length = *f++;
+	}
+
+	spec->conversion = *f;
+	if (*f != '\0') {
+		f++;
+	}
+	*format = f;
+}
+
+static int64_t Fmt_GetSigned(va_list * arguments, char length)
+{
+	switch (length) {
+	case 'H':
+		return (signed char)va_arg(*arguments, int);
+	case 'h':
+		return (short)va_arg(*arguments, int);
+	case 'l':
+		return va_arg(*arguments, long);
+	case 'L':
+		return va_arg(*arguments, long long);
+	case 'z':
+		return va_arg(*arguments, ptrdiff_t);
+	default:
+		return va_arg(*arguments, int);
+	}
+}
+
+static uint64_t Fmt_GetUnsigned(va_list * arguments, char length)
+{
+	switch (length) {
+	case 'H':
+		return (unsigned char)va_arg(*arguments, unsigned int);
+	case 'h':
+		return (unsigned short)va_arg(*arguments, unsigned int);
+	case 'l':
+		return va_arg(*arguments, unsigned long);
+	case 'L':
+		return va_arg(*arguments, unsigned long long);
+	case 'z':
+		return va_arg(*arguments, size_t);
+	default:
+		return va_arg(*arguments, unsigned int);
+	}
+}
+
+/// %f as fixed-point number, false if it is not finite or too large
+static bool Fmt_GetFixed(struct FmtField * field, double value, int precision)
+{
+	unsigned int fraction = precision < 0 ? FMT_DEFAULT_PRECISION : (unsigned int)precision;
+	if (fraction > FMT_MAX_PRECISION) {
+		fraction = FMT_MAX_PRECISION;
+	}
+
+	if (isnan(value)) {
+		field->text = "nan";
+		field->textLength = 3;
+		return false;
+	}
+	double scaled = fabs(value) * (double)s_powersOf10[fraction] + 0.5;
+	if (!(scaled < 1.8e19)) {
+		field->text = isinf(value) ? "inf" : "ovf";
+		field->textLength = 3;
+		return false;
+	}
+
+	field->value = (uint64_t)scaled;
+	field->fraction = fraction;
+	return true;
+}
+
+/**
+ * Parse the conversion behind a '%' and take its argument
+ * @return	false if the conversion is not supported
+ */
+static bool Fmt_GetField(const char ** format, va_list * arguments, struct FmtField * field)
+{
+	struct FmtSpec spec;
+	Fmt_ParseSpec(format, arguments, &spec);
+
+	field->padding = 0;
+	field->prefixLength = 0;
+	field->zeros = 0;
+	field->text = NULL;
+	field->value = 0;
+	field->hex = false;
+	field->upper = false;
+	field->fraction = 0;
+	bool negative = false;
+	bool sign = false;
+
+	switch (spec.conversion) {
+	case 'd':
+	case 'i': {
+		int64_t value = Fmt_GetSigned(arguments, spec.length);
+		negative = value < 0;
+		field->value = negative ? 0 - (uint64_t)value : (uint64_t)value;
+		sign = true;
+		break;
+	}
+	case 'u':
+		field->value = Fmt_GetUnsigned(arguments, spec.length);
+		break;
+	case 'x':
+	case 'X':
+		field->value = Fmt_GetUnsigned(arguments, spec.length);
+		field->hex = true;
+		field->upper = spec.conversion == 'X';
+		break;
+	case 'p':
+		field->value = (uintptr_t)va_arg(*arguments, void *);
+		field->hex = true;
+		field->prefix[0] = '0';
+		field->prefix[1] = 'x';
+		field->prefixLength = 2;
+		break;
+	case 'f': {
+		double value = va_arg(*arguments, double);
+		negative = signbit(value);
+		sign = true;
+		Fmt_GetFixed(field, value, spec.precision);
+		// the precision is the number of fraction digits, not the minimum number of digits
+		spec.precision = -1;
+		break;
+	}
+	case 'c':
+		field->character = (char)va_arg(*arguments, int);
+		field->text = &field->character;
+		field->textLength = 1;
+		break;
+	case 's': {
+		const char * string = va_arg(*arguments, const char *);
+		if (string == NULL) {
+			string = "(null)";
+		}
+		field->text = string;
+		if (spec.precision >= 0) {
+			// a string with known length does not have to be zero terminated
+			const char * end = memchr(string, '\0', (size_t)spec.precision);
+			field->textLength = end != NULL ? (unsigned int)(end - string) : (unsigned int)spec.precision;
+		} else {
+			field->textLength = strlen(string);
+		}
+		break;
+	}
+	case '%':
+		field->text = "%";
+		field->textLength = 1;
+		break;
+	default:
+		return false;
+	}
+
+	if (negative) {
+		field->prefix[0] = '-';
+		field->prefixLength = 1;
+	} else if (sign && spec.plus) {
+		field->prefix[0] = '+';
+		field->prefixLength = 1;
+	}
+
+	unsigned int bodyLength;
+	if (field->text != NULL) {
+		bodyLength = field->textLength;
+	} else {
+		field->digits = field->hex ? Fmt_HexDigits(field->value) : Fmt_DecimalDigits(field->value);
+		if (field->digits <= field->fraction) {
+			// at least one digit in front of the point
+			field->digits = field->fraction + 1;
+		}
+		if (spec.precision >= 0) {
+			if ((unsigned int)spec.precision > field->digits) {
+				field->zeros = (unsigned int)spec.precision - field->digits;
+			} else if (spec.precision == 0 && field->value == 0) {
+				field->digits = 0;
+			}
+		}
+		bodyLength = field->digits + (field->fraction > 0 ? 1 : 0);
+	}
+
+	unsigned int length = field->prefixLength + field->zeros + bodyLength;
+	if (spec.width > length) {
+		if (spec.zero && !spec.left && field->text == NULL && spec.precision < 0) {
+			field->zeros += spec.width - length;
+		} else {
+			field->padding = spec.width - length;
+		}
+	}
+	field->left = spec.left;
+	field->next = *format;
+
+	return true;
+}
+
+static unsigned int Fmt_GetFieldLength(const struct FmtField * field)
+{
+	unsigned int bodyLength = field->text != NULL ? field->textLength : field->digits + (field->fraction > 0 ? 1 : 0);
+	return field->padding + field->prefixLength + field->zeros + bodyLength;
+}
+
+static void Fmt_WriteField(struct FmtWriter * writer, const struct FmtField * field)
+{
+	if (!field->left) {
+		FmtWriter_Fill(writer, ' ', field->padding);
+	}
+	FmtWriter_Write(writer, field->prefix, field->prefixLength);
+	FmtWriter_Fill(writer, '0', field->zeros);
+
+	if (field->text != NULL) {
+		FmtWriter_Write(writer, field->text, field->textLength);
+	} else {
+		char digits[FMT_MAX_DIGITS];
+		if (field->hex) {
+			Fmt_RenderHex(digits + field->digits, field->value, field->digits, field->upper);
+		} else {
+			Fmt_RenderDecimal(digits + field->digits, field->value, field->digits);
+		}
+		unsigned int integer = field->digits - field->fraction;
+		FmtWriter_Write(writer, digits, integer);
+		if (field->fraction > 0) {
+			FmtWriter_Write(writer, ".", 1);
+			FmtWriter_Write(writer, digits + integer, field->fraction);
+		}
+	}
+
+	if (field->left) {
+		FmtWriter_Fill(writer, ' ', field->padding);
+	}
+}
+
+/**
+ * Length of the formatted message. The first BUFFERED_UART_PRINTF_FIELDS conversions are kept in fields
+ * @param[out]	numberFields	number of conversions in format
+ * @return		FMT_INVALID if the format contains an unsupported conversion
+ */
+static unsigned int Fmt_Measure(const char * format, va_list arguments, struct FmtField * fields, unsigned int * numberFields)
+{
+	va_list copy;
+	va_copy(copy, arguments);
+	unsigned int length = 0;
+	unsigned int n = 0;
+	for (;;) {
+		const char * percent = Fmt_FindConversion(format);
+		length += (unsigned int)(percent - format);
+		if (*percent == '\0') {
+			break;
+		}
+		format = percent + 1;
+
+		struct FmtField uncached;
+		struct FmtField * field = n < BUFFERED_UART_PRINTF_FIELDS ? &fields[n] : &uncached;
+		if (!Fmt_GetField(&format, &copy, field)) {
+			length = FMT_INVALID;
+			break;
+		}
+		length += Fmt_GetFieldLength(field);
+		n++;
+	}
+	va_end(copy);
+
+	*numberFields = n;
+	return length;
+}
+
+/// render the message, from the fields of Fmt_Measure if it kept all of them
+static void Fmt_Render(struct FmtWriter * writer, const char * format, va_list arguments, const struct FmtField * fields, unsigned int numberFields)
+{
+	va_list copy;
+	va_copy(copy, arguments);
+	for (unsigned int n = 0;; n++) {
+		const char * percent = Fmt_FindConversion(format);
+		FmtWriter_Write(writer, format, (unsigned int)(percent - format));
+		if (*percent == '\0') {
+			break;
+		}
+		format = percent + 1;
+
+		if (numberFields <= BUFFERED_UART_PRINTF_FIELDS) {
+			Fmt_WriteField(writer, &fields[n]);
+			format = fields[n].next;
+		} else {
+			struct FmtField field;
+			Fmt_GetField(&format, &copy, &field);
+			Fmt_WriteField(writer, &field);
+		}
+	}
+	va_end(copy);
+}
+
+/**
+ * Format a message directly into the tx queue and send it, see @ref BufferedUart_TransmitFmt
+ * @param[in]	uart
+ * @param[in]	format	see stm32_buffered_uart_printf.h for the supported conversions
+ * @return		HAL_StatusTypeDef
+ */
+HAL_StatusTypeDef BufferedUart_Printf(struct BufferedUart *uart, const char *format, ...)
+{
+	va_list arguments;
+	va_start(arguments, format);
+	HAL_StatusTypeDef status = BufferedUart_TransmitFmt(uart, format, arguments);
+	va_end(arguments);
+
+	return status;
+}
+
+/**
+ * Format a message directly into the tx queue and send it
+ * The message is measured first and exactly its length is reserved, so nothing is queued if it does
+ * not fit, and nothing is copied afterwards.
+ * @note uses @ref BufferedUart_TxReserve, so it must not be called from several contexts concurrently
+ * @param[in]	uart
+ * @param[in]	format		see stm32_buffered_uart_printf.h for the supported conversions
+ * @param[in]	arguments
+ * @return		HAL_StatusTypeDef	HAL_BUSY if there is not enough space in the tx queue, HAL_ERROR if
+ * 									the format contains an unsupported conversion
+ */
+HAL_StatusTypeDef BufferedUart_TransmitFmt(struct BufferedUart *uart, const char *format, va_list arguments)
+{
+	struct FmtField fields[BUFFERED_UART_PRINTF_FIELDS];
+	unsigned int numberFields;
+	unsigned int length = Fmt_Measure(format, arguments, fields, &numberFields);
+	if (length == FMT_INVALID) {
+		return HAL_ERROR;
+	}
+	if (length == 0) {
+		return HAL_OK;
+	}
+
+	struct BufferedUartSpan first;
+	struct BufferedUartSpan second;
+	HAL_StatusTypeDef status = BufferedUart_TxReserve(uart, length, &first, &second);
+	if (status != HAL_OK) {
+		return status;
+	}
+
+	struct FmtWriter writer = { first.data, first.data + first.length, second };
+	Fmt_Render(&writer, format, arguments, fields, numberFields);
+
+	return BufferedUart_TxCommit(uart, length);
+}
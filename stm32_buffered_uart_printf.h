@@ -0,0 +1,72 @@
+/**
+
+stm32_buffered_uart_printf
+formatted transmission which renders directly into the tx queue of stm32_buffered_uart
+
+The message is measured first, then exactly its length is reserved in the tx queue and the
+conversions are rendered into the reserved space (across the wrap around of the ring buffer).
+There is no intermediate buffer and no second copy, and a message which does not fit is not
+queued at all.
+
+Supported conversions (a subset of printf):
+	%d %i %u	integers, length modifiers hh h l ll z
+	%x %X %p	hexadecimal
+	%f			fixed-point from a double, at most 9 fraction digits (default 6), magnitudes from
+				1.8e19 / 10^precision on print as "ovf", ties are rounded away from zero
+	%c %s %%	%.*s takes a string with known length
+flags '-' '0' '+', width and precision (also as '*'). Anything else (e.g. %e, %g, '#', ' ')
+fails with HAL_ERROR. %p prints NULL as 0x0.
+
+
+MIT License
+
+Copyright (c) 2022 Jonas Rahlf
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+*/
+
+#pragma once
+
+#include <stdarg.h>
+#include "stm32_buffered_uart.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/// ==== configuration options ====
+
+// number of conversions which are parsed once, while the message is measured, and kept on the stack
+// for rendering (about 40 bytes each on a Cortex-M). Messages with more conversions are parsed twice
+// default 8
+#ifndef BUFFERED_UART_PRINTF_FIELDS
+#define BUFFERED_UART_PRINTF_FIELDS (8)
+#endif
+
+/// ==== end configuration options ====
+
+HAL_StatusTypeDef BufferedUart_Printf(struct BufferedUart *uart, const char *format, ...) __attribute__((format(printf, 2, 3)));
+HAL_StatusTypeDef BufferedUart_TransmitFmt(struct BufferedUart *uart, const char *format, va_list arguments);
+
+
+#ifdef __cplusplus
+}
+#endif